@@ -21,6 +21,7 @@
 #include <shmem.h>
 #include <arm.h>
 #include <pxi.h>
+#include <pxijob.h>
 
 #include "arm/gic.h"
 
@@ -88,6 +89,33 @@ static u32 pxiRxUpdate(u32 *args)
 	return lo;
 }
 
+static u32 pxiJobI2C(PxiJob *job, u8 *data)
+{
+	const u32 *args = job->req.args;
+	u32 size = min(args[2], PXIJOB_DATA_SIZE);
+
+	if (job->req.func == PXIJOB_I2C_WRITE)
+		return I2C_writeRegBuf(args[0], args[1], data, size);
+	return I2C_readRegBuf(args[0], args[1], data, size);
+}
+
+static u32 pxiJobNvramRead(PxiJob *job, u8 *data)
+{
+	const u32 *args = job->req.args;
+	u32 *dst = (u32*)args[2];
+
+	if (!dst) {
+		NVRAM_Read(args[0], (u32*)data, min(args[1], PXIJOB_DATA_SIZE));
+		return 0;
+	}
+
+	// FCRAM is cached on our side too
+	ARM_InvDC_Range(dst, args[1]);
+	NVRAM_Read(args[0], dst, args[1]);
+	ARM_WbInvDC_Range(dst, args[1]);
+	return 0;
+}
+
 void __attribute__((noreturn)) MainLoop(void)
 {
 	bool runPxiCmdProcessor = true;
@@ -105,6 +133,10 @@ void __attribute__((noreturn)) MainLoop(void)
 	getEventMCU()->reset();
 	memset(&sharedMem, 0, sizeof(sharedMem));
 
+	PxiJobSetHandler(PXIJOB_I2C_READ, pxiJobI2C);
+	PxiJobSetHandler(PXIJOB_I2C_WRITE, pxiJobI2C);
+	PxiJobSetHandler(PXIJOB_NVRAM_READ, pxiJobNvramRead);
+
 	// configure interrupts
 	gicSetInterruptConfig(PXI_RX_INTERRUPT, BIT(0), GIC_PRIO0, NULL);
 	gicSetInterruptConfig(VBLANK_INTERRUPT, BIT(0), GIC_PRIO0, NULL);
@@ -133,9 +165,11 @@ void __attribute__((noreturn)) MainLoop(void)
 		pxiCmd = pxiRxUpdate(args);
 
 		switch(pxiCmd) {
-			// ignore args and just wait until the next event
+			// ignore args and work on queued jobs or wait until the next event
+			// one job per loop, VBlank (HID state) keeps being handled meanwhile
 			case PXICMD_NONE:
-				ARM_WFI();
+				if (!PxiJobRunNext(&sharedMem.jobQueue, vblankUpdate))
+					ARM_WFI();
 				break;
 
 			// revert to legacy boot mode
@@ -201,6 +235,11 @@ void __attribute__((noreturn)) MainLoop(void)
 				break;
 			}
 
+			// wakes us up after jobs were queued on an empty queue
+			case PXICMD_JOB_KICK:
+				pxiReply = 0;
+				break;
+
 			// replies -1 on default
 			default:
 				pxiReply = 0xFFFFFFFF;
@@ -5,10 +5,47 @@
 	.cpu    arm946e-s
 	.arch   armv5te
 	.arm
+	.syntax unified
+	@ r3 = partially consumed src word, r2 = bytes left
+	@ 16 bytes per loop, then single words, then the basic loop
+	.macro MEMCPY_MERGE sh
+	movs    r12, r2, LSR#4
+	beq     2f
+1:
+	ldm     r1!, {r5-r8}
+	mov     r4, r3, LSR#\sh
+	orr     r4, r4, r5, LSL#(32-\sh)
+	mov     r5, r5, LSR#\sh
+	orr     r5, r5, r6, LSL#(32-\sh)
+	mov     r6, r6, LSR#\sh
+	orr     r6, r6, r7, LSL#(32-\sh)
+	mov     r7, r7, LSR#\sh
+	orr     r7, r7, r8, LSL#(32-\sh)
+	mov     r3, r8
+	stm     r0!, {r4-r7}
+	subs    r12, r12, #1
+	bne     1b
+2:
+	ands    r12, r2, #0xC
+	beq     4f
+3:
+	ldr     r5, [r1], #4
+	mov     r4, r3, LSR#\sh
+	orr     r4, r4, r5, LSL#(32-\sh)
+	mov     r3, r5
+	str     r4, [r0], #4
+	subs    r12, r12, #4
+	bne     3b
+4:
+	@ point src back at the first byte not yet copied
+	sub     r1, r1, #(4-(\sh/8))
+	ands    r2, r2, #0x3
+	b       .L5
+	.endm
+
 	.section .text.memcpy, "ax", %progbits
 	.align  2
 	.global memcpy
-	.syntax unified
 	.type   memcpy, %function
 memcpy:
 	@ r0 = dest
@@ -20,22 +57,23 @@ memcpy:
 	push    {r0,r4-r9,lr}
 	@ pre-fetch data
 	pld     [r1]
-	@ alignment check with word size
-	@ if not aligned but both are in the same misalignment, fix it up
-	@ otherwise jump to basic loop
-	orr     r12, r0, r1
-	ands    r12, r12, #3
-	beq     .L1
-	mov     r12, r0, LSL#30
-	cmp     r12, r1, LSL#30
-	bne     .L6
-.L0:
+	@ short copies are not worth the alignment setup
+	cmp     r2, #8
+	blo     .L6
+	@ align dest to word size, then pick the aligned block copy
+	@ or, if src ends up misaligned, the shift and merge copy
+	ands    r12, r0, #3
+	beq     .L0
+	rsb     r12, r12, #4
+	sub     r2, r2, r12
+.Lhead:
 	ldrb    r3, [r1], #1
 	strb    r3, [r0], #1
-	subs    r2, r2, #1
-	popeq   {r0,r4-r9,pc}
-	adds    r12, r12, #0x40000000
-	bne     .L0
+	subs    r12, r12, #1
+	bne     .Lhead
+.L0:
+	ands    r12, r1, #3
+	bne     .L7
 .L1:
 	@ check if length higher than 32
 	@ if so, do the 32 byte block copy loop,
@@ -67,4 +105,19 @@ memcpy:
 	strb    r3, [r0], #1
 	subs    r2, r2, #1
 	b       .L5
+.L7:
+	@ dest is word aligned, src is off by r12 bytes
+	@ read src in aligned words and merge neighbours with shifts,
+	@ this never reads past the word holding the last source byte
+	bic     r1, r1, #3
+	ldr     r3, [r1], #4
+	cmp     r12, #2
+	beq     .L9
+	bhi     .L10
+.L8:
+	MEMCPY_MERGE 8
+.L9:
+	MEMCPY_MERGE 16
+.L10:
+	MEMCPY_MERGE 24
 	.size   memcpy, .-memcpy
@@ -0,0 +1,41 @@
+@ memset_arm946e-s - memset on top of the burst fill in mmio.s
+@ byte stores up to word alignment, the rest is done by iomemset
+	.cpu    arm946e-s
+	.arch   armv5te
+	.arm
+	.section .text.memset, "ax", %progbits
+	.align  2
+	.global memset
+	.syntax unified
+	.type   memset, %function
+memset:
+	@ r0 = dest
+	@ r1 = value
+	@ r2 = length
+	@ r0 is returned untouched, r12 walks the buffer
+	mov     r12, r0
+	and     r1, r1, #0xFF
+	cmp     r2, #8
+	blo     .L2
+	orr     r1, r1, r1, LSL#8
+	orr     r1, r1, r1, LSL#16
+.L0:
+	tst     r12, #3
+	beq     .L1
+	strb    r1, [r12], #1
+	sub     r2, r2, #1
+	b       .L0
+.L1:
+	push    {r0,lr}
+	mov     r0, r12
+	bl      iomemset
+	pop     {r0,pc}
+.L2: @ the basic loop
+	cmp     r2, #0
+	bxeq    lr
+.L3:
+	strb    r1, [r12], #1
+	subs    r2, r2, #1
+	bne     .L3
+	bx      lr
+	.size   memset, .-memset
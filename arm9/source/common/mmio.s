@@ -27,15 +27,24 @@
 
 
 @ void iomemcpy(vu32 *restrict dst, const vu32 *restrict src, u32 size)
+@ moves 64 byte blocks (one SHA FIFO fill) as two 8 word bursts
 ASM_FUNC iomemcpy
 	bics    r12, r2, #31
 	beq     iomemcpy_test_words
 	stmfd   sp!, {r4-r10}
+	tst     r12, #32
+	ldmneia r1!, {r3-r10}
+	stmneia r0!, {r3-r10}
+	bics    r12, r12, #32
+	beq     iomemcpy_blocks_done
 	iomemcpy_blocks_lp:
 		ldmia  r1!, {r3-r10}
 		stmia  r0!, {r3-r10}
-		subs   r12, #32
+		ldmia  r1!, {r3-r10}
+		stmia  r0!, {r3-r10}
+		subs   r12, #64
 		bne    iomemcpy_blocks_lp
+iomemcpy_blocks_done:
 	ldmfd   sp!, {r4-r10}
 iomemcpy_test_words:
 	ands    r12, r2, #28
@@ -56,7 +65,19 @@ iomemcpy_halfword_byte:
 
 
 @ void iomemset(vu32 *ptr, u32 value, u32 size)
+@ word stores up to the next 32 byte boundary first, so the bursts
+@ below always write whole cache lines (the data cache does not
+@ allocate on writes, big fills stream past it)
 ASM_FUNC iomemset
+	cmp     r2, #64
+	blo     iomemset_aligned
+	iomemset_align_lp:
+		tst    r0, #31
+		beq    iomemset_aligned
+		str    r1, [r0], #4
+		sub    r2, #4
+		b      iomemset_align_lp
+iomemset_aligned:
 	bics    r12, r2, #31
 	beq     iomemset_test_words
 	stmfd   sp!, {r4-r9}
@@ -67,10 +88,16 @@ ASM_FUNC iomemset
 	mov     r7, r1
 	mov     r8, r1
 	mov     r9, r1
+	tst     r12, #32
+	stmneia r0!, {r1, r3-r9}
+	bics    r12, r12, #32
+	beq     iomemset_blocks_done
 	iomemset_blocks_lp:
 		stmia  r0!, {r1, r3-r9}
-		subs   r12, #32
+		stmia  r0!, {r1, r3-r9}
+		subs   r12, #64
 		bne    iomemset_blocks_lp
+iomemset_blocks_done:
 	ldmfd   sp!, {r4-r9}
 iomemset_test_words:
 	ands    r12, r2, #28
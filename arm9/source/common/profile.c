@@ -0,0 +1,140 @@
+#include "profile.h"
+#include "mmio.h"
+
+#ifdef PROFILE_ZONES
+ProfileStats profile_stats[PROF_ZONE_COUNT];
+ProfileStats profile_job_stats[PXIJOB_COUNT];
+#endif
+
+static const char* profile_names[PROF_ZONE_COUNT + PXIJOB_COUNT] = {
+    "cart read", "AES", "SHA", "FatFs", "UI draw", "SD read", "SD write", "NAND",
+    // ARM11 jobs, in PXIJOB_* order
+    "job lzss", "job i2c rd", "job i2c wr", "job nvram"
+};
+
+void ProfileReset(void) {
+    #ifdef PROFILE_ZONES
+    for (u32 i = 0; i < PROF_ZONE_COUNT; i++) {
+        profile_stats[i].ticks = 0;
+        profile_stats[i].bytes = 0;
+        profile_stats[i].calls = 0;
+    }
+    for (u32 i = 0; i < PXIJOB_COUNT; i++) {
+        profile_job_stats[i].ticks = 0;
+        profile_job_stats[i].calls = 0;
+    }
+    #endif
+}
+
+// one line per zone and ARM11 job, either human readable or as CSV (times in microseconds)
+// throughput is only shown for zones that count their bytes
+u32 ProfileReport(char* txt, u32 max_len, bool csv) {
+    u32 len = 0;
+    if (!max_len) return 0;
+    *txt = '\0';
+
+    #ifdef PROFILE_ZONES
+    if (csv) len = snprintf(txt, max_len, "zone,calls,total_us,avg_us,bytes\n");
+    else len = snprintf(txt, max_len, "%-10.10s %7s %10s %8s %7s\n", "zone", "calls", "total ms", "avg us", "MB/s");
+    for (u32 i = 0; (i < PROF_ZONE_COUNT + PXIJOB_COUNT) && (len < max_len); i++) {
+        ProfileStats* stats = (i < PROF_ZONE_COUNT) ? profile_stats + i : profile_job_stats + (i - PROF_ZONE_COUNT);
+        u64 usec = (stats->ticks * 1000000) / TICKS_PER_SEC;
+        u32 avg = stats->calls ? (u32) (usec / stats->calls) : 0;
+        u64 mbps10 = (stats->bytes && usec) ? (stats->bytes * 10) / usec : 0;
+        if (csv) len += snprintf(txt + len, max_len - len, "%s,%lu,%llu,%lu,%llu\n",
+            profile_names[i], stats->calls, usec, avg, stats->bytes);
+        else if (!mbps10) len += snprintf(txt + len, max_len - len, "%-10.10s %7lu %10llu %8lu %7s\n",
+            profile_names[i], stats->calls, usec / 1000, avg, "-");
+        else len += snprintf(txt + len, max_len - len, "%-10.10s %7lu %10llu %8lu %5llu.%llu\n",
+            profile_names[i], stats->calls, usec / 1000, avg, mbps10 / 10, mbps10 % 10);
+    }
+    #else
+    (void) csv;
+    (void) profile_names;
+    len = snprintf(txt, max_len, "(built without profiling zones)\n");
+    #endif
+
+    return min(len, max_len - 1);
+}
+
+#ifdef PROFILE_ZONES
+#define MEMBENCH_BYTES  (4 * 1024 * 1024) // moved per size class and kernel
+
+static void MemBenchMemcpy(u8* dst, const u8* src, u32 size, u32 i) {
+    (void) i;
+    memcpy(dst, src, size);
+}
+
+static void MemBenchMemcpyMisaligned(u8* dst, const u8* src, u32 size, u32 i) {
+    (void) i;
+    memcpy(dst, src + 1, size);
+}
+
+static void MemBenchMemset(u8* dst, const u8* src, u32 size, u32 i) {
+    (void) src;
+    memset(dst, i, size); // changing value, so repeated fills are not folded
+}
+
+static void MemBenchIomemcpy(u8* dst, const u8* src, u32 size, u32 i) {
+    (void) i;
+    iomemcpy((vu32*) dst, (const vu32*) src, size);
+}
+#endif
+
+// MB/s of the copy / fill kernels per size class, buffers are on the heap
+u32 ProfileMemBench(char* txt, u32 max_len) {
+    u32 len = 0;
+    if (!max_len) return 0;
+    *txt = '\0';
+
+    #ifdef PROFILE_ZONES
+    const u32 sizes[] = { 16, 64, 512, 4096, 64 * 1024, 256 * 1024 };
+    const u32 n_sizes = sizeof(sizes) / sizeof(u32);
+    const struct {
+        const char* name;
+        void (*run)(u8* dst, const u8* src, u32 size, u32 i);
+    } kernels[] = {
+        { "memcpy", MemBenchMemcpy },
+        { "memcpy+1", MemBenchMemcpyMisaligned },
+        { "memset", MemBenchMemset },
+        { "iomemcpy", MemBenchIomemcpy }
+    };
+    const u32 n_kernels = sizeof(kernels) / sizeof(kernels[0]);
+
+    u32 buffer_size = sizes[n_sizes - 1] + 4;
+    u8* src = (u8*) malloc(buffer_size);
+    u8* dst = (u8*) malloc(buffer_size);
+    if (!src || !dst) {
+        free(src);
+        free(dst);
+        return snprintf(txt, max_len, "(out of memory)\n");
+    }
+    memset(src, 0xA5, buffer_size);
+
+    len = snprintf(txt, max_len, "%-9.9s", "size");
+    for (u32 k = 0; k < n_kernels; k++)
+        len += snprintf(txt + len, max_len - len, " %9s", kernels[k].name);
+    for (u32 s = 0; (s < n_sizes) && (len < max_len); s++) {
+        u32 size = sizes[s];
+        u32 count = MEMBENCH_BYTES / size;
+        len += snprintf(txt + len, max_len - len, "\n%-9lu", size);
+        for (u32 k = 0; (k < n_kernels) && (len < max_len); k++) {
+            u32 start = ProfileTicks();
+            for (u32 i = 0; i < count; i++)
+                kernels[k].run(dst, src, size, i);
+            u32 ticks = ProfileTicks() - start;
+            u64 mbps10 = ticks ? ((u64) count * size * TICKS_PER_SEC * 10) / ((u64) ticks * 1000000) : 0;
+            len += snprintf(txt + len, max_len - len, " %7llu.%llu", mbps10 / 10, mbps10 % 10);
+        }
+    }
+    if (len < max_len) len += snprintf(txt + len, max_len - len, "\n(MB/s, %lu MiB per cell)\n",
+        (u32) (MEMBENCH_BYTES >> 20));
+
+    free(src);
+    free(dst);
+    #else
+    len = snprintf(txt, max_len, "(built without profiling zones)\n");
+    #endif
+
+    return min(len, max_len - 1);
+}
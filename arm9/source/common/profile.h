@@ -0,0 +1,82 @@
+#pragma once
+
+#include "common.h"
+#include "timer.h"
+#include "pxijob.h"
+
+// profiling zones, only compiled in with PROFILE_ZONES (make PROFILE=1)
+// times are inclusive, a zone entered again inside itself is counted once
+typedef enum {
+    PROF_CART_READ = 0,
+    PROF_AES,
+    PROF_SHA,
+    PROF_FATFS,
+    PROF_UI_DRAW,
+    PROF_SD_READ,
+    PROF_SD_WRITE,
+    PROF_NAND,
+    PROF_ZONE_COUNT
+} ProfileZone;
+
+typedef struct {
+    u64 ticks;
+    u64 bytes; // payload moved, for zones that count it
+    u32 calls;
+    u32 depth;
+} ProfileStats;
+
+typedef struct {
+    ProfileZone zone;
+    u32 start;
+} ProfileScope;
+
+#ifdef PROFILE_ZONES
+extern ProfileStats profile_stats[PROF_ZONE_COUNT];
+extern ProfileStats profile_job_stats[PXIJOB_COUNT];
+
+// lower 32 bits of the cascaded timers, wraps after ~64 seconds
+static inline u32 ProfileTicks(void) {
+    u16 hi, lo;
+    do {
+        hi = *TIMER_VAL1;
+        lo = *TIMER_VAL0;
+    } while (hi != *TIMER_VAL1);
+    return ((u32) hi << 16) | lo;
+}
+
+static inline ProfileScope ProfileEnter(ProfileZone zone) {
+    ProfileScope scope = { zone, 0 };
+    if (!profile_stats[zone].depth++) scope.start = ProfileTicks();
+    return scope;
+}
+
+static inline void ProfileLeave(ProfileScope* scope) {
+    ProfileStats* stats = profile_stats + scope->zone;
+    if (--stats->depth) return;
+    stats->ticks += ProfileTicks() - scope->start;
+    stats->calls++;
+}
+
+// ARM11 job latency, from publishing until the ARM9 sees it done
+static inline void ProfileJob(u32 func, u32 ticks) {
+    if (func >= PXIJOB_COUNT) return;
+    profile_job_stats[func].ticks += ticks;
+    profile_job_stats[func].calls++;
+}
+
+static inline void ProfileBytes(ProfileZone zone, u32 bytes) {
+    profile_stats[zone].bytes += bytes;
+}
+
+// counts everything from here to the end of the enclosing scope
+#define PROFILE_ZONE(zone) \
+    __attribute__((cleanup(ProfileLeave))) ProfileScope _profile_scope = ProfileEnter(zone)
+#define PROFILE_BYTES(zone, bytes) ProfileBytes(zone, bytes)
+#else
+#define PROFILE_ZONE(zone)
+#define PROFILE_BYTES(zone, bytes)
+#endif
+
+void ProfileReset(void);
+u32 ProfileReport(char* txt, u32 max_len, bool csv);
+u32 ProfileMemBench(char* txt, u32 max_len);
@@ -32,11 +32,14 @@ bool get_dstime(DsTime* dstime) {
 }
 
 bool set_dstime(DsTime* dstime) {
+    u8 regs[sizeof(DsTime)];
+    u8 data[sizeof(DsTime)];
+    u32 n = 0;
     if (!is_valid_dstime(dstime)) return false;
     for (u32 i = 0; i < sizeof(DsTime); i++) {
         if ((i == 3) || (i == 7)) continue; // skip the unused bytes
-        if (!I2C_writeReg(I2C_DEV_MCU, 0x30+i, ((u8*)dstime)[i]))
-            return false;
+        regs[n] = 0x30+i;
+        data[n++] = ((u8*)dstime)[i];
     }
-    return true;
+    return I2C_writeRegs(I2C_DEV_MCU, regs, data, 1, n);
 }
@@ -4,26 +4,48 @@
 #include "vff.h"
 #include "png.h"
 
-static void Screenshot_Transpose(u16 *dest, const u16 *fb, u32 w, u32 stride)
+#define SNAP_BACKGROUND RGB(0x1F, 0x1F, 0x1F) // gray background
+
+// blocked transpose: the n pixels of a column are continuous in the framebuffer
+static void Screenshot_Transpose(u16 *dest, const u16 *fb, u32 w, u32 stride, u32 y, u32 n)
+{
+    for (u32 x = 0; x < w; x++) {
+        const u16 *src = fb + (x * SCREEN_HEIGHT) + (SCREEN_HEIGHT - (y + n));
+        for (u32 i = 0; i < n; i++)
+            dest[((n - 1 - i) * stride) + x] = src[i];
+    }
+}
+
+// top screen above bottom screen, bottom screen centered
+static void Screenshot_ReadRows(u16 *rows, u32 y, u32 n, void *data)
 {
-    for (u32 y = 0; y < SCREEN_HEIGHT; y++) {
-        for (u32 x = 0; x < w; x++)
-            *(dest++) = GetColor(fb, x, y);
-        dest += stride;
+    (void) data;
+    while (n) {
+        if (y < SCREEN_HEIGHT) {
+            u32 n_top = min(n, SCREEN_HEIGHT - y);
+            Screenshot_Transpose(rows, GetScreenBuffer(TOP_SCREEN), SCREEN_WIDTH_TOP, SCREEN_WIDTH_TOP, y, n_top);
+            rows += n_top * SCREEN_WIDTH_TOP;
+            y += n_top;
+            n -= n_top;
+            continue;
+        }
+
+        u32 margin = (SCREEN_WIDTH_TOP - SCREEN_WIDTH_BOT) / 2;
+        for (u32 r = 0; r < n; r++) {
+            u16 *row = rows + (r * SCREEN_WIDTH_TOP);
+            for (u32 x = 0; x < margin; x++)
+                row[x] = row[SCREEN_WIDTH_TOP - 1 - x] = SNAP_BACKGROUND;
+        }
+        Screenshot_Transpose(rows + margin, GetScreenBuffer(BOT_SCREEN), SCREEN_WIDTH_BOT, SCREEN_WIDTH_TOP, y - SCREEN_HEIGHT, n);
+        break;
     }
 }
 
 void CreateScreenshot(void) {
     u8 *png;
-    u16 *buffer;
     DsTime dstime;
     size_t png_size;
     char filename[64];
-    u32 snapbuf_size, snap_w, snap_h, bot_offset;
-
-    snapbuf_size = (SCREEN_WIDTH_TOP * SCREEN_HEIGHT * BYTES_PER_PIXEL) * 2;
-    snap_w = SCREEN_WIDTH_TOP;
-    snap_h = SCREEN_HEIGHT * 2;
 
     fvx_rmkdir(OUTPUT_PATH);
     get_dstime(&dstime);
@@ -32,35 +54,25 @@ void CreateScreenshot(void) {
         dstime.bcd_h, dstime.bcd_m, dstime.bcd_s);
     filename[63] = '\0';
 
-    buffer = malloc(snapbuf_size);
-    if (!buffer) return;
-
-    for (unsigned i = snapbuf_size/4; i < snapbuf_size/2; i++)
-        buffer[i] = RGB(0x1F, 0x1F, 0x1F); // gray background
-
-    bot_offset = (SCREEN_WIDTH_TOP * SCREEN_HEIGHT) + 40;
-
-    Screenshot_Transpose(buffer, TOP_SCREEN, SCREEN_WIDTH_TOP, 0);
-    Screenshot_Transpose(buffer + bot_offset, BOT_SCREEN, SCREEN_WIDTH_BOT, 80);
-
-    png = PNG_Compress(buffer, snap_w, snap_h, &png_size);
+    png = PNG_CompressRows(Screenshot_ReadRows, NULL, SCREEN_WIDTH_TOP, SCREEN_HEIGHT * 2, &png_size);
 
     if (png && png_size) {
-        u16 *buffer_top = buffer, *buffer_bottom = buffer + bot_offset;
-
-        // "snap effect"
-        memcpy(buffer_bottom, BOT_SCREEN, SCREEN_SIZE_BOT);
-        memcpy(buffer_top, TOP_SCREEN, SCREEN_SIZE_TOP);
-        memset(BOT_SCREEN, 0, SCREEN_SIZE_BOT);
-        memset(TOP_SCREEN, 0, SCREEN_SIZE_TOP);
+        // "snap effect", the UI back buffers still hold the screen contents
+        bool snap = (GetScreenBuffer(TOP_SCREEN) != TOP_SCREEN) &&
+            (GetScreenBuffer(BOT_SCREEN) != BOT_SCREEN);
+        if (snap) {
+            memset(BOT_SCREEN, 0, SCREEN_SIZE_BOT);
+            memset(TOP_SCREEN, 0, SCREEN_SIZE_TOP);
+        }
 
         fvx_qwrite(filename, png, 0, png_size, NULL);
 
-        memcpy(BOT_SCREEN, buffer_bottom, SCREEN_SIZE_BOT);
-        memcpy(TOP_SCREEN, buffer_top, SCREEN_SIZE_TOP);
+        if (snap) {
+            RestoreScreen(BOT_SCREEN, NULL);
+            RestoreScreen(TOP_SCREEN, NULL);
+        }
     }
     // what to do on error...?
 
-    free(buffer);
     free(png);
 }
@@ -8,6 +8,8 @@
 #include <stdio.h>
 
 #include "qrcodegen.h"
+#include "png.h"
+#include "profile.h"
 #include "vram0.h"
 #include "ui.h"
 #include "rtc.h"
@@ -20,6 +22,28 @@
 #define FONT_MAX_WIDTH 8
 #define FONT_MAX_HEIGHT 10
 #define PROGRESS_REFRESH_RATE 30 // the progress bar is only allowed to draw to screen every X milliseconds
+#define GLYPH_CACHE_N 128 // # of pre-rendered glyphs for opaque text
+#define TEXT_CACHE_N 32 // # of cached strings per screen
+#define TEXT_CACHE_LEN 64 // max # of cached characters per string
+#define COLOR_NONE 0xFFFFFFFF // not a valid RGB565 color
+#define DAMAGE_BLOCK 8 // damage is tracked in blocks of 8 rows per column
+#define DAMAGE_FULL ((1u << (SCREEN_HEIGHT / DAMAGE_BLOCK)) - 1)
+
+typedef struct {
+    u32 character;
+    u32 color;
+    u32 bgcolor;
+    u16 pixels[FONT_MAX_WIDTH * FONT_MAX_HEIGHT]; // column by column, in framebuffer order
+} GlyphCacheEntry;
+
+typedef struct {
+    int x;
+    int y;
+    u32 color;
+    u32 bgcolor;
+    u32 len; // zero if unused
+    u16 text[TEXT_CACHE_LEN]; // what is currently on screen
+} TextCacheEntry;
 
 static u32 font_width = 0;
 static u32 font_height = 0;
@@ -29,6 +53,27 @@ static u8* font_bin = NULL;
 static u16* font_map = NULL;
 static u16 ascii_lut[0x60];
 
+// glyph atlas (one row mask per column), glyph & text caches
+static u16* font_atlas = NULL;
+static GlyphCacheEntry* glyph_cache = NULL;
+static TextCacheEntry* text_cache = NULL; // TEXT_CACHE_N for each screen
+static u32 text_cache_next[2] = { 0 };
+static int text_cache_box[2][4] = { 0 }; // x0, y0, x1, y1 of all cached strings
+
+// off-screen back buffers, damaged rows per column get copied to VRAM once per frame
+static u16* back_buffer[2] = { NULL };
+static u32 damage[2][SCREEN_WIDTH_TOP] = { { 0 } }; // one bit per block of rows
+static int damage_x[2][2] = { { 0 } }; // x0, x1 of all damaged columns
+static u32 clear_color[2] = { COLOR_NONE, COLOR_NONE }; // back buffer is all this color
+static u32 frame_depth = 0;
+static u32 frame_count = 0;
+static u64 frame_vram_bytes = 0;
+
+// progress status, published by hot loops and drawn by UpdateProgress()
+static ProgressStatus progress = { 0 };
+static u64 progress_timer = 0;
+static u64 progress_next = 0; // ticks of the next progress redraw
+
 // lookup table to sort CP-437 so it can be binary searched with Unicode codepoints
 static const u8 cp437_sorted[0x100] = {
     0x00, 0xF5, 0xF6, 0xFC, 0xFD, 0xFB, 0xFA, 0xA4, 0xF3, 0xF2, 0xF4, 0xF9, 0xF8, 0xFE, 0xFF, 0xF7,
@@ -84,7 +129,7 @@ u16 GetFontIndex(u16 c, bool use_ascii_lut)
     else if (use_ascii_lut && c < 0x80) return ascii_lut[c - 0x20];
 
     int left = 0;
-    int right = font_count;
+    int right = font_count - 1;
 
     while (left <= right) {
         int mid = left + ((right - left) / 2);
@@ -320,20 +365,292 @@ bool SetFont(const void* font, u32 font_size) {
         ascii_lut[i] = GetFontIndex(i + 0x20, false);
     }
 
+    // glyph atlas, rotated for the column-major framebuffer
+    if (font_atlas) free(font_atlas);
+    if (glyph_cache) free(glyph_cache);
+    if (text_cache) free(text_cache);
+    font_atlas = NULL;
+    glyph_cache = NULL;
+    text_cache = NULL;
+    if ((font_width <= FONT_MAX_WIDTH) && (font_height <= FONT_MAX_HEIGHT)) {
+        font_atlas = malloc(sizeof(u16) * font_width * font_count);
+        glyph_cache = malloc(sizeof(GlyphCacheEntry) * GLYPH_CACHE_N);
+        text_cache = malloc(sizeof(TextCacheEntry) * TEXT_CACHE_N * 2);
+    }
+    if (font_atlas) {
+        for (u32 i = 0; i < font_count; i++) {
+            for (u32 xx = 0; xx < font_width; xx++) {
+                u16 mask = 0;
+                for (u32 yy = 0; yy < font_height; yy++)
+                    mask |= ((font_bin[(i * font_height) + yy] >> (7 - xx)) & 1) << yy;
+                font_atlas[(i * font_width) + xx] = mask;
+            }
+        }
+    }
+    if (glyph_cache) memset(glyph_cache, 0xFF, sizeof(GlyphCacheEntry) * GLYPH_CACHE_N);
+    if (text_cache) memset(text_cache, 0x00, sizeof(TextCacheEntry) * TEXT_CACHE_N * 2);
+    InvalidateTextCache(NULL);
+
     line_height = min(10, font_height + 2);
     return true;
 }
 
+static inline int GetScreenIndex(const u16* screen)
+{
+    return (screen == TOP_SCREEN) ? 0 : (screen == BOT_SCREEN) ? 1 : -1;
+}
+
+// forget about text on screen, NULL for both screens
+void InvalidateTextCache(u16 *screen)
+{
+    for (int s = 0; s < 2; s++) {
+        if (screen && (s != GetScreenIndex(screen))) continue;
+        if (text_cache) memset(text_cache + (s * TEXT_CACHE_N), 0x00, sizeof(TextCacheEntry) * TEXT_CACHE_N);
+        memset(text_cache_box[s], 0x00, sizeof(text_cache_box[s]));
+    }
+}
+
+// forget about cached strings that get drawn over
+static void InvalidateTextRect(u16 *screen, int x, int y, int w, int h, const TextCacheEntry* keep)
+{
+    int s = GetScreenIndex(screen);
+    if ((s < 0) || !text_cache) return;
+
+    int* box = text_cache_box[s];
+    if ((x >= box[2]) || (x + w <= box[0]) || (y >= box[3]) || (y + h <= box[1]))
+        return; // nothing cached there
+
+    TextCacheEntry* entry = text_cache + (s * TEXT_CACHE_N);
+    for (u32 i = 0; i < TEXT_CACHE_N; i++, entry++) {
+        if (!entry->len || (entry == keep)) continue;
+        if ((x < entry->x + (int) (entry->len * font_width)) && (x + w > entry->x) &&
+            (y < entry->y + (int) font_height) && (y + h > entry->y))
+            entry->len = 0;
+    }
+}
+
+static TextCacheEntry* GetTextCacheEntry(u16 *screen, int x, int y, u32 color, u32 bgcolor, bool alloc)
+{
+    int s = GetScreenIndex(screen);
+    if ((s < 0) || !text_cache || (bgcolor == COLOR_TRANSPARENT)) return NULL;
+
+    TextCacheEntry* entry = text_cache + (s * TEXT_CACHE_N);
+    for (u32 i = 0; i < TEXT_CACHE_N; i++) {
+        if (entry[i].len && (entry[i].x == x) && (entry[i].y == y) &&
+            (entry[i].color == color) && (entry[i].bgcolor == bgcolor))
+            return entry + i;
+    }
+    if (!alloc) return NULL;
+
+    // prefer free slots, otherwise replace round robin
+    u32 i = 0;
+    for (; (i < TEXT_CACHE_N) && entry[i].len; i++);
+    if (i >= TEXT_CACHE_N) {
+        i = text_cache_next[s];
+        text_cache_next[s] = (i + 1) % TEXT_CACHE_N;
+    }
+
+    entry += i;
+    entry->x = x;
+    entry->y = y;
+    entry->color = color;
+    entry->bgcolor = bgcolor;
+    entry->len = 0;
+    return entry;
+}
+
+static void UpdateTextCacheBox(u16 *screen, int x, int y, int w, int h)
+{
+    int s = GetScreenIndex(screen);
+    if (s < 0) return;
+
+    int* box = text_cache_box[s];
+    if (box[2] <= box[0]) { // empty box
+        box[0] = x;
+        box[1] = y;
+        box[2] = x + w;
+        box[3] = y + h;
+    } else {
+        box[0] = min(box[0], x);
+        box[1] = min(box[1], y);
+        box[2] = max(box[2], x + w);
+        box[3] = max(box[3], y + h);
+    }
+}
+
+// copies pixels without byte writes, dest and src need the same alignment
+static void CopyPixels(u16* dest, const u16* src, u32 n)
+{
+    if (n && ((u32) dest & 0x2)) {
+        *(dest++) = *(src++);
+        n--;
+    }
+    u32* dest_wide = (u32*)(void*) dest;
+    const u32* src_wide = (const u32*)(const void*) src;
+    for (; n >= 2; n -= 2)
+        *(dest_wide++) = *(src_wide++);
+    if (n) *(u16*)(void*) dest_wide = *(const u16*)(const void*) src_wide;
+}
+
+// returns the back buffer for a screen (or the screen itself if there is none)
+static u16* GetDrawBuffer(const u16* screen)
+{
+    int s = GetScreenIndex(screen);
+    if (s < 0) return (u16*) screen;
+
+    if (!back_buffer[s]) {
+        back_buffer[s] = (u16*) malloc(SCREEN_SIZE(screen));
+        if (!back_buffer[s]) return (u16*) screen; // draw directly
+        memcpy(back_buffer[s], screen, SCREEN_SIZE(screen));
+    }
+
+    return back_buffer[s];
+}
+
+// copies all damaged column parts from the back buffer to VRAM
+static void PresentScreen(int s)
+{
+    u16* screen = (s == 0) ? TOP_SCREEN : BOT_SCREEN;
+    const u16* buffer = back_buffer[s];
+    const u32* mask = damage[s];
+    const int x_end = damage_x[s][1];
+
+    if (!buffer) return;
+    for (int x = damage_x[s][0]; x < x_end;) {
+        // neighbouring full columns are continuous in the framebuffer
+        if (mask[x] == DAMAGE_FULL) {
+            int n = 1;
+            while ((x + n < x_end) && (mask[x + n] == DAMAGE_FULL)) n++;
+            u32 offset = PIXEL_OFFSET(x, SCREEN_HEIGHT - 1);
+            CopyPixels(screen + offset, buffer + offset, n * SCREEN_HEIGHT);
+            frame_vram_bytes += n * SCREEN_HEIGHT * BYTES_PER_PIXEL;
+            x += n;
+            continue;
+        }
+
+        // otherwise, copy each run of damaged blocks
+        for (u32 b = 0, m = mask[x]; m; b++, m >>= 1) {
+            if (!(m & 1)) continue;
+            u32 b0 = b;
+            for (; m & 2; b++, m >>= 1);
+            u32 y0 = b0 * DAMAGE_BLOCK;
+            u32 y1 = (b + 1) * DAMAGE_BLOCK;
+            u32 offset = PIXEL_OFFSET(x, y1 - 1);
+            CopyPixels(screen + offset, buffer + offset, y1 - y0);
+            frame_vram_bytes += (y1 - y0) * BYTES_PER_PIXEL;
+        }
+        x++;
+    }
+
+    if (x_end > damage_x[s][0])
+        memset(damage[s] + damage_x[s][0], 0, (x_end - damage_x[s][0]) * sizeof(u32));
+    damage_x[s][0] = damage_x[s][1] = 0;
+}
+
+// marks a part of the back buffer as changed, presents it when not inside a frame
+static void DamageScreen(const u16* screen, int x, int y, int w, int h)
+{
+    int s = GetScreenIndex(screen);
+    if ((s < 0) || !back_buffer[s]) return;
+
+    int x1 = min(x + w, (int) SCREEN_WIDTH(screen));
+    int y1 = min(y + h, SCREEN_HEIGHT);
+    x = max(x, 0);
+    y = max(y, 0);
+    if ((x >= x1) || (y >= y1)) return;
+
+    u32 b0 = y / DAMAGE_BLOCK;
+    u32 b1 = (y1 - 1) / DAMAGE_BLOCK;
+    u32 mask = ((1u << (b1 - b0 + 1)) - 1) << b0;
+    for (int i = x; i < x1; i++)
+        damage[s][i] |= mask;
+
+    int* dx = damage_x[s];
+    if (dx[1] <= dx[0]) {
+        dx[0] = x;
+        dx[1] = x1;
+    } else {
+        dx[0] = min(dx[0], x);
+        dx[1] = max(dx[1], x1);
+    }
+
+    clear_color[s] = COLOR_NONE;
+    if (!frame_depth) {
+        PresentScreen(s);
+        frame_count++;
+    }
+}
+
+// frames can be nested, everything is presented when the outermost frame ends
+// don't wait for user input inside a frame
+void BeginFrame(void)
+{
+    frame_depth++;
+}
+
+void EndFrame(void)
+{
+    if (!frame_depth || --frame_depth) return;
+    PROFILE_ZONE(PROF_UI_DRAW);
+    for (int s = 0; s < 2; s++)
+        PresentScreen(s);
+    frame_count++;
+}
+
+// drops out of all open frames and shows what was drawn so far
+// (for the exception handler, which may have interrupted a frame)
+void ResetFrames(void)
+{
+    frame_depth = 0;
+    for (int s = 0; s < 2; s++)
+        PresentScreen(s);
+    frame_count++;
+}
+
+void GetFrameStats(u32* frames, u64* vram_bytes)
+{
+    if (frames) *frames = frame_count;
+    if (vram_bytes) *vram_bytes = frame_vram_bytes;
+}
+
+// returns what is (or is about to be) shown on a screen, in framebuffer layout
+const u16* GetScreenBuffer(const u16* screen)
+{
+    return GetDrawBuffer(screen);
+}
+
+// overwrites a whole screen, i.e. with a copy taken earlier
+// NULL data presents the back buffer again after VRAM was written directly
+void RestoreScreen(u16* screen, const u16* data)
+{
+    if (data) memcpy(GetDrawBuffer(screen), data, SCREEN_SIZE(screen));
+    InvalidateTextCache(screen);
+    DamageScreen(screen, 0, 0, SCREEN_WIDTH(screen), SCREEN_HEIGHT);
+}
+
 void ClearScreen(u16* screen, u32 color)
 {
-    u32 *screen_wide = (u32*)(void*)screen;
+    int s = GetScreenIndex(screen);
     int width = (screen == TOP_SCREEN) ? SCREEN_WIDTH_TOP : SCREEN_WIDTH_BOT;
     if (color == COLOR_TRANSPARENT)
         color = COLOR_BLACK;
 
-    color |= color << 16;
-    for (int i = 0; i < (width * SCREEN_HEIGHT / 2); i++)
-        *(screen_wide++) = color;
+    InvalidateTextCache(screen);
+    if ((s >= 0) && (clear_color[s] == color))
+        return; // already cleared to that color
+
+    u16* buffer = GetDrawBuffer(screen);
+    if ((color & 0xFF) == ((color >> 8) & 0xFF)) { // black, white, ... are byte fills
+        memset(buffer, color & 0xFF, width * SCREEN_HEIGHT * sizeof(u16));
+    } else {
+        u32* buffer_wide = (u32*)(void*) buffer;
+        u32 color_wide = color | (color << 16);
+        for (int i = 0; i < (width * SCREEN_HEIGHT / 2); i++)
+            *(buffer_wide++) = color_wide;
+    }
+
+    DamageScreen(screen, 0, 0, width, SCREEN_HEIGHT);
+    if ((s >= 0) && back_buffer[s]) clear_color[s] = color;
 }
 
 void ClearScreenF(bool clear_main, bool clear_alt, u32 color)
@@ -344,22 +661,35 @@ void ClearScreenF(bool clear_main, bool clear_alt, u32 color)
 
 u16 GetColor(const u16 *screen, int x, int y)
 {
-    return screen[PIXEL_OFFSET(x, y)];
+    return GetDrawBuffer(screen)[PIXEL_OFFSET(x, y)];
 }
 
 void DrawPixel(u16 *screen, int x, int y, u32 color)
 {
-    screen[PIXEL_OFFSET(x, y)] = color;
+    u16* pixel = GetDrawBuffer(screen) + PIXEL_OFFSET(x, y);
+    InvalidateTextRect(screen, x, y, 1, 1, NULL);
+    if (*pixel == (u16) color) return;
+    *pixel = color;
+    DamageScreen(screen, x, y, 1, 1);
 }
 
 void DrawRectangle(u16 *screen, int x, int y, u32 width, u32 height, u32 color)
 {
-    screen += PIXEL_OFFSET(x, y) - height + 1;
-    while(width--) {
-        for (u32 h = 0; h < height; h++)
-            screen[h] = color;
-        screen += SCREEN_HEIGHT;
+    u16* buffer = GetDrawBuffer(screen) + PIXEL_OFFSET(x, y) - height + 1;
+    int x0 = width, x1 = 0; // changed columns, only those get damaged
+    InvalidateTextRect(screen, x, y, width, height, NULL);
+    for (int w = 0; w < (int) width; w++, buffer += SCREEN_HEIGHT) {
+        bool changed = false;
+        for (u32 h = 0; h < height; h++) {
+            if (buffer[h] == (u16) color) continue;
+            buffer[h] = color;
+            changed = true;
+        }
+        if (!changed) continue;
+        x0 = min(x0, w);
+        x1 = w + 1;
     }
+    if (x0 < x1) DamageScreen(screen, x + x0, y, x1 - x0, height);
 }
 
 void DrawBitmap(u16 *screen, int x, int y, u32 w, u32 h, const u16* bitmap)
@@ -372,12 +702,49 @@ void DrawBitmap(u16 *screen, int x, int y, u32 w, u32 h, const u16* bitmap)
     if ((x < 0) || (y < 0) || (w > SCREEN_WIDTH(screen)) || (h > SCREEN_HEIGHT))
         return;
 
-    screen += PIXEL_OFFSET(x, y);
-    while(h--) {
+    InvalidateTextRect(screen, x, y, w, h, NULL);
+    u16* buffer = GetDrawBuffer(screen) + PIXEL_OFFSET(x, y);
+    for (u32 yy = h; yy; yy--) {
         for (u32 i = 0; i < w; i++)
-            screen[i * SCREEN_HEIGHT] = *(bitmap++);
-        screen--;
+            buffer[i * SCREEN_HEIGHT] = *(bitmap++);
+        buffer--;
+    }
+    DamageScreen(screen, x, y, w, h);
+}
+
+// row y of a PNG goes y pixels up from the framebuffer offset of its first row
+static void DrawPngRow(const u16* row, u32 y, u32 w, void* data)
+{
+    u16* buffer = ((u16*) data) - y;
+    for (u32 i = 0; i < w; i++)
+        buffer[i * SCREEN_HEIGHT] = row[i];
+}
+
+// decodes a PNG straight into the screen, negative x / y center it
+bool DrawPng(u16 *screen, int x, int y, const u8* png, u32 png_size)
+{
+    u32 w, h;
+
+    // reject images that don't fit before decoding anything
+    if (!PNG_GetSize(png, png_size, &w, &h) || (w > SCREEN_WIDTH(screen)) || (h > SCREEN_HEIGHT))
+        return false;
+    if (x < 0) x = (SCREEN_WIDTH(screen) - w) >> 1;
+    if (y < 0) y = (SCREEN_HEIGHT - h) >> 1;
+    if ((x + w > SCREEN_WIDTH(screen)) || (y + h > SCREEN_HEIGHT))
+        return false;
+
+    InvalidateTextRect(screen, x, y, w, h, NULL);
+    u16* buffer = GetDrawBuffer(screen);
+    bool res = PNG_DecompressRows(png, png_size, w, h, PNG_SCRATCH_MAX, DrawPngRow, buffer + PIXEL_OFFSET(x, y));
+    if (res) DamageScreen(screen, x, y, w, h);
+    else if (buffer != screen) { // don't present half an image, take back what is on screen
+        for (u32 i = 0; i < w; i++) {
+            u32 offset = PIXEL_OFFSET(x + i, y + h - 1);
+            CopyPixels(buffer + offset, screen + offset, h);
+        }
     }
+
+    return res;
 }
 
 void DrawQrCode(u16 *screen, const u8* qrcode)
@@ -395,6 +762,7 @@ void DrawQrCode(u16 *screen, const u8* qrcode)
     // clear screen, draw the canvas
     u32 x_canvas = (SCREEN_WIDTH(screen) - size_canvas) / 2;
     u32 y_canvas = (SCREEN_HEIGHT - size_canvas) / 2;
+    BeginFrame();
     ClearScreen(screen, COLOR_STD_BG);
     DrawRectangle(screen, x_canvas, y_canvas, size_canvas, size_canvas, COLOR_WHITE);
 
@@ -402,42 +770,117 @@ void DrawQrCode(u16 *screen, const u8* qrcode)
     u32 x_qr = (SCREEN_WIDTH(screen) - size_qr_s) / 2;
     u32 y_qr = (SCREEN_HEIGHT - size_qr_s) / 2;
     int xDisplacement = x_qr * SCREEN_HEIGHT;
+    u16* buffer = GetDrawBuffer(screen);
     for (u32 y = 0; y < size_qr_s; y++) {
         int yDisplacement = SCREEN_HEIGHT - (y_qr + y) - 1;
-        u16* screenPos = screen + xDisplacement + yDisplacement;
+        u16* screenPos = buffer + xDisplacement + yDisplacement;
         for (u32 x = 0; x < size_qr_s; x++) {
             u16 c = qrcodegen_getModule(qrcode, x/scale, y/scale) ? COLOR_BLACK : COLOR_WHITE;
             *(screenPos) = c;
             screenPos += SCREEN_HEIGHT;
         }
     }
+    DamageScreen(screen, x_qr, y_qr, size_qr_s, size_qr_s);
+    EndFrame();
 }
 
-void DrawCharacter(u16 *screen, u32 character, int x, int y, u32 color, u32 bgcolor)
+static const u16* GetGlyphPixels(u32 character, u32 color, u32 bgcolor)
 {
-    for (int yy = 0; yy < (int) font_height; yy++) {
-        int xDisplacement = x * SCREEN_HEIGHT;
-        int yDisplacement = SCREEN_HEIGHT - (y + yy) - 1;
-        u16* screenPos = screen + xDisplacement + yDisplacement;
-
-        u8 charPos = font_bin[GetFontIndex(character, true) * font_height + yy];
-        for (int xx = 7; xx >= (8 - (int) font_width); xx--) {
-            if ((charPos >> xx) & 1) {
-                *screenPos = color;
-            } else if (bgcolor != COLOR_TRANSPARENT) {
-                *screenPos = bgcolor;
+    GlyphCacheEntry* entry = glyph_cache + ((character ^ (color * 7) ^ (bgcolor * 13)) % GLYPH_CACHE_N);
+
+    if ((entry->character != character) || (entry->color != color) || (entry->bgcolor != bgcolor)) {
+        const u16* columns = font_atlas + (GetFontIndex(character, true) * font_width);
+        u16* pixels = entry->pixels;
+        for (u32 xx = 0; xx < font_width; xx++) {
+            for (int yy = font_height - 1; yy >= 0; yy--)
+                *(pixels++) = ((columns[xx] >> yy) & 1) ? color : bgcolor;
+        }
+        entry->character = character;
+        entry->color = color;
+        entry->bgcolor = bgcolor;
+    }
+
+    return entry->pixels;
+}
+
+// draws to the back buffer, damage is up to the caller
+static void DrawGlyph(u16 *screen, u32 character, int x, int y, u32 color, u32 bgcolor)
+{
+    screen = GetDrawBuffer(screen);
+    if (!font_atlas) { // fallback, no atlas available
+        for (int yy = 0; yy < (int) font_height; yy++) {
+            int xDisplacement = x * SCREEN_HEIGHT;
+            int yDisplacement = SCREEN_HEIGHT - (y + yy) - 1;
+            u16* screenPos = screen + xDisplacement + yDisplacement;
+
+            u8 charPos = font_bin[GetFontIndex(character, true) * font_height + yy];
+            for (int xx = 7; xx >= (8 - (int) font_width); xx--) {
+                if ((charPos >> xx) & 1) {
+                    *screenPos = color;
+                } else if (bgcolor != COLOR_TRANSPARENT) {
+                    *screenPos = bgcolor;
+                }
+                screenPos += SCREEN_HEIGHT;
             }
-            screenPos += SCREEN_HEIGHT;
+        }
+        return;
+    }
+
+    // each glyph column is one continuous span in the framebuffer
+    u16* screenPos = screen + PIXEL_OFFSET(x, y + font_height - 1);
+    if ((bgcolor != COLOR_TRANSPARENT) && glyph_cache) { // opaque: copy pre-rendered spans
+        const u16* pixels = GetGlyphPixels(character, color, bgcolor);
+        for (u32 xx = 0; xx < font_width; xx++, screenPos += SCREEN_HEIGHT) {
+            for (u32 yy = 0; yy < font_height; yy++)
+                screenPos[yy] = *(pixels++);
+        }
+    } else { // transparent: set foreground pixels only
+        const u16* columns = font_atlas + (GetFontIndex(character, true) * font_width);
+        for (u32 xx = 0; xx < font_width; xx++, screenPos += SCREEN_HEIGHT) {
+            u16* pixel = screenPos + font_height - 1;
+            for (u32 mask = columns[xx]; mask; mask >>= 1, pixel--)
+                if (mask & 1) *pixel = color;
         }
     }
 }
 
+void DrawCharacter(u16 *screen, u32 character, int x, int y, u32 color, u32 bgcolor)
+{
+    InvalidateTextRect(screen, x, y, font_width, font_height, NULL);
+    DrawGlyph(screen, character, x, y, color, bgcolor);
+    DamageScreen(screen, x, y, font_width, font_height);
+}
+
 void DrawString(u16 *screen, const char *str, int x, int y, u32 color, u32 bgcolor)
 {
+    PROFILE_ZONE(PROF_UI_DRAW);
     size_t max_len = (((screen == TOP_SCREEN) ? SCREEN_WIDTH_TOP : SCREEN_WIDTH_BOT) - x) / font_width;
-
-    for (size_t i = 0; i < max_len && *str; i++) {
-        DrawCharacter(screen, GetCharacter(&str), x + i * font_width, y, color, bgcolor);
+    TextCacheEntry* entry = GetTextCacheEntry(screen, x, y, color, bgcolor, false);
+    u16 text[TEXT_CACHE_LEN];
+    size_t i = 0;
+    size_t d0 = max_len, d1 = 0; // drawn characters
+
+    // characters already on screen (same place, same colors) are skipped
+    for (; i < max_len && *str; i++) {
+        u32 character = GetCharacter(&str);
+        if (!entry || (i >= entry->len) || (entry->text[i] != (u16) character)) {
+            DrawGlyph(screen, character, x + i * font_width, y, color, bgcolor);
+            if (d0 > i) d0 = i;
+            d1 = i + 1;
+        }
+        if (i < TEXT_CACHE_LEN) text[i] = (u16) character;
+    }
+    if (!i) return;
+    if (d1) DamageScreen(screen, x + d0 * font_width, y, (d1 - d0) * font_width, font_height);
+
+    // update the text cache
+    InvalidateTextRect(screen, x, y, i * font_width, font_height, entry);
+    if (!entry) entry = GetTextCacheEntry(screen, x, y, color, bgcolor, true);
+    if (entry) {
+        u32 len = min(i, TEXT_CACHE_LEN);
+        memcpy(entry->text, text, len * sizeof(u16));
+        entry->len = max(entry->len, len);
+        UpdateTextCacheBox(screen, x, y, entry->len * font_width, font_height);
     }
 }
 
@@ -718,9 +1161,11 @@ bool ShowPrompt(bool ask, const char *format, ...)
     vsnprintf(str, STRBUF_SIZE, format, va);
     va_end(va);
 
+    BeginFrame();
     ClearScreenF(true, false, COLOR_STD_BG);
     DrawStringCenter(MAIN_SCREEN, COLOR_STD_FONT, COLOR_STD_BG, "%s\n \n%s", str,
         (ask) ? "(<A> yes, <B> no)" : "(<A> to continue)");
+    EndFrame();
 
     while (true) {
         u32 pad_state = InputWait(0);
@@ -863,6 +1308,7 @@ u32 ShowSelectPrompt(int n, const char** options, const char *format, ...) {
     y = (str_height >= SCREEN_HEIGHT) ? 0 : (SCREEN_HEIGHT - str_height) / 2;
     yopt = y + GetDrawStringHeight(str) + 8;
 
+    BeginFrame();
     ClearScreenF(true, false, COLOR_STD_BG);
     DrawStringF(MAIN_SCREEN, x, y, COLOR_STD_FONT, COLOR_STD_BG, "%s", str);
     DrawStringF(MAIN_SCREEN, x, yopt + (n_show*(line_height+2)) + line_height, COLOR_STD_FONT, COLOR_STD_BG, "(<A> select, <B> cancel)");
@@ -891,6 +1337,7 @@ u32 ShowSelectPrompt(int n, const char** options, const char *format, ...) {
 
             DrawRectangle(MAIN_SCREEN, bar_x, bar_y, bar_width, bar_height, COLOR_SIDE_BAR);
         }
+        EndFrame();
 
         u32 pad_state = InputWait(0);
         if (pad_state & BUTTON_DOWN) sel = (sel+1) % n;
@@ -904,6 +1351,7 @@ u32 ShowSelectPrompt(int n, const char** options, const char *format, ...) {
         }
         if (sel < 0) sel = 0;
         else if (sel >= n) sel = n-1;
+        BeginFrame();
 
         int prev_scroll = scroll;
         if (sel < scroll) scroll = sel;
@@ -942,6 +1390,7 @@ u32 ShowFileScrollPrompt(int n, const DirEntry** options, bool hide_ext, const c
     yopt = y + GetDrawStringHeight(str) + 8;
     fname_len = min(64, item_width / FONT_WIDTH_EXT - 14);
 
+    BeginFrame();
     ClearScreenF(true, false, COLOR_STD_BG);
     DrawStringF(MAIN_SCREEN, x, y, COLOR_STD_FONT, COLOR_STD_BG, "%s", str);
     DrawStringF(MAIN_SCREEN, x, yopt + (n_show*(line_height+2)) + line_height, COLOR_STD_FONT, COLOR_STD_BG, "(<A> select, <B> cancel)");
@@ -988,6 +1437,7 @@ u32 ShowFileScrollPrompt(int n, const DirEntry** options, bool hide_ext, const c
             DrawRectangle(MAIN_SCREEN, bar_x, bar_y + bar_height, bar_width, SCREEN_HEIGHT - (bar_y + bar_height), COLOR_STD_BG);
             DrawRectangle(MAIN_SCREEN, bar_x, bar_y, bar_width, bar_height, COLOR_SIDE_BAR);
         } else DrawRectangle(MAIN_SCREEN, bar_x, yopt, bar_width, flist_height, COLOR_STD_BG);
+        EndFrame();
 
         u32 pad_state = InputWait(0);
         if (pad_state & BUTTON_DOWN) sel = (sel+1) % n;
@@ -1001,6 +1451,7 @@ u32 ShowFileScrollPrompt(int n, const DirEntry** options, bool hide_ext, const c
         }
         if (sel < 0) sel = 0;
         else if (sel >= n) sel = n-1;
+        BeginFrame();
         if (sel < scroll) scroll = sel;
         else if (sel ==  n-1 && sel >= (scroll + n_show - 1)) scroll = sel - n_show + 1;
         else if (sel >= (scroll + (n_show-1) - 1)) scroll = sel - (n_show-1) + 1;
@@ -1383,33 +1834,43 @@ bool ShowRtcSetterPrompt(void* time, const char *format, ...) {
     return ret;
 }
 
-bool ShowProgress(u64 current, u64 total, const char* opstr)
+ProgressStatus* GetProgressStatus(void)
+{
+    return &progress;
+}
+
+// draws the published progress status, at most every PROGRESS_REFRESH_RATE ms unless forced
+// this is cheap to call when there is nothing to draw
+bool UpdateProgress(bool force)
 {
     static u32 last_prog_width = 0;
-    static u64 timer = 0;
+    static u64 last_sec_remain = 0;
     const u32 bar_width = 240;
     const u32 bar_height = 12;
     const u32 bar_pos_x = (SCREEN_WIDTH_MAIN - bar_width) / 2;
     const u32 bar_pos_y = (SCREEN_HEIGHT / 2) - bar_height - 2 - 10;
     const u32 text_pos_y = bar_pos_y + bar_height + 2;
+    const u32 status_len = min(63, (SCREEN_WIDTH_MAIN - bar_pos_x) / FONT_WIDTH_EXT);
+
+    u64 ticks = timer_ticks(progress_timer);
+    if (!force && (ticks < progress_next)) return !CheckButton(BUTTON_B);
+    progress_next = ticks + (TICKS_PER_SEC * PROGRESS_REFRESH_RATE / 1000);
+    PROFILE_ZONE(PROF_UI_DRAW);
+
+    u64 current = progress.current;
+    u64 total = progress.total;
     u32 prog_width = ((total > 0) && (current <= total)) ? (current * (bar_width-4)) / total : 0;
     u32 prog_percent = ((total > 0) && (current <= total)) ? (current * 100) / total : 0;
     char tempstr[64];
     char progstr[UTF_BUFFER_BYTESIZE(64)];
 
-    static u64 last_msec_elapsed = 0;
-    static u64 last_sec_remain = 0;
-    if (!current) {
-        timer = timer_start();
-        last_sec_remain = 0;
-    } else if (timer_msec(timer) < last_msec_elapsed + PROGRESS_REFRESH_RATE) return !CheckButton(BUTTON_B);
-    last_msec_elapsed = timer_msec(timer);
-    u64 sec_elapsed = (total > 0) ? timer_sec( timer ) : 0;
+    u64 sec_elapsed = (total > 0) ? ticks / TICKS_PER_SEC : 0;
     u64 sec_total = (current > 0) ? (sec_elapsed * total) / current : 0;
-    u64 sec_remain = (!last_sec_remain) ? (sec_total - sec_elapsed) : ((last_sec_remain + (sec_total - sec_elapsed) + 1) / 2);
+    u64 sec_remain = (!current) ? 0 : (!last_sec_remain) ? (sec_total - sec_elapsed) : ((last_sec_remain + (sec_total - sec_elapsed) + 1) / 2);
     if (sec_remain >= 60 * 60) sec_remain = 60 * 60 - 1;
     last_sec_remain = sec_remain;
 
+    BeginFrame();
     if (!current || last_prog_width > prog_width) {
         ClearScreenF(true, false, COLOR_STD_BG);
         DrawRectangle(MAIN_SCREEN, bar_pos_x, bar_pos_y, bar_width, bar_height, COLOR_STD_FONT);
@@ -1418,7 +1879,7 @@ bool ShowProgress(u64 current, u64 total, const char* opstr)
     DrawRectangle(MAIN_SCREEN, bar_pos_x + 2, bar_pos_y + 2, prog_width, bar_height - 4, COLOR_STD_FONT);
     DrawRectangle(MAIN_SCREEN, bar_pos_x + 2 + prog_width, bar_pos_y + 2, (bar_width-4) - prog_width, bar_height - 4, COLOR_STD_BG);
 
-    TruncateString(progstr, opstr, min(63, (bar_width / FONT_WIDTH_EXT) - 7), 8);
+    TruncateString(progstr, progress.opstr ? progress.opstr : "", min(63, (bar_width / FONT_WIDTH_EXT) - 7), 8);
     snprintf(tempstr, 64, "%s (%lu%%)", progstr, prog_percent);
     ResizeString(progstr, tempstr, bar_width / FONT_WIDTH_EXT, 8, false);
     DrawString(MAIN_SCREEN, progstr, bar_pos_x, text_pos_y, COLOR_STD_FONT, COLOR_STD_BG);
@@ -1430,11 +1891,51 @@ bool ShowProgress(u64 current, u64 total, const char* opstr)
     }
     DrawString(MAIN_SCREEN, "(hold B to cancel)", bar_pos_x + 2, text_pos_y + 14, COLOR_STD_FONT, COLOR_STD_BG);
 
+    // optional status: hashes, status line, hint
+    if (progress.show_hash) {
+        char hash_str[32+1];
+        DrawString(MAIN_SCREEN, "Current hash:", bar_pos_x, bar_pos_y + 64, COLOR_STD_FONT, COLOR_STD_BG);
+        snprintf(hash_str, 32+1, "%016llX%016llX", getbe64(progress.hash + 16), getbe64(progress.hash + 24));
+        DrawString(MAIN_SCREEN, hash_str, bar_pos_x, bar_pos_y + 74, COLOR_STD_FONT, COLOR_STD_BG);
+        DrawString(MAIN_SCREEN, "Expected:", bar_pos_x, bar_pos_y + 94, COLOR_STD_FONT, COLOR_STD_BG);
+        snprintf(hash_str, 32+1, "%016llX%016llX", getbe64(progress.expected + 16), getbe64(progress.expected + 24));
+        DrawString(MAIN_SCREEN, hash_str, bar_pos_x, bar_pos_y + 104, COLOR_STD_FONT, COLOR_STD_BG);
+    }
+    if (progress.status) {
+        if (!progress.show_count) snprintf(tempstr, 64, "%s", progress.status);
+        else if (!progress.count_max) snprintf(tempstr, 64, "%s%lu", progress.status, progress.count);
+        else snprintf(tempstr, 64, "%s%lu/%lu", progress.status, progress.count, progress.count_max);
+        ResizeString(progstr, tempstr, status_len, 8, false);
+        DrawString(MAIN_SCREEN, progstr, bar_pos_x, bar_pos_y + 114, COLOR_STD_FONT, COLOR_STD_BG);
+        DrawString(MAIN_SCREEN, progress.marker ? "*" : " ", bar_pos_x - 15, bar_pos_y + 114, COLOR_STD_FONT, COLOR_STD_BG);
+    }
+    if (progress.status || progress.hint) {
+        ResizeString(progstr, progress.hint ? progress.hint : "", status_len, 8, false);
+        DrawString(MAIN_SCREEN, progstr, bar_pos_x, bar_pos_y + 124, COLOR_STD_FONT, COLOR_STD_BG);
+    }
+    EndFrame();
+
     last_prog_width = prog_width;
 
     return !CheckButton(BUTTON_B);
 }
 
+// publishes progress and draws it (rate limited), current == 0 (re)starts the progress display
+bool ShowProgress(u64 current, u64 total, const char* opstr)
+{
+    if (!current) {
+        memset(&progress, 0, sizeof(ProgressStatus));
+        progress_timer = timer_start();
+        progress_next = 0;
+    }
+
+    progress.current = current;
+    progress.total = total;
+    progress.opstr = opstr;
+
+    return UpdateProgress(!current);
+}
+
 int ShowBrightnessConfig(int set_brightness)
 {
     const int old_brightness = set_brightness;
@@ -1452,6 +1953,7 @@ int ShowBrightnessConfig(int set_brightness)
         COLOR_RED, COLOR_GREEN, COLOR_BLUE, COLOR_WHITE
     };
 
+    BeginFrame();
     ClearScreen(MAIN_SCREEN, COLOR_STD_BG);
 
     bar_count = countof(brightness_slider_colmasks);
@@ -1471,6 +1973,7 @@ int ShowBrightnessConfig(int set_brightness)
         (SCREEN_HEIGHT / 4) * 2, COLOR_STD_FONT, COLOR_STD_BG, "%s", brightness_str);
 
     // draw all color gradient bars
+    u16* buffer = GetDrawBuffer(MAIN_SCREEN);
     for (int x = 0; x < bar_width; x++) {
         u32 intensity;
         u16 intensity_mask;
@@ -1483,12 +1986,15 @@ int ShowBrightnessConfig(int set_brightness)
 
         intensity_mask = RGB(intensity, intensity, intensity);
 
+        InvalidateTextRect(MAIN_SCREEN, bar_x_pos + x, bar_y_pos - bar_height + 1, 1, bar_count * bar_height, NULL);
         for (u32 b = 0; b < bar_count; b++) {
-            u16 *screen_base = &MAIN_SCREEN[PIXEL_OFFSET(bar_x_pos + x, (b * bar_height) + bar_y_pos)];
+            u16 *screen_base = &buffer[PIXEL_OFFSET(bar_x_pos + x, (b * bar_height) + bar_y_pos)];
             for (int y = 0; y < bar_height; y++)
                 *(screen_base++) = brightness_slider_colmasks[b] & intensity_mask;
         }
     }
+    DamageScreen(MAIN_SCREEN, bar_x_pos, bar_y_pos - bar_height + 1, bar_width, bar_count * bar_height);
+    EndFrame();
 
     while(1) {
         int prev_brightness, slider_x_pos, slider_y_pos;
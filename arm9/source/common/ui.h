@@ -43,6 +43,22 @@
 
 #define COLOR_TRANSPARENT   COLOR_SUPERFUCHSIA
 
+// progress status, hot loops only publish into this
+// formatting and drawing happens in UpdateProgress(), at a fixed rate
+typedef struct {
+    u64 current;
+    u64 total;
+    const char* opstr;
+    const char* status; // status line (optional)
+    bool show_count; // status line is followed by count (and "/count_max")
+    u32 count;
+    u32 count_max;
+    const char* hint; // line below the status line (optional)
+    bool marker; // marker in front of the status line
+    bool show_hash;
+    u8 hash[32]; // current and expected SHA-256
+    u8 expected[32];
+} ProgressStatus;
 
 #ifndef AUTO_UNLOCK
 bool PRINTF_ARGS(2) ShowUnlockSequence(u32 seqlvl, const char *format, ...);
@@ -54,6 +70,13 @@ u8* GetFontFromPbm(const void* pbm, const u32 riff_size, u32* w, u32* h);
 u8* GetFontFromRiff(const void* riff, const u32 riff_size, u32* w, u32* h, u16* count);
 bool SetFont(const void* font, const u32 font_size);
 
+void BeginFrame(void);
+void EndFrame(void);
+void ResetFrames(void);
+void GetFrameStats(u32* frames, u64* vram_bytes);
+const u16* GetScreenBuffer(const u16* screen);
+void RestoreScreen(u16 *screen, const u16* data);
+
 u16 GetColor(const u16 *screen, int x, int y);
 
 void ClearScreen(u16 *screen, u32 color);
@@ -61,8 +84,10 @@ void ClearScreenF(bool clear_main, bool clear_alt, u32 color);
 void DrawPixel(u16 *screen, int x, int y, u32 color);
 void DrawRectangle(u16 *screen, int x, int y, u32 width, u32 height, u32 color);
 void DrawBitmap(u16 *screen, int x, int y, u32 w, u32 h, const u16* bitmap);
+bool DrawPng(u16 *screen, int x, int y, const u8* png, u32 png_size);
 void DrawQrCode(u16 *screen, const u8* qrcode);
 
+void InvalidateTextCache(u16 *screen);
 void DrawCharacter(u16 *screen, u32 character, int x, int y, u32 color, u32 bgcolor);
 void DrawString(u16 *screen, const char *str, int x, int y, u32 color, u32 bgcolor);
 void PRINTF_ARGS(6) DrawStringF(u16 *screen, int x, int y, u32 color, u32 bgcolor, const char *format, ...);
@@ -97,6 +122,8 @@ u64 PRINTF_ARGS(2) ShowNumberPrompt(u64 start_val, const char *format, ...);
 bool PRINTF_ARGS(3) ShowDataPrompt(u8* data, u32* size, const char *format, ...);
 bool PRINTF_ARGS(2) ShowRtcSetterPrompt(void* time, const char *format, ...);
 bool ShowProgress(u64 current, u64 total, const char* opstr);
+ProgressStatus* GetProgressStatus(void);
+bool UpdateProgress(bool force);
 
 int ShowBrightnessConfig(int set_brightness);
 
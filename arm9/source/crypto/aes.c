@@ -1,5 +1,6 @@
 /* original version by megazig */
 #include "aes.h"
+#include "profile.h"
 
 // FIXME some things make assumptions about alignemnts!
 // setup_aeskey? and set_ctr do not anymore (c) d0k3
@@ -222,11 +223,11 @@ void ctr_decrypt_byte(void *inbuf, void *outbuf, size_t size, size_t off, uint32
     {
         size_t last_byte = ((off_fix + bytes_left) >= AES_BLOCK_SIZE) ?
             AES_BLOCK_SIZE : off_fix + bytes_left;
-        for (i=off_fix; i<last_byte; i++)
-            temp[i] = *(in++);
+        memcpy(temp + off_fix, in, last_byte - off_fix);
         ctr_decrypt(temp, temp, 1, mode, ctr_local);
-        for (i=off_fix; i<last_byte; i++)
-            *(out++) = temp[i];
+        memcpy(out, temp + off_fix, last_byte - off_fix);
+        in += last_byte - off_fix;
+        out += last_byte - off_fix;
         bytes_left -= last_byte - off_fix;
     }
 
@@ -241,11 +242,9 @@ void ctr_decrypt_byte(void *inbuf, void *outbuf, size_t size, size_t off, uint32
 
     if (bytes_left) // handle misaligned offset (at end)
     {
-        for (i=0; i<bytes_left; i++)
-            temp[i] = *(in++);
+        memcpy(temp, in, bytes_left);
         ctr_decrypt(temp, temp, 1, mode, ctr_local);
-        for (i=0; i<bytes_left; i++)
-            *(out++) = temp[i];
+        memcpy(out, temp, bytes_left);
         bytes_left = 0;
     }
 }
@@ -271,6 +270,7 @@ void ctr_decrypt(void *inbuf, void *outbuf, size_t size, uint32_t mode, uint8_t
 
 void aes_decrypt(void* inbuf, void* outbuf, size_t size, uint32_t mode)
 {
+    PROFILE_ZONE(PROF_AES);
     uint8_t *in  = inbuf;
     uint8_t *out = outbuf;
     size_t block_count = size;
@@ -293,6 +293,7 @@ void aes_decrypt(void* inbuf, void* outbuf, size_t size, uint32_t mode)
 
 void aes_cmac(void* inbuf, void* outbuf, size_t size)
 {
+    PROFILE_ZONE(PROF_AES);
     // only works for full blocks
     uint32_t zeroes[4] __attribute__((aligned(32))) = { 0 };
     uint32_t xorpad[4] __attribute__((aligned(32))) = { 0 };
@@ -1,26 +1,39 @@
 #include "crc16.h"
 
-#define CRC16_TABVAL  \
-    0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401, \
-    0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400
+#define CRC16_POLY  0xA001
 
+// bytewise table, generated on first use
+static u16 crc16_table[256];
+static bool crc16_table_init = false;
 
-// see: https://github.com/TASVideos/desmume/blob/master/desmume/src/bios.cpp#L1070tions
-u16 crc16_quick(const void* src, u32 len) {
-    static const u16 tabval[] = { CRC16_TABVAL };
-    u16* data = (u16*) src;
-    u16 crc = 0xFFFF;
+static void crc16_init_table(void) {
+    for (u32 i = 0; i < 256; i++) {
+        u16 crc = i;
+        for (u32 b = 0; b < 8; b++)
+            crc = (crc & 1) ? ((crc >> 1) ^ CRC16_POLY) : (crc >> 1);
+        crc16_table[i] = crc;
+    }
+    crc16_table_init = true;
+}
+
+u16 crc16_update(u16 crc, const void* src, u32 len) {
+    const u8* data = (const u8*) src;
+    if (!crc16_table_init) crc16_init_table();
 
-    for (len >>= 1; len; len--) {
-        u16 curr = *(data++);
-        for (u32 i = 0; i < 4; i++) {
-            u16 tval = tabval[crc&0xF];
-            crc >>= 4;
-            crc ^= tval;
-            tval = tabval[(curr >> (4*i))&0xF];
-            crc ^= tval;
-        }
+    for (; len >= 4; len -= 4, data += 4) {
+        crc = (crc >> 8) ^ crc16_table[(crc ^ data[0]) & 0xFF];
+        crc = (crc >> 8) ^ crc16_table[(crc ^ data[1]) & 0xFF];
+        crc = (crc >> 8) ^ crc16_table[(crc ^ data[2]) & 0xFF];
+        crc = (crc >> 8) ^ crc16_table[(crc ^ data[3]) & 0xFF];
     }
+    for (; len; len--)
+        crc = (crc >> 8) ^ crc16_table[(crc ^ *(data++)) & 0xFF];
 
     return crc;
 }
+
+// see: https://github.com/TASVideos/desmume/blob/master/desmume/src/bios.cpp#L1070tions
+// (BIOS GetCRC16 works on halfwords, a trailing odd byte is ignored)
+u16 crc16_quick(const void* src, u32 len) {
+    return crc16_update(crc16_init(), src, len & ~0x1);
+}
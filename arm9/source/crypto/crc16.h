@@ -2,4 +2,9 @@
 
 #include "common.h"
 
+// CRC-16/MODBUS as used by NDS/DSi (poly 0xA001 reflected, no final xor)
+// streaming API: crc16_update(crc16_init(), data, len), chunks can be any size
+#define crc16_init()    (0xFFFF)
+
+u16 crc16_update(u16 crc, const void* src, u32 len);
 u16 crc16_quick(const void* src, u32 len);
@@ -6,6 +6,12 @@
 
 #include "common.h"
 
+// streaming API: crc32_final(crc32_update(crc32_init(), data, len))
+#define crc32_init()        (0xFFFFFFFF)
+#define crc32_final(crc32)  (~(crc32))
+
 u32 crc32_adjust(u32 crc32, u8 input);
+u32 crc32_update(u32 crc32, const void* data, u32 length);
+u32 crc32_combine(u32 crc1, u32 crc2, u32 length2);
 u32 crc32_calculate(u32 crc32, const u8* data, u32 length);
 u32 crc32_calculate_from_file(const char* fileName, u32 offset, u32 length);
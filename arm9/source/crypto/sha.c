@@ -1,10 +1,6 @@
 #include "sha.h"
 #include "mmio.h"
-
-typedef struct
-{
-    u32 data[16];
-} _sha_block;
+#include "profile.h"
 
 void sha_init(u32 mode)
 {
@@ -14,11 +10,12 @@ void sha_init(u32 mode)
 
 void sha_update(const void* src, u32 size)
 {
+    PROFILE_ZONE(PROF_SHA);
     const u32* src32 = (const u32*)src;
 
     while(size >= 0x40) {
         while(*REG_SHACNT & 1);
-        *((volatile _sha_block*)REG_SHAINFIFO) = *((const _sha_block*)src32);
+        iomemcpy((void*)REG_SHAINFIFO, src32, 0x40);
         src32 += 16;
         size -= 0x40;
     }
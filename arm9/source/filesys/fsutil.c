@@ -175,7 +175,7 @@ bool FileGetSha(const char* path, u8* hash, u64 offset, u64 size, bool sha1) {
     fvx_lseek(&file, offset);
 
     u32 bufsiz = min(STD_BUFFER_SIZE, fsize);
-    u8* buffer = (u8*) malloc(bufsiz);
+    u8* buffer = (u8*) mem_pool_get(MEMPOOL_IO);
     if (!buffer) return false;
 
     ShowProgress(0, 0, path);
@@ -192,7 +192,7 @@ bool FileGetSha(const char* path, u8* hash, u64 offset, u64 size, bool sha1) {
 
     sha_get(hash);
     fvx_close(&file);
-    free(buffer);
+    mem_pool_put(MEMPOOL_IO, buffer);
 
     ShowProgress(1, 1, path);
 
@@ -553,6 +553,11 @@ bool PathMoveCopyRec(char* dest, char* orig, u32* flags, bool move, u8* buffer,
         fvx_lseek(&ofile, 0);
         fvx_sync(&ofile);
 
+        // the loop only publishes its position, UpdateProgress() draws at a fixed rate
+        ProgressStatus* progress = GetProgressStatus();
+        progress->total = osize;
+        progress->opstr = orig;
+
         if (calcsha) sha_init(sha1 ? SHA1_MODE : SHA256_MODE);
         for (u64 pos = 0; (pos < osize) && ret; pos += bufsiz) {
             UINT bytes_read = 0;
@@ -562,14 +567,14 @@ bool PathMoveCopyRec(char* dest, char* orig, u32* flags, bool move, u8* buffer,
                 (bytes_read != bytes_written))
                 ret = false;
 
-            u64 current = pos + bytes_read;
-            u64 total = osize;
-            if (ret && !ShowProgress(current, total, orig)) {
+            progress->current = pos + bytes_read;
+            if (ret && !UpdateProgress(false)) {
+                u64 current = progress->current;
                 if (flags && (*flags & NO_CANCEL)) {
                     ShowPrompt(false, "%s\nCancel is not allowed here", deststr);
                 } else ret = !ShowPrompt(true, "%s\nB button detected. Cancel?", deststr);
                 ShowProgress(0, 0, orig);
-                ShowProgress(current, total, orig);
+                ShowProgress(current, osize, orig);
             }
             if (calcsha)
                 sha_update(buffer, bytes_read);
@@ -671,7 +676,7 @@ bool PathMoveCopy(const char* dest, const char* orig, u32* flags, bool move) {
         if (flags && (*flags & BUILD_PATH)) fvx_rmkpath(ldest);
 
         // setup buffer
-        u8* buffer = (u8*) malloc(STD_BUFFER_SIZE);
+        u8* buffer = (u8*) mem_pool_get(MEMPOOL_IO);
         if (!buffer) {
             ShowPrompt(false, "Out of memory.");
             return false;
@@ -682,7 +687,7 @@ bool PathMoveCopy(const char* dest, const char* orig, u32* flags, bool move) {
         bool res = PathMoveCopyRec(ldest, lorig, flags, move && same_drv, buffer, STD_BUFFER_SIZE);
         if (move && res && (!flags || !(*flags&SKIP_CUR))) PathDelete(lorig);
 
-        free(buffer);
+        mem_pool_put(MEMPOOL_IO, buffer);
         return res;
     } else { // virtual destination handling
         // can't write an SHA file to a virtual destination
@@ -710,7 +715,7 @@ bool PathMoveCopy(const char* dest, const char* orig, u32* flags, bool move) {
         }
 
         // setup buffer
-        u8* buffer = (u8*) malloc(STD_BUFFER_SIZE);
+        u8* buffer = (u8*) mem_pool_get(MEMPOOL_IO);
         if (!buffer) {
             ShowPrompt(false, "Out of memory.");
             return false;
@@ -721,7 +726,7 @@ bool PathMoveCopy(const char* dest, const char* orig, u32* flags, bool move) {
         bool res = PathMoveCopyRec(ldest, lorig, flags, false, buffer, STD_BUFFER_SIZE);
         if (force_unmount) InitExtFS();
 
-        free(buffer);
+        mem_pool_put(MEMPOOL_IO, buffer);
         return res;
     }
 }
@@ -1,6 +1,7 @@
 #include "virtual.h"
 #include "ffconf.h"
 #include "vff.h"
+#include "profile.h"
 
 #if FF_USE_LFN != 0
 #define _MAX_FN_LEN (FF_MAX_LFN)
@@ -29,6 +30,7 @@ FRESULT fvx_open (FIL* fp, const TCHAR* path, BYTE mode) {
 }
 
 FRESULT fvx_read (FIL* fp, void* buff, UINT btr, UINT* br) {
+    PROFILE_ZONE(PROF_FATFS);
     #if _VFIL_ENABLED
     if (fp->obj.fs == NULL) {
         VirtualFile* vfile = VFIL(fp);
@@ -41,6 +43,7 @@ FRESULT fvx_read (FIL* fp, void* buff, UINT btr, UINT* br) {
 }
 
 FRESULT fvx_write (FIL* fp, const void* buff, UINT btw, UINT* bw) {
+    PROFILE_ZONE(PROF_FATFS);
     #if _VFIL_ENABLED
     if (fp->obj.fs == NULL) {
         VirtualFile* vfile = VFIL(fp);
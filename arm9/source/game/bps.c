@@ -30,6 +30,8 @@
 #define BEAT_VLIBUFSZ	(8)
 #define BEAT_MAXPATH	(256)
 #define BEAT_FILEBUFSZ	(256 * 1024)
+#define BEAT_WINDOWSZ	(64 * 1024) // read window for patch / source
+#define BEAT_RINGSZ	(256 * 1024) // output ring, must be a power of two
 
 #define BEAT_RANGE(c, i)	((c)->ranges[1][i] - (c)->ranges[0][i])
 #define BEAT_UPDATEDELAYMS	(1000 / 4)
@@ -103,12 +105,22 @@ static const u8 bps_chksumoffs[BEAT_FILENUM] = {
 };
 static const u8 bpm_signature[] = { 'B', 'P', 'M', '1' };
 
+/** BEAT READ WINDOW */
+typedef struct {
+	u8 *buf;
+	size_t pos, len; // window offset (relative to range start) and valid bytes
+} BEAT_Window;
+
 /** BEAT STATE STORAGE */
 typedef struct {
 	u8 *copybuf;
 	size_t foff[BEAT_FILENUM], eoal_offset;
 	size_t ranges[2][BEAT_FILENUM];
-	u32 ocrc; // Output crc
+	u32 ocrc; // Output crc (running state, see crc32_final())
+
+	BEAT_Window window[BEAT_FILENUM]; // unused for BEAT_OF
+	u8 *oring; // Output ring, holds the last BEAT_RINGSZ bytes written
+	size_t ohead, oflush, ovalid; // ring write head, flushed up to, valid from
 
 	union {
 		struct { // BPS exclusive fields
@@ -131,11 +143,12 @@ static bool BEAT_UpdateProgress(const BEAT_Context *ctx)
 	if (progress_refcnt > 2) bkpt; // nope, bug out
 
 	tmr = timer_msec(progress_timer);
-	if (CheckButton(BUTTON_B)) return false; // check for an abort situation
-	if (progress_refcnt != 1) return true; // only show the first level progress
 	if (tmr < BEAT_UPDATEDELAYMS) return true; // give it some time
 
 	progress_timer = timer_start();
+	if (CheckButton(BUTTON_B)) return false; // check for an abort situation
+	if (progress_refcnt != 1) return true; // only show the first level progress
+
 	ShowProgress(ctx->foff[BEAT_PF], BEAT_RANGE(ctx, BEAT_PF), ctx->processing);
 	return true;
 }
@@ -158,12 +171,34 @@ static const char *BEAT_ErrString(int error)
 	}
 }
 
-static int BEAT_Read(BEAT_Context *ctx, int id, void *out, size_t len, int fwd)
-{ // Read up to `len` bytes from the context file `id` to the `out` buffer
+static int BEAT_Flush(BEAT_Context *ctx)
+{ // Write all pending data from the output ring to BEAT_OF
+	if (ctx->oflush == ctx->ohead) return BEAT_OK;
+
+	fvx_lseek(&ctx->file[BEAT_OF], ctx->ranges[0][BEAT_OF] + ctx->oflush);
+	while(ctx->oflush < ctx->ohead) {
+		UINT bw;
+		size_t ringpos = ctx->oflush & (BEAT_RINGSZ - 1);
+		size_t blksz = min(ctx->ohead - ctx->oflush, BEAT_RINGSZ - ringpos);
+		FRESULT res = fvx_write(&ctx->file[BEAT_OF], ctx->oring + ringpos, blksz, &bw);
+		if (res != FR_OK || bw != blksz) return BEAT_IO_ERROR;
+		ctx->oflush += blksz;
+	}
+	return BEAT_OK;
+}
+
+static void BEAT_ResetOutput(BEAT_Context *ctx)
+{ // Start over with an empty output ring at the current BEAT_OF offset
+	ctx->ohead = ctx->oflush = ctx->ovalid = ctx->foff[BEAT_OF];
+}
+
+static void BEAT_ResetWindow(BEAT_Context *ctx, int id)
+{ ctx->window[id].pos = ctx->window[id].len = 0; } // Drop buffered data for `id`
+
+static int BEAT_ReadDirect(BEAT_Context *ctx, int id, void *out, size_t len, int fwd)
+{ // Read `len` bytes from the context file `id`, bypassing the read window
 	UINT br;
 	FRESULT res;
-	if ((len + ctx->foff[id]) > BEAT_RANGE(ctx, id))
-		return BEAT_OVERFLOW;
 
 	fvx_lseek(&ctx->file[id], BEAT_ABSPOS(ctx, id)); // ALWAYS use the state offset + start range
 	ctx->foff[id] += len * fwd;
@@ -171,19 +206,83 @@ static int BEAT_Read(BEAT_Context *ctx, int id, void *out, size_t len, int fwd)
 	return (res == FR_OK && br == len) ? BEAT_OK : BEAT_IO_ERROR;
 }
 
+static int BEAT_Read(BEAT_Context *ctx, int id, void *out, size_t len, int fwd)
+{ // Read up to `len` bytes from the context file `id` to the `out` buffer
+	BEAT_Window *win = &ctx->window[id];
+	size_t off = ctx->foff[id];
+	if ((len + off) > BEAT_RANGE(ctx, id))
+		return BEAT_OVERFLOW;
+
+	if (id == BEAT_OF) { // reading back output, make sure it's on disk
+		int res = BEAT_Flush(ctx);
+		if (res != BEAT_OK) return res;
+		return BEAT_ReadDirect(ctx, id, out, len, fwd);
+	}
+
+	if ((off < win->pos) || ((off + len) > (win->pos + win->len))) {
+		UINT br;
+		FRESULT res;
+		size_t fill;
+
+		// large reads don't benefit from the window
+		if (len >= BEAT_WINDOWSZ) return BEAT_ReadDirect(ctx, id, out, len, fwd);
+
+		// refill (prefetch) the window starting at the current offset
+		fill = min(BEAT_WINDOWSZ, BEAT_RANGE(ctx, id) - off);
+		BEAT_ResetWindow(ctx, id);
+		fvx_lseek(&ctx->file[id], BEAT_ABSPOS(ctx, id));
+		res = fvx_read(&ctx->file[id], win->buf, fill, &br);
+		if (res != FR_OK || br != fill) return BEAT_IO_ERROR;
+		win->pos = off;
+		win->len = fill;
+	}
+
+	memcpy(out, win->buf + (off - win->pos), len);
+	ctx->foff[id] += len * fwd;
+	return BEAT_OK;
+}
+
+static void BEAT_ReadRing(const BEAT_Context *ctx, size_t pos, u8 *out, size_t len)
+{ // Read `len` bytes of already written output at `pos` from the output ring
+	while(len > 0) {
+		size_t ringpos = pos & (BEAT_RINGSZ - 1);
+		size_t blksz = min(len, BEAT_RINGSZ - ringpos);
+		memcpy(out, ctx->oring + ringpos, blksz);
+		out += blksz;
+		pos += blksz;
+		len -= blksz;
+	}
+}
+
 static int BEAT_WriteOut(BEAT_Context *ctx, const u8 *in, size_t len, int fwd)
-{ // Write `len` bytes from `in` to BEAT_OF, updates the output CRC
-	UINT bw;
-	FRESULT res;
+{ // Write `len` bytes from `in` to BEAT_OF (via the output ring), updates the output CRC
+	int res;
 	if ((len + ctx->foff[BEAT_OF]) > BEAT_RANGE(ctx, BEAT_OF))
 		return BEAT_OVERFLOW;
 
-	// Blindly assume all writes will be done linearly
-	ctx->ocrc = ~crc32_calculate(~ctx->ocrc, in, len);
-	fvx_lseek(&ctx->file[BEAT_OF], BEAT_ABSPOS(ctx, BEAT_OF));
+	ctx->ocrc = crc32_update(ctx->ocrc, in, len);
+
+	// Writes should always be linear, start over if they're not
+	if (ctx->foff[BEAT_OF] != ctx->ohead) {
+		res = BEAT_Flush(ctx);
+		if (res != BEAT_OK) return res;
+		BEAT_ResetOutput(ctx);
+	}
+
 	ctx->foff[BEAT_OF] += len * fwd;
-	res = fvx_write(&ctx->file[BEAT_OF], in, len, &bw);
-	return (res == FR_OK && bw == len) ? BEAT_OK : BEAT_IO_ERROR;
+	while(len > 0) {
+		size_t ringpos = ctx->ohead & (BEAT_RINGSZ - 1);
+		size_t blksz = min(len, BEAT_RINGSZ - ringpos);
+		if ((ctx->ohead + blksz - ctx->oflush) > BEAT_RINGSZ) { // ring full
+			res = BEAT_Flush(ctx);
+			if (res != BEAT_OK) return res;
+		}
+		memcpy(ctx->oring + ringpos, in, blksz);
+		ctx->ohead += blksz;
+		in += blksz;
+		len -= blksz;
+	}
+	return BEAT_OK;
 }
 
 static void BEAT_SeekOff(BEAT_Context *ctx, int id, ssize_t offset)
@@ -221,7 +320,7 @@ static s32 BEAT_DecodeSigned(u32 val) // Extract the signed number
 static int BEAT_RunActions(BEAT_Context *ctx, const BEAT_Action *acts)
 { // Parses an action list and runs commands specified in `acts`
 	u32 vli, len;
-	int cmd, res;
+	int cmd, res = BEAT_OK;
 
 	while((res == BEAT_OK) &&
 		(ctx->foff[BEAT_PF] < (BEAT_RANGE(ctx, BEAT_PF) - ctx->eoal_offset))) {
@@ -236,11 +335,25 @@ static int BEAT_RunActions(BEAT_Context *ctx, const BEAT_Action *acts)
 		if (res != BEAT_OK) return res; // Break on error or user abort
 	}
 
-	return res;
+	return BEAT_EOAL;
+}
+
+static int BEAT_AllocBuffers(BEAT_Context *ctx)
+{ // Allocate block copy buffer, output ring and read windows in one go
+	u8 *buf = malloc(BEAT_FILEBUFSZ + BEAT_RINGSZ + (BEAT_WINDOWSZ * 2));
+	if (buf == NULL) return BEAT_OUT_OF_MEMORY;
+
+	ctx->copybuf = buf;
+	ctx->oring = buf + BEAT_FILEBUFSZ;
+	ctx->window[BEAT_PF].buf = ctx->oring + BEAT_RINGSZ;
+	ctx->window[BEAT_IF].buf = ctx->window[BEAT_PF].buf + BEAT_WINDOWSZ;
+	return BEAT_OK;
 }
 
 static void BEAT_ReleaseCTX(BEAT_Context *ctx)
 { // Release any resources associated to the context
+	if (ctx->copybuf && fvx_opened(&ctx->file[BEAT_OF]))
+		BEAT_Flush(ctx); // best effort, errors were reported already
 	free(ctx->copybuf);
 	for (int i = 0; i < BEAT_FILENUM; i++) {
 		if (fvx_opened(&ctx->file[i])) fvx_close(&ctx->file[i]);
@@ -289,6 +402,10 @@ static int BPS_InitCTX_Advanced(BEAT_Context *ctx, const char *bps_path, const c
 	res = fvx_open(&ctx->file[BEAT_OF], out_path, BEAT_RWCREATE);
 	if (res != FR_OK) return BEAT_IO_ERROR;
 
+	// Allocate block copy buffer, output ring and read windows
+	res = BEAT_AllocBuffers(ctx);
+	if (res != BEAT_OK) return res;
+
 	// Verify BPS1 header magic
 	res = BEAT_Read(ctx, BEAT_PF, read_magic, sizeof(read_magic), 1);
 	if (res != BEAT_OK) return BEAT_IO_ERROR;
@@ -322,13 +439,9 @@ static int BPS_InitCTX_Advanced(BEAT_Context *ctx, const char *bps_path, const c
 	}
 
 	// Initialize output checksums
-	ctx->ocrc = 0;
+	ctx->ocrc = crc32_init();
 	ctx->xocrc = expected_chksum[BEAT_OF];
 
-	// Allocate temporary block copy buffer
-	ctx->copybuf = malloc(BEAT_FILEBUFSZ);
-	if (ctx->copybuf == NULL) return BEAT_OUT_OF_MEMORY;
-
 	// Seek back to the start of action stream / end of metadata
 	BEAT_SeekAbs(ctx, BEAT_PF, metaend_off);
 	progress_refcnt++;
@@ -407,7 +520,11 @@ static int BPS_TargetCopy(BEAT_Context *ctx, u32 len)
 	offset = BEAT_DecodeSigned(vli);
 	out_off = ctx->foff[BEAT_OF];
 	rel_off = ctx->target_relative + offset;
-	if (rel_off > out_off) return BEAT_BADPATCH; // Illegal
+	if (rel_off >= out_off) return BEAT_BADPATCH; // Illegal
+
+	// if the copy distance fits the output ring, the source data is still in memory
+	bool in_ring = (out_off == ctx->ohead) && (rel_off >= ctx->ovalid) &&
+		((out_off - rel_off) <= BEAT_RINGSZ);
 
 	while(len != 0) {
 		u8 *remfill;
@@ -416,9 +533,13 @@ static int BPS_TargetCopy(BEAT_Context *ctx, u32 len)
 		blksz = min(len, BEAT_FILEBUFSZ);
 		distance = min((ssize_t)(out_off - rel_off), blksz);
 
-		BEAT_SeekAbs(ctx, BEAT_OF, rel_off);
-		res = BEAT_Read(ctx, BEAT_OF, ctx->copybuf, distance, 0);
-		if (res != BEAT_OK) return res;
+		if (in_ring) {
+			BEAT_ReadRing(ctx, rel_off, ctx->copybuf, distance);
+		} else {
+			BEAT_SeekAbs(ctx, BEAT_OF, rel_off);
+			res = BEAT_Read(ctx, BEAT_OF, ctx->copybuf, distance, 0);
+			if (res != BEAT_OK) return res;
+		}
 
 		remfill = ctx->copybuf + distance;
 		remainder = blksz - distance;
@@ -454,8 +575,10 @@ static int BPS_RunActions(BEAT_Context *ctx)
 	};
 	int res = BEAT_RunActions(ctx, BPS_Actions);
 	if (res == BEAT_ABORTED) return BEAT_ABORTED;
-	if (res == BEAT_EOAL) // Verify hashes
-		return (ctx->ocrc == ctx->xocrc) ? BEAT_OK : BEAT_BADOUTPUT;
+	if (res == BEAT_EOAL) { // Write remaining output, verify hashes
+		if (BEAT_Flush(ctx) != BEAT_OK) return BEAT_IO_ERROR;
+		return (crc32_final(ctx->ocrc) == ctx->xocrc) ? BEAT_OK : BEAT_BADOUTPUT;
+	}
 	return res; // some kind of error
 }
 
@@ -466,6 +589,7 @@ static int BPM_OpenFile(BEAT_Context *ctx, int id, const char *path, size_t max_
 {
 	FRESULT res;
 
+	if ((id == BEAT_OF) && (BEAT_Flush(ctx) != BEAT_OK)) return BEAT_IO_ERROR;
 	if (fvx_opened(&ctx->file[id])) fvx_close(&ctx->file[id]);
 	res = fvx_open(&ctx->file[id], path, max_sz ? BEAT_RWCREATE : BEAT_READONLY);
 	if (res != FR_OK) return BEAT_IO_ERROR;
@@ -479,8 +603,10 @@ static int BPM_OpenFile(BEAT_Context *ctx, int id, const char *path, size_t max_
 
 	// if a new file is opened it makes no sense to keep the old CRC
 	// a single outfile wont be created from more than one infile (& patch)
-	ctx->ocrc = 0;
+	ctx->ocrc = crc32_init();
 	ctx->foff[id] = 0;
+	if (id == BEAT_OF) BEAT_ResetOutput(ctx);
+	else BEAT_ResetWindow(ctx, id);
 	return BEAT_OK;
 }
 
@@ -498,6 +624,10 @@ static int BPM_InitCTX(BEAT_Context *ctx, const char *bpm_path, const char *src_
 	ctx->target_dir = dst_dir;
 	ctx->eoal_offset = 4;
 
+	// Allocate block copy buffer, output ring and read windows
+	res = BEAT_AllocBuffers(ctx);
+	if (res != BEAT_OK) return res;
+
 	chksum = crc32_calculate_from_file(bpm_path, 0, fs_size(bpm_path) - 4);
 	res = BPM_OpenFile(ctx, BEAT_PF, bpm_path, 0);
 	if (res != BEAT_OK) return res;
@@ -517,10 +647,6 @@ static int BPM_InitCTX(BEAT_Context *ctx, const char *bpm_path, const char *src_
 	if (res != BEAT_OK) return res;
 	if (expected_chksum != chksum) return BEAT_BADCHKSUM;
 
-	// Allocate temporary block copy buffer
-	ctx->copybuf = malloc(BEAT_FILEBUFSZ);
-	if (ctx->copybuf == NULL) return BEAT_OUT_OF_MEMORY;
-
 	// Seek back to the start of action stream / end of metadata
 	BEAT_SeekAbs(ctx, BEAT_PF, metaend_off);
 	progress_refcnt++;
@@ -580,7 +706,7 @@ static int BPM_CreateFile(BEAT_Context *ctx, u32 name_len)
 
 	res = BEAT_Read(ctx, BEAT_PF, &checksum, sizeof(u32), 1);
 	if (res != BEAT_OK) return res;
-	if (ctx->ocrc != checksum) return BEAT_BADOUTPUT; // get and check CRC32
+	if (crc32_final(ctx->ocrc) != checksum) return BEAT_BADOUTPUT; // get and check CRC32
 	return BEAT_OK;
 }
 
@@ -634,7 +760,7 @@ static int BPM_MirrorFile(BEAT_Context *ctx, u32 name_len)
 
 	res = BEAT_Read(ctx, BEAT_PF, &checksum, sizeof(u32), 1);
 	if (res != BEAT_OK) return res;
-	if (ctx->ocrc != checksum) return BEAT_BADOUTPUT; // verify checksum
+	if (crc32_final(ctx->ocrc) != checksum) return BEAT_BADOUTPUT; // verify checksum
 	return BEAT_OK;
 }
 
@@ -648,7 +774,7 @@ static int BPM_RunActions(BEAT_Context *ctx)
 	};
 	int res = BEAT_RunActions(ctx, BPM_Actions);
 	if (res == BEAT_ABORTED) return BEAT_ABORTED;
-	if (res == BEAT_EOAL) return BEAT_OK;
+	if (res == BEAT_EOAL) return BEAT_Flush(ctx);
 	return res;
 }
 
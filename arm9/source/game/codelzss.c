@@ -1,5 +1,6 @@
 #include "codelzss.h"
 #include "ui.h"
+#include "offload.h"
 
 #define CODE_COMP_SIZE(f)   ((f)->off_size_comp & 0xFFFFFF)
 #define CODE_COMP_END(f)    ((int) CODE_COMP_SIZE(f) - (int) (((f)->off_size_comp >> 24) % 0xFF))
@@ -8,10 +9,7 @@
 #define CODE_SEG_OFFSET(s)  (((s) & 0x0FFF) + 2)
 #define CODE_SEG_SIZE(s)    ((((s) >> 12) & 0xF) + 3)
 
-typedef struct {
-    u32 off_size_comp; // 0xOOSSSSSS, where O == reverse offset and S == size
-    u32 addsize_dec; // decompressed size - compressed size
-} PACKED_ALIGN(4) CodeLzssFooter;
+#define CODE_PROGRESS_STEP  0x10000 // progress / cancel check interval (output bytes)
 
 
 u32 GetCodeLzssUncompressedSize(void* footer, u32 comp_size) {
@@ -23,6 +21,36 @@ u32 GetCodeLzssUncompressedSize(void* footer, u32 comp_size) {
     return CODE_DEC_SIZE(f) + (comp_size - CODE_COMP_SIZE(f));
 }
 
+// copy a back reference, writes ptr_out[-1] ... ptr_out[-seg_len] from ptr_out[seg_off] downwards
+static inline void CopyCodeLzssSegment(u8* ptr_out, u32 seg_off, u32 seg_len) {
+    const u8* ptr_src = ptr_out + seg_off;
+
+    if (seg_off >= 3) { // distance >= 4, source never overlaps the next 4 output bytes
+        if (!(((u32) ptr_out | (seg_off + 1)) & 0x3)) { // source and destination word aligned
+            u32* out32 = (u32*) (void*) ptr_out;
+            const u32* src32 = (const u32*) (const void*) (ptr_src + 1);
+            for (; seg_len >= 4; seg_len -= 4)
+                *(--out32) = *(--src32);
+            ptr_out = (u8*) out32;
+            ptr_src = ((const u8*) src32) - 1;
+        } else {
+            for (; seg_len >= 4; seg_len -= 4, ptr_out -= 4, ptr_src -= 4) {
+                u8 b0 = ptr_src[0];
+                u8 b1 = ptr_src[-1];
+                u8 b2 = ptr_src[-2];
+                u8 b3 = ptr_src[-3];
+                ptr_out[-1] = b0;
+                ptr_out[-2] = b1;
+                ptr_out[-3] = b2;
+                ptr_out[-4] = b3;
+            }
+        }
+    }
+
+    // remainder, or overlapping copy (distance < 4) byte by byte
+    while (seg_len--) *(--ptr_out) = *(ptr_src--);
+}
+
 // see: https://github.com/zoogie/DSP1/blob/master/source/main.c#L44
 u32 DecompressCodeLzss(u8* code, u32* code_size, u32 max_size) {
     u8* data_start = code;
@@ -42,13 +70,18 @@ u32 DecompressCodeLzss(u8* code, u32* code_size, u32 max_size) {
     u8* data_end = (u8*) comp_start + CODE_DEC_SIZE(footer);
     u8* ptr_in = (u8*) comp_start + CODE_COMP_END(footer);
     u8* ptr_out = data_end;
+    u32 prog_next = 0;
 
     // main decompression loop
     while ((ptr_in > comp_start) && (ptr_out > comp_start)) {
-        if (!ShowProgress(data_end - ptr_out, data_end - data_start, "Decompressing .code...")) {
-            if (ShowPrompt(true, "Decompressing .code...\nB button detected. Cancel?")) return 1;
-            ShowProgress(0, data_end - data_start, "Decompressing .code...");
-            ShowProgress(data_end - ptr_out, data_end - data_start, "Decompressing .code...");
+        u32 prog_done = data_end - ptr_out;
+        if (prog_done >= prog_next) {
+            prog_next = prog_done + CODE_PROGRESS_STEP;
+            if (!ShowProgress(prog_done, data_end - data_start, "Decompressing .code...")) {
+                if (ShowPrompt(true, "Decompressing .code...\nB button detected. Cancel?")) return 1;
+                ShowProgress(0, data_end - data_start, "Decompressing .code...");
+                ShowProgress(prog_done, data_end - data_start, "Decompressing .code...");
+            }
         }
 
         // sanity check
@@ -56,6 +89,39 @@ u32 DecompressCodeLzss(u8* code, u32* code_size, u32 max_size) {
 
         // read and process control byte
         u8 ctrlbyte = *(--ptr_in);
+
+        // fast path: a full control block can't run past the start of input or output
+        // (max 16 byte in, 8 * 18 byte out), so only the segment offset needs checking
+        if ((ptr_in - comp_start > 2 * 8) && (ptr_out - comp_start > CODE_SEG_SIZE(0xFFFF) * 8)) {
+            if (!ctrlbyte) { // eight verbatim bytes
+                ptr_out[-1] = ptr_in[-1];
+                ptr_out[-2] = ptr_in[-2];
+                ptr_out[-3] = ptr_in[-3];
+                ptr_out[-4] = ptr_in[-4];
+                ptr_out[-5] = ptr_in[-5];
+                ptr_out[-6] = ptr_in[-6];
+                ptr_out[-7] = ptr_in[-7];
+                ptr_out[-8] = ptr_in[-8];
+                ptr_out -= 8;
+                ptr_in -= 8;
+                continue;
+            }
+
+            for (u32 mask = 0x80; mask; mask >>= 1) {
+                if (ctrlbyte & mask) {
+                    ptr_in -= 2;
+                    u16 seg_code = getle16(ptr_in);
+                    u32 seg_off = CODE_SEG_OFFSET(seg_code);
+                    u32 seg_len = CODE_SEG_SIZE(seg_code);
+                    if (ptr_out + seg_off >= data_end) return 1;
+                    CopyCodeLzssSegment(ptr_out, seg_off, seg_len);
+                    ptr_out -= seg_len;
+                } else *(--ptr_out) = *(--ptr_in);
+            }
+            continue;
+        }
+
+        // slow path, close to the start of the buffer
         for (int i = 7; i >= 0; i--) {
             // end conditions met?
             if ((ptr_in <= comp_start) || (ptr_out <= comp_start))
@@ -75,10 +141,8 @@ u32 DecompressCodeLzss(u8* code, u32* code_size, u32 max_size) {
                     return 1;
 
                 // copy data to the correct place
-                for (u32 c = 0; c < seg_len; c++) {
-                    u8 byte = *(ptr_out + seg_off);
-                    *(--ptr_out) = byte;
-                }
+                CopyCodeLzssSegment(ptr_out, seg_off, seg_len);
+                ptr_out -= seg_len;
             } else {
                 // sanity check for both pointers
                 if ((ptr_out == comp_start) || (ptr_in == comp_start))
@@ -99,265 +163,74 @@ u32 DecompressCodeLzss(u8* code, u32* code_size, u32 max_size) {
     return 0;
 }
 
-// see https://github.com/dnasdw/3dstool/blob/master/src/backwardlz77.cpp (GPLv3)
-typedef struct {
-    u16 WindowPos;
-    u16 WindowLen;
-    s16* OffsetTable;
-    s16* ReversedOffsetTable;
-    s16* ByteTable;
-    s16* EndTable;
-} sCompressInfo;
-
-void initTable(sCompressInfo* a_pInfo, void* a_pWork) {
-    a_pInfo->WindowPos = 0;
-    a_pInfo->WindowLen = 0;
-    a_pInfo->OffsetTable = (s16*)(a_pWork);
-    a_pInfo->ReversedOffsetTable = (s16*)(a_pWork) + 4098;
-    a_pInfo->ByteTable = (s16*)(a_pWork) + 4098 + 4098;
-    a_pInfo->EndTable = (s16*)(a_pWork) + 4098 + 4098 + 256;
-
-    for (int i = 0; i < 256; i++) {
-        a_pInfo->ByteTable[i] = -1;
-        a_pInfo->EndTable[i] = -1;
-    }
-}
-
-int search(sCompressInfo* a_pInfo, const u8* a_pSrc, int* a_nOffset, int a_nMaxSize) {
-    if (a_nMaxSize < 3) {
-        return 0;
-    }
-
-    const u8* pSearch = NULL;
-    int nSize = 2;
-    const u16 uWindowPos = a_pInfo->WindowPos;
-    const u16 uWindowLen = a_pInfo->WindowLen;
-    s16* pReversedOffsetTable = a_pInfo->ReversedOffsetTable;
-
-    for (s16 nOffset = a_pInfo->EndTable[*(a_pSrc - 1)]; nOffset != -1; nOffset = pReversedOffsetTable[nOffset]) {
-        if (nOffset < uWindowPos) {
-            pSearch = a_pSrc + uWindowPos - nOffset;
-        } else {
-            pSearch = a_pSrc + uWindowLen + uWindowPos - nOffset;
-        }
-
-        if (pSearch - a_pSrc < 3) {
-            continue;
-        }
-
-        if (*(pSearch - 2) != *(a_pSrc - 2) || *(pSearch - 3) != *(a_pSrc - 3)) {
-            continue;
-        }
-
-        int nMaxSize = (int)((s64)min(a_nMaxSize, pSearch - a_pSrc));
-        int nCurrentSize = 3;
-
-        while (nCurrentSize < nMaxSize && *(pSearch - nCurrentSize - 1) == *(a_pSrc - nCurrentSize - 1)) {
-            nCurrentSize++;
-        }
-
-        if (nCurrentSize > nSize) {
-            nSize = nCurrentSize;
-            *a_nOffset = (int)(pSearch - a_pSrc);
-            if (nSize == a_nMaxSize) {
-                break;
-            }
-        }
-    }
-
-    if (nSize < 3) {
-        return 0;
-    }
 
-    return nSize;
+static bool CompressCodeLzssProgress(u32 done, u32 total, void* data) {
+    (void) data;
+    if (ShowProgress(done, total, "Compressing .code...")) return true;
+    if (ShowPrompt(true, "Compressing .code...\nB button detected. Cancel?")) return false;
+    ShowProgress(0, total, "Compressing .code...");
+    ShowProgress(done, total, "Compressing .code...");
+    return true;
 }
 
-void slideByte(sCompressInfo* a_pInfo, const u8* a_pSrc) {
-    u8 uInData = *(a_pSrc - 1);
-    u16 uInsertOffset = 0;
-    const u16 uWindowPos = a_pInfo->WindowPos;
-    const u16 uWindowLen = a_pInfo->WindowLen;
-    s16* pOffsetTable = a_pInfo->OffsetTable;
-    s16* pReversedOffsetTable = a_pInfo->ReversedOffsetTable;
-    s16* pByteTable = a_pInfo->ByteTable;
-    s16* pEndTable = a_pInfo->EndTable;
-
-    if (uWindowLen == 4098) {
-        u8 uOutData = *(a_pSrc + 4097);
-
-        if ((pByteTable[uOutData] = pOffsetTable[pByteTable[uOutData]]) == -1) {
-            pEndTable[uOutData] = -1;
-        } else {
-            pReversedOffsetTable[pByteTable[uOutData]] = -1;
-        }
-
-        uInsertOffset = uWindowPos;
-    } else {
-        uInsertOffset = uWindowLen;
+// runs the compressor on the ARM11, the ARM9 only handles progress and cancel
+// returns false if the job could not be handed over (result is untouched then)
+static bool CompressCodeLzssOffload(const u8* src, u32 src_size, u8* dst, u32* dst_size, u32 flags, bool* result) {
+    u32 work_size = align(CodeLzssWorkSize(flags), OFFLOAD_ALIGN);
+    if (!OffloadBufferOk(src, src_size)) return false;
+
+    // work and output get their own cache lines, the ARM11 writes to both
+    // dst is only used directly if it doesn't share a cache line with anything
+    bool direct = OffloadBufferOk(dst, *dst_size) &&
+        !((u32) dst % CODE_LZSS_DST_ALIGN) && !(*dst_size % CODE_LZSS_DST_ALIGN);
+    u32 out_size = align(*dst_size, OFFLOAD_ALIGN);
+    u8* buffer = (u8*) malloc(work_size + (direct ? 0 : out_size) + OFFLOAD_ALIGN);
+    if (!buffer) return false;
+    u8* work = (u8*) align((u32) buffer, OFFLOAD_ALIGN);
+    u8* out = direct ? dst : work + work_size;
+
+    u32 ticket;
+    const u32 args[6] = { (u32) src, src_size, (u32) out, *dst_size, flags, (u32) work };
+    OffloadFlush(src, src_size);
+    OffloadFlush(work, work_size);
+    OffloadFlush(out, out_size);
+    if (!OffloadSubmit(PXIJOB_LZSS_COMPRESS, args, 6, &ticket)) {
+        free(buffer);
+        return false;
     }
 
-    s16 nOffset = pEndTable[uInData];
-
-    if (nOffset == -1) {
-        pByteTable[uInData] = uInsertOffset;
-    } else {
-        pOffsetTable[nOffset] = uInsertOffset;
-    }
-
-    pEndTable[uInData] = uInsertOffset;
-    pOffsetTable[uInsertOffset] = -1;
-    pReversedOffsetTable[uInsertOffset] = nOffset;
-
-    if (uWindowLen == 4098) {
-        a_pInfo->WindowPos = (uWindowPos + 1) % 4098;
-    } else {
-        a_pInfo->WindowLen++;
+    bool cancel = false;
+    ShowProgress(0, src_size, "Compressing .code...");
+    while (!OffloadDone(ticket)) {
+        if (!cancel && !CompressCodeLzssProgress(OffloadProgress(ticket), src_size, NULL)) {
+            OffloadCancel(ticket);
+            cancel = true;
+        }
     }
-}
 
-static inline void slide(sCompressInfo* a_pInfo, const u8* a_pSrc, int a_nSize) {
-    for (int i = 0; i < a_nSize; i++) {
-        slideByte(a_pInfo, a_pSrc--);
+    u32 res = 0;
+    u32 out_words[PXIJOB_MAX_OUT];
+    *result = OffloadResult(ticket, &res, out_words) && res;
+    if (*result) {
+        OffloadInvalidate(out, out_size);
+        *dst_size = out_words[0];
+        if (!direct) memcpy(dst, out, *dst_size);
     }
-}
 
-s64 alignBytes(s64 a_nData, s64 a_nAlignment) {
-    return (a_nData + a_nAlignment - 1) / a_nAlignment * a_nAlignment;
+    free(buffer);
+    return true;
 }
 
-bool CompressCodeLzss(const u8* a_pUncompressed, u32 a_uUncompressedSize, u8* a_pCompressed, u32* a_uCompressedSize) {
-    const int s_nCompressWorkSize = (4098 + 4098 + 256 + 256) * sizeof(s16);
-    bool bResult = true;
-
-    if (a_uUncompressedSize > sizeof(CodeLzssFooter) && *a_uCompressedSize >= a_uUncompressedSize) {
-        u8* pWork = malloc(s_nCompressWorkSize * sizeof(u8));
-        if (!pWork) return false;
-
-        do {
-            sCompressInfo info;
-            initTable(&info, pWork);
-
-            const int nMaxSize = 0xF + 3;
-            const u8* pSrc = a_pUncompressed + a_uUncompressedSize;
-            u8* pDest = a_pCompressed + a_uUncompressedSize;
-
-            while (pSrc - a_pUncompressed > 0 && pDest - a_pCompressed > 0) {
-                if (!ShowProgress((u32)(a_pUncompressed + a_uUncompressedSize - pSrc), a_uUncompressedSize, "Compressing .code...")) {
-                    if (ShowPrompt(true, "Compressing .code...\nB button detected. Cancel?")) {
-                        bResult = false;
-                        break;
-                    }
-                    ShowProgress(0, a_uUncompressedSize, "Compressing .code...");
-                    ShowProgress((u32)(a_pUncompressed + a_uUncompressedSize - pSrc), a_uUncompressedSize, "Compressing .code...");
-                }
-
-                u8* pFlag = --pDest;
-                *pFlag = 0;
-
-                for (int i = 0; i < 8; i++) {
-                    int nOffset = 0;
-                    int nSize = search(&info, pSrc, &nOffset, (int)((s64)min((s64)min(nMaxSize, pSrc - a_pUncompressed), a_pUncompressed + a_uUncompressedSize - pSrc)));
-
-                    if (nSize < 3) {
-                        if (pDest - a_pCompressed < 1) {
-                            bResult = false;
-                            break;
-                        }
-
-                        slide(&info, pSrc, 1);
-                        *--pDest = *--pSrc;
-                    } else {
-                        if (pDest - a_pCompressed < 2) {
-                            bResult = false;
-                            break;
-                        }
-
-                        *pFlag |= 0x80 >> i;
-                        slide(&info, pSrc, nSize);
-                        pSrc -= nSize;
-                        nSize -= 3;
-                        *--pDest = (nSize << 4 & 0xF0) | ((nOffset - 3) >> 8 & 0x0F);
-                        *--pDest = (nOffset - 3) & 0xFF;
-                    }
-
-                    if (pSrc - a_pUncompressed <= 0) {
-                        break;
-                    }
-                }
-
-                if (!bResult) {
-                    break;
-                }
-            }
-
-            if (!bResult) {
-                break;
-            }
-
-            *a_uCompressedSize = (u32)(a_pCompressed + a_uUncompressedSize - pDest);
-        } while (false);
-
-        free(pWork);
-    } else {
-        bResult = false;
-    }
-
-    if (bResult) {
-        u32 uOrigSize = a_uUncompressedSize;
-        u8* pCompressBuffer = a_pCompressed + a_uUncompressedSize - *a_uCompressedSize;
-        u32 uCompressBufferSize = *a_uCompressedSize;
-        u32 uOrigSafe = 0;
-        u32 uCompressSafe = 0;
-        bool bOver = false;
-
-        while (uOrigSize > 0) {
-            u8 uFlag = pCompressBuffer[--uCompressBufferSize];
-
-            for (int i = 0; i < 8; i++) {
-                if ((uFlag << i & 0x80) == 0) {
-                    uCompressBufferSize--;
-                    uOrigSize--;
-                } else {
-                    int nSize = (pCompressBuffer[--uCompressBufferSize] >> 4 & 0x0F) + 3;
-                    uCompressBufferSize--;
-                    uOrigSize -= nSize;
-
-                    if (uOrigSize < uCompressBufferSize) {
-                        uOrigSafe = uOrigSize;
-                        uCompressSafe = uCompressBufferSize;
-                        bOver = true;
-                        break;
-                    }
-                }
-
-                if (uOrigSize <= 0) {
-                    break;
-                }
-            }
-
-            if (bOver) {
-                break;
-            }
-        }
-
-        u32 uCompressedSize = *a_uCompressedSize - uCompressSafe;
-        u32 uPadOffset = uOrigSafe + uCompressedSize;
-        u32 uCompFooterOffset = (u32)(alignBytes(uPadOffset, 4));
-        *a_uCompressedSize = uCompFooterOffset + sizeof(CodeLzssFooter);
-        u32 uTop = *a_uCompressedSize - uOrigSafe;
-        u32 uBottom = *a_uCompressedSize - uPadOffset;
-
-        if (*a_uCompressedSize >= a_uUncompressedSize || uTop > 0xFFFFFF) {
-            bResult = false;
-        } else {
-            memcpy(a_pCompressed, a_pUncompressed, uOrigSafe);
-            memmove(a_pCompressed + uOrigSafe, pCompressBuffer + uCompressSafe, uCompressedSize);
-            memset(a_pCompressed + uPadOffset, 0xFF, uCompFooterOffset - uPadOffset);
-            CodeLzssFooter* pCompFooter = (void*)(a_pCompressed + uCompFooterOffset);
-            pCompFooter->off_size_comp = uTop | (uBottom << 24);
-            pCompFooter->addsize_dec = a_uUncompressedSize - *a_uCompressedSize;
-        }
-    }
-
-    return bResult;
+bool CompressCodeLzss(const u8* a_pUncompressed, u32 a_uUncompressedSize, u8* a_pCompressed, u32* a_uCompressedSize, u32 a_uFlags) {
+    bool result = false;
+    if (CompressCodeLzssOffload(a_pUncompressed, a_uUncompressedSize, a_pCompressed, a_uCompressedSize, a_uFlags, &result))
+        return result;
+
+    // ARM11 not usable, do it here
+    void* work = malloc(CodeLzssWorkSize(a_uFlags));
+    if (!work) return false;
+    result = CodeLzssCompress(a_pUncompressed, a_uUncompressedSize, a_pCompressed, a_uCompressedSize, a_uFlags,
+        work, CompressCodeLzssProgress, NULL);
+    free(work);
+    return result;
 }
@@ -1,9 +1,14 @@
 #pragma once
 
 #include "common.h"
+#include "offload.h"
+#include <lzss.h>
 
 #define EXEFS_CODE_NAME  ".code"
 
+// FCRAM output buffers aligned to this (start and size) are compressed into in place
+#define CODE_LZSS_DST_ALIGN OFFLOAD_ALIGN
+
 u32 GetCodeLzssUncompressedSize(void* footer, u32 comp_size);
 u32 DecompressCodeLzss(u8* code, u32* code_size, u32 max_size);
-bool CompressCodeLzss(const u8* a_pUncompressed, u32 a_uUncompressedSize, u8* a_pCompressed, u32* a_uCompressedSize);
+bool CompressCodeLzss(const u8* a_pUncompressed, u32 a_uUncompressedSize, u8* a_pCompressed, u32* a_uCompressedSize, u32 a_uFlags);
@@ -17,13 +17,29 @@ typedef enum {
     IPS_16MB,
     IPS_INVALID_FILE_PATH,
     IPS_CANCELED,
-    IPS_MEMORY
+    IPS_MEMORY,
+    IPS_IO_ERROR
 } IPSERROR;
 
+#define IPS_EOF             0x454F46 // "EOF"
+#define IPS_WINDOW_SIZE     0x10000  // patch read window, must fit the largest record (0xFFFF)
+
+typedef struct {
+    u32 offset; // output offset
+    u32 size;
+    u32 source; // offset of record data in patch, unused for RLE records
+    u32 index; // position in patch, later records win on overlap
+    bool rle;
+    u8 rle_byte;
+} IPSRecord;
+
 static FIL patchFile, inFile, outFile;
 static size_t patchSize;
-static u8 *patch;
+static u8 *patch; // patch read window
+static u32 patchWindowOffset, patchWindowSize;
 static u32 patchOffset;
+static bool patchError;
+static IPSRecord *records;
 
 char errName[256];
 
@@ -45,81 +61,127 @@ int displayError(int errcode) {
             ShowPrompt(false, "%s\nPatching canceled.", errName); break;
         case IPS_MEMORY:
             ShowPrompt(false, "%s\nNot enough memory.", errName); break;
+        case IPS_IO_ERROR:
+            ShowPrompt(false, "%s\nFailed to read or write file.", errName); break;
     }
     fvx_close(&patchFile);
     fvx_close(&inFile);
     fvx_close(&outFile);
+    if (patch) free(patch);
+    if (records) free(records);
+    patch = NULL;
+    records = NULL;
     return errcode;
 }
 
-typedef enum {
-    COPY_IN,
-    COPY_PATCH,
-    COPY_RLE
-} COPYMODE;
-
-bool IPScopy(u8 mode, u32 size, u8 rle) {
-    bool ret = true;
-    if (mode == COPY_PATCH) {
-        UINT bytes_written = size;
-        if ((fvx_write(&outFile, &patch[patchOffset], size, &bytes_written) != FR_OK) ||
-            (size != bytes_written))
-            ret = false;
-        patchOffset += size;
-    } else {
-        u32 bufsiz = min(STD_BUFFER_SIZE, size);
-        u8* buffer = malloc(bufsiz);
-        if (!buffer) return false;
-        if (mode == COPY_RLE) memset(buffer, rle, bufsiz);
-
-        for (u64 pos = 0; (pos < size) && ret; pos += bufsiz) {
-            UINT read_bytes = min(bufsiz, size - pos);
-            UINT bytes_written = read_bytes;
-            if (((mode == COPY_IN) && (fvx_read(&inFile, buffer, read_bytes, &bytes_written) != FR_OK)) ||
-                ((mode == COPY_PATCH) && (fvx_read(&patchFile, buffer, read_bytes, &bytes_written) != FR_OK)) ||
-                (read_bytes != bytes_written))
-                ret = false;
-            if ((ret && (fvx_write(&outFile, buffer, read_bytes, &bytes_written) != FR_OK)) ||
-                (read_bytes != bytes_written))
-                ret = false;
-        }
+bool IPSfetch(u32 offset, u32 size) {
+    // make sure patch data [offset, offset + size) is inside the read window
+    if ((offset >= patchWindowOffset) && (offset + size <= patchWindowOffset + patchWindowSize))
+        return true;
 
-        free(buffer);
+    UINT bytes_read;
+    u32 fill = min(IPS_WINDOW_SIZE, patchSize - offset);
+    patchWindowSize = 0;
+    if ((size > fill) || (fvx_lseek(&patchFile, offset) != FR_OK) ||
+        (fvx_read(&patchFile, patch, fill, &bytes_read) != FR_OK) ||
+        (bytes_read != fill)) {
+        patchError = true;
+        return false;
     }
-    return ret;
+
+    patchWindowOffset = offset;
+    patchWindowSize = fill;
+    return true;
 }
 
 u8 read8() {
-    if (patchOffset >= patchSize) return 0;
-    return patch[patchOffset++];
+    if ((patchOffset >= patchSize) || !IPSfetch(patchOffset, 1)) return 0;
+    return patch[patchOffset++ - patchWindowOffset];
 }
 
 UINT read16() {
     if (patchOffset+1 >= patchSize) return 0;
-    UINT buf = patch[patchOffset++] << 8;
-    buf |= patch[patchOffset++];
+    UINT buf = read8() << 8;
+    buf |= read8();
     return buf;
 }
 
 UINT read24() {
     if (patchOffset+2 >= patchSize) return 0;
-    UINT buf = patch[patchOffset++] << 16;
-    buf |= patch[patchOffset++] << 8;
-    buf |= patch[patchOffset++];
+    UINT buf = read8() << 16;
+    buf |= read8() << 8;
+    buf |= read8();
     return buf;
 }
 
+int IPScompare(const void* a, const void* b) {
+    const IPSRecord* ra = (const IPSRecord*) a;
+    const IPSRecord* rb = (const IPSRecord*) b;
+    if (ra->offset != rb->offset) return (ra->offset < rb->offset) ? -1 : 1;
+    return (ra->index < rb->index) ? -1 : (ra->index > rb->index) ? 1 : 0;
+}
+
+int IPScompareIndex(const void* a, const void* b) {
+    const IPSRecord* ra = (const IPSRecord*) a;
+    const IPSRecord* rb = (const IPSRecord*) b;
+    return (ra->index < rb->index) ? -1 : (ra->index > rb->index) ? 1 : 0;
+}
+
+bool IPSsort(u32 n_records) {
+    // sort records by output offset, unless that changes the result for overlapping records
+    qsort(records, n_records, sizeof(IPSRecord), IPScompare);
+    for (u32 i = 0; i < n_records; i++) {
+        u32 end = records[i].offset + records[i].size;
+        for (u32 j = i + 1; (j < n_records) && (records[j].offset < end); j++) {
+            if (records[j].index < records[i].index) {
+                qsort(records, n_records, sizeof(IPSRecord), IPScompareIndex);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool IPSapply(u8* buffer, u32 pos, u32 len, u32 first, u32 n_records, bool sorted, bool dry) {
+    // apply all records touching [pos, pos + len) to buffer, or just check for them (dry)
+    bool touched = false;
+    for (u32 i = first; i < n_records; i++) {
+        IPSRecord* rec = &records[i];
+        if (sorted && (rec->offset >= pos + len)) break;
+        u32 start = max(rec->offset, pos);
+        u32 end = min(rec->offset + rec->size, pos + len);
+        if (start >= end) continue;
+        touched = true;
+        if (dry) break;
+
+        if (rec->rle) {
+            memset(buffer + start - pos, rec->rle_byte, end - start);
+        } else {
+            u32 source = rec->source + (start - rec->offset);
+            if (!IPSfetch(source, end - start)) return false;
+            memcpy(buffer + start - pos, patch + source - patchWindowOffset, end - start);
+        }
+    }
+    return touched;
+}
+
 int ApplyIPSPatch(const char* patchName, const char* inName, const char* outName) {
     int error = IPS_INVALID;
     UINT outlen_min, outlen_max, outlen_min_mem;
     snprintf(errName, 256, "%s", patchName);
 
+    patch = NULL;
+    records = NULL;
+    patchWindowOffset = patchWindowSize = 0;
+    patchOffset = 0;
+    patchError = false;
+
     if (fvx_open(&patchFile, patchName, FA_READ) != FR_OK) return displayError(IPS_INVALID_FILE_PATH);
     patchSize = fvx_size(&patchFile);
     ShowProgress(0, patchSize, patchName);
 
-    patch = malloc(patchSize);
-    if (!patch || fvx_read(&patchFile, patch, patchSize, NULL) != FR_OK) return displayError(IPS_MEMORY);
+    patch = malloc(IPS_WINDOW_SIZE);
+    if (!patch) return displayError(IPS_MEMORY);
 
     // Check validity of patch
     if (patchSize < 8) return displayError(IPS_INVALID);
@@ -129,15 +191,16 @@ int ApplyIPSPatch(const char* patchName, const char* inName, const char* outName
         read8() != 'C' ||
         read8() != 'H')
     {
-        return displayError(IPS_INVALID);
+        return displayError(patchError ? IPS_IO_ERROR : IPS_INVALID);
     }
 
     unsigned int offset = read24();
     unsigned int outlen = 0;
     unsigned int thisout = 0;
     unsigned int lastoffset = 0;
+    unsigned int n_records = 0;
     bool w_scrambled = false;
-    while (offset != 0x454F46) // 454F46=EOF
+    while (offset != IPS_EOF)
     {
         if (!ShowProgress(patchOffset, patchSize, patchName)) {
             if (ShowPrompt(true, "%s\nB button detected. Cancel?", patchName)) return displayError(IPS_CANCELED);
@@ -163,6 +226,7 @@ int ApplyIPSPatch(const char* patchName, const char* inName, const char* outName
         if (thisout > outlen) outlen = thisout;
         if (patchOffset >= patchSize) return displayError(IPS_INVALID);
         offset = read24();
+        n_records++;
     }
     outlen_min_mem = outlen;
     outlen_max = 0xFFFFFFFF;
@@ -176,52 +240,96 @@ int ApplyIPSPatch(const char* patchName, const char* inName, const char* outName
             w_scrambled = true;
         }
     }
+    if (patchError) return displayError(IPS_IO_ERROR);
     if (patchOffset != patchSize) return displayError(IPS_INVALID);
     outlen_min = outlen;
     error = IPS_OK;
     if (w_scrambled) error = IPS_SCRAMBLED;
 
+    // collect all records, sorted by output offset where possible
+    records = malloc(max(n_records, 1) * sizeof(IPSRecord));
+    if (!records) return displayError(IPS_MEMORY);
+    patchOffset = 5;
+    offset = read24();
+    for (u32 i = 0; offset != IPS_EOF; i++) {
+        IPSRecord* rec = &records[i];
+        rec->offset = offset;
+        rec->index = i;
+        rec->size = read16();
+        rec->rle = (rec->size == 0);
+        if (rec->rle) {
+            rec->size = read16();
+            rec->rle_byte = read8();
+        } else {
+            rec->source = patchOffset;
+            patchOffset += rec->size;
+        }
+        offset = read24();
+    }
+    if (patchError) return displayError(IPS_IO_ERROR);
+    bool sorted = !w_scrambled || IPSsort(n_records);
+
     // start applying patch
     bool inPlace = false;
     if (!CheckWritePermissions(outName)) return displayError(IPS_INVALID_FILE_PATH);
     if (strncasecmp(inName, outName, 256) == 0)
     {
         if (fvx_open(&outFile, outName, FA_WRITE | FA_READ) != FR_OK) return displayError(IPS_INVALID_FILE_PATH);
-        inFile = outFile;
         inPlace = true;
     }
     else if ((fvx_open(&inFile, inName, FA_READ) != FR_OK) ||
             (fvx_open(&outFile, outName, FA_CREATE_ALWAYS | FA_WRITE | FA_READ) != FR_OK))
             return displayError(IPS_INVALID_FILE_PATH);
 
-    size_t inSize = fvx_size(&inFile);
+    FIL* src = inPlace ? &outFile : &inFile;
+    size_t inSize = fvx_size(src);
     outlen = max(outlen_min, min(inSize, outlen_max));
     fvx_lseek(&outFile, max(outlen, outlen_min_mem));
     fvx_lseek(&outFile, 0);
     size_t outSize = outlen;
     ShowProgress(0, outSize, outName);
 
-    fvx_lseek(&inFile, 0);
-    if (!inPlace && !IPScopy(COPY_IN, min(inSize, outlen), 0)) return displayError(IPS_MEMORY);
-    fvx_lseek(&outFile, inSize);
-    if (outSize > inSize && !IPScopy(COPY_RLE, outSize - inSize, 0)) return displayError(IPS_MEMORY);
+    u32 bufsiz = min(STD_BUFFER_SIZE, max(outSize, 1));
+    u8* buffer = malloc(bufsiz);
+    if (!buffer) return displayError(IPS_MEMORY);
 
-    fvx_lseek(&patchFile, 5);
-    offset = read24();
-    while (offset != 0x454F46)
-    {
-        if (!ShowProgress(offset, outSize, outName)) {
-            if (ShowPrompt(true, "%s\nB button detected. Cancel?", outName)) return displayError(IPS_CANCELED);
+    // single streaming pass: input data (zero padded), patched, written in full chunks
+    // when patching in place, chunks without any records are left alone
+    u32 first = 0;
+    for (u32 pos = 0; pos < outSize; pos += bufsiz) {
+        u32 len = min(bufsiz, outSize - pos);
+        u32 len_in = (pos < inSize) ? min(len, inSize - pos) : 0;
+        UINT btx;
+
+        if (!ShowProgress(pos, outSize, outName)) {
+            if (ShowPrompt(true, "%s\nB button detected. Cancel?", outName)) {
+                free(buffer);
+                return displayError(IPS_CANCELED);
+            }
             ShowProgress(0, outSize, outName);
-            ShowProgress(offset, outSize, outName);
+            ShowProgress(pos, outSize, outName);
         }
 
-        fvx_lseek(&outFile, offset);
-        unsigned int size = read16();
-        if (size == 0 && !IPScopy(COPY_RLE, read16(), read8())) return displayError(IPS_MEMORY);
-        else if (size != 0 && !IPScopy(COPY_PATCH, size, 0)) return displayError(IPS_MEMORY);
-        offset = read24();
+        if (!inPlace || (len_in < len) || IPSapply(NULL, pos, len, first, n_records, sorted, true)) {
+            if (len_in && ((fvx_lseek(src, pos) != FR_OK) ||
+                (fvx_read(src, buffer, len_in, &btx) != FR_OK) || (btx != len_in))) {
+                free(buffer);
+                return displayError(IPS_IO_ERROR);
+            }
+            memset(buffer + len_in, 0x00, len - len_in);
+            IPSapply(buffer, pos, len, first, n_records, sorted, false);
+            if (patchError || (fvx_lseek(&outFile, pos) != FR_OK) ||
+                (fvx_write(&outFile, buffer, len, &btx) != FR_OK) || (btx != len)) {
+                free(buffer);
+                return displayError(IPS_IO_ERROR);
+            }
+        }
+
+        // sorted records ending before the next chunk are done
+        while (sorted && (first < n_records) && (records[first].offset + records[first].size <= pos + len))
+            first++;
     }
+    free(buffer);
 
     fvx_lseek(&outFile, outSize);
     f_truncate(&outFile);
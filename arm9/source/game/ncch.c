@@ -106,50 +106,91 @@ u32 SetupNcchCrypto(NcchHeader* ncch, u16 crypt_to) {
     return res_from | res_to;
 }
 
-u32 CryptNcchSection(void* data, u32 offset_data, u32 size_data, u32 offset_section, u32 size_section,
-    u32 offset_ctr, NcchHeader* ncch, u32 snum, u16 crypt_to, u32 keyid) {
-    u16 crypt_from = NCCH_GET_CRYPTO(ncch);
-    const u32 mode = AES_CNT_CTRNAND_MODE;
+// keyid 1 only makes a difference for secure3 / secure4 / 7.x and seed crypto
+#define NCCH_KEYID(crypto, keyid) (((keyid) && !((crypto) & 0x01) && (((crypto) >> 8) || ((crypto) & 0x20))) ? 1 : 0)
+
+static void AddNcchCryptExtent(NcchCryptPlan* plan, u32 offset, u32 size, u32 offset_ctr, u32 snum, u32 keyid) {
+    if (!size || (plan->n_extents >= NCCH_CRYPT_EXTENTS_MAX)) return;
+
+    // keep extents sorted by offset
+    u32 i = plan->n_extents++;
+    for (; i && (plan->extents[i-1].offset > offset); i--)
+        plan->extents[i] = plan->extents[i-1];
+
+    NcchCryptExtent* extent = plan->extents + i;
+    extent->offset = offset;
+    extent->size = size;
+    extent->offset_ctr = offset_ctr;
+    extent->snum = snum;
+    extent->keyid = keyid;
+}
 
-    // check if section in data
-    if ((offset_section >= offset_data + size_data) ||
-        (offset_data >= offset_section + size_section) ||
-        !size_section) {
-        return 0; // section not in data
-    }
+// parses the NCCH (and ExeFS) header once, exefs may be NULL
+u32 BuildNcchCryptPlan(NcchCryptPlan* plan, NcchHeader* ncch, ExeFsHeader* exefs) {
+    memset(plan, 0, sizeof(NcchCryptPlan));
+    plan->ncch = ncch;
+
+    // exthdr handling
+    if (ncch->size_exthdr)
+        AddNcchCryptExtent(plan, NCCH_EXTHDR_OFFSET, NCCH_EXTHDR_SIZE, 0, 1, 0);
 
-    // determine data / offset / size
-    u8* data8 = (u8*)data;
-    u8* data_i = data8;
-    u32 offset_i = 0;
-    u32 size_i = size_section;
-    if (offset_section < offset_data)
-        offset_i = offset_data - offset_section;
-    else data_i = data8 + (offset_section - offset_data);
-    size_i = size_section - offset_i;
-    if (size_i > size_data - (data_i - data8))
-        size_i = size_data - (data_i - data8);
-
-    // actual decryption stuff
-    u8 ctr[16];
-    GetNcchCtr(ctr, ncch, snum);
-    if (!(crypt_from & NCCH_NOCRYPTO)) {
-        if (SetNcchKey(ncch, crypt_from, keyid) != 0) return 1;
-        ctr_decrypt_byte(data_i, data_i, size_i, offset_i + offset_ctr, mode, ctr);
+    // exefs handling
+    if (ncch->size_exefs) {
+        u32 offset_exefs = ncch->offset_exefs * NCCH_MEDIA_UNIT;
+        AddNcchCryptExtent(plan, offset_exefs, 0x200, 0, 2, 0);
+        if (exefs) for (u32 i = 0; i < 10; i++) {
+            ExeFsFileHeader* file = exefs->files + i;
+            if (!file->size) continue;
+            u32 size_pad = align(file->size, NCCH_MEDIA_UNIT) - file->size;
+            AddNcchCryptExtent(plan, offset_exefs + 0x200 + file->offset, file->size,
+                0x200 + file->offset, 2, EXEFS_KEYID(file->name));
+            AddNcchCryptExtent(plan, offset_exefs + 0x200 + file->offset + file->size, size_pad,
+                0x200 + file->offset + file->size, 2, 0);
+        }
     }
-    if (!(crypt_to & NCCH_NOCRYPTO)) {
-        if (SetNcchKey(ncch, crypt_to, keyid) != 0) return 1;
-        ctr_decrypt_byte(data_i, data_i, size_i, offset_i + offset_ctr, mode, ctr);
+
+    // romfs handling
+    if (ncch->size_romfs)
+        AddNcchCryptExtent(plan, ncch->offset_romfs * NCCH_MEDIA_UNIT,
+            ncch->size_romfs * NCCH_MEDIA_UNIT, 0, 3, 1);
+
+    return 0;
+}
+
+// one pass over data, keys are only set up when they actually change
+static u32 CryptNcchExtents(u8* data, u32 offset, u32 size, NcchCryptPlan* plan, u16 crypto) {
+    const u32 mode = AES_CNT_CTRNAND_MODE;
+    u32 keyid_set = (u32) -1;
+
+    for (u32 i = 0; i < plan->n_extents; i++) {
+        NcchCryptExtent* extent = plan->extents + i;
+        if (extent->offset >= offset + size) break; // no more extents in data
+        if (offset >= extent->offset + extent->size) continue;
+
+        // determine data / offset / size
+        u32 offset_i = (offset > extent->offset) ? offset - extent->offset : 0;
+        u8* data_i = (offset > extent->offset) ? data : data + (extent->offset - offset);
+        u32 size_i = min(extent->size - offset_i, size - (data_i - data));
+
+        // actual decryption stuff
+        u32 keyid = NCCH_KEYID(crypto, extent->keyid);
+        if (keyid != keyid_set) {
+            if (SetNcchKey(plan->ncch, crypto, keyid) != 0) return 1;
+            keyid_set = keyid;
+        }
+        u8 ctr[16];
+        GetNcchCtr(ctr, plan->ncch, extent->snum);
+        ctr_decrypt_byte(data_i, data_i, size_i, offset_i + extent->offset_ctr, mode, ctr);
     }
 
     return 0;
 }
 
-// on the fly de-/encryptor for NCCH
-u32 CryptNcch(void* data, u32 offset, u32 size, NcchHeader* ncch, ExeFsHeader* exefs, u16 crypt_to) {
+// on the fly de-/encryptor for NCCH, using a prepared plan
+u32 CryptNcchPlan(void* data, u32 offset, u32 size, NcchCryptPlan* plan, u16 crypt_to) {
     const u32 offset_flag3 = 0x188 + 3;
     const u32 offset_flag7 = 0x188 + 7;
-    u16 crypt_from = NCCH_GET_CRYPTO(ncch);
+    u16 crypt_from = NCCH_GET_CRYPTO(plan->ncch);
 
     // check for encryption
     if ((crypt_to & crypt_from & NCCH_NOCRYPTO) || (crypt_to == crypt_from))
@@ -163,55 +204,29 @@ u32 CryptNcch(void* data, u32 offset, u32 size, NcchHeader* ncch, ExeFsHeader* e
         ((u8*)data)[offset_flag7 - offset] |= (crypt_to & (0x01|0x20|0x04));
     }
 
-    // exthdr handling
-    if (ncch->size_exthdr) {
-        if (CryptNcchSection(data, offset, size,
-            NCCH_EXTHDR_OFFSET,
-            NCCH_EXTHDR_SIZE,
-            0, ncch, 1, crypt_to, 0) != 0) return 1;
-    }
-
-    // exefs handling
-    if (ncch->size_exefs) {
-        // exefs header handling
-        if (CryptNcchSection(data, offset, size,
-            ncch->offset_exefs * NCCH_MEDIA_UNIT,
-            0x200, 0, ncch, 2, crypt_to, 0) != 0) return 1;
-
-        // exefs file handling
-        if (exefs) for (u32 i = 0; i < 10; i++) {
-            ExeFsFileHeader* file = exefs->files + i;
-            if (!file->size) continue;
-
-            u32 offset_file = (ncch->offset_exefs * NCCH_MEDIA_UNIT) + 0x200 + file->offset;
-            u32 size_file = file->size;
-            u32 offset_pad = offset_file + size_file;
-            u32 size_pad = align(size_file, NCCH_MEDIA_UNIT) - size_file;
-
-            if (CryptNcchSection(data, offset, size, offset_file, size_file, 0x200 + file->offset,
-                ncch, 2, crypt_to, EXEFS_KEYID(file->name)) != 0) return 1;
-            if (CryptNcchSection(data, offset, size, offset_pad, size_pad, 0x200 + file->offset + file->size,
-                ncch, 2, crypt_to, 0) != 0) return 1;
-        }
-    }
-
-    // romfs handling
-    if (ncch->size_romfs) {
-        if (CryptNcchSection(data, offset, size,
-            ncch->offset_romfs * NCCH_MEDIA_UNIT,
-            ncch->size_romfs * NCCH_MEDIA_UNIT,
-            0, ncch, 3, crypt_to, 1) != 0) return 1;
-    }
+    // CTR mode, so decrypting everything first, then encrypting gives the same result
+    if (!(crypt_from & NCCH_NOCRYPTO) && (CryptNcchExtents(data, offset, size, plan, crypt_from) != 0))
+        return 1;
+    if (!(crypt_to & NCCH_NOCRYPTO) && (CryptNcchExtents(data, offset, size, plan, crypt_to) != 0))
+        return 1;
 
     return 0;
 }
 
+// on the fly de-/encryptor for NCCH
+u32 CryptNcch(void* data, u32 offset, u32 size, NcchHeader* ncch, ExeFsHeader* exefs, u16 crypt_to) {
+    NcchCryptPlan plan;
+    BuildNcchCryptPlan(&plan, ncch, exefs);
+    return CryptNcchPlan(data, offset, size, &plan, crypt_to);
+}
+
 // on the fly de- / encryptor for NCCH - sequential
 u32 CryptNcchSequential(void* data, u32 offset, u32 size, u16 crypt_to) {
     // warning: this will only work for sequential processing
     // unexpected results otherwise
     static NcchHeader ncch = { 0 };
     static ExeFsHeader exefs = { 0 };
+    static NcchCryptPlan plan = { 0 };
     static NcchHeader* ncchptr = NULL;
     static ExeFsHeader* exefsptr = NULL;
 
@@ -220,6 +235,7 @@ u32 CryptNcchSequential(void* data, u32 offset, u32 size, u16 crypt_to) {
         memcpy(&ncch, data, sizeof(NcchHeader));
         ncchptr = (ValidateNcchHeader(&ncch) == 0) ? &ncch : NULL;
         exefsptr = NULL;
+        if (ncchptr) BuildNcchCryptPlan(&plan, ncchptr, NULL);
     }
 
     // safety check, ncch pointer
@@ -232,14 +248,15 @@ u32 CryptNcchSequential(void* data, u32 offset, u32 size, u16 crypt_to) {
             ((offset + size) >= offset_exefs + sizeof(ExeFsHeader))) {
             memcpy(&exefs, (u8*)data + offset_exefs - offset, sizeof(ExeFsHeader));
             if ((NCCH_ENCRYPTED(ncchptr)) &&
-                (DecryptNcch((u8*) &exefs, offset_exefs, sizeof(ExeFsHeader), ncchptr, NULL) != 0))
+                (CryptNcchPlan((u8*) &exefs, offset_exefs, sizeof(ExeFsHeader), &plan, NCCH_NOCRYPTO) != 0))
                 return 1;
             if (ValidateExeFsHeader(&exefs, 0) != 0) return 1;
             exefsptr = &exefs;
+            BuildNcchCryptPlan(&plan, ncchptr, exefsptr);
         }
     }
 
-    return CryptNcch(data, offset, size, ncchptr, exefsptr, crypt_to);
+    return CryptNcchPlan(data, offset, size, &plan, crypt_to);
 }
 
 u32 SetNcchSdFlag(void* data) { // data must be at least 0x600 byte and start with NCCH header
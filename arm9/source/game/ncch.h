@@ -24,6 +24,8 @@
 #define DecryptNcchSequential(data, offset, size) CryptNcchSequential(data, offset, size, NCCH_NOCRYPTO)
 #define EncryptNcchSequential(data, offset, size, crypto) CryptNcchSequential(data, offset, size, crypto)
 
+#define NCCH_CRYPT_EXTENTS_MAX (2 + (2 * 10) + 1) // exthdr, exefs header, exefs files + padding, romfs
+
 // see: https://www.3dbrew.org/wiki/NCCH/Extended_Header
 // very limited, contains only required stuff
 typedef struct {
@@ -83,9 +85,26 @@ typedef struct {
     u8  hash_romfs[0x20];
 } __attribute__((packed, aligned(16))) NcchHeader;
 
+// crypto plan for a single NCCH, extents sorted by offset
+typedef struct {
+    u32 offset; // relative to NCCH start
+    u32 size;
+    u32 offset_ctr; // relative to section start
+    u8  snum; // section for the CTR
+    u8  keyid;
+} NcchCryptExtent;
+
+typedef struct {
+    NcchHeader* ncch;
+    u32 n_extents;
+    NcchCryptExtent extents[NCCH_CRYPT_EXTENTS_MAX];
+} NcchCryptPlan;
+
 u32 ValidateNcchHeader(NcchHeader* header);
 u32 SetNcchKey(NcchHeader* ncch, u16 crypto, u32 keyid);
 u32 SetupNcchCrypto(NcchHeader* ncch, u16 crypt_to);
+u32 BuildNcchCryptPlan(NcchCryptPlan* plan, NcchHeader* ncch, ExeFsHeader* exefs);
+u32 CryptNcchPlan(void* data, u32 offset, u32 size, NcchCryptPlan* plan, u16 crypto);
 u32 CryptNcch(void* data, u32 offset, u32 size, NcchHeader* ncch, ExeFsHeader* exefs, u16 crypto);
 u32 CryptNcchSequential(void* data, u32 offset, u32 size, u16 crypto);
 u32 SetNcchSdFlag(void* data);
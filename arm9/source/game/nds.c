@@ -36,9 +36,15 @@ u32 VerifyTwlIconData(TwlIconData* icon, u32 version) {
     if (version && (!tsize || tsize > isize)) return 1;
 
     u32 size = version ? tsize : isize;
-    if ((size >= 0x0840) && (crc16_quick(icn + 0x0020, 0x0840 - 0x0020) != icon->crc_0x0020_0x0840)) return 1;
-    if ((size >= 0x0940) && (crc16_quick(icn + 0x0020, 0x0940 - 0x0020) != icon->crc_0x0020_0x0940)) return 1;
-    if ((size >= 0x1240) && (crc16_quick(icn + 0x0020, 0x0A40 - 0x0020) != icon->crc_0x0020_0x0A40)) return 1;
+
+    // the first three CRCs share their start, so each one continues the previous one
+    u16 crc = crc16_init();
+    if (size >= 0x0840) crc = crc16_update(crc, icn + 0x0020, 0x0840 - 0x0020);
+    if ((size >= 0x0840) && (crc != icon->crc_0x0020_0x0840)) return 1;
+    if (size >= 0x0940) crc = crc16_update(crc, icn + 0x0840, 0x0940 - 0x0840);
+    if ((size >= 0x0940) && (crc != icon->crc_0x0020_0x0940)) return 1;
+    if (size >= 0x1240) crc = crc16_update(crc, icn + 0x0940, 0x0A40 - 0x0940);
+    if ((size >= 0x1240) && (crc != icon->crc_0x0020_0x0A40)) return 1;
     if ((size >= 0x23C0) && (crc16_quick(icn + 0x1240, 0x23C0 - 0x1240) != icon->crc_0x1240_0x23C0)) return 1;
     
     return 0;
@@ -108,7 +108,7 @@ u32 FindTitleKey(Ticket* ticket, u8* title_id) {
 
     // search for a titlekey inside encTitleKeys.bin / decTitleKeys.bin
     // when found, add it to the ticket
-    TitleKeysInfo* tikdb = (TitleKeysInfo*) malloc(STD_BUFFER_SIZE); // more than enough
+    TitleKeysInfo* tikdb = (TitleKeysInfo*) mem_pool_get(MEMPOOL_IO); // more than enough
     if (!tikdb) return 1;
     for (u32 enc = 0; (enc <= 1) && !found; enc++) {
         u32 len = LoadSupportFile((enc) ? TIKDB_NAME_ENC : TIKDB_NAME_DEC, tikdb, STD_BUFFER_SIZE);
@@ -128,7 +128,7 @@ u32 FindTitleKey(Ticket* ticket, u8* title_id) {
             break;
         }
     }
-    free(tikdb);
+    mem_pool_put(MEMPOOL_IO, tikdb);
 
     // desperate measures - search in the internal ticket database
     Ticket* ticket_tmp = NULL;
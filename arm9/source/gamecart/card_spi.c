@@ -22,6 +22,7 @@
 #include "card_spi.h"
 #include <spi.h>
 #include "timer.h"
+#include "crc32.h"
 
 #define SPI_CMD_RDSR 5
 #define SPI_CMD_WREN 6
@@ -98,47 +99,103 @@ const CardSPITypeData * const FLASH_CTR_GENERIC = flashTypes + 5;
 #define REG_CFG9_CARDCTL      *((vu16*)0x1000000C)
 #define CARDCTL_SPICARD       (1u<<8)
 
-int CardSPIWriteRead(bool infrared, const void* cmd, u32 cmdSize, void* answer, u32 answerSize, const void* data, u32 dataSize) {
-    u32 headerFooterVal = 0;
+// GBATEK asks for 0x800 cycles at 33 MHz after each infrared transfer
+#define CARDSPI_IR_GAP_TICKS  (0x800 * 2)
+
+// bulk writes compare and verify in blocks of this size (in whole write units)
+#define CARDSPI_BULK_BLOCK    4096
+#define CARDSPI_BULK_UNITS    256
+#define CARDSPI_BULK_RETRIES  3
+
+static u32 cardSpiBusHold = 0;
+static u64 cardSpiIrIdle = 0; // end of the last infrared transaction
+static CardSPIXferFunc cardSpiXfer = NULL; // NULL for the real bus
+
+void CardSPISetXfer(CardSPIXferFunc xfer) {
+    cardSpiXfer = xfer;
+}
+
+static int CardSPIDoXfer(u32 dev, const SPI_XferInfo* xfer, u32 xfer_cnt, bool done) {
+    if (cardSpiXfer) return cardSpiXfer(dev, xfer, xfer_cnt, done);
+    return SPI_DoXfer(dev, xfer, xfer_cnt, done);
+}
 
-    REG_CFG9_CARDCTL |= CARDCTL_SPICARD;
+static void CardSPISetCardCtl(bool spi) {
+    if (cardSpiXfer) return; // leave the slot alone while emulated
+    if (spi) REG_CFG9_CARDCTL |= CARDCTL_SPICARD;
+    else REG_CFG9_CARDCTL &= ~CARDCTL_SPICARD;
+}
+
+static void CardSPIWaitIrGap(void) {
+    while (timer_ticks(cardSpiIrIdle) < CARDSPI_IR_GAP_TICKS);
+}
+
+// keeps the SPI interface selected across several transactions
+static void CardSPIBusHold(bool hold) {
+    if (hold) {
+        if (!cardSpiBusHold++) CardSPISetCardCtl(true);
+    } else if (cardSpiBusHold && !--cardSpiBusHold) {
+        CardSPISetCardCtl(false);
+        CardSPIWaitIrGap();
+    }
+}
+
+static void CardSPISelect(bool infrared) {
+    if (!cardSpiBusHold) CardSPISetCardCtl(true);
 
     if (infrared) {
+        u32 headerFooterVal = 0;
         SPI_XferInfo irXfer = { &headerFooterVal, 1, false };
-        SPI_DoXfer(SPI_DEV_CART_IR, &irXfer, 1, false);
+        CardSPIWaitIrGap();
+        CardSPIDoXfer(SPI_DEV_CART_IR, &irXfer, 1, false);
         // Wait as specified by GBATEK (0x800 cycles at 33 MHz)
         ARM_WaitCycles(0x800 * 4);
     }
+}
+
+static void CardSPIDeselect(bool infrared) {
+    // the gap after infrared transfers is only waited out once the next
+    // transaction needs it, so whatever happens in between overlaps with it
+    if (infrared) cardSpiIrIdle = timer_start();
+    if (!cardSpiBusHold) {
+        CardSPISetCardCtl(false);
+        if (infrared) CardSPIWaitIrGap();
+    }
+}
+
+int CardSPIWriteRead(bool infrared, const void* cmd, u32 cmdSize, void* answer, u32 answerSize, const void* data, u32 dataSize) {
+    CardSPISelect(infrared);
 
     SPI_XferInfo transfers[3] = {
         { (u8*) cmd, cmdSize, false },
         { answer, answerSize, true },
         { (u8*) data, dataSize, false },
     };
-    SPI_DoXfer(SPI_DEV_CART_FLASH, transfers, 3, true);
-
-    REG_CFG9_CARDCTL &= ~CARDCTL_SPICARD;
-
-    if (infrared) {
-        // Wait as specified by GBATEK (0x800 cycles at 33 MHz)
-        ARM_WaitCycles(0x800 * 4);
-    }
+    CardSPIDoXfer(SPI_DEV_CART_FLASH, transfers, 3, true);
 
+    CardSPIDeselect(infrared);
     return 0;
 }
 
 int CardSPIWaitWriteEnd(bool infrared, u32 timeout) {
     u8 cmd = SPI_CMD_RDSR, statusReg = 0;
+    SPI_XferInfo cmdXfer = { &cmd, 1, false };
+    SPI_XferInfo statusXfer = { &statusReg, 1, true };
     int res = 0;
     u64 time_start = timer_start();
 
+    // the chip keeps sending its status register for as long as it stays selected
+    CardSPISelect(infrared);
+    CardSPIDoXfer(SPI_DEV_CART_FLASH, &cmdXfer, 1, false);
     do {
-        res = CardSPIWriteRead(infrared, &cmd, 1, &statusReg, 1, 0, 0);
-        if (res) return res;
-        if (timer_msec(time_start) > timeout) return 1;
-    } while(statusReg & SPI_FLG_WIP);
+        CardSPIDoXfer(SPI_DEV_CART_FLASH, &statusXfer, 1, false);
+        if (!(statusReg & SPI_FLG_WIP)) break;
+        if (timer_msec(time_start) > timeout) res = 1;
+    } while(!res);
+    CardSPIDoXfer(SPI_DEV_CART_FLASH, NULL, 0, true);
+    CardSPIDeselect(infrared);
 
-    return 0;
+    return res;
 }
 
 int CardSPIEnableWriting_512B(CardSPIType type) {
@@ -166,10 +223,17 @@ int CardSPIEnableWriting(CardSPIType type) {
     return type.chip->enableWriting(type);
 }
 
-int _SPIWriteTransaction(CardSPIType type, void* cmd, u32 cmdSize, const void* data, u32 dataSize) {
+// returns while the chip is still busy, the next transaction waits for it
+int _SPIWriteTransactionAsync(CardSPIType type, void* cmd, u32 cmdSize, const void* data, u32 dataSize) {
     int res;
+    if ((res = CardSPIWaitWriteEnd(type.infrared, 10000))) return res;
     if ((res = CardSPIEnableWriting(type))) return res;
-    if ((res = CardSPIWriteRead(type.infrared, cmd, cmdSize, NULL, 0, (void*) ((u8*) data), dataSize))) return res;
+    return CardSPIWriteRead(type.infrared, cmd, cmdSize, NULL, 0, (void*) ((u8*) data), dataSize);
+}
+
+int _SPIWriteTransaction(CardSPIType type, void* cmd, u32 cmdSize, const void* data, u32 dataSize) {
+    int res;
+    if ((res = _SPIWriteTransactionAsync(type, cmd, cmdSize, data, dataSize))) return res;
     return CardSPIWaitWriteEnd(type.infrared, 10000);
 }
 
@@ -194,6 +258,16 @@ int CardSPIReadJEDECIDAndStatusReg(bool infrared, u32* id, u8* statusReg) {
     return 0;
 }
 
+// walks all known chips, NULL past the last one
+const CardSPITypeData* CardSPIGetKnownType(u32 idx) {
+    const u32 nEeprom = sizeof(EEPROMTypes) / sizeof(CardSPITypeData);
+    const u32 nFlash = sizeof(flashTypes) / sizeof(CardSPITypeData);
+    if (idx == 0) return &EEPROM_512B;
+    if (--idx < nEeprom) return EEPROMTypes + idx;
+    if ((idx -= nEeprom) < nFlash) return flashTypes + idx;
+    return NULL;
+}
+
 u32 CardSPIGetPageSize(CardSPIType type) {
     if (type.chip == NO_CHIP) return 0;
     return type.chip->pageSize;
@@ -224,19 +298,33 @@ u32 CardSPIGetCapacity(CardSPIType type) {
 int CardSPIWriteSaveData_9bit(CardSPIType type, u32 offset, const void* data, u32 size) {
     u8 cmd[2] = { (offset >= 0x100) ? SPI_512B_EEPROM_CMD_WRHI : SPI_512B_EEPROM_CMD_WRLO, (u8) offset };
 
-    return _SPIWriteTransaction(type, cmd, 2, (void*) ((u8*) data), size);
+    return _SPIWriteTransactionAsync(type, cmd, 2, (void*) ((u8*) data), size);
 }
 
 int CardSPIWriteSaveData_16bit(CardSPIType type, u32 offset, const void* data, u32 size) {
     u8 cmd[3] = { type.chip->writeCommand, (u8)(offset >> 8), (u8) offset };
 
-    return _SPIWriteTransaction(type, cmd, 3, (void*) ((u8*) data), size);
+    return _SPIWriteTransactionAsync(type, cmd, 3, (void*) ((u8*) data), size);
 }
 
 int CardSPIWriteSaveData_24bit_write(CardSPIType type, u32 offset, const void* data, u32 size) {
     u8 cmd[4] = { type.chip->writeCommand, (u8)(offset >> 16), (u8)(offset >> 8), (u8) offset };
+    const u32 pageSize = CardSPIGetPageSize(type);
+    u8 page[256];
+    int res;
 
-    return _SPIWriteTransaction(type, cmd, 4, (void*) ((u8*) data), size);
+    // flash page write may leave the bytes it wasn't sent erased, so partial pages are filled up
+    if ((type.chip->jedecId != 0xFFFF) && ((offset % pageSize) || (size < pageSize)) && (pageSize <= sizeof(page))) {
+        u32 pageStart = offset - (offset % pageSize);
+        if ((res = CardSPIReadSaveData(type, pageStart, page, pageSize))) return res;
+        memcpy(page + (offset - pageStart), data, size);
+        cmd[1] = (u8)(pageStart >> 16);
+        cmd[2] = (u8)(pageStart >> 8);
+        cmd[3] = (u8) pageStart;
+        return _SPIWriteTransactionAsync(type, cmd, 4, page, pageSize);
+    }
+
+    return _SPIWriteTransactionAsync(type, cmd, 4, (void*) ((u8*) data), size);
 }
 
 int CardSPIWriteSaveData_24bit_erase_program(CardSPIType type, u32 offset, const void* data, u32 size) {
@@ -265,11 +353,18 @@ int CardSPIWriteSaveData_24bit_erase_program(CardSPIType type, u32 offset, const
     }
 
     for(u32 pos = offset; pos < offset + eraseSize; pos += pageSize) {
+        const u8* page = (const u8*) data - offset + pos;
+        u32 n;
+
+        // erased pages are all 0xFF already
+        for (n = 0; (n < pageSize) && (page[n] == 0xFF); n++);
+        if (n == pageSize) continue;
+
         cmd[1] = (u8)(pos >> 16);
         cmd[2] = (u8)(pos >> 8);
         cmd[3] = (u8) pos;
         for(int i = 0; i < 10; i++) {
-            if (!(res = _SPIWriteTransaction(type, cmd, 4, (void*) ((u8*) data - offset + pos), pageSize))) {
+            if (!(res = _SPIWriteTransactionAsync(type, cmd, 4, (void*) page, pageSize))) {
                 break;
             }
             CardSPIWriteRead(type.infrared, "\x04", 1, NULL, 0, NULL, 0);
@@ -284,30 +379,82 @@ int CardSPIWriteSaveData_24bit_erase_program(CardSPIType type, u32 offset, const
     return 0;
 }
 
+// compares chip contents to data in small chunks, no buffer of the full size needed
+static int CardSPICompareSaveData(CardSPIType type, u32 offset, const void* data, u32 size, bool* equal) {
+    u32 buffer[64];
+    *equal = false;
+    for (u32 pos = 0; pos < size; pos += sizeof(buffer)) {
+        u32 len = min(size - pos, sizeof(buffer));
+        int res = CardSPIReadSaveData(type, offset + pos, buffer, len);
+        if (res) return res;
+        if (memcmp(buffer, (const u8*) data + pos, len) != 0) return 0;
+    }
+    *equal = true;
+    return 0;
+}
+
+static int CardSPICrcSaveData(CardSPIType type, u32 offset, u32 size, u32* crc) {
+    u32 buffer[64];
+    *crc = crc32_init();
+    for (u32 pos = 0; pos < size; pos += sizeof(buffer)) {
+        u32 len = min(size - pos, sizeof(buffer));
+        int res = CardSPIReadSaveData(type, offset + pos, buffer, len);
+        if (res) return res;
+        *crc = crc32_update(*crc, buffer, len);
+    }
+    return 0;
+}
+
+// bulk write: per block, every write unit is compared first, then only the
+// units that changed get programmed back to back and the block is verified by CRC
 int CardSPIWriteSaveData(CardSPIType type, u32 offset, const void* data, u32 size) {
     if (type.chip == NO_CHIP) return 1;
 
     if (size == 0) return 0;
     u32 end = offset + size;
-    u32 pos = offset;
     u32 writeSize = type.chip->writeSize;
     if (writeSize == 0) return 0xC8E13404;
+    u32 blockSize = max(writeSize, min(CARDSPI_BULK_BLOCK, writeSize * CARDSPI_BULK_UNITS));
 
+    CardSPIBusHold(true);
     int res = CardSPIWaitWriteEnd(type.infrared, 1000);
-    if (res) return res;
 
-    while(pos < end) {
-        u32 remaining = end - pos;
-        u32 nb = writeSize - (pos % writeSize);
+    for (u32 block = offset; !res && (block < end); block = ((block / blockSize) + 1) * blockSize) {
+        u32 blockEnd = min(end, ((block / blockSize) + 1) * blockSize);
+        const u8* blockData = (const u8*) data - offset + block;
+        bool dirty[CARDSPI_BULK_UNITS];
+        bool changed = false;
+        u32 n = 0;
+
+        for (u32 pos = block; !res && (pos < blockEnd); pos = ((pos / writeSize) + 1) * writeSize, n++) {
+            u32 dataSize = min(blockEnd - pos, writeSize - (pos % writeSize));
+            bool equal = false;
+            res = CardSPICompareSaveData(type, pos, blockData - block + pos, dataSize, &equal);
+            dirty[n] = !equal;
+            changed |= !equal;
+        }
+        if (res || !changed) continue;
 
-        u32 dataSize = (remaining < nb) ? remaining : nb;
+        for (u32 retry = 0; !res; retry++) {
+            u32 crc, crcChip = 0;
 
-        if ((res = type.chip->writeSaveData(type, pos, (void*) ((u8*) data - offset + pos), dataSize))) return res;
+            n = 0;
+            for (u32 pos = block; !res && (pos < blockEnd); pos = ((pos / writeSize) + 1) * writeSize, n++) {
+                u32 dataSize = min(blockEnd - pos, writeSize - (pos % writeSize));
+                if (dirty[n]) res = type.chip->writeSaveData(type, pos, blockData - block + pos, dataSize);
+            }
+            if (res) break;
 
-        pos = ((pos / writeSize) + 1) * writeSize; // truncate
+            // calculated while the chip is still busy with the last unit
+            crc = crc32_update(crc32_init(), blockData, blockEnd - block);
+            if ((res = CardSPICrcSaveData(type, block, blockEnd - block, &crcChip))) break;
+            if (crc == crcChip) break;
+            if (retry + 1 >= CARDSPI_BULK_RETRIES) res = 1;
+        }
     }
 
-    return 0;
+    CardSPIBusHold(false);
+    return res;
 }
 
 int CardSPIReadSaveData_9bit(CardSPIType type, u32 pos, void* data, u32 size) {
@@ -359,10 +506,12 @@ int CardSPIReadSaveData(CardSPIType type, u32 offset, void* data, u32 size) {
 
     if (size == 0) return 0;
 
+    CardSPIBusHold(true);
     int res = CardSPIWaitWriteEnd(type.infrared, 1000);
-    if (res) return res;
+    if (!res) res = type.chip->readSaveData(type, offset, data, size);
+    CardSPIBusHold(false);
 
-    return type.chip->readSaveData(type, offset, data, size);
+    return res;
 }
 
 int CardSPIEraseSector_emulated(CardSPIType type, u32 offset) {
@@ -443,9 +592,10 @@ int _SPIIsDataMirrored(CardSPIType type, int size, bool* mirrored) {
     if ((res = CardSPIReadSaveData(type, offset0, &buf1, 1))) return res;
     if ((res = CardSPIReadSaveData(type, offset1, &buf2, 1))) return res;
     buf3=~buf1;
-    if ((res = CardSPIWriteSaveData(type, offset0, &buf3, 1))) return res;
+    // plain writes, on a chip with wider addresses they don't land and can't be verified
+    if ((res = type.chip->writeSaveData(type, offset0, &buf3, 1))) return res;
     if ((res = CardSPIReadSaveData(type, offset1, &buf4, 1))) return res;
-    if ((res = CardSPIWriteSaveData(type, offset0, &buf1, 1))) return res;
+    if ((res = type.chip->writeSaveData(type, offset0, &buf1, 1))) return res;
 
     *mirrored = buf2 != buf4;
     return 0;
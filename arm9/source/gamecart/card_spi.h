@@ -20,6 +20,7 @@
 
 #pragma once
 #include "common.h"
+#include <spi.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -51,6 +52,11 @@ struct CardSPITypeData {
 
 extern const CardSPITypeData * const FLASH_CTR_GENERIC; // Handles each 3ds cartridge the exact same
 
+// save chip transfers go through xfer instead of the SPI bus (NULL for the bus)
+typedef int (*CardSPIXferFunc)(u32 dev, const SPI_XferInfo* xfer, u32 xfer_cnt, bool done);
+void CardSPISetXfer(CardSPIXferFunc xfer);
+const CardSPITypeData* CardSPIGetKnownType(u32 idx);
+
 int CardSPIWriteRead(bool infrared, const void* cmd, u32 cmdSize, void* answer, u32 answerSize, const void* data, u32 dataSize);
 int CardSPIWaitWriteEnd(bool infrared, u32 timeout);
 int CardSPIEnableWriting(CardSPIType type);
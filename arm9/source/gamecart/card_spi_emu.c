@@ -0,0 +1,299 @@
+#include "card_spi_emu.h"
+#include "timer.h"
+
+#define SPI_CMD_PP      2
+#define SPI_CMD_READ    3
+#define SPI_CMD_WRDI    4
+#define SPI_CMD_RDSR    5
+#define SPI_CMD_WREN    6
+#define SPI_CMD_PW      10
+#define SPI_CMD_RDHI    11 // 512 byte EEPROM, upper half
+#define SPI_CMD_RDID    0x9F
+#define SPI_CMD_SE      0xD8
+#define SPI_CMD_MXIC_SE 0x20
+
+#define SPI_FLG_WIP     1
+#define SPI_FLG_WEL     2
+
+static struct {
+    const CardSPIEmuChip* chip;
+    u8* mem;
+    CardSPIEmuStats stats;
+    u64 busyUntil;
+    bool wel;
+    bool irHeader;
+    // current transaction
+    u32 nBytes;         // bytes clocked in or out so far
+    u8 cmd;
+    u32 addr;
+    u32 nAddr;          // address bytes still expected
+    u32 nData;          // data bytes after the address
+} emu;
+
+bool CardSPIEmuChipFor(const CardSPITypeData* type, bool infrared, CardSPIEmuChip* chip) {
+    bool eeprom = (type->jedecId == 0xFFFF);
+    u32 capacity = type->capacity ? type->capacity : (1 << 19);
+    u32 exponent = 0;
+
+    if (!type->writeSaveData || !type->writeSize) return false;
+    while ((1u << exponent) < capacity) exponent++;
+
+    memset(chip, 0, sizeof(CardSPIEmuChip));
+    chip->jedec = eeprom ? 0xFFFFFF : (((u32) type->jedecId << 8) | exponent);
+    chip->status = (capacity == 512) ? 0xF0 : 0x00;
+    chip->capacity = capacity;
+    chip->addrBits = (capacity == 512) ? 9 : (eeprom && (capacity <= 0x10000)) ? 16 : 24;
+    chip->pageSize = type->pageSize;
+    chip->eraseSize = eeprom ? 0 : type->eraseSize;
+    chip->infrared = infrared;
+    // page program is quicker than page write, which erases first
+    chip->writeUsec = eeprom ? 3000 : (type->writeSize == type->eraseSize) ? 300 : 800;
+    chip->eraseUsec = (type->eraseSize >= 0x10000) ? 150000 : 20000;
+    return true;
+}
+
+static bool CardSPIEmuBusy(void) {
+    return timer_ticks(0) < emu.busyUntil;
+}
+
+static void CardSPIEmuSetBusy(u32 usec) {
+    emu.busyUntil = timer_ticks(0) + ((u64) usec * TICKS_PER_SEC) / 1000000;
+}
+
+static u32 CardSPIEmuAddrBytes(u8 cmd) {
+    if ((cmd != SPI_CMD_READ) && (cmd != SPI_CMD_RDHI) && (cmd != SPI_CMD_PP) && (cmd != SPI_CMD_PW) &&
+        (cmd != SPI_CMD_SE) && (cmd != SPI_CMD_MXIC_SE))
+        return 0;
+    return (emu.chip->addrBits + 7) / 8 - ((emu.chip->addrBits == 9) ? 1 : 0);
+}
+
+static bool CardSPIEmuIsWrite(u8 cmd) {
+    return (cmd == SPI_CMD_PP) || (cmd == SPI_CMD_PW);
+}
+
+// one byte from the host, MOSI
+static void CardSPIEmuIn(u8 byte) {
+    const CardSPIEmuChip* chip = emu.chip;
+
+    if (!emu.nBytes++) {
+        emu.cmd = byte;
+        emu.addr = 0;
+        emu.nAddr = CardSPIEmuAddrBytes(byte);
+        emu.nData = 0;
+        if (chip->infrared && !emu.irHeader) emu.stats.violations++;
+        if ((byte != SPI_CMD_RDSR) && CardSPIEmuBusy()) emu.stats.violations++;
+        // 512 byte EEPROMs take the 9th address bit from the command
+        if ((chip->addrBits == 9) && ((byte == SPI_CMD_RDHI) || (byte == SPI_CMD_PW))) emu.addr = 1;
+        return;
+    }
+
+    if (emu.nAddr) {
+        emu.addr = (emu.addr << 8) | byte;
+        emu.nAddr--;
+        return;
+    }
+
+    if (CardSPIEmuIsWrite(emu.cmd) && emu.wel && !CardSPIEmuBusy()) {
+        u32 page = emu.addr & ~(chip->pageSize - 1);
+        // flash page write erases the whole page, only the bytes sent get programmed
+        if (!emu.nData && chip->eraseSize && (emu.cmd == SPI_CMD_PW))
+            memset(emu.mem + (page % chip->capacity), 0xFF, chip->pageSize);
+        u32 pos = page | ((emu.addr + emu.nData) & (chip->pageSize - 1));
+        u8* dest = emu.mem + (pos % chip->capacity);
+        if ((emu.addr % chip->pageSize) + emu.nData >= chip->pageSize) emu.stats.violations++;
+        // flash can only clear bits, anything else overwrites
+        if (chip->eraseSize && (emu.cmd == SPI_CMD_PP)) *dest &= byte;
+        else *dest = byte;
+    }
+    emu.nData++;
+}
+
+// one byte to the host, MISO
+static u8 CardSPIEmuOut(void) {
+    const CardSPIEmuChip* chip = emu.chip;
+
+    if (!emu.nBytes++) return 0xFF;
+    if (emu.cmd == SPI_CMD_RDSR)
+        return chip->status | (CardSPIEmuBusy() ? SPI_FLG_WIP : 0) | (emu.wel ? SPI_FLG_WEL : 0);
+    if (emu.cmd == SPI_CMD_RDID) {
+        u32 n = emu.nData++;
+        return (n < 3) ? (u8) (chip->jedec >> (16 - (n * 8))) : 0xFF;
+    }
+
+    if (emu.nAddr) { // clocks meant as reads still complete the address
+        emu.addr <<= 8;
+        emu.nAddr--;
+        return 0xFF;
+    }
+    if ((emu.cmd == SPI_CMD_READ) || (emu.cmd == SPI_CMD_RDHI)) {
+        emu.stats.bytesRead++;
+        if (CardSPIEmuBusy()) return 0xFF;
+        return emu.mem[(emu.addr + emu.nData++) % chip->capacity];
+    }
+    return 0xFF;
+}
+
+static void CardSPIEmuEnd(void) {
+    const CardSPIEmuChip* chip = emu.chip;
+    u8 cmd = emu.cmd;
+
+    if (!emu.nBytes) return;
+    emu.stats.transactions++;
+    emu.nBytes = 0;
+    emu.irHeader = false;
+
+    if (CardSPIEmuBusy() && (cmd != SPI_CMD_RDSR)) return; // ignored
+    if (cmd == SPI_CMD_WREN) emu.wel = true;
+    else if (cmd == SPI_CMD_WRDI) emu.wel = false;
+    else if ((CardSPIEmuIsWrite(cmd) && emu.nData) || ((cmd == SPI_CMD_SE) || (cmd == SPI_CMD_MXIC_SE))) {
+        bool erase = !CardSPIEmuIsWrite(cmd);
+        if (!emu.wel || (erase && !chip->eraseSize)) {
+            emu.stats.violations++;
+            return;
+        }
+        if (erase) {
+            memset(emu.mem + ((emu.addr % chip->capacity) & ~(chip->eraseSize - 1)), 0xFF, chip->eraseSize);
+            emu.stats.erases++;
+        } else emu.stats.programs++;
+        emu.wel = false;
+        CardSPIEmuSetBusy(erase ? chip->eraseUsec : chip->writeUsec);
+    }
+}
+
+static int CardSPIEmuXfer(u32 dev, const SPI_XferInfo* xfer, u32 xfer_cnt, bool done) {
+    if (dev == SPI_DEV_CART_IR) {
+        emu.irHeader = true;
+        return 0;
+    }
+
+    for (u32 i = 0; i < xfer_cnt; i++) {
+        u8* buf = (u8*) xfer[i].buf;
+        if (!buf) continue;
+        for (u32 n = 0; n < xfer[i].len; n++) {
+            if (xfer[i].read) buf[n] = CardSPIEmuOut();
+            else CardSPIEmuIn(buf[n]);
+        }
+    }
+
+    if (done) CardSPIEmuEnd();
+    return 0;
+}
+
+void CardSPIEmuInit(const CardSPIEmuChip* chip, u8* memory) {
+    memset(&emu, 0, sizeof(emu));
+    emu.chip = chip;
+    emu.mem = memory;
+    CardSPISetXfer(CardSPIEmuXfer);
+}
+
+void CardSPIEmuDeinit(void) {
+    CardSPISetXfer(NULL);
+    emu.chip = NULL;
+}
+
+CardSPIEmuStats* CardSPIEmuGetStats(void) {
+    return &emu.stats;
+}
+
+bool CardSPIEmuRun(const CardSPITypeData* type, bool infrared, u8* mem, const u8* img, u8* rd, CardSPIEmuResult* res) {
+    CardSPIEmuChip chip;
+    CardSPIType spi = { type, infrared };
+    bool ok = true;
+
+    if (!CardSPIEmuChipFor(type, infrared, &chip) || (chip.capacity > CARDSPI_EMU_MAX_SIZE)) return false;
+    memset(res, 0, sizeof(CardSPIEmuResult));
+    memset(mem, chip.eraseSize ? 0xFF : 0x00, chip.capacity);
+    CardSPIEmuInit(&chip, mem);
+
+    CardSPIType found = CardSPIGetCardSPIType(infrared);
+    res->idOk = (found.chip == type) && (found.infrared == infrared);
+    if (CardSPIGetCapacity(spi) != chip.capacity) ok = false;
+
+    u64 start = timer_start();
+    if (CardSPIWriteSaveData(spi, 0, img, chip.capacity) != 0) ok = false;
+    res->ticksRestore = timer_ticks(start);
+    res->transactions = emu.stats.transactions;
+    if (memcmp(mem, img, chip.capacity) != 0) ok = false;
+
+    start = timer_start();
+    if (CardSPIWriteSaveData(spi, 0, img, chip.capacity) != 0) ok = false;
+    res->ticksRewrite = timer_ticks(start);
+
+    start = timer_start();
+    if ((CardSPIReadSaveData(spi, 0, rd, chip.capacity) != 0) || (memcmp(rd, img, chip.capacity) != 0)) ok = false;
+    res->ticksRead = timer_ticks(start);
+
+    res->violations = emu.stats.violations;
+    res->dataOk = ok;
+    CardSPIEmuDeinit();
+    return true;
+}
+
+static u32 CardSPIEmuMsec(u32 ticks) {
+    return (u32) (((u64) ticks * 1000) / TICKS_PER_SEC);
+}
+
+// one row of the benchmark table, nothing if the type can't be emulated
+static u32 CardSPIEmuBenchChip(char* txt, u32 max_len, const CardSPITypeData* type, bool infrared,
+    u8* mem, u8* img, u8* rd, u32* seed, u32* tested, u32* failed) {
+    CardSPIEmuChip chip;
+    CardSPIEmuResult res;
+    char name[16];
+
+    if (!CardSPIEmuChipFor(type, infrared, &chip) || (chip.capacity > CARDSPI_EMU_MAX_SIZE)) return 0;
+    if (chip.jedec != 0xFFFFFF) snprintf(name, sizeof(name), "FLASH %04X%s", type->jedecId, infrared ? " IR" : "");
+    else if (chip.capacity < 1024) snprintf(name, sizeof(name), "EEPROM %luB", chip.capacity);
+    else snprintf(name, sizeof(name), "EEPROM %luK", chip.capacity >> 10);
+
+    for (u32 i = 0; i < chip.capacity; i++) {
+        *seed = (*seed * 1103515245) + 12345;
+        img[i] = (u8) (*seed >> 16);
+    }
+    if (!CardSPIEmuRun(type, infrared, mem, img, rd, &res)) return 0;
+
+    (*tested)++;
+    if (!res.idOk || !res.dataOk || res.violations) (*failed)++;
+
+    return snprintf(txt, max_len, "%-13.13s %-4s %-4s %6lu %6lu %5lu %6lu %4lu\n", name,
+        res.idOk ? "ok" : "FAIL", res.dataOk ? "ok" : "FAIL", CardSPIEmuMsec(res.ticksRestore),
+        CardSPIEmuMsec(res.ticksRewrite), CardSPIEmuMsec(res.ticksRead), res.transactions, res.violations);
+}
+
+u32 CardSPIEmuBench(char* txt, u32 max_len) {
+    u32 len = 0;
+    if (!max_len) return 0;
+    *txt = '\0';
+
+    u8* mem = (u8*) malloc(CARDSPI_EMU_MAX_SIZE);
+    u8* img = (u8*) malloc(CARDSPI_EMU_MAX_SIZE);
+    u8* rd = (u8*) malloc(CARDSPI_EMU_MAX_SIZE);
+    u32 seed = 0x5A7E;
+    u32 tested = 0;
+    u32 failed = 0;
+    if (!mem || !img || !rd) {
+        free(mem);
+        free(img);
+        free(rd);
+        return min((u32) snprintf(txt, max_len, "(out of memory)\n"), max_len - 1);
+    }
+
+    len = snprintf(txt, max_len, "%-13.13s %-4s %-4s %6s %6s %5s %6s %4s\n",
+        "chip", "id", "data", "rst ms", "rw ms", "rd ms", "trans", "viol");
+    for (u32 i = 0; CardSPIGetKnownType(i) && (len < max_len); i++)
+        len += CardSPIEmuBenchChip(txt + len, max_len - len, CardSPIGetKnownType(i), false, mem, img, rd, &seed, &tested, &failed);
+    // infrared framing, first flash chip
+    for (u32 i = 0; CardSPIGetKnownType(i) && (len < max_len); i++) {
+        if (CardSPIGetKnownType(i)->jedecId == 0xFFFF) continue;
+        len += CardSPIEmuBenchChip(txt + len, max_len - len, CardSPIGetKnownType(i), true, mem, img, rd, &seed, &tested, &failed);
+        break;
+    }
+    if (len < max_len) len += snprintf(txt + len, max_len - len,
+        "\nResult: %s (%lu of %lu chips failed)\n", failed ? "FAIL" : "PASS", failed, tested);
+    if (len < max_len) len += snprintf(txt + len, max_len - len,
+        "\n(rst: full restore, rw: same data again,\n trans: bus transactions for rst)\n");
+
+    free(mem);
+    free(img);
+    free(rd);
+    return min(len, max_len - 1);
+}
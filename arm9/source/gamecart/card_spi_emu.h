@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+#include "card_spi.h"
+
+// emulated EEPROM / flash save chip, plugged in below card_spi.c in place
+// of the SPI bus, so save handling can be checked and timed without a cart
+// (on the console via CardSPIEmuBench(), on the host via test/cardspi_test.c)
+
+#define CARDSPI_EMU_MAX_SIZE    (1 << 19) // larger chips are not emulated
+
+typedef struct {
+    u32 jedec;          // RDID answer, 0xFFFFFF for EEPROMs (no RDID)
+    u8 status;          // status register bits besides WIP / WEL
+    u32 capacity;       // addresses wrap around at this size
+    u32 addrBits;       // 9 (512 byte EEPROM), 16 or 24
+    u32 pageSize;       // programming wraps around within a page
+    u32 eraseSize;      // 0 for EEPROMs, flash page program only clears bits,
+                        // flash page write leaves the rest of the page erased
+    bool infrared;      // expects the infrared header before every transaction
+    u32 writeUsec;      // busy time after programming a page
+    u32 eraseUsec;      // busy time after erasing
+} CardSPIEmuChip;
+
+typedef struct {
+    u32 transactions;
+    u32 bytesRead;
+    u32 programs;
+    u32 erases;
+    u32 violations;     // busy chip accessed, write without WREN, page wrap, no IR header
+} CardSPIEmuStats;
+
+typedef struct {
+    bool idOk;          // detected as the emulated type
+    bool dataOk;        // capacity, restore, rewrite and read back all fine
+    u32 ticksRestore;   // full image written over a blank chip
+    u32 ticksRewrite;   // same image again, nothing needs writing
+    u32 ticksRead;
+    u32 transactions;   // bus transactions for the restore
+    u32 violations;
+} CardSPIEmuResult;
+
+// derives a chip model from a known type, false for types without writing
+bool CardSPIEmuChipFor(const CardSPITypeData* type, bool infrared, CardSPIEmuChip* chip);
+// memory holds chip->capacity bytes of chip contents, both must stay valid until deinit
+void CardSPIEmuInit(const CardSPIEmuChip* chip, u8* memory);
+void CardSPIEmuDeinit(void);
+CardSPIEmuStats* CardSPIEmuGetStats(void);
+
+// identifies the chip, restores img (chip capacity bytes) to it, writes it again and
+// reads it back into rd, mem holds the chip contents, all need CARDSPI_EMU_MAX_SIZE bytes
+// false if the type can't be emulated
+bool CardSPIEmuRun(const CardSPITypeData* type, bool infrared, u8* mem, const u8* img, u8* rd, CardSPIEmuResult* res);
+// runs every known type, plus the first flash via infrared, and reports time, bus
+// transactions and violations; fails on misidentification, bad data or violations
+u32 CardSPIEmuBench(char* txt, u32 max_len);
@@ -0,0 +1,154 @@
+#include "cartcache.h"
+#include "protocol.h"
+#include "command_ctr.h"
+#include "ncch.h"
+#include "ncsd.h"
+#include "nds.h"
+
+#define CARTCACHE_PINS_MAX  (8 * 3) // NCCH header, ExeFS header, RomFS head per partition
+
+typedef struct {
+    u32 line; // cart offset / CARTCACHE_LINE_SIZE
+    u32 used; // LRU stamp, 0 for empty lines
+    bool pinned;
+} CartCacheTag;
+
+typedef struct {
+    u32 first;
+    u32 last;
+} CartCachePin;
+
+static u8* cache_data = NULL;
+static CartData* cache_cdata = NULL;
+static CartCacheTag cache_tags[CARTCACHE_LINES];
+static CartCachePin cache_pins[CARTCACHE_PINS_MAX];
+static u32 cache_n_pins = 0;
+static u32 cache_n_pinned = 0;
+static u32 cache_stamp = 0;
+static u32 cache_mem_size = 0; // header (and secure area), kept in cdata anyway
+
+static void CartCachePinRange(u64 offset, u64 size) {
+    if (!size || (cache_n_pins >= CARTCACHE_PINS_MAX)) return;
+    cache_pins[cache_n_pins].first = offset / CARTCACHE_LINE_SIZE;
+    cache_pins[cache_n_pins].last = (offset + size - 1) / CARTCACHE_LINE_SIZE;
+    cache_n_pins++;
+}
+
+static bool CartCacheIsPinned(u32 line) {
+    for (u32 i = 0; i < cache_n_pins; i++)
+        if ((line >= cache_pins[i].first) && (line <= cache_pins[i].last)) return true;
+    return false;
+}
+
+static u8* CartCacheGetLine(u32 line) {
+    CartCacheTag* victim = NULL;
+
+    for (u32 i = 0; i < CARTCACHE_LINES; i++) {
+        CartCacheTag* tag = cache_tags + i;
+        if (tag->used && (tag->line == line)) {
+            tag->used = ++cache_stamp;
+            return cache_data + (i * CARTCACHE_LINE_SIZE);
+        }
+        if (!tag->pinned && (!victim || (tag->used < victim->used)))
+            victim = tag;
+    }
+    if (!victim) return NULL;
+
+    // the last line may stick out past the cart end, that part is just filler
+    u8* data = cache_data + ((victim - cache_tags) * CARTCACHE_LINE_SIZE);
+    victim->used = 0;
+    if (ReadCartSectors(data, line * (CARTCACHE_LINE_SIZE / 0x200), CARTCACHE_LINE_SIZE / 0x200, cache_cdata, true) != 0)
+        return NULL;
+    victim->line = line;
+    victim->used = ++cache_stamp;
+    if ((cache_n_pinned < CARTCACHE_PINNED_MAX) && CartCacheIsPinned(line)) {
+        victim->pinned = true;
+        cache_n_pinned++;
+    }
+    return data;
+}
+
+// drops all cached lines, pinned ones included, pins are set up again on refill
+static void CartCacheFlush(void) {
+    memset(cache_tags, 0, sizeof(cache_tags));
+    cache_n_pinned = 0;
+}
+
+u32 CartCacheInit(CartData* cdata) {
+    CartCacheFree();
+    cache_data = (u8*) malloc(CARTCACHE_LINES * CARTCACHE_LINE_SIZE);
+    if (!cache_data) return 1;
+    cache_cdata = cdata;
+    cache_mem_size = (cdata->cart_type & CART_CTR) ? 0x4000 : 0x8000;
+
+    if (cdata->cart_type & CART_CTR) {
+        // NCCH headers first, so the ones read below stay in the cache
+        NcsdHeader* ncsd = (NcsdHeader*) (void*) cdata->header;
+        for (u32 p = 0; p < 8; p++) {
+            if (ncsd->partitions[p].size)
+                CartCachePinRange((u64) ncsd->partitions[p].offset * NCSD_MEDIA_UNIT, sizeof(NcchHeader));
+        }
+        for (u32 p = 0; p < 8; p++) {
+            u64 offset = (u64) ncsd->partitions[p].offset * NCSD_MEDIA_UNIT;
+            NcchHeader ncch;
+            if (!ncsd->partitions[p].size ||
+                (ReadCartBytesCached(&ncch, offset, sizeof(NcchHeader), cdata) != 0) ||
+                (ValidateNcchHeader(&ncch) != 0))
+                continue;
+            if (ncch.size_exefs)
+                CartCachePinRange(offset + ((u64) ncch.offset_exefs * NCCH_MEDIA_UNIT), sizeof(ExeFsHeader));
+            if (ncch.size_romfs)
+                CartCachePinRange(offset + ((u64) ncch.offset_romfs * NCCH_MEDIA_UNIT),
+                    min((u64) ncch.size_romfs * NCCH_MEDIA_UNIT, CARTCACHE_ROMFS_PIN));
+        }
+    } else if (cdata->cart_type & CART_NTR) {
+        // NitroFS name and allocation tables
+        TwlHeader* twl = (TwlHeader*) (void*) cdata->header;
+        CartCachePinRange(twl->fnt_offset, min(twl->fnt_size, CARTCACHE_ROMFS_PIN));
+        CartCachePinRange(twl->fat_offset, min(twl->fat_size, CARTCACHE_ROMFS_PIN));
+    }
+
+    return 0;
+}
+
+void CartCacheFree(void) {
+    free(cache_data);
+    cache_data = NULL;
+    cache_cdata = NULL;
+    CartCacheFlush();
+    cache_n_pins = 0;
+    cache_stamp = 0;
+}
+
+u32 ReadCartBytesCached(void* buffer, u64 offset, u64 count, CartData* cdata) {
+    CartSession* session = CTR_GetSession();
+    // forced refreshes are retries of bad reads, these need to hit the cart
+    // (and anything cached before may be just as bad)
+    if (cache_data && session->force_refresh) CartCacheFlush();
+    if (!cache_data || (cdata != cache_cdata) || session->uncached || session->force_refresh)
+        return ReadCartBytes(buffer, offset, count, cdata, true);
+    if (!CART_INSERTED) return 1;
+
+    u8* buffer8 = (u8*) buffer;
+    while (count) {
+        u32 in_line = offset % CARTCACHE_LINE_SIZE;
+        u64 len;
+        if (offset < cache_mem_size) { // served from memory anyway
+            len = min(count, cache_mem_size - offset);
+            if (ReadCartBytes(buffer8, offset, len, cdata, true) != 0) return 1;
+        } else if (!(offset % 0x200) && (count >= CARTCACHE_BYPASS_SIZE)) { // streamed
+            len = count - (count % 0x200);
+            if (ReadCartSectors(buffer8, offset / 0x200, len / 0x200, cdata, true) != 0) return 1;
+        } else {
+            u8* data = CartCacheGetLine(offset / CARTCACHE_LINE_SIZE);
+            if (!data) return 1;
+            len = min(count, CARTCACHE_LINE_SIZE - in_line);
+            memcpy(buffer8, data + in_line, len);
+        }
+        buffer8 += len;
+        offset += len;
+        count -= len;
+    }
+
+    return 0;
+}
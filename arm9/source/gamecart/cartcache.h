@@ -0,0 +1,19 @@
+#pragma once
+
+#include "common.h"
+#include "gamecart.h"
+
+// LRU cache of cart data in front of ReadCartSectors(), for the small
+// scattered reads of browsing a mounted cart image. NCCH / ExeFS headers
+// and the start of each RomFS (IVFC header, master hash, lvl3 metadata)
+// stay pinned once read, big sequential reads go straight to the cart.
+
+#define CARTCACHE_LINE_SIZE     0x1000 // one NTR page, 8 sectors
+#define CARTCACHE_LINES         64
+#define CARTCACHE_PINNED_MAX    (CARTCACHE_LINES / 2)
+#define CARTCACHE_BYPASS_SIZE   0x8000 // reads this big are not cached
+#define CARTCACHE_ROMFS_PIN     0x10000 // pinned head of each RomFS
+
+u32 CartCacheInit(CartData* cdata);
+void CartCacheFree(void);
+u32 ReadCartBytesCached(void* buffer, u64 offset, u64 count, CartData* cdata);
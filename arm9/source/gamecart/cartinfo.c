@@ -0,0 +1,123 @@
+#include "cartinfo.h"
+#include "sha.h"
+#include "vff.h"
+
+#define CARTINFO_MAGIC      "GM9CINFO"
+#define CARTINFO_VERSION    2 // 1 also remembered NTR carts
+#define CARTINFO_NO_CHIP    0xFFFFFFFF
+
+typedef struct {
+    u8  fingerprint[0x20];
+    u32 save_type;
+    u32 save_size;
+    u32 spi_chip; // CardSPIGetKnownType() index
+    u32 spi_infrared;
+} PACKED_STRUCT CartInfoEntry;
+
+typedef struct {
+    char magic[8];
+    u32 version;
+    u32 n_entries;
+    CartInfoEntry entries[CARTINFO_ENTRIES]; // most recently added first
+} PACKED_STRUCT CartInfoFile;
+
+static void CartInfoFingerprint(u8* fingerprint, const CartData* cdata) {
+    // header and private header (with the unique ID)
+    u32 size = 0x4000 + PRIV_HDR_SIZE;
+    sha_init(SHA256_MODE);
+    sha_update(&(cdata->cart_type), sizeof(u32));
+    sha_update(&(cdata->cart_id), sizeof(u32));
+    sha_update(&(cdata->cart_size), sizeof(u64));
+    sha_update(cdata->header, size);
+    sha_get(fingerprint);
+}
+
+static bool CartInfoRead(CartInfoFile* cinfo) {
+    UINT br;
+    if ((fvx_qread(CARTINFO_PATH, cinfo, 0, sizeof(CartInfoFile), &br) != FR_OK) ||
+        (br != sizeof(CartInfoFile)) ||
+        (memcmp(cinfo->magic, CARTINFO_MAGIC, 8) != 0) ||
+        (cinfo->version != CARTINFO_VERSION) ||
+        (cinfo->n_entries > CARTINFO_ENTRIES))
+        return false;
+    return true;
+}
+
+bool CartInfoLoad(CartData* cdata) {
+    if (!(cdata->cart_type & CART_CTR)) return false;
+    CartInfoFile* cinfo = (CartInfoFile*) malloc(sizeof(CartInfoFile));
+    if (!cinfo) return false;
+
+    u8 fingerprint[0x20];
+    CartInfoFingerprint(fingerprint, cdata);
+
+    CartInfoEntry* entry = NULL;
+    if (CartInfoRead(cinfo)) {
+        for (u32 i = 0; !entry && (i < cinfo->n_entries); i++)
+            if (memcmp(cinfo->entries[i].fingerprint, fingerprint, 0x20) == 0)
+                entry = cinfo->entries + i;
+    }
+
+    // entries that don't make sense anymore get probed again, and so do
+    // carts without a save (could have been a badly seated cart)
+    bool res = false;
+    if (entry && (entry->save_type != CARD_SAVE_NONE) && (entry->save_type <= CARD_SAVE_RETAIL_NAND)) {
+        const CardSPITypeData* chip = CardSPIGetKnownType(entry->spi_chip);
+        if ((entry->save_type == CARD_SAVE_SPI) ? (chip != NULL) : (entry->spi_chip == CARTINFO_NO_CHIP)) {
+            cdata->save_type = (CardSaveType) entry->save_type;
+            cdata->save_size = entry->save_size;
+            cdata->spi_save_type = (CardSPIType) { chip, entry->spi_infrared != 0 };
+            res = true;
+        }
+    }
+
+    free(cinfo);
+    return res;
+}
+
+bool CartInfoSave(const CartData* cdata) {
+    if (!(cdata->cart_type & CART_CTR)) return false;
+    CartInfoFile* cinfo = (CartInfoFile*) malloc(sizeof(CartInfoFile));
+    if (!cinfo) return false;
+
+    if (!CartInfoRead(cinfo)) {
+        memset(cinfo, 0x00, sizeof(CartInfoFile));
+        memcpy(cinfo->magic, CARTINFO_MAGIC, 8);
+        cinfo->version = CARTINFO_VERSION;
+    }
+
+    CartInfoEntry entry;
+    memset(&entry, 0x00, sizeof(CartInfoEntry));
+    CartInfoFingerprint(entry.fingerprint, cdata);
+    entry.save_type = (u32) cdata->save_type;
+    entry.save_size = cdata->save_size;
+    entry.spi_chip = CARTINFO_NO_CHIP;
+    entry.spi_infrared = cdata->spi_save_type.infrared ? 1 : 0;
+    for (u32 i = 0; cdata->spi_save_type.chip && CardSPIGetKnownType(i); i++) {
+        if (CardSPIGetKnownType(i) == cdata->spi_save_type.chip) {
+            entry.spi_chip = i;
+            break;
+        }
+    }
+
+    // drop an older entry for the same cart, or the oldest one
+    u32 n = cinfo->n_entries;
+    for (u32 i = 0; i < n; i++) {
+        if (memcmp(cinfo->entries[i].fingerprint, entry.fingerprint, 0x20) == 0) {
+            memmove(cinfo->entries + i, cinfo->entries + i + 1, (n - i - 1) * sizeof(CartInfoEntry));
+            n--;
+            break;
+        }
+    }
+    if (n >= CARTINFO_ENTRIES) n = CARTINFO_ENTRIES - 1;
+    memmove(cinfo->entries + 1, cinfo->entries, n * sizeof(CartInfoEntry));
+    memcpy(cinfo->entries, &entry, sizeof(CartInfoEntry));
+    cinfo->n_entries = n + 1;
+
+    // SD only, this is not worth writing to NAND
+    bool res = ((fvx_rmkdir("0:/gm9/support") == FR_OK) &&
+        (fvx_qwrite(CARTINFO_PATH, cinfo, 0, sizeof(CartInfoFile), NULL) == FR_OK));
+
+    free(cinfo);
+    return res;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "common.h"
+#include "gamecart.h"
+
+// remembers what the slow save probes found out about a CTR cart, keyed by
+// a hash of its headers (including the unique ID), so reinserting or
+// remounting a known cart skips them; anything not matching is probed again,
+// carts where no save was found are never remembered
+// (NTR / TWL carts are always probed, the same game ships with different
+// save chips and nothing but the probe tells them apart)
+#define CARTINFO_PATH       "0:/gm9/support/cartinfo.bin"
+#define CARTINFO_ENTRIES    32
+
+bool CartInfoLoad(CartData* cdata);
+bool CartInfoSave(const CartData* cdata);
@@ -7,11 +7,8 @@
 #include "protocol_ctr.h"
 #include "ui.h"
 
-static int read_count = 0;
-
-static int refresh_count = 0;
-int refresh_call_every = 10000;
-bool force_refresh = false;
+static CartSession default_session = { .refresh_every = CART_REFRESH_DEFAULT };
+static CartSession* session_current = &default_session;
 
 //#define HundredRefreshes
 
@@ -21,26 +18,51 @@ static void CTR_CmdC5()
     CTR_SendCommand(c5_cmd, 0, 1, 0x100002C, NULL);
 }
 
+void CTR_InitSession(CartSession* session, u32 refresh_every)
+{
+    memset(session, 0, sizeof(CartSession));
+    session->refresh_every = refresh_every;
+    // refreshing before every read is for broken carts, cached data won't help there
+    session->uncached = !refresh_every;
+}
+
+CartSession* CTR_GetSession(void)
+{
+    return session_current;
+}
+
+CartSession* CTR_SetSession(CartSession* session)
+{
+    CartSession* prev = session_current;
+    session_current = session ? session : &default_session;
+    return prev;
+}
+
 void CTR_CmdReadData(u32 sector, u32 length, u32 blocks, void* buffer)
 {
-    if(read_count++ >= refresh_call_every || force_refresh)
+    CTR_CmdReadDataSession(session_current, sector, length, blocks, buffer);
+}
+
+void CTR_CmdReadDataSession(CartSession* session, u32 sector, u32 length, u32 blocks, void* buffer)
+{
+    if(session->read_count++ >= session->refresh_every || session->force_refresh)
     {
         
     #ifdef HundredRefreshes
         for (int i = 0; i < 100; i++)
         {
-            refresh_count += 99;
+            session->refresh_count += 99;
     #endif        
-            refresh_count++;
+            session->refresh_count++;
             CTR_CmdC5();
     #ifdef HundredRefreshes
         }
     #endif         
 
-        read_count = 0;
+        session->read_count = 0;
 
         char tempstr[64];
-        snprintf(tempstr, 64, "%d", refresh_count);
+        snprintf(tempstr, 64, "%lu", session->refresh_count);
         DrawString(MAIN_SCREEN, "Refresh count:", 0, 0, COLOR_STD_FONT, COLOR_STD_BG);
         DrawString(MAIN_SCREEN, tempstr, 0, 10, COLOR_STD_FONT, COLOR_STD_BG);
     }
@@ -51,6 +73,8 @@ void CTR_CmdReadData(u32 sector, u32 length, u32 blocks, void* buffer)
         0x00000000, 0x00000000
     };
     CTR_SendCommand(read_cmd, length, blocks, 0x104822C, buffer);
+    session->reads++;
+    session->sectors += (length * blocks) / 0x200;
     
    
     
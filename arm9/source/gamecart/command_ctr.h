@@ -6,8 +6,29 @@
 
 #include "common.h"
 
+#define CART_REFRESH_DEFAULT    10000
+
+// read / refresh policy and statistics of whoever reads the cart right now;
+// the fixer brings its own, and so do hashing, copying and fixing with the
+// forced refresh (SELECT) - everything else, verifying included, shares the
+// default one
+typedef struct {
+    u32 refresh_every;  // reads between two refreshes, 0 refreshes before every read
+    bool force_refresh; // refresh before every read while set
+    bool uncached;      // skip the cart read cache, retries have to reach the cart
+    u32 read_count;     // reads since the last refresh
+    u32 refresh_count;
+    u64 reads;
+    u64 sectors;
+} CartSession;
+
+void CTR_InitSession(CartSession* session, u32 refresh_every);
+CartSession* CTR_GetSession(void);
+CartSession* CTR_SetSession(CartSession* session); // NULL for the default, returns the previous one
+
 void CTR_CmdReadSectorSD(u8* aBuffer, u32 aSector);
 void CTR_CmdReadData(u32 sector, u32 length, u32 blocks, void* buffer);
+void CTR_CmdReadDataSession(CartSession* session, u32 sector, u32 length, u32 blocks, void* buffer);
 void CTR_CmdReadHeader(void* buffer);
 void CTR_CmdReadUniqueID(void* buffer);
 u32 CTR_CmdGetSecureId(u32 rand1, u32 rand2);
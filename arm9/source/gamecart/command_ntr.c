@@ -11,7 +11,20 @@
 #include "protocol_ntr.h"
 #include "card_ntr.h"
 
+// 0x1000 byte data reads, probed on the first bulk read after secure init
+#define NTR_PAGE_SIZE       0x1000
+#define NTR_PAGE_UNKNOWN    0
+#define NTR_PAGE_OK         1
+#define NTR_PAGE_BROKEN     2
+
 u32 ReadDataFlags = 0;
+static u32 ReadPageState = NTR_PAGE_UNKNOWN;
+
+// new cart, long reads get probed again
+void NTR_ResetReadPageState(void)
+{
+    ReadPageState = NTR_PAGE_UNKNOWN;
+}
 
 void NTR_CmdReset(void)
 {
@@ -64,4 +77,41 @@ void NTR_CmdReadData (u32 offset, void* buffer)
     cardParamCommand (NTRCARD_CMD_DATA_READ, offset, ReadDataFlags | NTRCARD_ACTIVATE | NTRCARD_nRESET | NTRCARD_BLK_SIZE(1), (u32*)buffer, 0x200 / 4);
 }
 
+static void NTR_CmdReadPage (u32 offset, void* buffer)
+{
+    cardParamCommand (NTRCARD_CMD_DATA_READ, offset, ReadDataFlags | NTRCARD_ACTIVATE | NTRCARD_nRESET | NTRCARD_BLK_SIZE(4), (u32*)buffer, NTR_PAGE_SIZE / 4);
+}
+
+// reads count 0x200 byte blocks, page aligned parts go out as 0x1000 byte
+// commands, which saves the per command latency on 7 out of 8 blocks
+void NTR_CmdReadDataBlocks (u32 offset, void* buffer, u32 count)
+{
+    u8* buff = (u8*) buffer;
 
+    while (count) {
+        if ((ReadPageState != NTR_PAGE_BROKEN) && !(offset % NTR_PAGE_SIZE) &&
+            (count >= NTR_PAGE_SIZE / 0x200)) {
+            NTR_CmdReadPage(offset, buff);
+            if (ReadPageState == NTR_PAGE_UNKNOWN) {
+                // some carts don't do long reads, check against single blocks once
+                u32 block[0x200 / 4];
+                ReadPageState = NTR_PAGE_OK;
+                for (u32 i = 0; i < NTR_PAGE_SIZE; i += 0x200) {
+                    NTR_CmdReadData(offset + i, block);
+                    if (memcmp(buff + i, block, 0x200) != 0) {
+                        memcpy(buff + i, block, 0x200);
+                        ReadPageState = NTR_PAGE_BROKEN;
+                    }
+                }
+            }
+            offset += NTR_PAGE_SIZE;
+            buff += NTR_PAGE_SIZE;
+            count -= NTR_PAGE_SIZE / 0x200;
+        } else {
+            NTR_CmdReadData(offset, buff);
+            offset += 0x200;
+            buff += 0x200;
+            count--;
+        }
+    }
+}
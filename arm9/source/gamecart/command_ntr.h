@@ -14,6 +14,8 @@ u32 NTR_CmdGetCartId(void);
 void NTR_CmdEnter16ByteMode(void);
 void NTR_CmdReadHeader (u8* buffer);
 void NTR_CmdReadData (u32 offset, void* buffer);
+void NTR_CmdReadDataBlocks (u32 offset, void* buffer, u32 count);
+void NTR_ResetReadPageState(void);
 
 bool NTR_Secure_Init (u8* buffer, u8* sa_copy, u32 CartID, int iCardDevice);
 
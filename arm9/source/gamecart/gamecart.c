@@ -3,13 +3,13 @@
 #include "command_ctr.h"
 #include "command_ntr.h"
 #include "card_spi.h"
+#include "cartinfo.h"
 #include "nds.h"
 #include "ncch.h"
 #include "ncsd.h"
+#include "profile.h"
 #include "rtc.h"
 
-#define CART_INSERTED (!(REG_CARDSTATUS & 0x1))
-
 typedef struct {
     NcsdHeader ncsd;
     u32 card2_offset;
@@ -217,29 +217,32 @@ u32 InitCartRead(CartData* cdata) {
         memset(priv_header + 0x44, 0x00, 4);
         memset(priv_header + 0x48, 0xFF, 8);
 
-        // save data
-        u32 card2_offset = getle32(cdata->header + 0x200);
-        if (card2_offset != 0xFFFFFFFF) {
-            cdata->save_type = CARD_SAVE_CARD2;
-            cdata->save_size = GetCtrCartSaveSize(cdata);
-            // Sanity checks
-            if ((cdata->save_size == 0) ||
-                (card2_offset * NCSD_MEDIA_UNIT >= cdata->cart_size) ||
-                (card2_offset * NCSD_MEDIA_UNIT + cdata->save_size > cdata->cart_size)) {
-                cdata->save_type = CARD_SAVE_NONE;
-            }
-        } else {
-            cdata->spi_save_type = (CardSPIType) { FLASH_CTR_GENERIC, false };
-            cdata->save_size = CardSPIGetCapacity(cdata->spi_save_type);
-            if (cdata->save_size == 0) {
-                cdata->spi_save_type = (CardSPIType) { NO_CHIP, false };
-            }
-            if (cdata->spi_save_type.chip == NO_CHIP) {
-                cdata->save_type = CARD_SAVE_NONE;
+        // save data, known carts skip the probing
+        if (!CartInfoLoad(cdata)) {
+            u32 card2_offset = getle32(cdata->header + 0x200);
+            if (card2_offset != 0xFFFFFFFF) {
+                cdata->save_type = CARD_SAVE_CARD2;
+                cdata->save_size = GetCtrCartSaveSize(cdata);
+                // Sanity checks
+                if ((cdata->save_size == 0) ||
+                    (card2_offset * NCSD_MEDIA_UNIT >= cdata->cart_size) ||
+                    (card2_offset * NCSD_MEDIA_UNIT + cdata->save_size > cdata->cart_size)) {
+                    cdata->save_type = CARD_SAVE_NONE;
+                }
             } else {
-                cdata->save_type = CARD_SAVE_SPI;
+                cdata->spi_save_type = (CardSPIType) { FLASH_CTR_GENERIC, false };
                 cdata->save_size = CardSPIGetCapacity(cdata->spi_save_type);
+                if (cdata->save_size == 0) {
+                    cdata->spi_save_type = (CardSPIType) { NO_CHIP, false };
+                }
+                if (cdata->spi_save_type.chip == NO_CHIP) {
+                    cdata->save_type = CARD_SAVE_NONE;
+                } else {
+                    cdata->save_type = CARD_SAVE_SPI;
+                    cdata->save_size = CardSPIGetCapacity(cdata->spi_save_type);
+                }
             }
+            if (cdata->save_type != CARD_SAVE_NONE) CartInfoSave(cdata);
         }
     } else { // NTR/TWL cartridges
         // NTR header
@@ -281,7 +284,7 @@ u32 InitCartRead(CartData* cdata) {
         // last safety check
         if (cdata->data_size > cdata->cart_size) return 1;
 
-        // save data
+        // save data, always probed (nothing read so far tells the save chip apart)
         bool infrared = *(nds_header->game_code) == 'I';
         cdata->spi_save_type = CardSPIGetCardSPIType(infrared);
         if (cdata->spi_save_type.chip == NO_CHIP) {
@@ -295,8 +298,10 @@ u32 InitCartRead(CartData* cdata) {
 }
 
 u32 ReadCartSectors(void* buffer, u32 sector, u32 count, CartData* cdata, bool card2_blanking) {
+    PROFILE_ZONE(PROF_CART_READ);
     u8* buffer8 = (u8*) buffer;
     if (!CART_INSERTED) return 1;
+    PROFILE_BYTES(PROF_CART_READ, count * 0x200);
     // header
     const u32 header_sectors = 0x4000/0x200;
     if (sector < header_sectors) {
@@ -358,9 +363,7 @@ u32 ReadCartSectors(void* buffer, u32 sector, u32 count, CartData* cdata, bool c
         }
 
         // regular cart data
-        u32 off = sector * 0x200;
-        for (u32 i = 0; i < count; i++, off += 0x200, buff += 0x200)
-            NTR_CmdReadData(off, buff);
+        NTR_CmdReadDataBlocks(sector * 0x200, buff, count);
 
         // modcrypt area handling
         if ((cdata->cart_type & CART_TWL) &&
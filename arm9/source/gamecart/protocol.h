@@ -10,6 +10,8 @@
 #define REG_CARDCYCLES0 (*(vu16*)0x10000012)
 #define REG_CARDCYCLES1 (*(vu16*)0x10000014)
 
+#define CART_INSERTED (!(REG_CARDSTATUS & 0x1))
+
 
 #define LATENCY 0x822Cu
 #define BSWAP32(n)  __builtin_bswap32(n)
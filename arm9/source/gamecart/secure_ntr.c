@@ -20,6 +20,7 @@
 
 #include "protocol_ntr.h"
 #include "secure_ntr.h"
+#include "command_ntr.h"
 #include "card_ntr.h"
 // #include "draw.h"
 #include "timer.h"
@@ -252,6 +253,7 @@ bool NTR_Secure_Init (u8* header, u8* sa_copy, u32 CartID, int iCardDevice)
 
     iGameCode = *((vu32*)(void*)&header[0x0C]);
     ReadDataFlags = cardControl13 & ~ NTRCARD_BLK_SIZE(7);
+    NTR_ResetReadPageState();
     NTR_InitKey (iGameCode, iCardHash, nCardHash, iKeyCode, iCardDevice?1:2, iCardDevice);
 
     if(!iCheapCard) flagsKey1 |= NTRCARD_SEC_LARGE;
@@ -25,6 +25,9 @@
 #include "vram0.h"
 #include "i2c.h"
 #include "pxi.h"
+#include "profile.h"
+#include "card_spi_emu.h"
+#include "command_ctr.h"
 
 #ifndef N_PANES
 #define N_PANES 3
@@ -43,8 +46,6 @@
 #define BOOTMENU_KEY    BUTTON_START
 #endif
 
-extern int refresh_call_every;
-
 
 typedef struct {
     char path[256];
@@ -135,12 +136,7 @@ u32 SplashInit(const char* modestr) {
     ClearScreenF(true, true, COLOR_STD_BG);
 
     if (splash) {
-        u32 splash_width, splash_height;
-        u16* bitmap = PNG_Decompress(splash, splash_size, &splash_width, &splash_height);
-        if (bitmap) {
-            DrawBitmap(TOP_SCREEN, -1, -1, splash_width, splash_height, bitmap);
-            free(bitmap);
-        }
+        DrawPng(TOP_SCREEN, -1, -1, splash, splash_size);
     } else {
         DrawStringF(TOP_SCREEN, 10, 10, COLOR_STD_FONT, COLOR_TRANSPARENT, "(" VRAM0_SPLASH_PNG " not found)");
     }
@@ -507,7 +503,6 @@ u32 SdFormatMenu(const char* slabel) {
 u32 FileGraphicsViewer(const char* path) {
     const u32 max_size = SCREEN_SIZE(ALT_SCREEN);
     u64 filetype = IdentifyFileType(path);
-    u16* bitmap = NULL;
     u8* input = (u8*)malloc(max_size);
     u32 w = 0;
     u32 h = 0;
@@ -517,22 +512,18 @@ u32 FileGraphicsViewer(const char* path) {
         return ret;
 
     u32 input_size = FileGetData(path, input, max_size, 0);
-    if (input_size && (input_size < max_size)) {
-        if (filetype & GFX_PNG) {
-            bitmap = PNG_Decompress(input, input_size, &w, &h);
-            if (bitmap != NULL) ret = 0;
-        }
-    }
-
-    if ((ret == 0) && w && h && (w <= SCREEN_WIDTH(ALT_SCREEN)) && (h <= SCREEN_HEIGHT)) {
+    if (input_size && (input_size < max_size) && (filetype & GFX_PNG) &&
+        PNG_GetSize(input, input_size, &w, &h) && w && h &&
+        (w <= SCREEN_WIDTH(ALT_SCREEN)) && (h <= SCREEN_HEIGHT)) {
         ClearScreenF(true, true, COLOR_STD_BG);
-        DrawBitmap(ALT_SCREEN, -1, -1, w, h, bitmap);
-        ShowString("Press <A> to continue");
-        while(!(InputWait(0) & (BUTTON_A | BUTTON_B)));
+        if (DrawPng(ALT_SCREEN, -1, -1, input, input_size)) {
+            ShowString("Press <A> to continue");
+            while(!(InputWait(0) & (BUTTON_A | BUTTON_B)));
+            ret = 0;
+        }
         ClearScreenF(true, true, COLOR_STD_BG);
-    } else ret = 1;
+    }
 
-    free(bitmap);
     free(input);
     return ret;
 }
@@ -659,7 +650,7 @@ u32 FileHexViewer(const char* path) {
             last_mode = mode;
             ClearScreen(TOP_SCREEN, COLOR_STD_BG);
             if (dual_screen) ClearScreen(BOT_SCREEN, COLOR_STD_BG);
-            else memcpy(BOT_SCREEN, bottom_cpy, SCREEN_SIZE_BOT);
+            else RestoreScreen(BOT_SCREEN, (u16*) bottom_cpy);
         }
         // fix offset (if required)
         if (offset % cols) offset -= (offset % cols); // fix offset (align to cols)
@@ -752,7 +743,7 @@ u32 FileHexViewer(const char* path) {
                 } else offset = found_offset;
                 if (MAIN_SCREEN == TOP_SCREEN) ClearScreen(TOP_SCREEN, COLOR_STD_BG);
                 else if (dual_screen) ClearScreen(BOT_SCREEN, COLOR_STD_BG);
-                else memcpy(BOT_SCREEN, bottom_cpy, SCREEN_SIZE_BOT);
+                else RestoreScreen(BOT_SCREEN, (u16*) bottom_cpy);
             } else if (pad_state & BUTTON_X) {
                 static const char* optionstr[3] = { "Go to offset", "Search for string", "Search for data" };
                 u32 user_select = ShowSelectPrompt(3, optionstr, "Current offset: %08X\nSelect action:",
@@ -784,7 +775,7 @@ u32 FileHexViewer(const char* path) {
                 }
                 if (MAIN_SCREEN == TOP_SCREEN) ClearScreen(TOP_SCREEN, COLOR_STD_BG);
                 else if (dual_screen) ClearScreen(BOT_SCREEN, COLOR_STD_BG);
-                else memcpy(BOT_SCREEN, bottom_cpy, SCREEN_SIZE_BOT);
+                else RestoreScreen(BOT_SCREEN, (u16*) bottom_cpy);
             }
             if (edit_mode && CheckWritePermissions(path)) { // setup edit mode
                 found_size = 0;
@@ -838,7 +829,7 @@ u32 FileHexViewer(const char* path) {
     }
 
     ClearScreen(TOP_SCREEN, COLOR_STD_BG);
-    if (MAIN_SCREEN == TOP_SCREEN) memcpy(BOT_SCREEN, bottom_cpy, SCREEN_SIZE_BOT);
+    if (MAIN_SCREEN == TOP_SCREEN) RestoreScreen(BOT_SCREEN, (u16*) bottom_cpy);
     else ClearScreen(BOT_SCREEN, COLOR_STD_BG);
 
     free(bottom_cpy);
@@ -1317,10 +1308,14 @@ u32 FileHandlerMenu(char* current_path, u32* cursor, u32* scroll, PaneData** pan
     }
     else if (user_select == calcsha1) { // -> calculate SHA-1
 
+        CartSession session, *prev_session = CTR_GetSession();
         if (CheckButton(BUTTON_SELECT))
         {
             if (ShowPrompt(true, "This will run refresh on EVERY read. \nOnly use this option for broken cartridges. \nAre you SURE you want to do this?"))
-                refresh_call_every = 0;
+            {
+                CTR_InitSession(&session, 0);
+                CTR_SetSession(&session);
+            }
             else
                 return 0;
         }
@@ -1328,7 +1323,7 @@ u32 FileHandlerMenu(char* current_path, u32* cursor, u32* scroll, PaneData** pan
         ShaCalculator(file_path, true);
         GetDirContents(current_dir, current_path);
 
-        refresh_call_every = 10000;
+        CTR_SetSession(prev_session);
         return 0;
     }
     else if (user_select == calccmac) { // -> calculate CMAC
@@ -1381,17 +1376,21 @@ u32 FileHandlerMenu(char* current_path, u32* cursor, u32* scroll, PaneData** pan
     }
     else if (user_select == copystd) { // -> copy to OUTPUT_PATH
         
+        CartSession session, *prev_session = CTR_GetSession();
         if (CheckButton(BUTTON_SELECT))
         {
             if (ShowPrompt(true, "This will run refresh on EVERY read. \nOnly use this option for broken cartridges. \nAre you SURE you want to do this?"))
-                refresh_call_every = 0;
+            {
+                CTR_InitSession(&session, 0);
+                CTR_SetSession(&session);
+            }
             else
                 return 0;
         }
 
         StandardCopy(cursor, scroll);
 
-        refresh_call_every = 10000;
+        CTR_SetSession(prev_session);
         return 0;
     }
     else if (user_select == inject) { // -> inject data from clipboard
@@ -1572,17 +1571,21 @@ u32 FileHandlerMenu(char* current_path, u32* cursor, u32* scroll, PaneData** pan
             autoskip = true; 
         }        
                 
+        CartSession session, *prev_session = CTR_GetSession();
         if (CheckButton(BUTTON_SELECT))
         {
             if (ShowPrompt(true, "This will run refresh on EVERY read. \nOnly use this option for broken cartridges. \nAre you SURE you want to do this?"))
-                refresh_call_every = 0;
+            {
+                CTR_InitSession(&session, 0);
+                CTR_SetSession(&session);
+            }
             else
                 return 0;
         }
 
         ShowPrompt(false, "Corruption fix run %s", (AttemptFixNcsdFile(file_path, log, autoskip) == 0) ? "finished. Run verify." : "failed.");
 
-        refresh_call_every = 10000;
+        CTR_SetSession(prev_session);
 
         return 0;
     }
@@ -2240,7 +2243,7 @@ u32 HomeMoreMenu(char* current_path) {
     NandPartitionInfo np_info;
     if (GetNandPartitionInfo(&np_info, NP_TYPE_BONUS, NP_SUBTYPE_CTR, 0, NAND_SYSNAND) != 0) np_info.count = 0;
 
-    const char* optionstr[8];
+    const char* optionstr[12];
     const char* promptstr = "HOME more... menu.\nSelect action:";
     u32 n_opt = 0;
     int sdformat = ++n_opt;
@@ -2252,6 +2255,11 @@ u32 HomeMoreMenu(char* current_path) {
     int bright = ++n_opt;
     int calib = ++n_opt;
     int sysinfo = ++n_opt;
+    #ifdef PROFILE_ZONES
+    int profile = ++n_opt;
+    #else
+    int profile = -1;
+    #endif
     int readme = (FindVTarFileInfo(VRAM0_README_MD, NULL)) ? (int) ++n_opt : -1;
 
     if (sdformat > 0) optionstr[sdformat - 1] = "SD format menu";
@@ -2263,6 +2271,7 @@ u32 HomeMoreMenu(char* current_path) {
     if (bright > 0) optionstr[bright - 1] = "Configure brightness";
     if (calib > 0) optionstr[calib - 1] = "Calibrate touchscreen";
     if (sysinfo > 0) optionstr[sysinfo - 1] = "System info";
+    if (profile > 0) optionstr[profile - 1] = "Profiling data";
     if (readme > 0) optionstr[readme - 1] = "Show ReadMe";
 
     int user_select = ShowSelectPrompt(n_opt, optionstr, "%s", promptstr);
@@ -2384,10 +2393,47 @@ u32 HomeMoreMenu(char* current_path) {
         char* sysinfo_txt = (char*) malloc(STD_BUFFER_SIZE);
         if (!sysinfo_txt) return 1;
         MyriaSysinfo(sysinfo_txt);
+        #ifdef MONITOR_HEAP
+        u32 sysinfo_len = strnlen(sysinfo_txt, STD_BUFFER_SIZE);
+        mem_report(sysinfo_txt + sysinfo_len, STD_BUFFER_SIZE - sysinfo_len);
+        #endif
         MemTextViewer(sysinfo_txt, strnlen(sysinfo_txt, STD_BUFFER_SIZE), 1, false);
         free(sysinfo_txt);
         return 0;
     }
+    else if (user_select == profile) { // profiling zones
+        char* profile_txt = (char*) malloc(STD_BUFFER_SIZE);
+        if (!profile_txt) return 1;
+        u32 profile_len = ProfileReport(profile_txt, STD_BUFFER_SIZE, false);
+        MemTextViewer(profile_txt, profile_len, 1, false);
+
+        const char* profile_optstr[4] = { "Save as CSV to " OUTPUT_PATH, "Reset counters", "Memory benchmark", "Save chip benchmark" };
+        u32 profile_select = ShowSelectPrompt(4, profile_optstr, "Profiling data");
+        if (profile_select == 1) {
+            char csv_path[64];
+            DsTime dstime;
+            get_dstime(&dstime);
+            snprintf(csv_path, sizeof(csv_path), OUTPUT_PATH "/profile_%02X%02X%02X%02X%02X%02X.csv",
+                dstime.bcd_Y, dstime.bcd_M, dstime.bcd_D, dstime.bcd_h, dstime.bcd_m, dstime.bcd_s);
+            profile_len = ProfileReport(profile_txt, STD_BUFFER_SIZE, true);
+            fvx_rmkdir(OUTPUT_PATH);
+            ShowPrompt(false, "%s\n%s", csv_path, FileSetData(csv_path, profile_txt, profile_len, 0, true) ?
+                "Profiling data saved" : "Failed saving profiling data");
+        } else if (profile_select == 2) {
+            ProfileReset();
+        } else if (profile_select == 3) {
+            ShowString("Running memory benchmark...");
+            profile_len = ProfileMemBench(profile_txt, STD_BUFFER_SIZE);
+            MemTextViewer(profile_txt, profile_len, 1, false);
+        } else if (profile_select == 4) {
+            ShowString("Running save chip benchmark...");
+            profile_len = CardSPIEmuBench(profile_txt, STD_BUFFER_SIZE);
+            MemTextViewer(profile_txt, profile_len, 1, false);
+        }
+
+        free(profile_txt);
+        return 0;
+    }
     else if (user_select == readme) { // Display GodMode9 readme
         u64 README_md_size;
         char* README_md = FindVTarFileInfo(VRAM0_README_MD, &README_md_size);
@@ -2590,9 +2636,11 @@ u32 GodMode(int entrypoint) {
             curr_entry->marked = mark_next;
             mark_next = -2;
         }
+        BeginFrame();
         DrawDirContents(current_dir, cursor, &scroll);
         DrawUserInterface(current_path, curr_entry, N_PANES ? pane - panedata + 1 : 0);
         DrawTopBar(current_path);
+        EndFrame();
 
         // check write permissions
         if (~last_write_perm & GetWritePermissions()) {
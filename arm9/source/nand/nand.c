@@ -350,7 +350,9 @@ int ReadNandSectors(void* buffer, u32 sector, u32 count, u32 keyslot, u32 nand_s
 int WriteNandSectors(const void* buffer, u32 sector, u32 count, u32 keyslot, u32 nand_dst)
 {
     // buffer must not be changed, so this is a little complicated
-    void* nand_buffer = (void*) malloc(min(STD_BUFFER_SIZE, count * 0x200));
+    // (bounce buffers come from the pools, this is called for single sectors a lot)
+    MemPoolId pool = (count * 0x200 <= MEMPOOL_SECTOR_SIZE) ? MEMPOOL_SECTOR : MEMPOOL_IO;
+    void* nand_buffer = mem_pool_get(pool);
     if (!nand_buffer) return -1;
     int errorcode = 0;
 
@@ -373,7 +375,7 @@ int WriteNandSectors(const void* buffer, u32 sector, u32 count, u32 keyslot, u32
         }
     }
 
-    free(nand_buffer);
+    mem_pool_put(pool, nand_buffer);
     return errorcode;
 }
 
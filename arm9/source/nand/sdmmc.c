@@ -27,6 +27,7 @@
 #include <stdbool.h>
 #include "timer.h"
 #include "sdmmc.h"
+#include "profile.h"
 
 #define DATA32_SUPPORT
 
@@ -250,6 +251,8 @@ static void sdmmc_send_command(struct mmcdevice *ctx, u32 cmd, u32 args)
 
 int sdmmc_sdcard_writesectors(u32 sector_no, u32 numsectors, const u8 *in)
 {
+	PROFILE_ZONE(PROF_SD_WRITE);
+	PROFILE_BYTES(PROF_SD_WRITE, numsectors << 9);
 	if(handleSD.isSDHC == 0) sector_no <<= 9;
 	set_target(&handleSD);
 	sdmmc_write16(REG_SDSTOP,0x100);
@@ -266,6 +269,8 @@ int sdmmc_sdcard_writesectors(u32 sector_no, u32 numsectors, const u8 *in)
 
 int sdmmc_sdcard_readsectors(u32 sector_no, u32 numsectors, u8 *out)
 {
+	PROFILE_ZONE(PROF_SD_READ);
+	PROFILE_BYTES(PROF_SD_READ, numsectors << 9);
 	if(handleSD.isSDHC == 0) sector_no <<= 9;
 	set_target(&handleSD);
 	sdmmc_write16(REG_SDSTOP,0x100);
@@ -284,6 +289,8 @@ int sdmmc_sdcard_readsectors(u32 sector_no, u32 numsectors, u8 *out)
 
 int sdmmc_nand_readsectors(u32 sector_no, u32 numsectors, u8 *out)
 {
+	PROFILE_ZONE(PROF_NAND);
+	PROFILE_BYTES(PROF_NAND, numsectors << 9);
 	if(handleNAND.isSDHC == 0) sector_no <<= 9;
 	set_target(&handleNAND);
 	sdmmc_write16(REG_SDSTOP,0x100);
@@ -300,6 +307,8 @@ int sdmmc_nand_readsectors(u32 sector_no, u32 numsectors, u8 *out)
 
 int sdmmc_nand_writesectors(u32 sector_no, u32 numsectors, const u8 *in) //experimental
 {
+	PROFILE_ZONE(PROF_NAND);
+	PROFILE_BYTES(PROF_NAND, numsectors << 9);
 	if(handleNAND.isSDHC == 0) sector_no <<= 9;
 	set_target(&handleNAND);
 	sdmmc_write16(REG_SDSTOP,0x100);
@@ -2,40 +2,65 @@
 #include "arm.h"
 
 #include "i2c.h"
-#include "pxi.h"
-#include "shmem.h"
+#include "offload.h"
 
 bool I2C_readRegBuf(I2cDevice devId, u8 regAddr, u8 *out, u32 size)
 {
-	int ret;
-	u8 *const dataBuffer = ARM_GetSHMEM()->dataBuffer.b;
-	const u32 arg = devId | (regAddr << 8) | (size << 16);
+	const u32 args[3] = { devId, regAddr, size };
+	u32 ticket, ret;
+	u8 *data;
 
-	if (size >= SHMEM_BUFFER_SIZE)
+	if (size > PXIJOB_DATA_SIZE)
 		return false;
 
-	ret = PXI_DoCMD(PXICMD_I2C_OP, &arg, 1);
-	ARM_InvDC_Range(dataBuffer, size);
+	OffloadReserve(1);
+	if (!OffloadPrepare(0, PXIJOB_I2C_READ, args, 3))
+		return false;
+
+	ticket = OffloadPublish(1);
+	if (!OffloadWait(ticket, &ret) || !(data = OffloadData(ticket)))
+		return false;
 
-	memcpy(out, dataBuffer, size);
+	memcpy(out, data, size);
 	return ret;
 }
 
 bool I2C_writeRegBuf(I2cDevice devId, u8 regAddr, const u8 *in, u32 size)
 {
-	int ret;
-	u8 *const dataBuffer = ARM_GetSHMEM()->dataBuffer.b;
-	const u32 arg = devId | (regAddr << 8) | (size << 16) | BIT(31);
+	return I2C_writeRegs(devId, &regAddr, in, size, 1);
+}
+
+bool I2C_writeRegs(I2cDevice devId, const u8 *regAddrs, const u8 *in, u32 size, u32 count)
+{
+	u32 ticket, ret;
 
-	if (size >= SHMEM_BUFFER_SIZE)
+	if (size > PXIJOB_DATA_SIZE)
 		return false;
 
-	memcpy(dataBuffer, in, size);
-	ARM_WbDC_Range(dataBuffer, size);
-	ARM_DSB();
+	// writes go out in order, a full queue per batch
+	while (count) {
+		u32 batch = OffloadReserve(count);
 
-	ret = PXI_DoCMD(PXICMD_I2C_OP, &arg, 1);
-	return ret;
+		for (u32 i = 0; i < batch; i++) {
+			const u32 args[3] = { devId, regAddrs[i], size };
+			u8 *data = OffloadPrepare(i, PXIJOB_I2C_WRITE, args, 3);
+			if (!data)
+				return false;
+			memcpy(data, in + (i * size), size);
+		}
+
+		ticket = OffloadPublish(batch);
+		for (u32 i = 0; i < batch; i++) {
+			if (!OffloadWait(ticket + i, &ret) || !ret)
+				return false;
+		}
+
+		regAddrs += batch;
+		in += batch * size;
+		count -= batch;
+	}
+
+	return true;
 }
 
 u8 I2C_readReg(I2cDevice devId, u8 regAddr)
@@ -59,6 +59,20 @@ bool I2C_readRegBuf(I2cDevice devId, u8 regAddr, u8 *out, u32 size);
  */
 bool I2C_writeRegBuf(I2cDevice devId, u8 regAddr, const u8 *in, u32 size);
 
+/**
+ * @brief      Writes equally sized buffers to several I2C registers, handed
+ *             to the ARM11 in batches instead of one by one.
+ *
+ * @param[in]  devId     The device ID. Use the enum above.
+ * @param[in]  regAddrs  The register addresses, one per write.
+ * @param[in]  in        The input buffers, back to back.
+ * @param[in]  size      The size of a single write.
+ * @param[in]  count     The number of writes.
+ *
+ * @return     Returns true if all writes succeeded and false otherwise.
+ */
+bool I2C_writeRegs(I2cDevice devId, const u8 *regAddrs, const u8 *in, u32 size, u32 count);
+
 /**
  * @brief      Reads a byte from a I2C register.
  *
@@ -1,11 +1,76 @@
 #include "mymalloc.h"
-#include <stdlib.h>
+#include "common.h"
+#include <malloc.h>
+#include <unistd.h>
+
+// this file needs the real allocator
+#undef malloc
+#undef realloc
+#undef free
+
+// pools and arenas are accounted like everything else when monitoring the heap
+#ifdef MONITOR_HEAP
+#define mem_alloc_raw my_malloc
+#define mem_free_raw my_free
+#else
+#define mem_alloc_raw mem_malloc
+#define mem_free_raw free
+#endif
+
+#define MEM_STATS_MAX   16
+#define MEM_ARENA_ALIGN 8
+
+typedef struct {
+    const char* name;
+    size_t current;
+    size_t high_water;
+} MemStats;
+
+typedef struct {
+    size_t size;
+    u32 keep; // max number of cached free buffers
+    u32 n_free;
+    void* free_list[4];
+    u32 stats;
+} MemPool;
+
+extern char* fake_heap_end;
 
 static size_t total_allocated = 0;
 
+static MemStats mem_stats[MEM_STATS_MAX] = {
+    { "pool/io", 0, 0 },
+    { "pool/sector", 0, 0 }
+};
+static u32 n_mem_stats = MEMPOOL_COUNT;
+
+static MemPool mem_pools[MEMPOOL_COUNT] = {
+    { STD_BUFFER_SIZE, 2, 0, { NULL }, MEMPOOL_IO },
+    { MEMPOOL_SECTOR_SIZE, 4, 0, { NULL }, MEMPOOL_SECTOR }
+};
+
+// plain allocations get the cached pool buffers back before giving up
+void* mem_malloc(size_t size) {
+    void* ptr = malloc(size);
+    if (!ptr && size) {
+        mem_pool_trim();
+        ptr = malloc(size);
+    }
+    return ptr;
+}
+
+void* mem_realloc(void* ptr, size_t new_size) {
+    void* new_ptr = realloc(ptr, new_size);
+    if (!new_ptr && new_size) { // ptr is still valid here
+        mem_pool_trim();
+        new_ptr = realloc(ptr, new_size);
+    }
+    return new_ptr;
+}
+
 void* my_malloc(size_t size) {
     if (!size) return NULL; // nothing, return nothing
-    void* ptr = (void*) malloc(sizeof(size_t) + size);
+    void* ptr = mem_malloc(sizeof(size_t) + size);
     if (ptr) total_allocated += size;
     if (ptr) (*(size_t*) ptr) = size;
     return ptr ? (((char*) ptr) + sizeof(size_t)) : NULL;
@@ -23,7 +88,7 @@ void *my_realloc(void *ptr, size_t new_size) {
     void *real_ptr = (char*)ptr - sizeof(size_t);
     size_t old_size = *(size_t*)real_ptr;
 
-    void *new_ptr = realloc(real_ptr, new_size + sizeof(size_t));
+    void *new_ptr = mem_realloc(real_ptr, new_size + sizeof(size_t));
     if (new_ptr) {
         total_allocated -= old_size;
         total_allocated += new_size;
@@ -46,12 +111,98 @@ size_t mem_allocated(void) {
     return total_allocated;
 }
 
-size_t my_malloc_test(void) {
-    size_t add = 1024 * 1024;
-    for (size_t s = add;; s += add) {
-        void* ptr = (void*) malloc(s);
-        if (!ptr) return s;
-        free(ptr);
+// free bytes inside the malloc arena plus what is left above the break
+// fragmentation means the largest possible allocation may be smaller
+size_t mem_available(void) {
+    struct mallinfo mi = mallinfo();
+    char* heap_top = (char*) sbrk(0);
+    size_t unused = (heap_top && (heap_top < fake_heap_end)) ? (size_t) (fake_heap_end - heap_top) : 0;
+    return unused + mi.fordblks;
+}
+
+static u32 mem_stats_slot(const char* name) {
+    for (u32 i = 0; i < n_mem_stats; i++)
+        if (strncmp(mem_stats[i].name, name, 16) == 0) return i;
+    if (n_mem_stats >= MEM_STATS_MAX) return MEM_STATS_MAX - 1; // shared overflow slot
+    mem_stats[n_mem_stats].name = name;
+    return n_mem_stats++;
+}
+
+static void mem_stats_add(u32 slot, size_t size) {
+    MemStats* stats = mem_stats + slot;
+    stats->current += size;
+    stats->high_water = max(stats->high_water, stats->current);
+}
+
+void* mem_pool_get(MemPoolId id) {
+    MemPool* pool = mem_pools + id;
+    void* ptr = NULL;
+
+    if (pool->n_free) ptr = pool->free_list[--pool->n_free];
+    else ptr = mem_alloc_raw(pool->size); // trims the other pools if needed
+
+    if (ptr) mem_stats_add(pool->stats, pool->size);
+    return ptr;
+}
+
+void mem_pool_put(MemPoolId id, void* ptr) {
+    MemPool* pool = mem_pools + id;
+    if (!ptr) return;
+
+    mem_stats[pool->stats].current -= pool->size;
+    if (pool->n_free < pool->keep) pool->free_list[pool->n_free++] = ptr;
+    else mem_free_raw(ptr);
+}
+
+size_t mem_pool_size(MemPoolId id) {
+    return mem_pools[id].size;
+}
+
+// gives all cached buffers back to the heap
+void mem_pool_trim(void) {
+    for (u32 p = 0; p < MEMPOOL_COUNT; p++) {
+        MemPool* pool = mem_pools + p;
+        while (pool->n_free) mem_free_raw(pool->free_list[--pool->n_free]);
     }
-    return 0; // unreachable
+}
+
+bool mem_arena_init(MemArena* arena, size_t size, const char* name) {
+    arena->base = (u8*) mem_alloc_raw(size);
+
+    arena->size = arena->base ? size : 0;
+    arena->used = 0;
+    arena->stats = mem_stats_slot(name);
+    mem_stats_add(arena->stats, arena->size);
+    return arena->base != NULL;
+}
+
+// allocations are 8 byte aligned, they can't be freed one by one
+void* mem_arena_alloc(MemArena* arena, size_t size) {
+    size_t offset = (arena->used + MEM_ARENA_ALIGN - 1) & ~(MEM_ARENA_ALIGN - 1);
+    if (!size || (offset > arena->size) || (size > arena->size - offset)) return NULL;
+    arena->used = offset + size;
+    return arena->base + offset;
+}
+
+// gives back everything allocated after the mark (a previous arena->used)
+void mem_arena_reset(MemArena* arena, size_t mark) {
+    if (mark < arena->used) arena->used = mark;
+}
+
+void mem_arena_free(MemArena* arena) {
+    if (!arena->base) return;
+    mem_stats[arena->stats].current -= arena->size;
+    mem_free_raw(arena->base);
+    arena->base = NULL;
+    arena->size = arena->used = 0;
+}
+
+// current use and high-water mark per subsystem
+u32 mem_report(char* txt, u32 max_len) {
+    u32 len = snprintf(txt, max_len, "Heap: %lu KB in use, %lu KB available\n",
+        (u32) (mem_allocated() >> 10), (u32) (mem_available() >> 10));
+    for (u32 i = 0; (i < n_mem_stats) && (len < max_len); i++)
+        len += snprintf(txt + len, max_len - len, "%s: %lu KB (peak %lu KB)\n", mem_stats[i].name,
+            (u32) (mem_stats[i].current >> 10), (u32) (mem_stats[i].high_water >> 10));
+    return min(len, max_len);
 }
@@ -1,9 +1,43 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdbool.h>
+#include <types.h>
 
+// fixed size buffer pools, released buffers are kept around for reuse
+// pooled buffers come from mem_pool_get() and go back via mem_pool_put()
+typedef enum {
+    MEMPOOL_IO = 0,     // STD_BUFFER_SIZE, for I/O loops and hash scratch
+    MEMPOOL_SECTOR,     // MEMPOOL_SECTOR_SIZE, for small sector bounce buffers
+    MEMPOOL_COUNT
+} MemPoolId;
+
+#define MEMPOOL_SECTOR_SIZE 0x4000
+
+// scoped arena, one allocation that is given out piece by piece and freed at once
+typedef struct {
+    u8* base;
+    size_t size;
+    size_t used;
+    u32 stats; // subsystem accounting slot
+} MemArena;
+
+void* mem_malloc(size_t size);
+void* mem_realloc(void* ptr, size_t new_size);
 void* my_malloc(size_t size);
 void *my_realloc(void *ptr, size_t new_size);
 void my_free(void* ptr);
 size_t mem_allocated(void);
-size_t my_malloc_test(void);
+size_t mem_available(void);
+
+void* mem_pool_get(MemPoolId pool);
+void mem_pool_put(MemPoolId pool, void* ptr);
+size_t mem_pool_size(MemPoolId pool);
+void mem_pool_trim(void);
+
+bool mem_arena_init(MemArena* arena, size_t size, const char* name);
+void* mem_arena_alloc(MemArena* arena, size_t size);
+void mem_arena_reset(MemArena* arena, size_t mark);
+void mem_arena_free(MemArena* arena);
+
+u32 mem_report(char* txt, u32 max_len);
@@ -0,0 +1,119 @@
+#include "offload.h"
+#include "memmap.h"
+#include "arm.h"
+#include "pxi.h"
+#include "shmem.h"
+#include "profile.h"
+
+#ifdef PROFILE_ZONES
+// per slot submit time, latency is counted when the ARM9 first sees the job done
+static u32 offload_start[PXIJOB_QUEUE_LEN];
+static u32 offload_ticket[PXIJOB_QUEUE_LEN];
+static u32 offload_func[PXIJOB_QUEUE_LEN];
+static u32 offload_timed = 0; // one bit per slot still being timed
+#endif
+
+static inline PxiJobQueue* GetJobQueue(void) {
+    return &(ARM_GetSHMEM()->jobQueue);
+}
+
+bool OffloadBufferOk(const void* buffer, u32 size) {
+    u32 start = (u32) buffer;
+    return (start >= __FCRAM0_ADDR) && (start <= __FCRAM0_END) &&
+        (size <= __FCRAM0_END - start);
+}
+
+u32 OffloadReserve(u32 count) {
+    PxiJobQueue* queue = GetJobQueue();
+    count = min(count, PXIJOB_QUEUE_LEN);
+    while (PxiJobFree(queue) < count);
+    return count;
+}
+
+u8* OffloadPrepare(u32 index, u32 func, const u32* args, u32 argc) {
+    PxiJobQueue* queue = GetJobQueue();
+    if (!PxiJobPrepare(queue, index, func, args, argc)) return NULL;
+    return queue->data[(queue->head + index) % PXIJOB_QUEUE_LEN];
+}
+
+u32 OffloadPublish(u32 count) {
+    PxiJobQueue* queue = GetJobQueue();
+    u32 ticket = PxiJobPublish(queue, count);
+    // the ARM11 only needs a wake up if it ran out of work, it may have
+    // gone to sleep without seeing the new head if it finished everything
+    // before that (it checks head only after updating tail, we check tail
+    // only after publishing head, so one of us sees the other's update)
+    if (count && PxiJobDone(queue, ticket - 1)) PXI_DoCMD(PXICMD_JOB_KICK, NULL, 0);
+
+    #ifdef PROFILE_ZONES
+    u32 now = ProfileTicks();
+    for (u32 i = 0; i < count; i++) {
+        u32 slot = (ticket + i) % PXIJOB_QUEUE_LEN;
+        offload_start[slot] = now;
+        offload_ticket[slot] = ticket + i;
+        offload_func[slot] = queue->jobs[slot].req.func;
+        offload_timed |= BIT(slot);
+    }
+    #endif
+
+    return ticket;
+}
+
+bool OffloadSubmit(u32 func, const u32* args, u32 argc, u32* ticket) {
+    if (!OffloadPrepare(0, func, args, argc)) return false;
+    u32 first = OffloadPublish(1);
+    if (ticket) *ticket = first;
+    return true;
+}
+
+bool OffloadDone(u32 ticket) {
+    if (!PxiJobDone(GetJobQueue(), ticket)) return false;
+
+    #ifdef PROFILE_ZONES
+    u32 slot = ticket % PXIJOB_QUEUE_LEN;
+    if ((offload_timed & BIT(slot)) && (offload_ticket[slot] == ticket)) {
+        ProfileJob(offload_func[slot], ProfileTicks() - offload_start[slot]);
+        offload_timed &= ~BIT(slot);
+    }
+    #endif
+
+    return true;
+}
+
+u32 OffloadProgress(u32 ticket) {
+    return PxiJobProgress(GetJobQueue(), ticket);
+}
+
+void OffloadCancel(u32 ticket) {
+    PxiJob* job = PxiJobGet(GetJobQueue(), ticket);
+    if (!job) return;
+    *(vu32*) &job->req.cancel = 1;
+    ARM_WbDC_Range(&job->req, sizeof(PxiJobRequest));
+    ARM_DSB();
+}
+
+bool OffloadResult(u32 ticket, u32* result, u32* out) {
+    PxiJob* job = PxiJobGet(GetJobQueue(), ticket);
+    if (!job || !OffloadDone(ticket)) return false;
+    if (result) *result = job->status.result;
+    if (out) memcpy(out, job->status.out, PXIJOB_MAX_OUT * sizeof(u32));
+    return true;
+}
+
+bool OffloadWait(u32 ticket, u32* result) {
+    while (!OffloadDone(ticket));
+    return OffloadResult(ticket, result, NULL);
+}
+
+u8* OffloadData(u32 ticket) {
+    return PxiJobData(GetJobQueue(), ticket);
+}
+
+void OffloadFlush(const void* buffer, u32 size) {
+    ARM_WbInvDC_Range((void*) buffer, size);
+    ARM_DSB();
+}
+
+void OffloadInvalidate(void* buffer, u32 size) {
+    ARM_InvDC_Range(buffer, size);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "common.h"
+#include "pxijob.h"
+
+// job buffers the ARM11 writes to must not share a cache line with anything else
+#define OFFLOAD_ALIGN   32
+
+// true if the ARM11 can work on this buffer (FCRAM only)
+bool OffloadBufferOk(const void* buffer, u32 size);
+
+// hand a job to the ARM11, never waits for it to finish
+// inputs must be written back (OffloadFlush) before submitting
+bool OffloadSubmit(u32 func, const u32* args, u32 argc, u32* ticket);
+// batches: reserve slots, prepare jobs 0...n-1 (returns their slot data),
+// then publish them all at once, which costs one PXI round trip at most
+u32 OffloadReserve(u32 count);
+u8* OffloadPrepare(u32 index, u32 func, const u32* args, u32 argc);
+u32 OffloadPublish(u32 count);
+bool OffloadDone(u32 ticket);
+u32 OffloadProgress(u32 ticket);
+void OffloadCancel(u32 ticket);
+// only valid once done, out gets PXIJOB_MAX_OUT words (may be NULL)
+bool OffloadResult(u32 ticket, u32* result, u32* out);
+// waits for the job, false if its slot was reused meanwhile
+bool OffloadWait(u32 ticket, u32* result);
+// slot data of a finished job, NULL if its slot was reused meanwhile
+u8* OffloadData(u32 ticket);
+
+void OffloadFlush(const void* buffer, u32 size);
+void OffloadInvalidate(void* buffer, u32 size);
@@ -2,6 +2,7 @@
 #include <stdint.h>
 
 #include "lodepng.h"
+#include "crc32.h"
 #include "png.h"
 
 // dest and src can be the same
@@ -29,50 +30,791 @@ static inline void _rgb565_to_rgb24(u8 *dest, const u16 *src, size_t dim)
 	}
 }
 
-u16 *PNG_Decompress(const u8 *png, size_t png_len, u32 *w, u32 *h)
+// fast PNG encoder, meant for screenshots and other UI framebuffer exports
+// rows are Sub filtered and deflated with fixed Huffman codes, matching only
+// at distances 1, 3 (flat / gradient pixel runs) and one row (repeated rows)
+// each block of rows falls back to a stored block if that is smaller, so
+// the output never exceeds PNG_COMPRESS_BOUND()
+#define PNG_ROW_BLOCK	8
+#define PNG_MAX_MATCH	258
+#define PNG_STRIDE(w)	(1 + ((w) * 3))
+#define PNG_STORED_MAX	0xFFFF // LEN of a stored block is 16 bit
+// stored blocks for len bytes, 5 bytes of overhead each (at most one per row)
+#define PNG_STORED_SIZE(len)	((len) + (5 * (((len) + PNG_STORED_MAX - 1) / PNG_STORED_MAX)))
+#define PNG_COMPRESS_BOUND(w, h) \
+	(8 + 25 + 12 + 2 + ((PNG_STRIDE(w) + 5) * (h)) + 8 + 4 + 12)
+
+typedef struct {
+	u8 *out;
+	u32 pos;
+	u32 bits;
+	u32 n_bits;
+} PngBitWriter;
+
+static const u16 len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const u8 len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static u16 fixed_code[288]; // bit reversed fixed Huffman literal / length codes
+static u8 fixed_len[288];
+
+static void _png_init_fixed_codes(void)
 {
-	u16 *img;
-	unsigned res;
-	size_t width, height;
+	if (fixed_len[0]) return;
+	for (u32 sym = 0; sym < 288; sym++) {
+		u32 code, len;
+		if (sym < 144) { code = 0x30 + sym; len = 8; }
+		else if (sym < 256) { code = 0x190 + sym - 144; len = 9; }
+		else if (sym < 280) { code = sym - 256; len = 7; }
+		else { code = 0xC0 + sym - 280; len = 8; }
 
-	img = NULL;
-	res = lodepng_decode24((u8**)&img, &width, &height, png, png_len);
-	if (res) {
-		free(img);
+		u32 rev = 0;
+		for (u32 i = 0; i < len; i++)
+			rev |= ((code >> i) & 1) << (len - 1 - i);
+		fixed_code[sym] = rev;
+		fixed_len[sym] = len;
+	}
+}
+
+static inline void _png_put_bits(PngBitWriter *bw, u32 value, u32 n)
+{
+	bw->bits |= value << bw->n_bits;
+	bw->n_bits += n;
+	while (bw->n_bits >= 8) {
+		bw->out[bw->pos++] = bw->bits & 0xFF;
+		bw->bits >>= 8;
+		bw->n_bits -= 8;
+	}
+}
+
+static inline void _png_put_match(PngBitWriter *bw, u32 len, u32 dist)
+{
+	u32 lc = 0, dc = 0;
+	while ((lc < 28) && (len_base[lc + 1] <= len)) lc++;
+	_png_put_bits(bw, fixed_code[257 + lc], fixed_len[257 + lc]);
+	if (len_extra[lc]) _png_put_bits(bw, len - len_base[lc], len_extra[lc]);
+
+	// distance codes come in pairs, 2p and 2p+1 have p-1 extra bits
+	u32 dx = 0;
+	if (dist <= 4) dc = dist - 1;
+	else {
+		u32 p = 2;
+		while ((dist - 1) >> (p + 1)) p++;
+		dx = p - 1;
+		dc = (2 * p) + (((dist - 1) >> dx) & 1);
+	}
+	u32 rev = 0;
+	for (u32 i = 0; i < 5; i++)
+		rev |= ((dc >> i) & 1) << (4 - i);
+	_png_put_bits(bw, rev, 5);
+	if (dx) _png_put_bits(bw, (dist - 1) & ((1u << dx) - 1), dx);
+}
+
+static inline u32 _png_match_len(const u8 *data, u32 i, u32 end, u32 dist)
+{
+	u32 max_len = min(end - i, PNG_MAX_MATCH);
+	u32 len = 0;
+	while ((len < max_len) && (data[i + len] == data[i + len - dist])) len++;
+	return len;
+}
+
+// data[start...end] gets compressed, data[0...start] is history
+// returns false if the block would not fit into limit bytes
+static bool _png_deflate_fixed(PngBitWriter *bw, const u8 *data, u32 start, u32 end, u32 row, u32 limit)
+{
+	u32 pos_max = bw->pos + limit;
+
+	_png_put_bits(bw, 1 << 1, 3); // fixed Huffman, never final
+	for (u32 i = start; i < end;) {
+		u32 best = 0, best_dist = 0;
+		if (i >= row) {
+			best = _png_match_len(data, i, end, row);
+			best_dist = row;
+		}
+		if ((best < PNG_MAX_MATCH) && (i >= 3)) {
+			u32 len = _png_match_len(data, i, end, 3);
+			if (len > best) { best = len; best_dist = 3; }
+		}
+		if ((best < PNG_MAX_MATCH) && (i >= 1)) {
+			u32 len = _png_match_len(data, i, end, 1);
+			if (len > best) { best = len; best_dist = 1; }
+		}
+
+		if (best >= 3) {
+			_png_put_match(bw, best, best_dist);
+			i += best;
+		} else {
+			_png_put_bits(bw, fixed_code[data[i]], fixed_len[data[i]]);
+			i++;
+		}
+		if (bw->pos > pos_max) return false;
+	}
+	_png_put_bits(bw, fixed_code[256], fixed_len[256]);
+
+	return (bw->pos <= pos_max);
+}
+
+// split into blocks of up to PNG_STORED_MAX bytes, only the last one is final
+static void _png_deflate_stored(PngBitWriter *bw, const u8 *data, u32 len, bool final)
+{
+	do {
+		u32 n = min(len, PNG_STORED_MAX);
+		len -= n;
+		_png_put_bits(bw, (final && !len) ? 1 : 0, 3);
+		if (bw->n_bits) _png_put_bits(bw, 0, 8 - bw->n_bits);
+		_png_put_bits(bw, n & 0xFF, 8);
+		_png_put_bits(bw, n >> 8, 8);
+		_png_put_bits(bw, ~n & 0xFF, 8);
+		_png_put_bits(bw, (~n >> 8) & 0xFF, 8);
+		if (n) {
+			memcpy(bw->out + bw->pos, data, n);
+			bw->pos += n;
+			data += n;
+		}
+	} while (len);
+}
+
+static u32 _png_adler32(u32 adler, const u8 *data, u32 len)
+{
+	u32 s1 = adler & 0xFFFF, s2 = adler >> 16;
+	while (len) {
+		u32 n = min(len, 5552);
+		len -= n;
+		while (n--) {
+			s1 += *(data++);
+			s2 += s1;
+		}
+		s1 %= 65521;
+		s2 %= 65521;
+	}
+	return (s2 << 16) | s1;
+}
+
+static inline void _png_put_be32(u8 *out, u32 val)
+{
+	out[0] = val >> 24;
+	out[1] = val >> 16;
+	out[2] = val >> 8;
+	out[3] = val;
+}
+
+// writes the chunk header, returns the offset of the chunk data
+static u32 _png_begin_chunk(u8 *out, u32 pos, const char *type)
+{
+	memcpy(out + pos + 4, type, 4);
+	return pos + 8;
+}
+
+// writes chunk length and crc, returns the offset after the chunk
+static u32 _png_end_chunk(u8 *out, u32 chunk, u32 end)
+{
+	u32 crc = crc32_update(crc32_init(), out + chunk - 4, end - chunk + 4);
+	_png_put_be32(out + chunk - 8, end - chunk);
+	_png_put_be32(out + end, crc32_final(crc));
+	return end + 4;
+}
+
+// rows are requested from read() in blocks of up to PNG_ROW_BLOCK rows
+u8 *PNG_CompressRows(PNG_RowReader read, void *data, u32 w, u32 h, size_t *png_sz)
+{
+	static const u8 png_magic[8] = { PNG_MAGIC };
+	const u32 stride = PNG_STRIDE(w);
+	u8 *png, *raw;
+	u16 *rows;
+	u32 pos, idat;
+
+	if (!w || !h || (w > 0x2000) || (h > 0x2000)) return NULL;
+
+	png = malloc(PNG_COMPRESS_BOUND(w, h));
+	// previous row + current block of rows, as filtered bytes
+	raw = malloc(stride * (PNG_ROW_BLOCK + 1));
+	rows = malloc(w * PNG_ROW_BLOCK * sizeof(u16));
+	if (!png || !raw || !rows) {
+		free(png);
+		free(raw);
+		free(rows);
 		return NULL;
 	}
 
-	_rgb24_to_rgb565(img, (const u8*)img, width * height);
-	if (w) *w = width;
-	if (h) *h = height;
+	_png_init_fixed_codes();
+
+	memcpy(png, png_magic, 8);
+	pos = _png_begin_chunk(png, 8, "IHDR");
+	_png_put_be32(png + pos, w);
+	_png_put_be32(png + pos + 4, h);
+	png[pos + 8] = 8; // bit depth
+	png[pos + 9] = 2; // RGB
+	memset(png + pos + 10, 0, 3); // compression, filter, interlace
+	pos = _png_end_chunk(png, pos, pos + 13);
+
+	idat = _png_begin_chunk(png, pos, "IDAT");
+	PngBitWriter bw = { .out = png, .pos = idat, .bits = 0, .n_bits = 0 };
+	_png_put_bits(&bw, 0x78, 8); // zlib header, 32K window, fastest
+	_png_put_bits(&bw, 0x01, 8);
+
+	u32 adler = 1;
+	u32 history = 0;
+	for (u32 y = 0; y < h; y += PNG_ROW_BLOCK) {
+		u32 n = min(h - y, PNG_ROW_BLOCK);
+		u8 *dest = raw + history;
+		const u16 *src = rows;
+
+		read(rows, y, n, data);
+		for (u32 r = 0; r < n; r++) {
+			u8 *row = dest;
+			*(dest++) = 1; // Sub filter
+			_rgb565_to_rgb24(dest, src, w);
+			for (u32 i = (w * 3) - 1; i >= 3; i--)
+				dest[i] -= dest[i - 3];
+			dest += w * 3;
+			src += w;
+			adler = _png_adler32(adler, row, stride);
+		}
+
+		u32 len = n * stride;
+		PngBitWriter bw_start = bw;
+		if (!_png_deflate_fixed(&bw, raw, history, history + len, stride, PNG_STORED_SIZE(len))) {
+			bw = bw_start;
+			_png_deflate_stored(&bw, raw + history, len, false);
+		}
+
+		// keep the last row for matches in the next block
+		memmove(raw, raw + history + len - stride, stride);
+		history = stride;
+	}
+
+	_png_deflate_stored(&bw, NULL, 0, true); // empty final block
+	_png_put_be32(png + bw.pos, adler);
+	pos = _png_end_chunk(png, idat, bw.pos + 4);
+
+	pos = _png_begin_chunk(png, pos, "IEND");
+	pos = _png_end_chunk(png, pos, pos);
+
+	free(raw);
+	free(rows);
+
+	if (png_sz)
+		*png_sz = pos;
 
-	// the allocated buffer will be w*h*3 bytes long, but only w*h*2 bytes will be used
-	// however, this is not a problem and it'll all be freed with a regular free() call
-	return (u16*)img;
+	return png;
+}
+
+typedef struct {
+	const u16 *fb;
+	u32 w;
+} PngBuffer;
+
+static void _png_read_rows(u16 *rows, u32 y, u32 n, void *data)
+{
+	const PngBuffer *buffer = (const PngBuffer*) data;
+	memcpy(rows, buffer->fb + (y * buffer->w), n * buffer->w * sizeof(u16));
 }
 
 u8 *PNG_Compress(const u16 *fb, u32 w, u32 h, size_t *png_sz)
 {
-	u8 *img, *buf;
-	unsigned res;
-	size_t png_size;
+	PngBuffer buffer = { .fb = fb, .w = w };
+	return PNG_CompressRows(_png_read_rows, &buffer, w, h, png_sz);
+}
+
+// streaming PNG decoder, rows go out as RGB565 as soon as they are inflated
+// scratch is one deflate window and two rows, no full size image buffer
+// interlaced, 16 bit and low bit depth gray images are left to lodepng
+#define PNG_FAST_BITS	9
+
+typedef struct {
+	u16 count[16];
+	u16 symbol[288];
+	u16 fast[1 << PNG_FAST_BITS]; // (length << 9) | symbol, 0 for longer codes
+} PngHuffman;
+
+typedef struct {
+	// IDAT data, may be split across chunks
+	const u8 *in;
+	const u8 *in_end;
+	const u8 *png_end;
+	u32 bits;
+	u32 n_bits;
+	u32 overrun;
+	// output window and rows
+	u8 *window;
+	u32 window_mask;
+	u32 window_pos;
+	u8 *row;
+	u8 *prev;
+	u32 row_pos;
+	u32 stride;
+	u32 bpp;
+	u16 *out;
+	u32 y;
+	u32 adler;
+	// image
+	u32 w;
+	u32 h;
+	u8 color;
+	u8 depth;
+	u16 palette[256];
+	PNG_RowWriter write;
+	void *data;
+	PngHuffman lit;
+	PngHuffman dist;
+} PngStream;
+
+static inline u32 _png_get_be32(const u8 *in)
+{
+	return ((u32) in[0] << 24) | ((u32) in[1] << 16) | ((u32) in[2] << 8) | in[3];
+}
+
+bool PNG_GetSize(const u8 *png, size_t png_len, u32 *w, u32 *h)
+{
+	static const u8 png_magic[8] = { PNG_MAGIC };
+
+	if ((png_len < 8 + 25) || (memcmp(png, png_magic, 8) != 0) ||
+		(memcmp(png + 12, "IHDR", 4) != 0) || (_png_get_be32(png + 8) != 13))
+		return false;
+
+	if (w) *w = _png_get_be32(png + 16);
+	if (h) *h = _png_get_be32(png + 20);
+	return true;
+}
+
+// next IDAT byte, zeroes past the end of the data
+static inline u32 _png_next_byte(PngStream *ps)
+{
+	while (ps->in >= ps->in_end) {
+		// skip crc, the chunk directly after has to be IDAT as well
+		const u8 *chunk = ps->in_end + 4;
+		u32 len;
+		if ((chunk + 12 > ps->png_end) || (memcmp(chunk + 4, "IDAT", 4) != 0) ||
+			((len = _png_get_be32(chunk)) > (u32) (ps->png_end - chunk - 12))) {
+			ps->overrun++;
+			return 0;
+		}
+		ps->in = chunk + 8;
+		ps->in_end = ps->in + len;
+	}
+	return *(ps->in++);
+}
+
+static inline u32 _png_peek_bits(PngStream *ps, u32 n)
+{
+	while (ps->n_bits < n) {
+		ps->bits |= _png_next_byte(ps) << ps->n_bits;
+		ps->n_bits += 8;
+	}
+	return ps->bits & ((1u << n) - 1);
+}
+
+static inline void _png_drop_bits(PngStream *ps, u32 n)
+{
+	ps->bits >>= n;
+	ps->n_bits -= n;
+}
+
+static inline u32 _png_get_bits(PngStream *ps, u32 n)
+{
+	if (!n) return 0;
+	u32 val = _png_peek_bits(ps, n);
+	_png_drop_bits(ps, n);
+	return val;
+}
+
+// canonical Huffman code from code lengths, false if over-subscribed
+static bool _png_build_huffman(PngHuffman *hm, const u8 *lengths, u32 n)
+{
+	u16 offs[16];
+	s32 left = 1;
+
+	memset(hm->count, 0, sizeof(hm->count));
+	memset(hm->fast, 0, sizeof(hm->fast));
+	for (u32 i = 0; i < n; i++)
+		hm->count[lengths[i]]++;
+	for (u32 len = 1; len < 16; len++) {
+		left = (left << 1) - hm->count[len];
+		if (left < 0) return false;
+	}
+
+	offs[1] = 0;
+	for (u32 len = 1; len < 15; len++)
+		offs[len + 1] = offs[len] + hm->count[len];
+	for (u32 i = 0; i < n; i++)
+		if (lengths[i]) hm->symbol[offs[lengths[i]]++] = i;
 
-	img = NULL;
+	// lookup table for all codes up to PNG_FAST_BITS, stored bit reversed
+	u32 code = 0, index = 0;
+	for (u32 len = 1; len <= PNG_FAST_BITS; len++, code <<= 1) {
+		for (u32 k = 0; k < hm->count[len]; k++, code++) {
+			u32 rev = 0;
+			for (u32 i = 0; i < len; i++)
+				rev |= ((code >> i) & 1) << (len - 1 - i);
+			u16 entry = (len << 9) | hm->symbol[index++];
+			for (u32 i = rev; i < (1u << PNG_FAST_BITS); i += (1u << len))
+				hm->fast[i] = entry;
+		}
+	}
 
-	buf = malloc(w * h * 3);
-	if (!buf) return NULL;
+	return true;
+}
 
-	_rgb565_to_rgb24(buf, fb, w * h);
-	res = lodepng_encode24(&img, &png_size, buf, w, h);
-	free(buf);
+static s32 _png_decode_symbol(PngStream *ps, const PngHuffman *hm)
+{
+	u16 entry = hm->fast[_png_peek_bits(ps, PNG_FAST_BITS)];
+	if (entry) {
+		_png_drop_bits(ps, entry >> 9);
+		return entry & 0x1FF;
+	}
+
+	// slow path for long codes, one bit at a time
+	u32 bits = _png_peek_bits(ps, 15);
+	s32 code = 0, first = 0, index = 0;
+	for (u32 len = 1; len < 16; len++) {
+		code |= (bits >> (len - 1)) & 1;
+		s32 count = hm->count[len];
+		if (code - count < first) {
+			_png_drop_bits(ps, len);
+			return hm->symbol[index + (code - first)];
+		}
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+static inline u8 _png_paeth(u8 a, u8 b, u8 c)
+{
+	s32 p = (s32) a + b - c;
+	s32 pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if ((pa <= pb) && (pa <= pc)) return a;
+	return (pb <= pc) ? b : c;
+}
+
+static void _png_emit_row(PngStream *ps)
+{
+	u8 *row = ps->row + 1;
+	const u8 *prev = ps->prev + 1;
+	const u32 len = ps->stride - 1;
+	const u32 bpp = ps->bpp;
+
+	ps->adler = _png_adler32(ps->adler, ps->row, ps->stride);
+	switch (ps->row[0]) {
+		case 0:
+			break;
+		case 1:
+			for (u32 i = bpp; i < len; i++)
+				row[i] += row[i - bpp];
+			break;
+		case 2:
+			for (u32 i = 0; i < len; i++)
+				row[i] += prev[i];
+			break;
+		case 3:
+			for (u32 i = 0; i < len; i++)
+				row[i] += ((i >= bpp ? row[i - bpp] : 0) + prev[i]) >> 1;
+			break;
+		case 4:
+			for (u32 i = 0; i < len; i++)
+				row[i] += (i >= bpp) ? _png_paeth(row[i - bpp], prev[i], prev[i - bpp]) : prev[i];
+			break;
+		default:
+			ps->overrun++; // invalid filter, treat as broken data
+			break;
+	}
+
+	u16 *out = ps->out;
+	switch (ps->color) {
+		case 0: // gray
+			for (u32 x = 0; x < ps->w; x++) {
+				u8 v = row[x];
+				out[x] = (v >> 3) << 11 | (v >> 2) << 5 | (v >> 3);
+			}
+			break;
+		case 2: // RGB
+			_rgb24_to_rgb565(out, row, ps->w);
+			break;
+		case 3: // palette
+			for (u32 x = 0, bit = 0; x < ps->w; x++, bit += ps->depth) {
+				u32 idx = (row[bit >> 3] >> (8 - ps->depth - (bit & 7))) & ((1u << ps->depth) - 1);
+				out[x] = ps->palette[idx];
+			}
+			break;
+		case 4: // gray + alpha, alpha is ignored
+			for (u32 x = 0; x < ps->w; x++) {
+				u8 v = row[x * 2];
+				out[x] = (v >> 3) << 11 | (v >> 2) << 5 | (v >> 3);
+			}
+			break;
+		case 6: // RGBA, alpha is ignored
+			for (u32 x = 0; x < ps->w; x++) {
+				const u8 *px = row + (x * 4);
+				out[x] = (px[0] >> 3) << 11 | (px[1] >> 2) << 5 | (px[2] >> 3);
+			}
+			break;
+	}
+	ps->write(out, ps->y++, ps->w, ps->data);
+
+	u8 *tmp = ps->prev;
+	ps->prev = ps->row;
+	ps->row = tmp;
+	ps->row_pos = 0;
+}
+
+static inline void _png_put_byte(PngStream *ps, u8 b)
+{
+	ps->window[ps->window_pos++ & ps->window_mask] = b;
+	if (ps->y >= ps->h) return; // excess data is ignored
+	ps->row[ps->row_pos++] = b;
+	if (ps->row_pos == ps->stride) _png_emit_row(ps);
+}
+
+static bool _png_inflate_block(PngStream *ps)
+{
+	for (;;) {
+		s32 sym = _png_decode_symbol(ps, &ps->lit);
+		if (sym < 0) return false;
+		if (sym < 256) {
+			_png_put_byte(ps, sym);
+			continue;
+		}
+		if (sym == 256) return true;
+
+		sym -= 257;
+		if (sym >= 29) return false;
+		u32 len = len_base[sym] + _png_get_bits(ps, len_extra[sym]);
+
+		s32 sym_dist = _png_decode_symbol(ps, &ps->dist);
+		if ((sym_dist < 0) || (sym_dist >= 30)) return false;
+		u32 dc = sym_dist;
+		u32 dx = (dc < 4) ? 0 : (dc >> 1) - 1;
+		u32 dist = ((dc < 4) ? dc + 1 : (1u << (dx + 1)) + 1 + ((dc & 1) << dx)) + _png_get_bits(ps, dx);
+		if ((dist > ps->window_pos) || (dist > ps->window_mask + 1)) return false;
+
+		for (u32 from = ps->window_pos - dist; len; len--)
+			_png_put_byte(ps, ps->window[from++ & ps->window_mask]);
+		if (ps->overrun > 4) return false;
+	}
+}
+
+static bool _png_inflate_dynamic_tables(PngStream *ps)
+{
+	static const u8 order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+	u8 lengths[288 + 32];
+	u32 n_lit = _png_get_bits(ps, 5) + 257;
+	u32 n_dist = _png_get_bits(ps, 5) + 1;
+	u32 n_code = _png_get_bits(ps, 4) + 4;
+
+	if ((n_lit > 286) || (n_dist > 30)) return false;
+	memset(lengths, 0, 19);
+	for (u32 i = 0; i < n_code; i++)
+		lengths[order[i]] = _png_get_bits(ps, 3);
+	if (!_png_build_huffman(&ps->lit, lengths, 19)) return false;
+
+	for (u32 i = 0; i < n_lit + n_dist;) {
+		s32 sym = _png_decode_symbol(ps, &ps->lit);
+		if (sym < 0) return false;
+		if (sym < 16) {
+			lengths[i++] = sym;
+			continue;
+		}
+
+		u8 len = 0;
+		u32 repeat;
+		if (sym == 16) {
+			if (!i) return false;
+			len = lengths[i - 1];
+			repeat = 3 + _png_get_bits(ps, 2);
+		} else if (sym == 17) repeat = 3 + _png_get_bits(ps, 3);
+		else repeat = 11 + _png_get_bits(ps, 7);
+		if (i + repeat > n_lit + n_dist) return false;
+		while (repeat--) lengths[i++] = len;
+	}
+
+	if (!lengths[256]) return false;
+	return _png_build_huffman(&ps->lit, lengths, n_lit) &&
+		_png_build_huffman(&ps->dist, lengths + n_lit, n_dist);
+}
 
-	if (res) {
+static bool _png_inflate(PngStream *ps)
+{
+	u32 cmf = _png_get_bits(ps, 8);
+	u32 flg = _png_get_bits(ps, 8);
+	if (((cmf & 0xF) != 8) || (((cmf << 8) | flg) % 31) || (flg & 0x20))
+		return false;
+
+	for (bool final = false; !final;) {
+		final = _png_get_bits(ps, 1);
+		u32 type = _png_get_bits(ps, 2);
+		if (type == 0) { // stored
+			_png_drop_bits(ps, ps->n_bits & 7);
+			u32 len = _png_get_bits(ps, 16);
+			if ((len ^ 0xFFFF) != _png_get_bits(ps, 16)) return false;
+			while (len--) _png_put_byte(ps, _png_get_bits(ps, 8));
+		} else if (type == 1) { // fixed Huffman
+			u8 lengths[288 + 30];
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 112);
+			memset(lengths + 256, 7, 24);
+			memset(lengths + 280, 8, 8);
+			memset(lengths + 288, 5, 30);
+			_png_build_huffman(&ps->lit, lengths, 288);
+			_png_build_huffman(&ps->dist, lengths + 288, 30);
+			if (!_png_inflate_block(ps)) return false;
+		} else if (type == 2) { // dynamic Huffman
+			if (!_png_inflate_dynamic_tables(ps) || !_png_inflate_block(ps))
+				return false;
+		} else return false;
+		if (ps->overrun > 4) return false;
+	}
+
+	// zlib trailer
+	_png_drop_bits(ps, ps->n_bits & 7);
+	u32 adler = 0;
+	for (u32 i = 0; i < 4; i++)
+		adler = (adler << 8) | _png_get_bits(ps, 8);
+
+	return !ps->overrun && (ps->y == ps->h) && (adler == ps->adler);
+}
+
+// fallback for anything the streaming decoder doesn't handle
+// lodepng holds the IDAT data, the filtered and unfiltered image and the
+// RGB24 result at once, that estimate has to fit scratch_max
+static bool _png_decompress_lodepng(const u8 *png, size_t png_len, u32 scratch_max,
+	PNG_RowWriter write, void *data)
+{
+	const u8 *ihdr = png + 16;
+	u8 *img = NULL;
+	unsigned width, height;
+	u32 w, h;
+
+	if (!PNG_GetSize(png, png_len, &w, &h)) return false;
+	u64 bpp_bits = ihdr[8] * ((ihdr[9] == 2) ? 3 : (ihdr[9] == 4) ? 2 : (ihdr[9] == 6) ? 4 : 1);
+	u64 raw = (((u64) w * h * bpp_bits) + 7) >> 3;
+	u64 filtered = raw + (ihdr[12] ? 4 * (u64) h + 32 : h); // Adam7 passes add rows
+	u64 scratch = png_len + filtered + raw + ((u64) w * h * 3);
+	if (scratch > scratch_max) return false;
+
+	if (lodepng_decode24(&img, &width, &height, png, png_len)) {
 		free(img);
-		return NULL;
+		return false;
 	}
 
-	if (png_sz)
-		*png_sz = png_size;
+	// in place, the RGB565 data never overtakes the RGB24 data it comes from
+	for (u32 y = 0; y < height; y++) {
+		u16 *row = (u16*) (void*) (img + (y * width * 2));
+		_rgb24_to_rgb565(row, img + (y * width * 3), width);
+		write(row, y, width, data);
+	}
+
+	free(img);
+	return true;
+}
+
+// images larger than max_w x max_h are rejected before anything gets decoded
+// scratch_max limits the decoder memory (window, rows and state)
+bool PNG_DecompressRows(const u8 *png, size_t png_len, u32 max_w, u32 max_h, u32 scratch_max,
+	PNG_RowWriter write, void *data)
+{
+	const u8 *png_end = png + png_len;
+	const u8 *ihdr = png + 16;
+	const u8 *idat = NULL;
+	const u8 *plte = NULL;
+	u32 plte_len = 0;
+	u32 w, h;
+
+	if (!PNG_GetSize(png, png_len, &w, &h) || !w || !h || (w > max_w) || (h > max_h))
+		return false;
+
+	u8 depth = ihdr[8], color = ihdr[9];
+	bool stream = (ihdr[10] == 0) && (ihdr[11] == 0) && (ihdr[12] == 0) &&
+		((depth == 8) ? (color != 1) && (color <= 6) && (color != 5) :
+		(color == 3) && ((depth == 1) || (depth == 2) || (depth == 4)));
+	if (!stream) return _png_decompress_lodepng(png, png_len, scratch_max, write, data);
+
+	// find palette and first IDAT, check crcs on the way
+	for (const u8 *chunk = png + 8; chunk + 12 <= png_end;) {
+		u32 len = _png_get_be32(chunk);
+		if (len > (u32) (png_end - chunk - 12)) return false;
+		if (memcmp(chunk + 4, "IEND", 4) == 0) break;
+		u32 crc = crc32_final(crc32_update(crc32_init(), chunk + 4, len + 4));
+		if (crc != _png_get_be32(chunk + 8 + len)) return false;
+		if (memcmp(chunk + 4, "PLTE", 4) == 0) {
+			plte = chunk + 8;
+			plte_len = len / 3;
+		} else if ((memcmp(chunk + 4, "IDAT", 4) == 0) && !idat) idat = chunk;
+		chunk += len + 12;
+	}
+	if (!idat || (_png_get_be32(idat) < 2) || ((color == 3) && !plte)) return false;
+
+	// deflate window, no need to be larger than the whole image data
+	u32 bpp_bits = depth * ((color == 2) ? 3 : (color == 4) ? 2 : (color == 6) ? 4 : 1);
+	u32 stride = 1 + (((w * bpp_bits) + 7) >> 3);
+	u32 window_size = 1u << (((idat[8] >> 4) & 0xF) + 8);
+	if (window_size > 0x8000) return false;
+	while ((window_size > 0x100) && ((window_size >> 1) >= stride * h)) window_size >>= 1;
 
+	u32 scratch = sizeof(PngStream) + window_size + (2 * stride) + (w * sizeof(u16));
+	if (scratch > scratch_max) return false;
+
+	PngStream *ps = (PngStream*) malloc(scratch);
+	if (!ps) return false;
+	memset(ps, 0, sizeof(PngStream));
+	ps->window = (u8*) (ps + 1);
+	ps->row = ps->window + window_size;
+	ps->prev = ps->row + stride;
+	ps->out = (u16*) (void*) (ps->prev + stride);
+	ps->window_mask = window_size - 1;
+	memset(ps->prev, 0, stride);
+
+	ps->in = idat + 8;
+	ps->in_end = ps->in + _png_get_be32(idat);
+	ps->png_end = png_end;
+	ps->stride = stride;
+	ps->bpp = max(1, bpp_bits >> 3);
+	ps->adler = 1;
+	ps->w = w;
+	ps->h = h;
+	ps->color = color;
+	ps->depth = depth;
+	ps->write = write;
+	ps->data = data;
+	for (u32 i = 0; i < min(plte_len, 256); i++) {
+		const u8 *rgb = plte + (i * 3);
+		ps->palette[i] = (rgb[0] >> 3) << 11 | (rgb[1] >> 2) << 5 | (rgb[2] >> 3);
+	}
+
+	bool res = _png_inflate(ps);
+	free(ps);
+	return res;
+}
+
+static void _png_write_rows(const u16 *row, u32 y, u32 w, void *data)
+{
+	memcpy(((u16*) data) + (y * w), row, w * sizeof(u16));
+}
+
+u16 *PNG_Decompress(const u8 *png, size_t png_len, u32 *w, u32 *h)
+{
+	u32 width, height;
+	u16 *img;
+
+	if (!PNG_GetSize(png, png_len, &width, &height) ||
+		!width || !height || (width > 0x2000) || (height > 0x2000))
+		return NULL;
+
+	img = malloc(width * height * sizeof(u16));
+	if (!img) return NULL;
+
+	if (!PNG_DecompressRows(png, png_len, width, height, (u32) -1, _png_write_rows, img)) {
+		free(img);
+		return NULL;
+	}
+
+	if (w) *w = width;
+	if (h) *h = height;
 	return img;
 }
@@ -6,5 +6,19 @@
 
 #define PNG_MAGIC   0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A
 
+// decoder scratch budget, enough for a full deflate window and screen sized rows
+#define PNG_SCRATCH_MAX (64 * 1024)
+
+// gets row y (w pixels), rows come in order
+typedef void (*PNG_RowWriter)(const u16 *row, u32 y, u32 w, void *data);
+
+bool PNG_GetSize(const u8 *png, size_t png_len, u32 *w, u32 *h);
+bool PNG_DecompressRows(const u8 *png, size_t png_len, u32 max_w, u32 max_h, u32 scratch_max,
+	PNG_RowWriter write, void *data);
 u16 *PNG_Decompress(const u8 *png, size_t png_len, u32 *w, u32 *h);
+
+// fills n rows of w pixels each, starting at row y
+typedef void (*PNG_RowReader)(u16 *rows, u32 y, u32 n, void *data);
+
+u8 *PNG_CompressRows(PNG_RowReader read, void *data, u32 w, u32 h, size_t *png_sz);
 u8 *PNG_Compress(const u16 *fb, u32 w, u32 h, size_t *png_sz);
@@ -1,7 +1,7 @@
 #include "common.h"
 #include "arm.h"
 #include "pxi.h"
-#include "shmem.h"
+#include "offload.h"
 
 bool spiflash_get_status(void)
 {
@@ -10,24 +10,57 @@ bool spiflash_get_status(void)
 
 bool spiflash_read(u32 offset, u32 size, u8 *buf)
 {
-	u32 *const dataBuffer = ARM_GetSHMEM()->dataBuffer.w;
-	u32 args[2];
+	u8 *direct = NULL;
+	u32 direct_len = 0;
+
+	// the cache line aligned part of a FCRAM buffer is read in place,
+	// in one go, everything else goes through the job slot data
+	if (OffloadBufferOk(buf, size)) {
+		direct = (u8*) align((u32) buf, OFFLOAD_ALIGN);
+		if ((u32) (direct - buf) < size)
+			direct_len = (size - (direct - buf)) & ~(OFFLOAD_ALIGN - 1);
+	}
 
 	while(size > 0) {
-		u32 blksz = min(size, SHMEM_BUFFER_SIZE);
+		u8 *dst[PXIJOB_QUEUE_LEN];
+		u32 len[PXIJOB_QUEUE_LEN];
+		u32 batch = OffloadReserve(PXIJOB_QUEUE_LEN);
+		u32 n, ticket;
+
+		for (n = 0; (n < batch) && (size > 0); n++) {
+			u32 args[3] = { offset, min(size, PXIJOB_DATA_SIZE), 0 };
 
-		args[0] = offset;
-		args[1] = blksz;
+			if (direct_len && (buf == direct)) {
+				args[1] = direct_len;
+				args[2] = (u32) buf;
+				OffloadFlush(buf, direct_len);
+			} else if (direct_len && (buf < direct)) {
+				args[1] = min(args[1], (u32) (direct - buf));
+			}
 
-		PXI_DoCMD(PXICMD_NVRAM_READ, args, 2);
-		ARM_InvDC_Range(dataBuffer, blksz);
-		ARM_DSB();
+			if (!OffloadPrepare(n, PXIJOB_NVRAM_READ, args, 3))
+				return false;
+			dst[n] = buf;
+			len[n] = args[1];
 
-		memcpy(buf, dataBuffer, blksz);
+			buf += args[1];
+			size -= args[1];
+			offset += args[1];
+		}
 
-		buf += blksz;
-		size -= blksz;
-		offset += blksz;
+		ticket = OffloadPublish(n);
+		for (u32 i = 0; i < n; i++) {
+			u8 *data;
+			if (!OffloadWait(ticket + i, NULL))
+				return false;
+			if (direct_len && (dst[i] == direct)) {
+				OffloadInvalidate(direct, direct_len);
+			} else {
+				if (!(data = OffloadData(ticket + i)))
+					return false;
+				memcpy(dst[i], data, len[i]);
+			}
+		}
 	}
 
 	return true;
@@ -74,6 +74,9 @@ void XRQ_DumpRegisters(u32 xrq, u32 *regs)
     DsTime dstime;
     get_dstime(&dstime);
 
+    /* Draw straight to the screens, even if we crashed inside a frame */
+    ResetFrames();
+
     /* Dump registers */
     wstr += sprintf(wstr, "Exception: %s (%lu)\n", XRQ_Name[xrq&7], xrq);
     wstr += sprintf(wstr, FLAVOR " " VERSION "\n");
@@ -12,6 +12,7 @@
 #include "aes.h"
 #include "sha.h"
 #include "rtc.h"
+#include "command_ctr.h"
 
 // use NCCH crypto defines for everything
 #define CRYPTO_DECRYPT  NCCH_NOCRYPTO
@@ -20,7 +21,6 @@
 // partitionA path
 #define PART_PATH       "D:/partitionA.bin"
 
-extern bool force_refresh;
 #define LOG_FILE_BUF_SIZE STD_BUFFER_SIZE
 //#define TEST_MODE 0
 
@@ -85,21 +85,21 @@ u32 GetNcchHeaders(NcchHeader* ncch, NcchExtHeader* exthdr, ExeFsHeader* exefs,
 u32 CheckFixNcchHash(u8* expected, FIL* file, u32 size_data, u32 offset_ncch, NcchHeader* ncch, ExeFsHeader* exefs, u32 offset_back, char** outstr, bool log, bool autoskip) 
 {
     u32 offset_data = fvx_tell(file) - offset_ncch;
+    CartSession* session = CTR_GetSession();
     u8 hash[32];
     u8 lasthash[32];
-    char tempstr[64];
-    char hash_str[32+1];
     
     memset(lasthash, 0, 32);
     bool first_hash = true;
 
-    u8* buffer = (u8*) malloc(STD_BUFFER_SIZE);
+    u8* buffer = (u8*) mem_pool_get(MEMPOOL_IO);
     if (!buffer) return 1;
 
     bool hash_match = false;
 
-	u32 pos_x = (SCREEN_WIDTH_MAIN - 240) / 2;
-	u32 pos_y = (SCREEN_HEIGHT / 2) - 12 - 2 - 10;
+    // status is only published here, UpdateProgress() draws it
+    ProgressStatus* progress = GetProgressStatus();
+    memcpy(progress->expected, expected, 32);
 
     bool was_bad = false;
     bool hash_stuck = false;
@@ -110,16 +110,16 @@ u32 CheckFixNcchHash(u8* expected, FIL* file, u32 size_data, u32 offset_ncch, Nc
 
     while (!hash_match)
     {
-        if (CheckButton(BUTTON_B))
+        if (!UpdateProgress(false))
         {
-            free(buffer);
-            force_refresh = false;
+            mem_pool_put(MEMPOOL_IO, buffer);
+            session->force_refresh = false;
             return 1;
         }
 
         sha_init(SHA256_MODE);
 
-        u32 buffersize = hash_stuck ? 0x100 : force_refresh ? 0x200 : STD_BUFFER_SIZE;
+        u32 buffersize = hash_stuck ? 0x100 : session->force_refresh ? 0x200 : STD_BUFFER_SIZE;
 
         for (u32 i = 0; i < size_data; i += buffersize) 
         {
@@ -131,14 +131,8 @@ u32 CheckFixNcchHash(u8* expected, FIL* file, u32 size_data, u32 offset_ncch, Nc
         }
 
         sha_get(hash);
-
-        DrawString(MAIN_SCREEN, "Current hash:", pos_x, pos_y + 64, COLOR_STD_FONT, COLOR_STD_BG);
-        snprintf(hash_str, 32+1, "%016llX%016llX", getbe64(hash + 16), getbe64(hash + 24));
-        DrawString(MAIN_SCREEN, hash_str, pos_x, pos_y + 74, COLOR_STD_FONT, COLOR_STD_BG);
-
-        DrawString(MAIN_SCREEN, "Expected:", pos_x, pos_y + 94, COLOR_STD_FONT, COLOR_STD_BG);
-        snprintf(hash_str, 32+1, "%016llX%016llX",getbe64(expected + 16), getbe64(expected + 24));
-        DrawString(MAIN_SCREEN, hash_str, pos_x, pos_y + 104, COLOR_STD_FONT, COLOR_STD_BG);
+        memcpy(progress->hash, hash, 32);
+        progress->show_hash = true;
 
         hash_match = !memcmp(hash, expected, 32);
 
@@ -166,8 +160,8 @@ u32 CheckFixNcchHash(u8* expected, FIL* file, u32 size_data, u32 offset_ncch, Nc
                     if (log)
                         *outstr += sprintf(*outstr, "Skipped: %x\n", offset_back);
 
-                    free(buffer);
-                    force_refresh = false;
+                    mem_pool_put(MEMPOOL_IO, buffer);
+                    session->force_refresh = false;
                     return 0;
                 }
             }
@@ -175,26 +169,29 @@ u32 CheckFixNcchHash(u8* expected, FIL* file, u32 size_data, u32 offset_ncch, Nc
             if (!first_hash && !memcmp(hash, lasthash, 32)) 
             {
                 hash_stuck_times++;
-                snprintf(tempstr, 64, "Hash stuck. Retries: %d/20                                      ", (int)hash_stuck_times);
-                DrawString(MAIN_SCREEN, tempstr, pos_x, pos_y + 114, COLOR_STD_FONT, COLOR_STD_BG);
+                progress->status = "Hash stuck. Retries: ";
+                progress->show_count = true;
+                progress->count = hash_stuck_times;
+                progress->count_max = 20;
                 hash_stuck = true;
                 hash_was_stuck = true;
 
                 if (hash_stuck_times >= 20)
                 {
-                    free(buffer);
+                    mem_pool_put(MEMPOOL_IO, buffer);
 
                     if (log)
                         *outstr += sprintf(*outstr, "Unfixable: %x\n", offset_back);
 
-                    force_refresh = false;
+                    session->force_refresh = false;
 
                     return 0;
                 }
             }
             else
             {
-                DrawString(MAIN_SCREEN, "HASH MISMATCH. Attempting refresh.                             ", pos_x, pos_y + 114, COLOR_STD_FONT, COLOR_STD_BG);
+                progress->status = "HASH MISMATCH. Attempting refresh.";
+                progress->show_count = false;
                 hash_stuck = false;
                 hash_stuck_times = 0;
             }
@@ -202,7 +199,7 @@ u32 CheckFixNcchHash(u8* expected, FIL* file, u32 size_data, u32 offset_ncch, Nc
             fvx_lseek(file, offset_back);
             was_bad = true;
             was_bad_retries = 5;
-            force_refresh = true;
+            session->force_refresh = true;
         }
         else
         {
@@ -210,38 +207,34 @@ u32 CheckFixNcchHash(u8* expected, FIL* file, u32 size_data, u32 offset_ncch, Nc
             
             if (was_bad_retries)
             {
-                snprintf(tempstr, 64, "Chunk OK now? Making sure. Retries to go: %d                    ", (int)was_bad_retries);
-                DrawString(MAIN_SCREEN, tempstr, pos_x, pos_y + 114, COLOR_STD_FONT, COLOR_STD_BG);
+                progress->status = "Chunk OK now? Making sure. Retries to go: ";
+                progress->show_count = true;
+                progress->count = was_bad_retries;
+                progress->count_max = 0;
                 fvx_lseek(file, offset_back);
                 hash_match = false;
                 was_bad_retries--;
             }
             else
-                DrawString(MAIN_SCREEN, "Chunk OK!                                                    ", pos_x, pos_y + 114, COLOR_STD_FONT, COLOR_STD_BG);
+            {
+                progress->status = "Chunk OK!";
+                progress->show_count = false;
+            }
         }
 
-        if (hash_was_stuck)
-            DrawString(MAIN_SCREEN, "*", pos_x - 15, pos_y + 114, COLOR_STD_FONT, COLOR_STD_BG);
-        else
-            DrawString(MAIN_SCREEN, " ", pos_x - 15, pos_y + 114, COLOR_STD_FONT, COLOR_STD_BG);
-
-        if (hash_bad_retries > 500)
-        {
-            DrawString(MAIN_SCREEN, "500 Retries exceeded. Press Y to skip this block.", pos_x, pos_y + 124, COLOR_STD_FONT, COLOR_STD_BG);
-        }
-        else
-            DrawString(MAIN_SCREEN, "                                                 ", pos_x, pos_y + 124, COLOR_STD_FONT, COLOR_STD_BG); 
+        progress->marker = hash_was_stuck;
+        progress->hint = (hash_bad_retries > 500) ? "500 Retries exceeded. Press Y to skip this block." : NULL;
 
         memcpy(lasthash, hash, 32);
         first_hash = false;
     }
 
-    free(buffer);
+    mem_pool_put(MEMPOOL_IO, buffer);
 
     if (was_bad && log)
         *outstr += sprintf(*outstr, "%x\n", offset_back);
 
-    force_refresh = false;
+    session->force_refresh = false;
 
     return !hash_match;
 }
@@ -250,7 +243,7 @@ u32 CheckNcchHash(u8* expected, FIL* file, u32 size_data, u32 offset_ncch, NcchH
     u32 offset_data = fvx_tell(file) - offset_ncch;
     u8 hash[32];
 
-    u8* buffer = (u8*) malloc(STD_BUFFER_SIZE);
+    u8* buffer = (u8*) mem_pool_get(MEMPOOL_IO);
     if (!buffer) return 1;
 
     sha_init(SHA256_MODE);
@@ -263,7 +256,7 @@ u32 CheckNcchHash(u8* expected, FIL* file, u32 size_data, u32 offset_ncch, NcchH
     }
     sha_get(hash);
 
-    free(buffer);
+    mem_pool_put(MEMPOOL_IO, buffer);
 
     return (memcmp(hash, expected, 32) == 0) ? 0 : 1;
 }
@@ -828,9 +821,18 @@ u32 AttemptFixNcch(const char* path, u32 offset, u32 size, bool log, bool autosk
         u8* masterhash = NULL;
         u8* lvl1_data = NULL;
         u8* lvl2_data = NULL;
+        MemArena ivfc_arena = { NULL, 0, 0, 0 };
         if (!ver_romfs && (ValidateRomFsHeader(&ivfc, ncch.size_romfs * NCCH_MEDIA_UNIT) == 0)) {
+            // all ivfc levels share one allocation
+            lvl1_size = align(ivfc.size_lvl1, 1 << ivfc.log_lvl1);
+            lvl2_size = align(ivfc.size_lvl2, 1 << ivfc.log_lvl2);
+            if (mem_arena_init(&ivfc_arena, ivfc.size_masterhash + lvl1_size + lvl2_size + 16, "ivfc")) {
+                masterhash = mem_arena_alloc(&ivfc_arena, ivfc.size_masterhash);
+                lvl1_data = mem_arena_alloc(&ivfc_arena, lvl1_size);
+                lvl2_data = mem_arena_alloc(&ivfc_arena, lvl2_size);
+            }
+
             // load masterhash(es)
-            masterhash = malloc(ivfc.size_masterhash);
             if (masterhash) {
                 u64 offset_add = (ncch.offset_romfs * NCCH_MEDIA_UNIT) + sizeof(RomFsIvfcHeader);
                 fvx_lseek(&file, offset + offset_add);
@@ -840,8 +842,6 @@ u32 AttemptFixNcch(const char* path, u32 offset, u32 size, bool log, bool autosk
             }
 
             // load lvl1
-            lvl1_size = align(ivfc.size_lvl1, 1 << ivfc.log_lvl1);
-            lvl1_data = malloc(lvl1_size);
             if (lvl1_data) {
                 u64 offset_add = (ncch.offset_romfs * NCCH_MEDIA_UNIT) + GetRomFsLvOffset(&ivfc, 1);
                 fvx_lseek(&file, offset + offset_add);
@@ -851,8 +851,6 @@ u32 AttemptFixNcch(const char* path, u32 offset, u32 size, bool log, bool autosk
             }
 
             // load lvl2
-            lvl2_size = align(ivfc.size_lvl2, 1 << ivfc.log_lvl2);
-            lvl2_data = malloc(lvl2_size);
             if (lvl2_data) {
                 u64 offset_add = (ncch.offset_romfs * NCCH_MEDIA_UNIT) + GetRomFsLvOffset(&ivfc, 2);
                 fvx_lseek(&file, offset + offset_add);
@@ -900,9 +898,7 @@ u32 AttemptFixNcch(const char* path, u32 offset, u32 size, bool log, bool autosk
             }
         }
 
-        if (masterhash) free(masterhash);
-        if (lvl1_data) free(lvl1_data);
-        if (lvl2_data) free(lvl2_data);
+        mem_arena_free(&ivfc_arena);
     }
     else
     {
@@ -1059,9 +1055,18 @@ u32 VerifyNcchFile(const char* path, u32 offset, u32 size) {
         u8* masterhash = NULL;
         u8* lvl1_data = NULL;
         u8* lvl2_data = NULL;
+        MemArena ivfc_arena = { NULL, 0, 0, 0 };
         if (!ver_romfs && (ValidateRomFsHeader(&ivfc, ncch.size_romfs * NCCH_MEDIA_UNIT) == 0)) {
+            // all ivfc levels share one allocation
+            lvl1_size = align(ivfc.size_lvl1, 1 << ivfc.log_lvl1);
+            lvl2_size = align(ivfc.size_lvl2, 1 << ivfc.log_lvl2);
+            if (mem_arena_init(&ivfc_arena, ivfc.size_masterhash + lvl1_size + lvl2_size + 16, "ivfc")) {
+                masterhash = mem_arena_alloc(&ivfc_arena, ivfc.size_masterhash);
+                lvl1_data = mem_arena_alloc(&ivfc_arena, lvl1_size);
+                lvl2_data = mem_arena_alloc(&ivfc_arena, lvl2_size);
+            }
+
             // load masterhash(es)
-            masterhash = malloc(ivfc.size_masterhash);
             if (masterhash) {
                 u64 offset_add = (ncch.offset_romfs * NCCH_MEDIA_UNIT) + sizeof(RomFsIvfcHeader);
                 fvx_lseek(&file, offset + offset_add);
@@ -1071,8 +1076,6 @@ u32 VerifyNcchFile(const char* path, u32 offset, u32 size) {
             }
 
             // load lvl1
-            lvl1_size = align(ivfc.size_lvl1, 1 << ivfc.log_lvl1);
-            lvl1_data = malloc(lvl1_size);
             if (lvl1_data) {
                 u64 offset_add = (ncch.offset_romfs * NCCH_MEDIA_UNIT) + GetRomFsLvOffset(&ivfc, 1);
                 fvx_lseek(&file, offset + offset_add);
@@ -1082,8 +1085,6 @@ u32 VerifyNcchFile(const char* path, u32 offset, u32 size) {
             }
 
             // load lvl2
-            lvl2_size = align(ivfc.size_lvl2, 1 << ivfc.log_lvl2);
-            lvl2_data = malloc(lvl2_size);
             if (lvl2_data) {
                 u64 offset_add = (ncch.offset_romfs * NCCH_MEDIA_UNIT) + GetRomFsLvOffset(&ivfc, 2);
                 fvx_lseek(&file, offset + offset_add);
@@ -1124,9 +1125,7 @@ u32 VerifyNcchFile(const char* path, u32 offset, u32 size) {
             }
         }
 
-        if (masterhash) free(masterhash);
-        if (lvl1_data) free(lvl1_data);
-        if (lvl2_data) free(lvl2_data);
+        mem_arena_free(&ivfc_arena);
     }
 
     if (!offset && (ver_exthdr|ver_exefs|ver_romfs)) { // verification summary
@@ -1142,7 +1141,7 @@ u32 VerifyNcchFile(const char* path, u32 offset, u32 size) {
 }
 
 
-u32 AttemptFixNcsdFile(const char* path, bool log, bool autoskip) 
+static u32 AttemptFixNcsd(const char* path, bool log, bool autoskip) 
 {
     NcsdHeader ncsd;
 
@@ -1182,6 +1181,20 @@ u32 AttemptFixNcsdFile(const char* path, bool log, bool autoskip)
     return 0;
 }
 
+u32 AttemptFixNcsdFile(const char* path, bool log, bool autoskip)
+{
+    // own session, so forced refreshes stay in here and reads always reach the cart
+    CartSession session;
+    CTR_InitSession(&session, CTR_GetSession()->refresh_every);
+    session.uncached = true;
+
+    CartSession* prev_session = CTR_SetSession(&session);
+    u32 ret = AttemptFixNcsd(path, log, autoskip);
+    CTR_SetSession(prev_session);
+
+    return ret;
+}
+
 u32 VerifyNcsdFile(const char* path) {
     NcsdHeader ncsd;
 
@@ -1625,6 +1638,45 @@ u32 CheckEncryptedGameFile(const char* path) {
     else return 1;
 }
 
+// crypts one (NCCH) content inside a CIA, starting at offset, files stay open
+static u32 CryptCiaContent(FIL* ofp, FIL* dfp, u8* buffer, u64 offset, u64 size, TmdContentChunk* chunk,
+    const u8* titlekey, u16 crypto, bool inplace, const char* dest) {
+    bool cia_crypto = getbe16(chunk->type) & 0x1;
+    bool ncch_crypto = false; // find out from the first (decrypted) buffer
+    FSIZE_t fsize = fvx_size(ofp);
+    UINT bytes_read, bytes_written;
+    u8 ctr[16];
+    u32 ret = 0;
+
+    GetTmdCtr(ctr, chunk);
+    if ((fvx_lseek(ofp, offset) != FR_OK) || (!inplace && (fvx_lseek(dfp, offset) != FR_OK)))
+        return 1;
+    sha_init(SHA256_MODE);
+    for (u64 i = 0; (i < size) && (ret == 0); i += STD_BUFFER_SIZE) {
+        u32 read_bytes = min(STD_BUFFER_SIZE, (size - i));
+        if (fvx_read(ofp, buffer, read_bytes, &bytes_read) != FR_OK) ret = 1;
+        if (cia_crypto && (DecryptCiaContentSequential(buffer, read_bytes, ctr, titlekey) != 0)) ret = 1;
+        if ((i == 0) && (read_bytes >= sizeof(NcchHeader))) {
+            NcchHeader* ncch = (NcchHeader*) (void*) buffer;
+            ncch_crypto = ((ValidateNcchHeader(ncch) == 0) && (NCCH_ENCRYPTED(ncch) || !(crypto & NCCH_NOCRYPTO)));
+            if (ncch_crypto && (SetupNcchCrypto(ncch, crypto) != 0)) {
+                ret = 1;
+                break; // nothing written yet
+            }
+        }
+        if (ncch_crypto && (CryptNcchSequential(buffer, i, read_bytes, crypto) != 0)) ret = 1;
+        if (inplace) fvx_lseek(ofp, fvx_tell(ofp) - read_bytes);
+        if (fvx_write(dfp, buffer, read_bytes, &bytes_written) != FR_OK) ret = 1;
+        sha_update(buffer, read_bytes);
+        if ((read_bytes != bytes_read) || (bytes_read != bytes_written)) ret = 1;
+        if (!ShowProgress(offset + i + read_bytes, fsize, dest)) ret = 1;
+    }
+    sha_get(chunk->hash);
+    chunk->type[1] &= ~0x01;
+
+    return ret;
+}
+
 u32 CryptNcchNcsdBossFirmFile(const char* orig, const char* dest, u32 mode, u16 crypto,
     u32 offset, u32 size, TmdContentChunk* chunk, const u8* titlekey) { // this line only for CIA contents
     // this will do a simple copy for unencrypted files
@@ -1700,35 +1752,7 @@ u32 CryptNcchNcsdBossFirmFile(const char* orig, const char* dest, u32 mode, u16
             if (!ShowProgress(offset + i + read_bytes, fsize, dest)) ret = 1;
         }
     } else if (mode & (GAME_CIA|GAME_NUSCDN)) { // for NCCHs inside CIAs
-        bool cia_crypto = getbe16(chunk->type) & 0x1;
-        bool ncch_crypto; // find out by decrypting the NCCH header
-        UINT bytes_read, bytes_written;
-        u8 ctr[16];
-
-        NcchHeader* ncch = (NcchHeader*) (void*) buffer;
-        GetTmdCtr(ctr, chunk); // NCCH crypto?
-        if (fvx_read(ofp, buffer, sizeof(NcchHeader), &bytes_read) != FR_OK) ret = 1;
-        if (cia_crypto) DecryptCiaContentSequential(buffer, sizeof(NcchHeader), ctr, titlekey);
-        ncch_crypto = ((ValidateNcchHeader(ncch) == 0) && (NCCH_ENCRYPTED(ncch) || !(crypto & NCCH_NOCRYPTO)));
-        if (ncch_crypto && (SetupNcchCrypto(ncch, crypto) != 0))
-            ret = 1;
-
-        GetTmdCtr(ctr, chunk);
-        fvx_lseek(ofp, offset);
-        sha_init(SHA256_MODE);
-        for (u64 i = 0; (i < size) && (ret == 0); i += STD_BUFFER_SIZE) {
-            u32 read_bytes = min(STD_BUFFER_SIZE, (size - i));
-            if (fvx_read(ofp, buffer, read_bytes, &bytes_read) != FR_OK) ret = 1;
-            if (cia_crypto && (DecryptCiaContentSequential(buffer, read_bytes, ctr, titlekey) != 0)) ret = 1;
-            if (ncch_crypto && (CryptNcchSequential(buffer, i, read_bytes, crypto) != 0)) ret = 1;
-            if (inplace) fvx_lseek(ofp, fvx_tell(ofp) - read_bytes);
-            if (fvx_write(dfp, buffer, read_bytes, &bytes_written) != FR_OK) ret = 1;
-            sha_update(buffer, read_bytes);
-            if ((read_bytes != bytes_read) || (bytes_read != bytes_written)) ret = 1;
-            if (!ShowProgress(offset + i + read_bytes, fsize, dest)) ret = 1;
-        }
-        sha_get(chunk->hash);
-        chunk->type[1] &= ~0x01;
+        ret = CryptCiaContent(ofp, dfp, buffer, offset, size, chunk, titlekey, crypto, inplace, dest);
     }
 
     fvx_close(ofp);
@@ -1759,22 +1783,55 @@ u32 CryptCiaFile(const char* orig, const char* dest, u16 crypto) {
         return 1;
     }
 
+    // open file(s) once for all contents
+    FIL ofile;
+    FIL dfile;
+    FIL* ofp = &ofile;
+    FIL* dfp = (inplace) ? &ofile : &dfile;
+    if (fvx_open(ofp, orig, inplace ? (FA_READ | FA_WRITE | FA_OPEN_EXISTING) : (FA_READ | FA_OPEN_EXISTING)) != FR_OK) {
+        free(cia);
+        return 1;
+    }
+    if (!inplace && (fvx_open(dfp, dest, FA_WRITE | FA_OPEN_ALWAYS) != FR_OK)) {
+        fvx_close(ofp);
+        free(cia);
+        return 1;
+    }
+
+    // set up buffer
+    u8* buffer = (u8*) malloc(STD_BUFFER_SIZE);
+    if (!buffer) {
+        fvx_close(ofp);
+        if (!inplace) fvx_close(dfp);
+        free(cia);
+        return 1;
+    }
+
     // decrypt CIA contents
     u32 content_count = getbe16(cia->tmd.content_count);
     u64 next_offset = info.offset_content;
     u8* cnt_index = cia->header.content_index;
-    for (u32 i = 0; (i < content_count) && (i < TMD_MAX_CONTENTS); i++) {
+    u32 ret = 0;
+    for (u32 i = 0; (i < content_count) && (i < TMD_MAX_CONTENTS) && (ret == 0); i++) {
         TmdContentChunk* chunk = &(cia->content_list[i]);
         u64 size = getbe64(chunk->size);
         u16 index = getbe16(chunk->index);
         if (!(cnt_index[index/8] & (1 << (7-(index%8))))) continue; // don't crypt missing contents
-        if (CryptNcchNcsdBossFirmFile(orig, dest, GAME_CIA, crypto, next_offset, size, chunk, titlekey) != 0) {
-            free(cia);
-            return 1;
-        }
+        if ((next_offset + size > fvx_size(ofp)) || // ensure free space in destination
+            (!inplace && ((fvx_lseek(dfp, next_offset + size) != FR_OK) || (fvx_tell(dfp) != next_offset + size))) ||
+            (CryptCiaContent(ofp, dfp, buffer, next_offset, size, chunk, titlekey, crypto, inplace, dest) != 0))
+            ret = 1;
         next_offset += size;
     }
 
+    free(buffer);
+    fvx_close(ofp);
+    if (!inplace) fvx_close(dfp);
+    if (ret != 0) {
+        free(cia);
+        return 1;
+    }
+
     // if not inplace: take over CIA metadata
     if (!inplace && (info.size_meta == CIA_META_SIZE)) {
         CiaMeta* meta = (CiaMeta*) (void*) (cia + 1);
@@ -2474,18 +2531,66 @@ u32 InstallCiaSystemData(CiaStub* cia, const char* drv) {
     return 0;
 }
 
-u32 InsertCiaContent(const char* path_cia, const char* path_content, u32 offset, u32 size,
+// streams one content from ofile (at its current position) to dfile, everything
+// (decrypting, SD flag fix, hashing, encrypting) happens in one pass over the data
+static u32 StreamCiaContent(FIL* dfile, FIL* ofile, u8* buffer, const char* path_content, u32 size,
     TmdContentChunk* chunk, const u8* titlekey, bool force_legit, bool cxi_fix, bool cdn_decrypt) {
     // crypto types / ctr
     bool ncch_decrypt = !force_legit;
     bool cia_encrypt = (force_legit && (getbe16(chunk->type) & 0x01));
     if (!cia_encrypt) chunk->type[1] &= ~0x01; // remove crypto flag
 
+    // main loop starts here
+    FSIZE_t offset = fvx_tell(ofile);
+    FSIZE_t fsize = fvx_size(ofile);
+    UINT bytes_read, bytes_written;
+    u8 ctr_in[16];
+    u8 ctr_out[16];
+    u32 ret = 0;
+    GetTmdCtr(ctr_in, chunk);
+    GetTmdCtr(ctr_out, chunk);
+    if (!ShowProgress(0, 0, path_content)) ret = 1;
+    for (u32 i = 0; (i < size) && (ret == 0); i += STD_BUFFER_SIZE) {
+        u32 read_bytes = min(STD_BUFFER_SIZE, (size - i));
+        if (fvx_read(ofile, buffer, read_bytes, &bytes_read) != FR_OK) ret = 2;
+        if (cdn_decrypt && (DecryptCiaContentSequential(buffer, read_bytes, ctr_in, titlekey) != 0)) ret = 1;
+        if ((i == 0) && ncch_decrypt) { // check if NCCH crypto is available
+            NcchHeader ncch;
+            memcpy(&ncch, buffer, min(read_bytes, sizeof(NcchHeader)));
+            if ((read_bytes < sizeof(NcchHeader)) ||
+                (ValidateNcchHeader(&ncch) != 0) ||
+                (SetupNcchCrypto(&ncch, NCCH_NOCRYPTO) != 0))
+                ncch_decrypt = false;
+        }
+        if (ncch_decrypt && (DecryptNcchSequential(buffer, i, read_bytes) != 0)) ret = 1;
+        if ((i == 0) && cxi_fix && (SetNcchSdFlag(buffer) != 0)) ret = 1;
+        if (i == 0) sha_init(SHA256_MODE);
+        sha_update(buffer, read_bytes);
+        if (cia_encrypt && (EncryptCiaContentSequential(buffer, read_bytes, ctr_out, titlekey) != 0)) ret = 1;
+        if (fvx_write(dfile, buffer, read_bytes, &bytes_written) != FR_OK) ret = 1;
+        if ((read_bytes != bytes_read) || (bytes_read != bytes_written)) ret = 1;
+        if (!ShowProgress(offset + i + read_bytes, fsize, path_content)) ret = 1;
+    }
+    u8 hash[0x20] __attribute__((aligned(4)));
+    sha_get(hash);
+
+    // force legit?
+    if (force_legit && (memcmp(hash, chunk->hash, 0x20) != 0)) return 2;
+    if (force_legit && (getbe64(chunk->size) != size)) return 2;
+
+    // chunk size / chunk hash
+    for (u32 i = 0; i < 8; i++) chunk->size[i] = (u8) (size >> (8*(7-i)));
+    memcpy(chunk->hash, hash, 0x20);
+
+    return ret;
+}
+
+u32 InsertCiaContent(const char* path_cia, const char* path_content, u32 offset, u32 size,
+    TmdContentChunk* chunk, const u8* titlekey, bool force_legit, bool cxi_fix, bool cdn_decrypt) {
     // open file(s)
     FIL ofile;
     FIL dfile;
     FSIZE_t fsize;
-    UINT bytes_read, bytes_written;
     if (fvx_open(&ofile, path_content, FA_READ | FA_OPEN_EXISTING) != FR_OK)
         return 1;
     fvx_lseek(&ofile, offset);
@@ -2507,19 +2612,6 @@ u32 InsertCiaContent(const char* path_cia, const char* path_content, u32 offset,
         return 1;
     }
 
-    // check if NCCH crypto is available
-    if (ncch_decrypt) {
-        NcchHeader ncch;
-        u8 ctr[16];
-        GetTmdCtr(ctr, chunk);
-        if ((fvx_read(&ofile, &ncch, sizeof(NcchHeader), &bytes_read) != FR_OK) ||
-            (cdn_decrypt && (DecryptCiaContentSequential((u8*) &ncch, 0x200, ctr, titlekey) != 0)) ||
-            (ValidateNcchHeader(&ncch) != 0) ||
-            (SetupNcchCrypto(&ncch, NCCH_NOCRYPTO) != 0))
-            ncch_decrypt = false;
-        fvx_lseek(&ofile, offset);
-    }
-
     // allocate buffer
     u8* buffer = (u8*) malloc(STD_BUFFER_SIZE);
     if (!buffer) {
@@ -2528,41 +2620,13 @@ u32 InsertCiaContent(const char* path_cia, const char* path_content, u32 offset,
         return 1;
     }
 
-    // main loop starts here
-    u8 ctr_in[16];
-    u8 ctr_out[16];
-    u32 ret = 0;
-    GetTmdCtr(ctr_in, chunk);
-    GetTmdCtr(ctr_out, chunk);
-    if (!ShowProgress(0, 0, path_content)) ret = 1;
-    for (u32 i = 0; (i < size) && (ret == 0); i += STD_BUFFER_SIZE) {
-        u32 read_bytes = min(STD_BUFFER_SIZE, (size - i));
-        if (fvx_read(&ofile, buffer, read_bytes, &bytes_read) != FR_OK) ret = 2;
-        if (cdn_decrypt && (DecryptCiaContentSequential(buffer, read_bytes, ctr_in, titlekey) != 0)) ret = 1;
-        if (ncch_decrypt && (DecryptNcchSequential(buffer, i, read_bytes) != 0)) ret = 1;
-        if ((i == 0) && cxi_fix && (SetNcchSdFlag(buffer) != 0)) ret = 1;
-        if (i == 0) sha_init(SHA256_MODE);
-        sha_update(buffer, read_bytes);
-        if (cia_encrypt && (EncryptCiaContentSequential(buffer, read_bytes, ctr_out, titlekey) != 0)) ret = 1;
-        if (fvx_write(&dfile, buffer, read_bytes, &bytes_written) != FR_OK) ret = 1;
-        if ((read_bytes != bytes_read) || (bytes_read != bytes_written)) ret = 1;
-        if (!ShowProgress(offset + i + read_bytes, fsize, path_content)) ret = 1;
-    }
-    u8 hash[0x20] __attribute__((aligned(4)));
-    sha_get(hash);
+    u32 ret = StreamCiaContent(&dfile, &ofile, buffer, path_content, size,
+        chunk, titlekey, force_legit, cxi_fix, cdn_decrypt);
 
     free(buffer);
     fvx_close(&ofile);
     fvx_close(&dfile);
 
-    // force legit?
-    if (force_legit && (memcmp(hash, chunk->hash, 0x20) != 0)) return 2;
-    if (force_legit && (getbe64(chunk->size) != size)) return 2;
-
-    // chunk size / chunk hash
-    for (u32 i = 0; i < 8; i++) chunk->size[i] = (u8) (size >> (8*(7-i)));
-    memcpy(chunk->hash, hash, 0x20);
-
     return ret;
 }
 
@@ -2576,6 +2640,93 @@ u32 InsertCiaMeta(const char* path_cia, CiaMeta* meta) {
     return (res) ? 0 : 1;
 }
 
+// builds a CIA front to back in a single pass: space for the stub is reserved
+// up front, contents and meta are appended with the destination (and source)
+// kept open, the final stub goes into the reserved space once at the end
+typedef struct {
+    CiaStub* cia;
+    FIL dfile;
+    FIL ofile;
+    char path_content[256]; // source kept open between contents
+    u8* buffer;
+    u32 offset_content;
+} CiaWriter;
+
+static u32 CiaWriterOpen(CiaWriter* writer, CiaStub* cia, const char* path_cia) {
+    CiaInfo info;
+    memset(writer, 0, sizeof(CiaWriter));
+    if (GetCiaInfo(&info, &(cia->header)) != 0) return 1;
+    writer->cia = cia;
+    writer->offset_content = info.offset_content;
+    writer->buffer = (u8*) malloc(STD_BUFFER_SIZE);
+    if (!writer->buffer) return 1;
+    if (fvx_open(&(writer->dfile), path_cia, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+        free(writer->buffer);
+        writer->buffer = NULL;
+        return 1;
+    }
+    // the stub itself is only written when closing
+    if ((fvx_lseek(&(writer->dfile), info.offset_content) != FR_OK) ||
+        (fvx_tell(&(writer->dfile)) != info.offset_content)) {
+        fvx_close(&(writer->dfile));
+        free(writer->buffer);
+        writer->buffer = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+static u32 CiaWriterAddContent(CiaWriter* writer, const char* path_content, u32 offset, u32 size,
+    TmdContentChunk* chunk, const u8* titlekey, bool force_legit, bool cxi_fix, bool cdn_decrypt) {
+    if (!writer->buffer) return 1;
+
+    // reopen the source only when it changes, seeks forward are cheap
+    if (strncmp(writer->path_content, path_content, 256) != 0) {
+        if (*(writer->path_content)) fvx_close(&(writer->ofile));
+        *(writer->path_content) = '\0';
+        if (fvx_open(&(writer->ofile), path_content, FA_READ | FA_OPEN_EXISTING) != FR_OK)
+            return 1;
+        strncpy(writer->path_content, path_content, 256 - 1);
+    }
+
+    FSIZE_t fsize = fvx_size(&(writer->ofile));
+    if (offset > fsize) return 1;
+    if (!size) size = fsize - offset;
+    if ((fvx_tell(&(writer->ofile)) != offset) && (fvx_lseek(&(writer->ofile), offset) != FR_OK))
+        return 1;
+
+    return StreamCiaContent(&(writer->dfile), &(writer->ofile), writer->buffer, path_content, size,
+        chunk, titlekey, force_legit, cxi_fix, cdn_decrypt);
+}
+
+static u32 CiaWriterAddMeta(CiaWriter* writer, CiaMeta* meta) {
+    UINT btw;
+    if (!writer->buffer) return 1;
+    return ((fvx_write(&(writer->dfile), meta, CIA_META_SIZE, &btw) == FR_OK) && (btw == CIA_META_SIZE)) ? 0 : 1;
+}
+
+// the stub is expected to be final (TMD hashes, header sizes), finalize false just closes
+static u32 CiaWriterClose(CiaWriter* writer, bool finalize) {
+    CiaInfo info;
+    UINT btw;
+    u32 ret = 0;
+    if (!writer->buffer) return 1;
+
+    if (finalize) {
+        ret = ((GetCiaInfo(&info, &(writer->cia->header)) != 0) ||
+            (info.offset_content != writer->offset_content) || // reserved space is fixed
+            (fvx_lseek(&(writer->dfile), 0) != FR_OK) ||
+            (fvx_write(&(writer->dfile), writer->cia, info.offset_content, &btw) != FR_OK) ||
+            (btw != info.offset_content)) ? 1 : 0;
+    }
+
+    if (*(writer->path_content)) fvx_close(&(writer->ofile));
+    fvx_close(&(writer->dfile));
+    free(writer->buffer);
+    writer->buffer = NULL;
+    return ret;
+}
+
 u32 InstallFromCiaFile(const char* path_cia, const char* path_dest) {
     CiaInfo info;
     u8 titlekey[16];
@@ -2963,6 +3114,7 @@ u32 BuildInstallFromNcchFile(const char* path_ncch, const char* path_dest, bool
         title_id[i] = (ncch.programId >> ((7-i)*8)) & 0xFF;
 
     // build the CIA stub
+    CiaWriter writer;
     CiaStub* cia = (CiaStub*) malloc(sizeof(CiaStub));
     if (!cia) return 1;
     memset(cia, 0, sizeof(CiaStub));
@@ -2971,7 +3123,7 @@ u32 BuildInstallFromNcchFile(const char* path_ncch, const char* path_dest, bool
         (BuildFakeTicket((Ticket*)&(cia->ticket), title_id) != 0) ||
         (BuildFakeTmd(&(cia->tmd), title_id, 1, save_size, 0, 0)) ||
         (FixCiaHeaderForTmd(&(cia->header), &(cia->tmd)) != 0) ||
-        (!install && (WriteCiaStub(cia, path_dest) != 0))) {
+        (!install && (CiaWriterOpen(&writer, cia, path_dest) != 0))) {
         free(cia);
         return 1;
     }
@@ -2979,8 +3131,9 @@ u32 BuildInstallFromNcchFile(const char* path_ncch, const char* path_dest, bool
     // insert / install NCCH content
     TmdContentChunk* chunk = cia->content_list;
     memset(chunk, 0, sizeof(TmdContentChunk)); // nothing else to do
-    if ((!install && (InsertCiaContent(path_dest, path_ncch, 0, 0, chunk, NULL, false, true, false) != 0)) ||
+    if ((!install && (CiaWriterAddContent(&writer, path_ncch, 0, 0, chunk, NULL, false, true, false) != 0)) ||
         (install && (InstallCiaContent(path_dest, path_ncch, 0, 0, chunk, title_id, NULL, true, false) != 0))) {
+        if (!install) CiaWriterClose(&writer, false);
         free(cia);
         return 1;
     }
@@ -2990,7 +3143,7 @@ u32 BuildInstallFromNcchFile(const char* path_ncch, const char* path_dest, bool
         CiaMeta* meta = (CiaMeta*) malloc(sizeof(CiaMeta));
         if (meta && has_exthdr && (BuildCiaMeta(meta, &exthdr, NULL) == 0) &&
             (LoadExeFsFile(meta->smdh, path_ncch, 0, "icon", sizeof(meta->smdh), NULL) == 0) &&
-            (InsertCiaMeta(path_dest, meta) == 0))
+            (CiaWriterAddMeta(&writer, meta) == 0))
             cia->header.size_meta = CIA_META_SIZE;
         free(meta);
     }
@@ -2999,8 +3152,9 @@ u32 BuildInstallFromNcchFile(const char* path_ncch, const char* path_dest, bool
     FindTitleKey((Ticket*)(&cia->ticket), title_id);
     if ((FixTmdHashes(&(cia->tmd)) != 0) ||
         (FixCiaHeaderForTmd(&(cia->header), &(cia->tmd)) != 0) ||
-        (!install && (WriteCiaStub(cia, path_dest) != 0)) ||
+        (!install && (CiaWriterClose(&writer, true) != 0)) ||
         (install && (InstallCiaSystemData(cia, path_dest) != 0))) {
+        if (!install) CiaWriterClose(&writer, false);
         free(cia);
         return 1;
     }
@@ -3033,6 +3187,7 @@ u32 BuildInstallFromNcsdFile(const char* path_ncsd, const char* path_dest, bool
     save_size = (u32) exthdr.savedata_size;
 
     // build the CIA stub
+    CiaWriter writer;
     CiaStub* cia = (CiaStub*) malloc(sizeof(CiaStub));
     if (!cia) return 1;
     memset(cia, 0, sizeof(CiaStub));
@@ -3041,7 +3196,7 @@ u32 BuildInstallFromNcsdFile(const char* path_ncsd, const char* path_dest, bool
         (BuildFakeTicket((Ticket*)&(cia->ticket), title_id) != 0) ||
         (BuildFakeTmd(&(cia->tmd), title_id, content_count, save_size, 0, 0)) ||
         (FixCiaHeaderForTmd(&(cia->header), &(cia->tmd)) != 0) ||
-        (!install && (WriteCiaStub(cia, path_dest) != 0))) {
+        (!install && (CiaWriterOpen(&writer, cia, path_dest) != 0))) {
         free(cia);
         return 1;
     }
@@ -3056,10 +3211,11 @@ u32 BuildInstallFromNcsdFile(const char* path_ncsd, const char* path_dest, bool
         memset(chunk, 0, sizeof(TmdContentChunk));
         chunk->id[3] = i;
         chunk->index[1] = i;
-        if ((!install && (InsertCiaContent(path_dest, path_ncsd,
+        if ((!install && (CiaWriterAddContent(&writer, path_ncsd,
                 offset, size, chunk++, NULL, false, (i == 0), false) != 0)) ||
             (install && (InstallCiaContent(path_dest, path_ncsd,
                 offset, size, chunk++, title_id, NULL, (i == 0), false) != 0))) {
+            if (!install) CiaWriterClose(&writer, false);
             free(cia);
             return 1;
         }
@@ -3070,7 +3226,7 @@ u32 BuildInstallFromNcsdFile(const char* path_ncsd, const char* path_dest, bool
         CiaMeta* meta = (CiaMeta*) malloc(sizeof(CiaMeta));
         if (meta && (BuildCiaMeta(meta, &exthdr, NULL) == 0) &&
             (LoadExeFsFile(meta->smdh, path_ncsd, NCSD_CNT0_OFFSET, "icon", sizeof(meta->smdh), NULL) == 0) &&
-            (InsertCiaMeta(path_dest, meta) == 0))
+            (CiaWriterAddMeta(&writer, meta) == 0))
             cia->header.size_meta = CIA_META_SIZE;
         if (meta) free(meta);
     }
@@ -3089,8 +3245,9 @@ u32 BuildInstallFromNcsdFile(const char* path_ncsd, const char* path_dest, bool
     FindTitleKey((Ticket*)&(cia->ticket), title_id);
     if ((FixTmdHashes(&(cia->tmd)) != 0) ||
         (FixCiaHeaderForTmd(&(cia->header), &(cia->tmd)) != 0) ||
-        (!install && (WriteCiaStub(cia, path_dest) != 0)) ||
+        (!install && (CiaWriterClose(&writer, true) != 0)) ||
         (install && (InstallCiaSystemData(cia, path_dest) != 0))) {
+        if (!install) CiaWriterClose(&writer, false);
         free(cia);
         return 1;
     }
@@ -3130,6 +3287,7 @@ u32 BuildInstallFromNdsFile(const char* path_nds, const char* path_dest, bool in
     memcpy(title_id, tidhigh_3ds, 3);
 
     // build the CIA stub
+    CiaWriter writer;
     CiaStub* cia = (CiaStub*) malloc(sizeof(CiaStub));
     if (!cia) return 1;
     memset(cia, 0, sizeof(CiaStub));
@@ -3138,7 +3296,7 @@ u32 BuildInstallFromNdsFile(const char* path_nds, const char* path_dest, bool in
         (BuildFakeTicket((Ticket*)&(cia->ticket), title_id) != 0) ||
         (BuildFakeTmd(&(cia->tmd), title_id, 1, save_size, privsave_size, twl_flag)) ||
         (FixCiaHeaderForTmd(&(cia->header), &(cia->tmd)) != 0) ||
-        (!install && (WriteCiaStub(cia, path_dest) != 0))) {
+        (!install && (CiaWriterOpen(&writer, cia, path_dest) != 0))) {
         free(cia);
         return 1;
     }
@@ -3146,8 +3304,9 @@ u32 BuildInstallFromNdsFile(const char* path_nds, const char* path_dest, bool in
     // insert / install NDS content
     TmdContentChunk* chunk = cia->content_list;
     memset(chunk, 0, sizeof(TmdContentChunk)); // nothing else to do
-    if ((!install && (InsertCiaContent(path_dest, path_nds, 0, 0, chunk, NULL, false, false, false) != 0)) ||
+    if ((!install && (CiaWriterAddContent(&writer, path_nds, 0, 0, chunk, NULL, false, false, false) != 0)) ||
         (install && (InstallCiaContent(path_dest, path_nds, 0, 0, chunk, title_id, NULL, false, false) != 0))) {
+        if (!install) CiaWriterClose(&writer, false);
         free(cia);
         return 1;
     }
@@ -3156,8 +3315,9 @@ u32 BuildInstallFromNdsFile(const char* path_nds, const char* path_dest, bool in
     FindTitleKey((Ticket*)(&cia->ticket), title_id);
     if ((FixTmdHashes(&(cia->tmd)) != 0) ||
         (FixCiaHeaderForTmd(&(cia->header), &(cia->tmd)) != 0) ||
-        (!install && (WriteCiaStub(cia, path_dest) != 0)) ||
+        (!install && (CiaWriterClose(&writer, true) != 0)) ||
         (install && (InstallCiaSystemData(cia, path_dest) != 0))) {
+        if (!install) CiaWriterClose(&writer, false);
         free(cia);
         return 1;
     }
@@ -3672,20 +3832,21 @@ u32 CompressCode(const char* path, const char* path_out) {
     // allocate memory
     u32 code_dec_size = fvx_qsize(path);
     u8* code_dec = (u8*) malloc(code_dec_size);
-    u32 code_cmp_size = code_dec_size;
-    u8* code_cmp = (u8*) malloc(code_cmp_size);
-    if (!code_dec || !code_cmp) {
+    u32 code_cmp_size = align(code_dec_size, CODE_LZSS_DST_ALIGN); // aligned, so it's compressed into in place
+    u8* code_cmp_buf = (u8*) malloc(code_cmp_size + CODE_LZSS_DST_ALIGN);
+    u8* code_cmp = (u8*) align((u32) code_cmp_buf, CODE_LZSS_DST_ALIGN);
+    if (!code_dec || !code_cmp_buf) {
         if (code_dec != NULL) free(code_dec);
-        if (code_cmp != NULL) free(code_cmp);
+        if (code_cmp_buf != NULL) free(code_cmp_buf);
         ShowPrompt(false, "Out of memory.");
         return 1;
     }
 
     // load code.bin and compress code
     if ((fvx_qread(path, code_dec, 0, code_dec_size, NULL) != FR_OK) ||
-        (!CompressCodeLzss(code_dec, code_dec_size, code_cmp, &code_cmp_size))) {
+        (!CompressCodeLzss(code_dec, code_dec_size, code_cmp, &code_cmp_size, CODE_LZSS_HASHCHAIN | CODE_LZSS_LAZY))) {
         free(code_dec);
-        free(code_cmp);
+        free(code_cmp_buf);
         return 1;
     }
 
@@ -3694,11 +3855,11 @@ u32 CompressCode(const char* path, const char* path_out) {
     free(code_dec);
     if (fvx_qwrite(dest, code_cmp, 0, code_cmp_size, NULL) != FR_OK) {
         fvx_unlink(dest);
-        free(code_cmp);
+        free(code_cmp_buf);
         return 1;
     }
 
-    free(code_cmp);
+    free(code_cmp_buf);
     return 0;
 }
 
@@ -1,6 +1,5 @@
 #include "paint9.h"
 #include "vram0.h"
-#include "png.h"
 #include "hid.h"
 #include "ui.h"
 
@@ -107,14 +106,8 @@ u32 Paint9(void) {
     u64 logo_size;
     u8* logo = FindVTarFileInfo(VRAM0_EASTER_BIN, &logo_size);
     ClearScreenF(true, true, COLOR_STD_BG);
-    if (logo) {
-        u32 logo_width, logo_height;
-        u16* bitmap = PNG_Decompress(logo, logo_size, &logo_width, &logo_height);
-        if (bitmap) {
-            DrawBitmap(TOP_SCREEN, -1, -1, logo_width, logo_height, bitmap);
-            free(bitmap);
-        }
-    } else DrawStringF(TOP_SCREEN, 10, 10, COLOR_STD_FONT, COLOR_TRANSPARENT, "(" VRAM0_EASTER_BIN " not found)");
+    if (logo) DrawPng(TOP_SCREEN, -1, -1, logo, logo_size);
+    else DrawStringF(TOP_SCREEN, 10, 10, COLOR_STD_FONT, COLOR_TRANSPARENT, "(" VRAM0_EASTER_BIN " not found)");
     DrawStringF(TOP_SCREEN, SCREEN_WIDTH_TOP - 10 - GetDrawStringWidth(snapstr),
         SCREEN_HEIGHT - 10 - GetDrawStringHeight(snapstr), COLOR_STD_FONT, COLOR_TRANSPARENT, "%s", snapstr);
 
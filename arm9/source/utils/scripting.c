@@ -24,7 +24,8 @@
 #define _ARG_MAX_LEN    512
 #define _VAR_CNT_LEN    256
 #define _VAR_NAME_LEN   32
-#define _VAR_MAX_BUFF   256
+#define _VAR_CHUNK_N    64  // vars per storage chunk
+#define _VAR_HASH_MIN   64  // initial var hash table size
 #define _ERR_STR_LEN    256
 
 #define _CHOICE_STR_LEN 32
@@ -49,6 +50,13 @@
 
 #define _MAX_FOR_DEPTH  16
 
+// events invalidating cached dynamic env vars
+#define _DYN_CLOCK      (1<<0) // RTC may have ticked (every line)
+#define _DYN_SYSNAND    (1<<1) // write to SysNAND
+#define _DYN_EMUNAND    (1<<2) // write to EmuNAND
+#define _DYN_SDCARD     (1<<3) // write to SD card (or anything else)
+#define _DYN_MOUNT      (1<<4) // (un)mount, SD switch, EmuNAND switch
+
 // macros for textviewer
 #define TV_VPAD         1 // vertical padding per line (above / below)
 #define TV_HPAD         0 // horizontal padding per line (left)
@@ -140,8 +148,44 @@ typedef struct {
 typedef struct {
     char name[_VAR_NAME_LEN]; // variable name
     char content[_VAR_CNT_LEN];
+    u32 hash;                 // hash of the name
+    u32 dyn;                  // index into dyn_vars + 1, zero for regular vars
 } Gm9ScriptVar;
 
+typedef struct Gm9ScriptVarChunk {
+    struct Gm9ScriptVarChunk* next;
+    u32 n_vars;
+    Gm9ScriptVar vars[_VAR_CHUNK_N];
+} Gm9ScriptVarChunk;
+
+typedef struct {
+    const char* name;
+    u32 events; // events invalidating the cached value
+} Gm9ScriptDynVar;
+
+typedef struct Gm9ScriptLine {
+    char* start;                    // line start inside the script buffer
+    char* end;                      // line end ('\n' or '\0')
+    char* arg[_MAX_ARGS];           // raw arguments, expanded on execution
+    u32 arg_len[_MAX_ARGS];
+    u32 flags;
+    u8 id;                          // cmd id, CMD_ID_NONE for empty lines, comments, labels
+    u8 argc;
+    u8 ctrl;                        // control flow keyword at line start (if any)
+    u8 valid;                       // false if the line does not parse
+    struct Gm9ScriptLine* cond;     // condition for 'if' / 'elif' / 'not'
+    struct Gm9ScriptLine* next_end; // next 'end' from here on, nested 'if' blocks skipped
+    struct Gm9ScriptLine* next_alt; // next 'else' / 'elif' / 'end' from here on, nested 'if' blocks skipped
+    struct Gm9ScriptLine* next_for; // next 'next' from here on
+} Gm9ScriptLine;
+
+typedef struct {
+    char* name;                     // label name, without the '@'
+    u32 name_len;
+    Gm9ScriptLine* line;
+    bool shadowed;                  // an earlier label starts with this name
+} Gm9ScriptLabel;
+
 static const Gm9ScriptCmd cmd_list[] = {
     { CMD_ID_NONE    , "#"       , 0, 0 }, // dummy entry
     { CMD_ID_NOT     , _CMD_NOT  , 0, 0 }, // inverts the output of the following command
@@ -205,6 +249,20 @@ static const Gm9ScriptCmd cmd_list[] = {
     { CMD_ID_BKPT    , "bkpt"    , 0, 0 }
 };
 
+// dynamic env vars, see upd_var()
+static const Gm9ScriptDynVar dyn_vars[] = {
+    { "SERIAL"   , _DYN_SYSNAND | _DYN_MOUNT },
+    { "REGION"   , _DYN_SYSNAND | _DYN_MOUNT },
+    { "SYSID0"   , _DYN_SYSNAND | _DYN_MOUNT },
+    { "EMUID0"   , _DYN_EMUNAND | _DYN_MOUNT },
+    { "DATESTAMP", _DYN_CLOCK },
+    { "TIMESTAMP", _DYN_CLOCK },
+    { "EMUBASE"  , _DYN_EMUNAND | _DYN_MOUNT },
+    { "SDSIZE"   , _DYN_MOUNT },
+    { "SDFREE"   , _DYN_SDCARD | _DYN_MOUNT },
+    { "NANDSIZE" , _DYN_MOUNT }
+};
+
 // global vars for preview
 static u32 preview_mode = 0; // 0 -> off 1 -> quick 2 -> full
 static u32 script_color_active = 0;
@@ -213,14 +271,29 @@ static u32 script_color_code = 0;
 
 // global vars for control flow
 static bool syntax_error = false;   // if true, severe error, script has to stop
-static char* jump_ptr = NULL;       // next position after a jump
-static char* for_ptr = NULL;        // position of the active 'for' command
+static Gm9ScriptLine* jump_ptr = NULL; // next line after a jump
+static Gm9ScriptLine* for_ptr = NULL;  // line after the active 'for' command
 static u32 skip_state = 0;          // zero, _SKIP_BLOCK, _SKIP_TILL_END
 static u32 ifcnt = 0;               // current # of 'if' nesting
 
-// script / var buffers
+// script buffer
 static void* script_buffer = NULL;
-static void* var_buffer = NULL;
+
+// script vars (chunked storage, open addressing hash table)
+static Gm9ScriptVarChunk* var_chunks = NULL; // newest chunk first
+static Gm9ScriptVar** var_hash = NULL;
+static u32 var_hash_size = 0;               // power of two, at least 50% free
+static u32 var_count = 0;
+static Gm9ScriptVar* var_null = NULL;       // first var ("NULL"), stands in for unknown vars
+static u32 dyn_valid = 0;                   // cached dyn_vars, one bit each
+
+// compiled script (lines, conditions, labels)
+static Gm9ScriptLine* script_lines = NULL; // one per line, plus an empty sentinel at the end
+static u32 script_n_lines = 0;
+static Gm9ScriptLabel* script_labels = NULL; // reachable labels, in search order
+static u32 script_n_labels = 0;
+static u32* label_hash = NULL;             // label index + 1, zero for empty slots
+static u32 label_hash_size = 0;            // power of two
 
 
 static inline bool isntrboot(void) {
@@ -339,15 +412,11 @@ static inline char* line_seek(const char* text, u32 len, u32 ww, const char* lin
     }
 }
 
-static inline u32 get_lno(const char* text, u32 len, const char* line) {
-    u32 lno = 1;
-
-    for (u32 i = 0; i < len; i++) {
-        if (line <= text + i) return lno;
-        else if (text[i] == '\n') lno++;
-    }
-
-    return 0;
+static inline u32 hash_name(const char* name, u32 len) {
+    u32 hash = 0x811C9DC5; // FNV-1a
+    for (u32 i = 0; i < len; i++)
+        hash = (hash ^ (u8) name[i]) * 0x01000193;
+    return hash;
 }
 
 void set_preview(const char* name, const char* content) {
@@ -370,27 +439,89 @@ void set_preview(const char* name, const char* content) {
     }
 }
 
-char* set_var(const char* name, const char* content) {
-    Gm9ScriptVar* vars = (Gm9ScriptVar*) var_buffer;
+Gm9ScriptVar** find_var(const char* name, u32 hash) {
+    u32 mask = var_hash_size - 1;
+    u32 h = hash & mask;
+    for (; var_hash[h]; h = (h + 1) & mask)
+        if ((var_hash[h]->hash == hash) && (strncmp(var_hash[h]->name, name, _VAR_NAME_LEN) == 0)) break;
+    return var_hash + h;
+}
+
+u32 get_dyn_id(const char* name) {
+    for (u32 i = 0; i < countof(dyn_vars); i++)
+        if (strncmp(dyn_vars[i].name, name, _VAR_NAME_LEN) == 0) return i + 1;
+    return 0;
+}
 
+Gm9ScriptVar* new_var(const char* name, u32 hash) {
+    // grow the hash table if required
+    if ((var_count + 1) * 2 > var_hash_size) {
+        Gm9ScriptVar** old_hash = var_hash;
+        u32 old_size = var_hash_size;
+        var_hash = (Gm9ScriptVar**) malloc(old_size * 2 * sizeof(Gm9ScriptVar*));
+        if (!var_hash) {
+            var_hash = old_hash;
+            return NULL;
+        }
+        memset(var_hash, 0x00, old_size * 2 * sizeof(Gm9ScriptVar*));
+        var_hash_size = old_size * 2;
+        for (u32 i = 0; i < old_size; i++)
+            if (old_hash[i]) *find_var(old_hash[i]->name, old_hash[i]->hash) = old_hash[i];
+        free(old_hash);
+    }
+
+    // get a new storage chunk if required
+    if (!var_chunks || (var_chunks->n_vars >= _VAR_CHUNK_N)) {
+        Gm9ScriptVarChunk* chunk = (Gm9ScriptVarChunk*) malloc(sizeof(Gm9ScriptVarChunk));
+        if (!chunk) return NULL;
+        chunk->next = var_chunks;
+        chunk->n_vars = 0;
+        var_chunks = chunk;
+    }
+
+    Gm9ScriptVar* var = var_chunks->vars + (var_chunks->n_vars++);
+    strncpy(var->name, name, _VAR_NAME_LEN);
+    var->name[_VAR_NAME_LEN - 1] = '\0';
+    *(var->content) = '\0';
+    var->hash = hash;
+    var->dyn = get_dyn_id(name);
+    *find_var(name, hash) = var;
+    if (!var_count++) var_null = var;
+
+    return var;
+}
+
+char* set_var(const char* name, const char* content) {
     if ((strnlen(name, _VAR_NAME_LEN) > (_VAR_NAME_LEN-1)) || (strnlen(content, _VAR_CNT_LEN) > (_VAR_CNT_LEN-1)) ||
         (strchr(name, '[') || strchr(name, ']')))
         return NULL;
 
-    u32 n_var = 0;
-    for (Gm9ScriptVar* var = vars; n_var < _VAR_MAX_BUFF; n_var++, var++)
-        if (!*(var->name) || (strncmp(var->name, name, _VAR_NAME_LEN) == 0)) break;
-    if (n_var >= _VAR_MAX_BUFF) return NULL;
-    strncpy(vars[n_var].name, name, _VAR_NAME_LEN);
-    vars[n_var].name[_VAR_NAME_LEN - 1] = '\0';
-    strncpy(vars[n_var].content, content, _VAR_CNT_LEN);
-    vars[n_var].content[_VAR_CNT_LEN - 1] = '\0';
-    if (!n_var) *(vars[n_var].content) = '\0'; // NULL var
+    u32 hash = hash_name(name, strnlen(name, _VAR_NAME_LEN));
+    Gm9ScriptVar* var = *find_var(name, hash);
+    if (!var && !(var = new_var(name, hash))) return NULL;
+    strncpy(var->content, content, _VAR_CNT_LEN);
+    var->content[_VAR_CNT_LEN - 1] = '\0';
+    if (var == var_null) *(var->content) = '\0'; // NULL var
+
+    // overwritten dynamic vars get refreshed on next use
+    if (var->dyn) dyn_valid &= ~(1 << (var->dyn - 1));
 
     // update preview stuff
     set_preview(name, content);
 
-    return vars[n_var].content;
+    return var->content;
+}
+
+char* set_dyn_var(const char* name, const char* content) {
+    char* ret = set_var(name, content);
+    u32 dyn = get_dyn_id(name);
+    if (ret && dyn) dyn_valid |= (1 << (dyn - 1));
+    return ret;
+}
+
+void invalidate_vars(u32 events) {
+    for (u32 i = 0; i < countof(dyn_vars); i++)
+        if (dyn_vars[i].events & events) dyn_valid &= ~(1 << i);
 }
 
 void upd_var(const char* name) {
@@ -408,8 +539,8 @@ void upd_var(const char* name) {
         else if (*secinfo_data < SMDH_NUM_REGIONS)
             strncpy(env_region, g_regionNamesShort[*secinfo_data], countof(env_region) - 1);
 
-        set_var("SERIAL", env_serial);
-        set_var("REGION", env_region);
+        set_dyn_var("SERIAL", env_serial);
+        set_dyn_var("REGION", env_region);
     }
 
     // device sysnand / emunand id0
@@ -425,7 +556,7 @@ void upd_var(const char* name) {
                 snprintf(env_id0, 32+1, "%08lx%08lx%08lx%08lx",
                     sha256sum[0], sha256sum[1], sha256sum[2], sha256sum[3]);
             } else snprintf(env_id0, 0xF, "UNKNOWN");
-            set_var(env_id0_name, env_id0);
+            set_dyn_var(env_id0_name, env_id0);
         }
     }
 
@@ -437,8 +568,8 @@ void upd_var(const char* name) {
         char env_time[16+1];
         snprintf(env_date, 16, "%02lX%02lX%02lX", (u32) dstime.bcd_Y, (u32) dstime.bcd_M, (u32) dstime.bcd_D);
         snprintf(env_time, 16, "%02lX%02lX%02lX", (u32) dstime.bcd_h, (u32) dstime.bcd_m, (u32) dstime.bcd_s);
-        if (!name || (strncmp(name, "DATESTAMP", _VAR_NAME_LEN) == 0)) set_var("DATESTAMP", env_date);
-        if (!name || (strncmp(name, "TIMESTAMP", _VAR_NAME_LEN) == 0)) set_var("TIMESTAMP", env_time);
+        if (!name || (strncmp(name, "DATESTAMP", _VAR_NAME_LEN) == 0)) set_dyn_var("DATESTAMP", env_date);
+        if (!name || (strncmp(name, "TIMESTAMP", _VAR_NAME_LEN) == 0)) set_dyn_var("TIMESTAMP", env_time);
     }
 
     // emunand base sector
@@ -446,7 +577,7 @@ void upd_var(const char* name) {
         u32 emu_base = GetEmuNandBase();
         char emu_base_str[8+1];
         snprintf(emu_base_str, 8+1, "%08lX", emu_base);
-        set_var("EMUBASE", emu_base_str);
+        set_dyn_var("EMUBASE", emu_base_str);
     }
 
     // SD card storage
@@ -454,7 +585,7 @@ void upd_var(const char* name) {
         u64 sdsize = GetTotalSpace("0:");
         char sdsize_str[32+1];
         FormatBytes(sdsize_str, sdsize);
-        set_var("SDSIZE", sdsize_str);
+        set_dyn_var("SDSIZE", sdsize_str);
     }
 
     // SD card free storage
@@ -462,7 +593,7 @@ void upd_var(const char* name) {
         u64 sdfree = GetFreeSpace("0:");
         char sdfree_str[32+1];
         FormatBytes(sdfree_str, sdfree);
-        set_var("SDFREE", sdfree_str);
+        set_dyn_var("SDFREE", sdfree_str);
     }
 
     // NAND size
@@ -470,18 +601,16 @@ void upd_var(const char* name) {
         u64 nandsize = GetNandSizeSectors(NAND_SYSNAND) * 0x200;
         char nandsize_str[32+1];
         FormatBytes(nandsize_str, nandsize);
-        set_var("NANDSIZE", nandsize_str);
+        set_dyn_var("NANDSIZE", nandsize_str);
     }
 }
 
 char* get_var(const char* name, char** endptr) {
-    Gm9ScriptVar* vars = (Gm9ScriptVar*) var_buffer;
-
     u32 name_len = 0;
     char* pname = NULL;
     if (!endptr) { // no endptr, varname is verbatim
         pname = (char*) name;
-        name_len = strnlen(pname, _VAR_NAME_LEN);
+        name_len = strnlen(pname, _VAR_NAME_LEN - 1);
     } else { // endptr given, varname is in [VAR] format
         pname = (char*) name + 1;
         if (*name != '[') return NULL;
@@ -493,21 +622,41 @@ char* get_var(const char* name, char** endptr) {
     char vname[_VAR_NAME_LEN];
     strncpy(vname, pname, name_len);
     vname[name_len] = '\0';
-    upd_var(vname); // handle dynamic env vars
 
-    u32 n_var = 0;
-    for (Gm9ScriptVar* var = vars; n_var < _VAR_MAX_BUFF; n_var++, var++) {
-        if (!*(var->name) || (strncmp(var->name, vname, _VAR_NAME_LEN) == 0)) break;
+    u32 hash = hash_name(vname, name_len);
+    Gm9ScriptVar* var = *find_var(vname, hash);
+
+    // handle dynamic env vars, refresh only if outdated
+    u32 dyn = var ? var->dyn : get_dyn_id(vname);
+    if (dyn && !(dyn_valid & (1 << (dyn - 1)))) {
+        upd_var(vname);
+        var = *find_var(vname, hash);
     }
 
-    if (n_var >= _VAR_MAX_BUFF || !*(vars[n_var].name)) n_var = 0;
+    return var ? var->content : var_null->content;
+}
 
-    return vars[n_var].content;
+void free_vars(void) {
+    while (var_chunks) {
+        Gm9ScriptVarChunk* next = var_chunks->next;
+        free(var_chunks);
+        var_chunks = next;
+    }
+    if (var_hash) free(var_hash);
+    var_hash = NULL;
+    var_hash_size = 0;
+    var_count = 0;
+    var_null = NULL;
+    dyn_valid = 0;
 }
 
 bool init_vars(const char* path_script) {
     // reset var buffer
-    memset(var_buffer, 0x00, sizeof(Gm9ScriptVar) * _VAR_MAX_BUFF);
+    free_vars();
+    var_hash = (Gm9ScriptVar**) malloc(_VAR_HASH_MIN * sizeof(Gm9ScriptVar*));
+    if (!var_hash) return false;
+    memset(var_hash, 0x00, _VAR_HASH_MIN * sizeof(Gm9ScriptVar*));
+    var_hash_size = _VAR_HASH_MIN;
 
     // current path
     char curr_dir[_VAR_CNT_LEN];
@@ -519,7 +668,10 @@ bool init_vars(const char* path_script) {
     } else strncpy(curr_dir, "(null)",  _VAR_CNT_LEN - 1);
 
     // set env vars
-    set_var("NULL", ""); // this one is special and should not be changed later
+    if (!set_var("NULL", "")) { // this one is special and should not be changed later
+        free_vars();
+        return false;
+    }
     set_var("CURRDIR", curr_dir); // script path, never changes
     set_var("GM9OUT", OUTPUT_PATH); // output path, never changes
     set_var("HAX", IS_UNLOCKED ? (isntrboot() ? "ntrboot" : "sighax") : ""); // type of hax running from
@@ -641,129 +793,229 @@ char* get_string(char* ptr, const char* line_end, u32* len, char** next, char* e
     return str;
 }
 
-char* skip_block(char* ptr, bool ignore_else, bool stop_after_end) {
-    while (*ptr) {
-        // store line start / line end
-        char* line_start = ptr;
-        char* line_end = strchr(ptr, '\n');
-        if (!line_end) line_end = ptr + strlen(ptr);
+char* compile_line(Gm9ScriptLine* line, char* line_start, char* line_end) {
+    char* ptr = line_start;
+    char* str;
+    u32 len;
 
-        // grab first string
-        char* str = NULL;
-        u32 str_len = 0;
-        if (!(str = get_string(ptr, line_end, &str_len, &ptr, NULL)) || (str >= line_end)) {
-            // string error or empty line
-            ptr = line_end + 1;
-            continue;
-        }
+    // set everything to initial values
+    memset(line, 0x00, sizeof(Gm9ScriptLine));
+    line->start = line_start;
+    line->end = line_end;
 
-        // check string
-        if (MATCH_STR(str, str_len, _CMD_END)) { // stop at end
-            return line_start; // end of block found
-        } else if (!ignore_else && MATCH_STR(str, str_len, _CMD_ELSE)) { // stop at else
-            return line_start; // end of block found
-        } else if (!ignore_else && MATCH_STR(str, str_len, _CMD_ELIF)) { // stop at elif
-            return line_start; // end of block found
-        } else if (MATCH_STR(str, str_len, _CMD_IF)) {
-            ptr = line_start = skip_block(line_end + 1, true, false);
-            if (ptr == NULL) return NULL;
-
-            line_end = strchr(ptr, '\n');
-            if (!line_end) line_end = ptr + strlen(ptr);
-
-            str = get_string(ptr, line_end, &str_len, &ptr, NULL);
-            if (!(MATCH_STR(str, str_len, _CMD_END))) return NULL;
-            if (stop_after_end) return line_end + 1;
-        }
+    // search for cmd (same rules as parse_line())
+    char* cmd = NULL;
+    u32 cmd_len = 0;
+    if (!(cmd = get_string(ptr, line_end, &cmd_len, &ptr, NULL))) return NULL; // string error
+    if ((cmd >= line_end) || (*cmd == '#') || (*cmd == '@')) { // empty line or comment or label
+        line->valid = true;
+        return NULL;
+    }
 
-        // move on to the next line
-        ptr = line_end + 1;
+    // control flow keyword, used for resolving blocks
+    if (MATCH_STR(cmd, cmd_len, _CMD_IF)) line->ctrl = CMD_ID_IF;
+    else if (MATCH_STR(cmd, cmd_len, _CMD_ELIF)) line->ctrl = CMD_ID_ELIF;
+    else if (MATCH_STR(cmd, cmd_len, _CMD_ELSE)) line->ctrl = CMD_ID_ELSE;
+    else if (MATCH_STR(cmd, cmd_len, _CMD_END)) line->ctrl = CMD_ID_END;
+    else if (MATCH_STR(cmd, cmd_len, _CMD_FOR)) line->ctrl = CMD_ID_FOR;
+    else if (MATCH_STR(cmd, cmd_len, _CMD_NEXT)) line->ctrl = CMD_ID_NEXT;
+
+    // special handling for "if", "elif" and "not", return the condition
+    if (MATCH_STR(cmd, cmd_len, _CMD_NOT) || (line->ctrl == CMD_ID_IF) || (line->ctrl == CMD_ID_ELIF)) {
+        line->id = (line->ctrl) ? line->ctrl : CMD_ID_NOT;
+        line->valid = true;
+
+        // skip to behind the command
+        char* cond = line_start;
+        for (; IS_WHITESPACE(*cond); cond++);
+        for (; *cond && !IS_WHITESPACE(*cond); cond++);
+        return cond;
+    }
+
+    // got cmd, now parse flags & args
+    u32 flags = 0;
+    u32 argc = 0;
+    while ((str = get_string(ptr, line_end, &len, &ptr, NULL))) {
+        bool in_quotes = ((ptr - str) != (int) len); // hacky
+        if ((str >= line_end) || ((*str == '#') && !in_quotes)) { // end of line or comment
+            line->id = get_cmd_id(cmd, cmd_len, flags, argc, NULL);
+            line->flags = flags;
+            line->argc = argc;
+            line->valid = (line->id != CMD_ID_NONE);
+            return NULL;
+        }
+        if ((*str == '-') && !in_quotes) { // flag
+            u32 flag_add = get_flag(str, len, NULL);
+            if (!flag_add) return NULL; // not a proper flag
+            flags |= flag_add;
+        } else if (argc >= _MAX_ARGS) {
+            return NULL; // too many arguments
+        } else {
+            line->arg[argc] = str;
+            line->arg_len[argc++] = len;
+        }
     }
 
-    // end of block not found
+    // end reached with a failed get_string()
     return NULL;
 }
 
-char* find_next(char* ptr) {
-    while (ptr && *ptr) {
-        // store line start / line end
-        char* line_start = ptr;
-        char* line_end = strchr(ptr, '\n');
-        if (!line_end) line_end = ptr + strlen(ptr);
+bool get_label(Gm9ScriptLine* line, char** name, u32* name_len) {
+    char* ptr = line->start;
+    char* str = NULL;
+    u32 str_len = 0;
 
-        // grab first string
-        char* str = NULL;
-        u32 str_len = 0;
-        if (!(str = get_string(ptr, line_end, &str_len, &ptr, NULL)) || (str >= line_end)) {
-            // string error or empty line
-            ptr = line_end + 1;
-            continue;
-        }
+    if (!(str = get_string(ptr, line->end, &str_len, &ptr, NULL)) ||
+        (str >= line->end) || (*str != '@')) return false; // no label
 
-        // check string
-        if (MATCH_STR(str, str_len, _CMD_IF)) { // skip 'if' blocks
-            ptr = skip_block(ptr, true, true);
-        } else if (MATCH_STR(str, str_len, _CMD_END) || MATCH_STR(str, str_len, _CMD_FOR)) {
-            ptr = NULL; // this should not happen here
-        } else if (MATCH_STR(str, str_len, _CMD_NEXT)) {
-            return line_start;
-        }
+    *name = str + 1;
+    *name_len = str_len - 1;
 
-        // move on to the next line
-        ptr = line_end + 1;
-    }
+    // a label is only valid if there are no more strings after it
+    if (!(str = get_string(ptr, line->end, &str_len, &ptr, NULL))) return false; // string error
+    return (str >= line->end) || (*str == '#'); // end of line or comment
+}
 
-    // 'next' not found
-    return NULL;
+static inline bool match_label(const char* label, u32 label_len, const Gm9ScriptLabel* lbl) {
+    // compare it manually (also check for '*' at end)
+    u32 pdiff = 0;
+    for (; (pdiff < lbl->name_len) && (label[pdiff] == lbl->name[pdiff]); pdiff++);
+    return (pdiff >= label_len) || (label[pdiff] == '*');
 }
 
-char* find_label(const char* label, const char* last_found) {
-    char* script = (char*) script_buffer;
-    char* ptr = script;
-    u32 label_len = strnlen(label, _ARG_MAX_LEN);
+void free_script(void) {
+    if (script_lines) free(script_lines);
+    if (script_labels) free(script_labels);
+    script_lines = NULL;
+    script_labels = NULL;
+    label_hash = NULL;
+    script_n_lines = 0;
+    script_n_labels = 0;
+    label_hash_size = 0;
+}
 
-    if (last_found) {
-        ptr = strchr(last_found, '\n');
-        if (!ptr) return NULL;
-        ptr++;
-    }
+bool compile_script(char* script, u32 script_size) {
+    char* end = script + script_size;
+    Gm9ScriptLine tmp;
 
-    char* next = ptr;
-    for (; next && *ptr; ptr = next) {
-        // store line start / get line end
-        char* line_start = ptr;
+    // first pass: count lines and conditions
+    u32 n_lines = 0;
+    u32 n_conds = 0;
+    for (char* ptr = script; ptr < end; n_lines++) {
         char* line_end = strchr(ptr, '\n');
         if (!line_end) line_end = ptr + strlen(ptr);
-        next = line_end + 1;
+        for (char* cond = compile_line(&tmp, ptr, line_end); cond; n_conds++)
+            cond = compile_line(&tmp, cond, line_end);
+        ptr = line_end + 1;
+    }
 
-        // search for label
-        char* str = NULL;
-        u32 str_len = 0;
-        if (!(str = get_string(ptr, line_end, &str_len, &ptr, NULL))) continue; // string error, ignore line
-        else if (str >= line_end) continue; // empty line
+    // one buffer for lines, sentinel and conditions
+    script_lines = (Gm9ScriptLine*) malloc((n_lines + 1 + n_conds) * sizeof(Gm9ScriptLine));
+    if (!script_lines) return false;
+    script_n_lines = n_lines;
 
-        if (*str == '@') {
-            // label found
-            str++; str_len--;
+    // second pass: compile lines, conditions go behind the sentinel
+    Gm9ScriptLine* line = script_lines;
+    Gm9ScriptLine* cond_line = script_lines + n_lines + 1;
+    for (char* ptr = script; ptr < end; line++) {
+        char* line_end = strchr(ptr, '\n');
+        if (!line_end) line_end = ptr + strlen(ptr);
+        Gm9ScriptLine* prev = line;
+        for (char* cond = compile_line(line, ptr, line_end); cond; prev = prev->cond) {
+            prev->cond = cond_line++;
+            cond = compile_line(prev->cond, cond, line_end);
+        }
+        ptr = line_end + 1;
+    }
 
-            // compare it manually (also check for '*' at end)
-            u32 pdiff = 0;
-            for (; (pdiff < str_len) && (label[pdiff] == str[pdiff]); pdiff++);
-            if ((pdiff < label_len) && (label[pdiff] != '*')) continue; // no match
-            // otherwise: potential regular or wildcard match
+    // empty sentinel line, never executed
+    memset(line, 0x00, sizeof(Gm9ScriptLine));
+    line->start = line->end = end;
+    line->valid = true;
+
+    // resolve blocks, back to front
+    for (u32 i = n_lines; i > 0; i--) {
+        line = script_lines + i - 1;
+        Gm9ScriptLine* next = line + 1;
+        Gm9ScriptLine* block_end = (line->ctrl == CMD_ID_IF) ? next->next_end : NULL;
+        line->next_for = (line->ctrl == CMD_ID_NEXT) ? line : next->next_for;
+        if ((line->ctrl == CMD_ID_END) || (line->ctrl == CMD_ID_ELSE) || (line->ctrl == CMD_ID_ELIF))
+            line->next_alt = line;
+        else if (line->ctrl == CMD_ID_IF) line->next_alt = block_end ? (block_end + 1)->next_alt : NULL;
+        else line->next_alt = next->next_alt;
+        if (line->ctrl == CMD_ID_END) line->next_end = line;
+        else if (line->ctrl == CMD_ID_IF) line->next_end = block_end ? (block_end + 1)->next_end : NULL;
+        else line->next_end = next->next_end;
+    }
+
+    // collect labels reachable by search ('if' / 'for' blocks are skipped)
+    u32 n_labels = 0;
+    char* name;
+    u32 name_len;
+    for (line = script_lines; line && (line < script_lines + n_lines);) {
+        if (get_label(line, &name, &name_len)) n_labels++;
+        if (line->ctrl == CMD_ID_IF) line = (line + 1)->next_end ? (line + 1)->next_end + 1 : NULL;
+        else if (line->ctrl == CMD_ID_FOR) line = line->next_for;
+        else line++;
+    }
+
+    // label table and hash (at least 50% free)
+    for (label_hash_size = 16; label_hash_size < 2 * n_labels; label_hash_size <<= 1);
+    script_labels = (Gm9ScriptLabel*) malloc((n_labels * sizeof(Gm9ScriptLabel)) + (label_hash_size * sizeof(u32)));
+    if (!script_labels) {
+        free_script();
+        return false;
+    }
+    label_hash = (u32*) (void*) (script_labels + n_labels);
+    memset(label_hash, 0x00, label_hash_size * sizeof(u32));
+
+    for (line = script_lines; line && (line < script_lines + n_lines);) {
+        if (get_label(line, &name, &name_len)) {
+            Gm9ScriptLabel* lbl = script_labels + script_n_labels;
+            lbl->name = name;
+            lbl->name_len = name_len;
+            lbl->line = line;
+            lbl->shadowed = false;
+            for (Gm9ScriptLabel* prev = script_labels; (prev < lbl) && !lbl->shadowed; prev++)
+                lbl->shadowed = (prev->name_len > name_len) && (strncmp(prev->name, name, name_len) == 0);
+
+            // only the first label of a name goes into the hash
+            u32 mask = label_hash_size - 1;
+            u32 h = hash_name(name, name_len) & mask;
+            for (; label_hash[h]; h = (h + 1) & mask) {
+                Gm9ScriptLabel* hit = script_labels + label_hash[h] - 1;
+                if ((hit->name_len == name_len) && (strncmp(hit->name, name, name_len) == 0)) break;
+            }
+            if (!label_hash[h]) label_hash[h] = script_n_labels + 1;
+            script_n_labels++;
+        }
+        if (line->ctrl == CMD_ID_IF) line = (line + 1)->next_end ? (line + 1)->next_end + 1 : NULL;
+        else if (line->ctrl == CMD_ID_FOR) line = line->next_for;
+        else line++;
+    }
 
-            // may be a match, see if there are more strings after it
-            if (!(str = get_string(ptr, line_end, &str_len, &ptr, NULL))) continue; // string error, ignore line
-            else if ((str < line_end) && (*str != '#')) continue; // neither end of line nor comment
+    return true;
+}
 
-            return line_start; // match found
-        } else if (MATCH_STR(str, str_len, _CMD_IF)) {
-            next = skip_block(line_start, true, true);
-        } else if (MATCH_STR(str, str_len, _CMD_FOR)) {
-            next = find_next(line_start);
-        } // otherwise: irrelevant line
+Gm9ScriptLabel* find_label(const char* label, const Gm9ScriptLabel* last_found) {
+    Gm9ScriptLabel* lbl = last_found ? (Gm9ScriptLabel*) last_found + 1 : script_labels;
+    u32 label_len = strnlen(label, _ARG_MAX_LEN);
+
+    // hashed lookup for plain labels, unless an earlier label also matches
+    if (!last_found && !strchr(label, '*')) {
+        u32 mask = label_hash_size - 1;
+        for (u32 h = hash_name(label, label_len) & mask; label_hash[h]; h = (h + 1) & mask) {
+            Gm9ScriptLabel* hit = script_labels + label_hash[h] - 1;
+            if ((hit->name_len != label_len) || (strncmp(hit->name, label, label_len) != 0)) continue;
+            if (!hit->shadowed) return hit;
+            break;
+        }
     }
 
+    // linear search for wildcards and partial matches
+    for (; lbl < script_labels + script_n_labels; lbl++)
+        if (match_label(label, label_len, lbl)) return lbl;
+
     return NULL;
 }
 
@@ -977,7 +1229,8 @@ bool run_cmd(cmd_id id, u32 flags, char** argv, char* err_str) {
         }
     }
     else if (id == CMD_ID_GOTO) {
-        jump_ptr = find_label(argv[0], NULL);
+        Gm9ScriptLabel* label = find_label(argv[0], NULL);
+        jump_ptr = label ? label->line : NULL;
         if (!jump_ptr) {
             ret = false;
             if (err_str) snprintf(err_str, _ERR_STR_LEN, "label not found");
@@ -985,15 +1238,16 @@ bool run_cmd(cmd_id id, u32 flags, char** argv, char* err_str) {
     }
     else if (id == CMD_ID_LABELSEL) {
         const char* options[_CHOICE_MAX_N] = { NULL };
-        char* options_jmp[_CHOICE_MAX_N] = { NULL };
+        Gm9ScriptLine* options_jmp[_CHOICE_MAX_N] = { NULL };
         char options_str[_CHOICE_MAX_N][_CHOICE_STR_LEN+1];
         u32 options_keys[_CHOICE_MAX_N] = { 0 };
 
         char* ast = strchr(argv[1], '*');
-        char* ptr = NULL;
+        Gm9ScriptLabel* label = NULL;
         u32 n_opt = 0;
-        while ((ptr = find_label(argv[1], ptr))) {
-            options_jmp[n_opt] = ptr;
+        while ((label = find_label(argv[1], label))) {
+            char* ptr = label->line->start;
+            options_jmp[n_opt] = label->line;
 
             while (*(ptr++) != '@');
             if (ast) ptr += (ast - argv[1]);
@@ -1042,7 +1296,7 @@ bool run_cmd(cmd_id id, u32 flags, char** argv, char* err_str) {
             memcpy(screen_copy, ALT_SCREEN, screen_size);
             DrawQrCode(ALT_SCREEN, qrcode);
             ShowPrompt(false, "%s", argv[0]);
-            memcpy(ALT_SCREEN, screen_copy, screen_size);
+            RestoreScreen(ALT_SCREEN, (u16*) screen_copy);
         } else if (err_str) snprintf(err_str, _ERR_STR_LEN, "out of memory");
         free(screen_copy);
     }
@@ -1550,11 +1804,39 @@ bool run_cmd(cmd_id id, u32 flags, char** argv, char* err_str) {
     return ret;
 }
 
-bool run_line(const char* line_start, const char* line_end, u32* flags, char* err_str, bool if_cond) {
+u32 get_cmd_events(cmd_id id, char** argv) {
+    switch (id) {
+        // commands that don't write or mount anything
+        case CMD_ID_NONE: case CMD_ID_NOT: case CMD_ID_IF: case CMD_ID_ELIF: case CMD_ID_ELSE: case CMD_ID_END:
+        case CMD_ID_FOR: case CMD_ID_NEXT: case CMD_ID_GOTO: case CMD_ID_LABELSEL: case CMD_ID_KEYCHK:
+        case CMD_ID_ECHO: case CMD_ID_QR: case CMD_ID_ASK: case CMD_ID_INPUT: case CMD_ID_FILESEL:
+        case CMD_ID_DIRSEL: case CMD_ID_SET: case CMD_ID_STRSPLIT: case CMD_ID_STRREP: case CMD_ID_CHK:
+        case CMD_ID_ALLOW: case CMD_ID_FIND: case CMD_ID_FINDNOT: case CMD_ID_FGET: case CMD_ID_SHA:
+        case CMD_ID_VERIFY: case CMD_ID_TEXTVIEW: case CMD_ID_ISDIR: case CMD_ID_EXIST: case CMD_ID_BKPT:
+            return 0;
+        case CMD_ID_MOUNT: case CMD_ID_UMOUNT: case CMD_ID_SWITCHSD: case CMD_ID_NEXTEMU:
+            return _DYN_MOUNT;
+        default:
+            break;
+    }
+
+    // anything else may write, check the drives involved
+    u32 events = _DYN_SDCARD;
+    for (u32 i = 0; i < cmd_list[id].n_args; i++) {
+        char drv = argv[i][0];
+        if ((drv >= 'a') && (drv <= 'z')) drv -= 'a' - 'A';
+        if (argv[i][1] != ':') continue;
+        if ((drv == '1') || (drv == 'S')) events |= _DYN_SYSNAND;
+        else if ((drv == '4') || (drv == 'E')) events |= _DYN_EMUNAND;
+    }
+
+    return events;
+}
+
+bool run_line(Gm9ScriptLine* line, u32* flags, char* err_str, bool if_cond) {
     char args[_MAX_ARGS][_ARG_MAX_LEN];
     char* argv[_MAX_ARGS];
-    u32 argc = 0;
-    cmd_id cmdid;
+    cmd_id cmdid = line->id;
 
     // set up argv array
     for (u32 i = 0; i < _MAX_ARGS; i++)
@@ -1565,12 +1847,24 @@ bool run_line(const char* line_start, const char* line_end, u32* flags, char* er
     if (!flags) flags = &lflags;
     *flags = 0;
 
-    // parse current line, grab cmd / flags / args
-    if (!parse_line(line_start, line_end, &cmdid, flags, &argc, argv, err_str)) {
+    // lines that failed to compile are parsed again for the error message
+    if (!line->valid) {
+        u32 argc = 0;
+        parse_line(line->start, line->end, &cmdid, flags, &argc, argv, err_str);
         syntax_error = true;
         return false;
     }
 
+    // expand precompiled args
+    for (u32 i = 0; i < line->argc; i++) {
+        if (!expand_arg(argv[i], line->arg[i], line->arg_len[i])) {
+            if (err_str) snprintf(err_str, _ERR_STR_LEN, "argument expand failed");
+            syntax_error = true;
+            return false; // arg expand failed
+        }
+    }
+    *flags = line->flags;
+
     // control flow command handling
     // block out of control flow commands
     if (if_cond && IS_CTRLFLOW_CMD(cmdid)) {
@@ -1588,21 +1882,18 @@ bool run_line(const char* line_start, const char* line_end, u32* flags, char* er
     // handle "if" / "elif" / "not"
     if ((cmdid == CMD_ID_IF) || (cmdid == CMD_ID_ELIF) || (cmdid == CMD_ID_NOT)) {
         // set defaults
-        argc = 1;
         strncpy(argv[0], _ARG_FALSE, _ARG_MAX_LEN - 1);
 
-        // skip to behind the command
-        char* line_start_next = (char*) line_start;
-        for (; IS_WHITESPACE(*line_start_next); line_start_next++);
-        for (; *line_start_next && !IS_WHITESPACE(*line_start_next); line_start_next++);
-
         // run condition, take over result
-        if (run_line(line_start_next, line_end, flags, err_str, true))
+        if (run_line(line->cond, flags, err_str, true))
             strncpy(argv[0], _ARG_TRUE, _ARG_MAX_LEN - 1);
     }
 
     // run the command (if available)
-    if (cmdid && !run_cmd(cmdid, *flags, argv, err_str)) {
+    if (!cmdid) return true;
+    bool ret = run_cmd(cmdid, *flags, argv, err_str);
+    invalidate_vars(get_cmd_events(cmdid, argv)); // dynamic vars affected by the command
+    if (!ret) {
         char* msg_fail = get_var("ERRORMSG", NULL);
         if (msg_fail && *msg_fail) *err_str = '\0'; // use custom error message
         return false;
@@ -1878,14 +2169,10 @@ bool ExecuteGM9Script(const char* path_script) {
 
 
     // allocate && check memory
-    var_buffer = (void*) malloc(sizeof(Gm9ScriptVar) * _VAR_MAX_BUFF);
     script_buffer = (void*) malloc(SCRIPT_MAX_SIZE);
     char* script = (char*) script_buffer;
-    char* ptr = script;
 
-    if (!var_buffer || !script_buffer) {
-        if (var_buffer) free(var_buffer);
-        if (script_buffer) free(script_buffer);
+    if (!script_buffer) {
         ShowPrompt(false, "Out of memory.");
         return false;
     }
@@ -1893,7 +2180,6 @@ bool ExecuteGM9Script(const char* path_script) {
     // fetch script from path
     u32 script_size = FileGetData(path_script, (u8*) script, SCRIPT_MAX_SIZE, 0);
     if (!script_size || (script_size >= SCRIPT_MAX_SIZE)) {
-        free(var_buffer);
         free(script_buffer);
         return false;
     }
@@ -1901,8 +2187,13 @@ bool ExecuteGM9Script(const char* path_script) {
     char* end = script + script_size;
     *end = '\0';
 
-    // initialise variables
-    init_vars(path_script);
+    // compile script (split lines / args, resolve blocks / labels), initialise variables
+    if (!compile_script(script, script_size) || !init_vars(path_script)) {
+        free_script();
+        free(script_buffer);
+        ShowPrompt(false, "Out of memory.");
+        return false;
+    }
 
     // setup script preview (only if used)
     u32 preview_mode_local = 0;
@@ -1915,14 +2206,13 @@ bool ExecuteGM9Script(const char* path_script) {
     }
 
     // script execute loop
-    u32 lno = 1;
+    Gm9ScriptLine* line = script_lines;
     bool result = true;
-    while (ptr < end) {
+    while (line < script_lines + script_n_lines) {
         u32 flags = 0;
-
-        // find line end
-        char* line_end = strchr(ptr, '\n');
-        if (!line_end) line_end = ptr + strlen(ptr);
+        u32 lno = (line - script_lines) + 1;
+        char* ptr = line->start;
+        char* line_end = line->end;
 
         // update script viewer
         if (MAIN_SCREEN != TOP_SCREEN) {
@@ -1931,21 +2221,17 @@ bool ExecuteGM9Script(const char* path_script) {
                     ClearScreen(TOP_SCREEN, COLOR_STD_BG);
                 if (preview_mode > 2) {
                     char* preview_str = get_var("PREVIEW_MODE", NULL);
-                    u32 bitmap_width, bitmap_height;
-                    u16* bitmap = NULL;
+                    bool drawn = false;
 
                     u8* png = (u8*) malloc(SCREEN_SIZE_TOP);
                     if (png) {
                         u32 png_size = FileGetData(preview_str, png, SCREEN_SIZE_TOP, 0);
                         if (png_size && png_size < SCREEN_SIZE_TOP)
-                            bitmap = PNG_Decompress(png, png_size, &bitmap_width, &bitmap_height);
+                            drawn = DrawPng(TOP_SCREEN, -1, -1, png, png_size);
                         free(png);
                     }
 
-                    if (bitmap) {
-                        DrawBitmap(TOP_SCREEN, -1, -1, bitmap_width, bitmap_height, bitmap);
-                        free(bitmap);
-                    } else if (ShowGameFileIcon(preview_str, TOP_SCREEN) != 0) {
+                    if (!drawn && (ShowGameFileIcon(preview_str, TOP_SCREEN) != 0)) {
                         if (strncmp(preview_str, "off", _VAR_CNT_LEN) == 0) preview_str = "(preview disabled)";
                         DrawStringCenter(TOP_SCREEN, COLOR_STD_FONT, COLOR_STD_BG, "%s", preview_str);
                     }
@@ -1978,26 +2264,27 @@ bool ExecuteGM9Script(const char* path_script) {
 
         // run command
         char err_str[_ERR_STR_LEN+1] = { 0 };
-        result = run_line(ptr, line_end, &flags, err_str, false);
+        invalidate_vars(_DYN_CLOCK); // RTC may have ticked since the last line
+        result = run_line(line, &flags, err_str, false);
 
 
         // skip state handling
-        char* skip_ptr = ptr;
+        Gm9ScriptLine* skip_ptr = line;
         if ((skip_state == _SKIP_BLOCK) || (skip_state == _SKIP_TILL_END)) {
-            skip_ptr = skip_block(line_end + 1, (skip_state == _SKIP_TILL_END), false);
+            skip_ptr = (skip_state == _SKIP_TILL_END) ? (line + 1)->next_end : (line + 1)->next_alt;
             if (!skip_ptr) {
                 snprintf(err_str, _ERR_STR_LEN, "unclosed conditional");
                 result = false;
                 syntax_error = true;
             }
         } else if (skip_state == _SKIP_TO_NEXT) {
-            skip_ptr = find_next(ptr);
+            skip_ptr = line->next_for;
             if (!skip_ptr) {
                 snprintf(err_str, _ERR_STR_LEN, "'for' without 'next'");
                 result = false;
                 syntax_error = true;
             }
-            for_ptr = (char*) line_end + 1;
+            for_ptr = line + 1;
         } else if (skip_state == _SKIP_TO_FOR) {
             skip_ptr = for_ptr;
             if (!skip_ptr) {
@@ -2036,21 +2323,16 @@ bool ExecuteGM9Script(const char* path_script) {
             } else result = true; // set back the result otherwise
         }
 
-        // reposition pointer
-        if (skip_ptr != ptr) {
-            ptr = skip_ptr;
-            lno = get_lno(script, script_size, ptr);
+        // reposition line pointer
+        if (skip_ptr != line) {
+            line = skip_ptr;
         } else if (jump_ptr) {
-            ptr = jump_ptr;
-            lno = get_lno(script, script_size, ptr);
+            line = jump_ptr;
             ifcnt = 0; // jumping into conditional block is unexpected/unsupported
             jump_ptr = NULL;
             for_ptr = NULL;
             for_handler(NULL, NULL, NULL, false);
-        } else {
-            ptr = line_end + 1;
-            lno++;
-        }
+        } else line++;
     }
 
 
@@ -2072,7 +2354,8 @@ bool ExecuteGM9Script(const char* path_script) {
     }
 
 
-    free(var_buffer);
+    free_script();
+    free_vars();
     free(script_buffer);
     return result;
 }
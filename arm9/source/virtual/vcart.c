@@ -1,5 +1,6 @@
 #include "vcart.h"
 #include "gamecart.h"
+#include "cartcache.h"
 
 #define FAT_LIMIT   0x100000000
 #define VFLAG_SECURE_AREA_ENC   (1UL<<28)
@@ -15,6 +16,8 @@ u32 InitVCartDrive(void) {
     if (!cart_checked) cart_checked = true;
     if (!cdata) cdata = (CartData*) malloc(sizeof(CartData));
     cart_init = (cdata && (InitCartRead(cdata) == 0) && (cdata->cart_size <= FAT_LIMIT));
+    if (cart_init) CartCacheInit(cdata); // runs uncached if this fails
+    else CartCacheFree();
     if (!cart_init && cdata) {
         free(cdata);
         cdata = NULL;
@@ -98,7 +101,7 @@ int ReadVCartFile(const VirtualFile* vfile, void* buffer, u64 offset, u64 count)
         return ReadCartInfo(buffer, foffset, count, cdata);
 
     SetSecureAreaEncryption(vfile->flags & VFLAG_SECURE_AREA_ENC);
-    return ReadCartBytes(buffer, foffset, count, cdata, true);
+    return ReadCartBytesCached(buffer, foffset, count, cdata);
 }
 
 int WriteVCartFile(const VirtualFile* vfile, const void* buffer, u64 offset, u64 count) {
@@ -12,11 +12,14 @@
 #include <types.h>
 
 #ifdef ARM9
-# ifdef MONITOR_HEAP
 #include "mymalloc.h"
+# ifdef MONITOR_HEAP
 #define malloc my_malloc
 #define realloc my_realloc
 #define free my_free
+# else
+#define malloc mem_malloc
+#define realloc mem_realloc
 # endif
 #endif
 
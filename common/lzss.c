@@ -0,0 +1,382 @@
+#include <common.h>
+#include <lzss.h>
+
+// see https://github.com/dnasdw/3dstool/blob/master/src/backwardlz77.cpp (GPLv3)
+typedef struct {
+    u16 WindowPos;
+    u16 WindowLen;
+    s16* OffsetTable;
+    s16* ReversedOffsetTable;
+    s16* ByteTable;
+    s16* EndTable;
+} sCompressInfo;
+
+static void initTable(sCompressInfo* a_pInfo, void* a_pWork) {
+    a_pInfo->WindowPos = 0;
+    a_pInfo->WindowLen = 0;
+    a_pInfo->OffsetTable = (s16*)(a_pWork);
+    a_pInfo->ReversedOffsetTable = (s16*)(a_pWork) + 4098;
+    a_pInfo->ByteTable = (s16*)(a_pWork) + 4098 + 4098;
+    a_pInfo->EndTable = (s16*)(a_pWork) + 4098 + 4098 + 256;
+
+    for (int i = 0; i < 256; i++) {
+        a_pInfo->ByteTable[i] = -1;
+        a_pInfo->EndTable[i] = -1;
+    }
+}
+
+static int search(sCompressInfo* a_pInfo, const u8* a_pSrc, int* a_nOffset, int a_nMaxSize) {
+    if (a_nMaxSize < 3) {
+        return 0;
+    }
+
+    const u8* pSearch = NULL;
+    int nSize = 2;
+    const u16 uWindowPos = a_pInfo->WindowPos;
+    const u16 uWindowLen = a_pInfo->WindowLen;
+    s16* pReversedOffsetTable = a_pInfo->ReversedOffsetTable;
+
+    for (s16 nOffset = a_pInfo->EndTable[*(a_pSrc - 1)]; nOffset != -1; nOffset = pReversedOffsetTable[nOffset]) {
+        if (nOffset < uWindowPos) {
+            pSearch = a_pSrc + uWindowPos - nOffset;
+        } else {
+            pSearch = a_pSrc + uWindowLen + uWindowPos - nOffset;
+        }
+
+        if (pSearch - a_pSrc < 3) {
+            continue;
+        }
+
+        if (*(pSearch - 2) != *(a_pSrc - 2) || *(pSearch - 3) != *(a_pSrc - 3)) {
+            continue;
+        }
+
+        int nMaxSize = (int)((s64)min(a_nMaxSize, pSearch - a_pSrc));
+        int nCurrentSize = 3;
+
+        while (nCurrentSize < nMaxSize && *(pSearch - nCurrentSize - 1) == *(a_pSrc - nCurrentSize - 1)) {
+            nCurrentSize++;
+        }
+
+        if (nCurrentSize > nSize) {
+            nSize = nCurrentSize;
+            *a_nOffset = (int)(pSearch - a_pSrc);
+            if (nSize == a_nMaxSize) {
+                break;
+            }
+        }
+    }
+
+    if (nSize < 3) {
+        return 0;
+    }
+
+    return nSize;
+}
+
+static void slideByte(sCompressInfo* a_pInfo, const u8* a_pSrc) {
+    u8 uInData = *(a_pSrc - 1);
+    u16 uInsertOffset = 0;
+    const u16 uWindowPos = a_pInfo->WindowPos;
+    const u16 uWindowLen = a_pInfo->WindowLen;
+    s16* pOffsetTable = a_pInfo->OffsetTable;
+    s16* pReversedOffsetTable = a_pInfo->ReversedOffsetTable;
+    s16* pByteTable = a_pInfo->ByteTable;
+    s16* pEndTable = a_pInfo->EndTable;
+
+    if (uWindowLen == 4098) {
+        u8 uOutData = *(a_pSrc + 4097);
+
+        if ((pByteTable[uOutData] = pOffsetTable[pByteTable[uOutData]]) == -1) {
+            pEndTable[uOutData] = -1;
+        } else {
+            pReversedOffsetTable[pByteTable[uOutData]] = -1;
+        }
+
+        uInsertOffset = uWindowPos;
+    } else {
+        uInsertOffset = uWindowLen;
+    }
+
+    s16 nOffset = pEndTable[uInData];
+
+    if (nOffset == -1) {
+        pByteTable[uInData] = uInsertOffset;
+    } else {
+        pOffsetTable[nOffset] = uInsertOffset;
+    }
+
+    pEndTable[uInData] = uInsertOffset;
+    pOffsetTable[uInsertOffset] = -1;
+    pReversedOffsetTable[uInsertOffset] = nOffset;
+
+    if (uWindowLen == 4098) {
+        a_pInfo->WindowPos = (uWindowPos + 1) % 4098;
+    } else {
+        a_pInfo->WindowLen++;
+    }
+}
+
+static inline void slide(sCompressInfo* a_pInfo, const u8* a_pSrc, int a_nSize) {
+    for (int i = 0; i < a_nSize; i++) {
+        slideByte(a_pInfo, a_pSrc--);
+    }
+}
+
+// hash chain matcher, an alternative to the byte tables above
+// positions are offsets into the uncompressed buffer, a match at position p
+// covers the bytes below p (backwards), hashed over the three bytes p-1...p-3
+#define CODE_WINDOW_SIZE    4098
+#define CODE_HASH_BITS      12
+#define CODE_HASH_SIZE      (1 << CODE_HASH_BITS)
+#define CODE_CHAIN_SIZE     0x2000 // power of two, must be larger than the window
+#define CODE_CHAIN_DEPTH    32
+
+typedef struct {
+    const u8* base;
+    u32* head; // CODE_HASH_SIZE entries, 0 == empty
+    u32* prev; // CODE_CHAIN_SIZE entries, 0 == end of chain
+} sHashChainInfo;
+
+static inline u32 hashBytes(const u8* a_pSrc) {
+    u32 uData = (*(a_pSrc - 1) << 16) | (*(a_pSrc - 2) << 8) | *(a_pSrc - 3);
+    return (uData * 2654435761U) >> (32 - CODE_HASH_BITS);
+}
+
+static void initHashChain(sHashChainInfo* a_pInfo, void* a_pWork, const u8* a_pBase) {
+    a_pInfo->base = a_pBase;
+    a_pInfo->head = (u32*)(a_pWork);
+    a_pInfo->prev = (u32*)(a_pWork) + CODE_HASH_SIZE;
+    memset(a_pInfo->head, 0x00, CODE_HASH_SIZE * sizeof(u32));
+}
+
+static inline void insertHashChain(sHashChainInfo* a_pInfo, u32 a_uPos) {
+    if (a_uPos < 3) return;
+    u32 uHash = hashBytes(a_pInfo->base + a_uPos);
+    a_pInfo->prev[a_uPos & (CODE_CHAIN_SIZE - 1)] = a_pInfo->head[uHash];
+    a_pInfo->head[uHash] = a_uPos;
+}
+
+static inline void slideHashChain(sHashChainInfo* a_pInfo, u32 a_uPos, int a_nSize) {
+    for (int i = 0; i < a_nSize; i++) {
+        insertHashChain(a_pInfo, a_uPos--);
+    }
+}
+
+// same contract as search(): returns match size (0 if < 3), offset is the backward distance
+// all positions above a_uPos must already be inserted, matches never overlap their source
+static int searchHashChain(sHashChainInfo* a_pInfo, u32 a_uPos, int* a_nOffset, int a_nMaxSize) {
+    if (a_nMaxSize < 3) {
+        return 0;
+    }
+
+    const u8* pSrc = a_pInfo->base + a_uPos;
+    const u32* pPrev = a_pInfo->prev;
+    int nSize = 2;
+    int nDepth = CODE_CHAIN_DEPTH;
+
+    for (u32 uCand = a_pInfo->head[hashBytes(pSrc)]; uCand && nDepth; uCand = pPrev[uCand & (CODE_CHAIN_SIZE - 1)]) {
+        u32 uDist = uCand - a_uPos;
+        if (uDist < 3) continue; // too close, comes first in the chain
+        if (uDist > CODE_WINDOW_SIZE) break; // chain is sorted by distance
+        nDepth--;
+
+        const u8* pSearch = pSrc + uDist;
+        int nMaxSize = min(a_nMaxSize, (int) uDist);
+
+        // reject early if this can't improve on the current best
+        if (nMaxSize <= nSize || *(pSearch - nSize - 1) != *(pSrc - nSize - 1)) {
+            continue;
+        }
+
+        int nCurrentSize = 0;
+        while (nCurrentSize < nMaxSize && *(pSearch - nCurrentSize - 1) == *(pSrc - nCurrentSize - 1)) {
+            nCurrentSize++;
+        }
+
+        if (nCurrentSize > nSize) {
+            nSize = nCurrentSize;
+            *a_nOffset = (int) uDist;
+            if (nSize == a_nMaxSize) {
+                break;
+            }
+        }
+    }
+
+    if (nSize < 3) {
+        return 0;
+    }
+
+    return nSize;
+}
+
+static s64 alignBytes(s64 a_nData, s64 a_nAlignment) {
+    return (a_nData + a_nAlignment - 1) / a_nAlignment * a_nAlignment;
+}
+
+u32 CodeLzssWorkSize(u32 a_uFlags) {
+    return (a_uFlags & CODE_LZSS_HASHCHAIN) ?
+        (CODE_HASH_SIZE + CODE_CHAIN_SIZE) * sizeof(u32) :
+        (4098 + 4098 + 256 + 256) * sizeof(s16);
+}
+
+bool CodeLzssCompress(const u8* a_pUncompressed, u32 a_uUncompressedSize, u8* a_pCompressed, u32* a_uCompressedSize, u32 a_uFlags,
+    void* a_pWork, CodeLzssProgress a_fProgress, void* a_pData) {
+    const bool bHashChain = a_uFlags & CODE_LZSS_HASHCHAIN;
+    const bool bLazy = bHashChain && (a_uFlags & CODE_LZSS_LAZY);
+    bool bResult = true;
+
+    if (a_uUncompressedSize > sizeof(CodeLzssFooter) && *a_uCompressedSize >= a_uUncompressedSize) {
+        do {
+            sCompressInfo info;
+            sHashChainInfo hcInfo;
+            if (bHashChain) initHashChain(&hcInfo, a_pWork, a_pUncompressed);
+            else initTable(&info, a_pWork);
+
+            const int nMaxSize = 0xF + 3;
+            const u8* pSrc = a_pUncompressed + a_uUncompressedSize;
+            u8* pDest = a_pCompressed + a_uUncompressedSize;
+
+            // lookahead result from lazy matching, reused on the next step
+            u32 uLazyPos = 0;
+            int nLazySize = 0;
+            int nLazyOffset = 0;
+
+            while (pSrc - a_pUncompressed > 0 && pDest - a_pCompressed > 0) {
+                if (a_fProgress && !a_fProgress((u32)(a_pUncompressed + a_uUncompressedSize - pSrc), a_uUncompressedSize, a_pData)) {
+                    bResult = false;
+                    break;
+                }
+
+                u8* pFlag = --pDest;
+                *pFlag = 0;
+
+                for (int i = 0; i < 8; i++) {
+                    const u32 uPos = (u32)(pSrc - a_pUncompressed);
+                    int nOffset = 0;
+                    int nSize = 0;
+
+                    if (!bHashChain) {
+                        nSize = search(&info, pSrc, &nOffset, (int)((s64)min((s64)min(nMaxSize, pSrc - a_pUncompressed), a_pUncompressed + a_uUncompressedSize - pSrc)));
+                    } else if (uLazyPos && (uLazyPos == uPos)) {
+                        nSize = nLazySize;
+                        nOffset = nLazyOffset;
+                    } else {
+                        nSize = searchHashChain(&hcInfo, uPos, &nOffset, min(nMaxSize, (int) uPos));
+                    }
+                    uLazyPos = 0;
+
+                    // lazy matching: emit a literal if the next position has a longer match
+                    if (bLazy && (nSize >= 3) && (nSize < nMaxSize)) {
+                        nLazyOffset = 0;
+                        nLazySize = searchHashChain(&hcInfo, uPos - 1, &nLazyOffset, min(nMaxSize, (int) uPos - 1));
+                        if (nLazySize > nSize) {
+                            uLazyPos = uPos - 1;
+                            nSize = 0;
+                        }
+                    }
+
+                    if (nSize < 3) {
+                        if (pDest - a_pCompressed < 1) {
+                            bResult = false;
+                            break;
+                        }
+
+                        if (bHashChain) slideHashChain(&hcInfo, uPos, 1);
+                        else slide(&info, pSrc, 1);
+                        *--pDest = *--pSrc;
+                    } else {
+                        if (pDest - a_pCompressed < 2) {
+                            bResult = false;
+                            break;
+                        }
+
+                        *pFlag |= 0x80 >> i;
+                        if (bHashChain) slideHashChain(&hcInfo, uPos, nSize);
+                        else slide(&info, pSrc, nSize);
+                        pSrc -= nSize;
+                        nSize -= 3;
+                        *--pDest = (nSize << 4 & 0xF0) | ((nOffset - 3) >> 8 & 0x0F);
+                        *--pDest = (nOffset - 3) & 0xFF;
+                    }
+
+                    if (pSrc - a_pUncompressed <= 0) {
+                        break;
+                    }
+                }
+
+                if (!bResult) {
+                    break;
+                }
+            }
+
+            if (!bResult || (pSrc > a_pUncompressed)) {
+                bResult = false; // out of output space, incompressible data
+                break;
+            }
+
+            *a_uCompressedSize = (u32)(a_pCompressed + a_uUncompressedSize - pDest);
+        } while (false);
+    } else {
+        bResult = false;
+    }
+
+    if (bResult) {
+        u32 uOrigSize = a_uUncompressedSize;
+        u8* pCompressBuffer = a_pCompressed + a_uUncompressedSize - *a_uCompressedSize;
+        u32 uCompressBufferSize = *a_uCompressedSize;
+        u32 uOrigSafe = 0;
+        u32 uCompressSafe = 0;
+        bool bOver = false;
+
+        while (uOrigSize > 0) {
+            u8 uFlag = pCompressBuffer[--uCompressBufferSize];
+
+            for (int i = 0; i < 8; i++) {
+                if ((uFlag << i & 0x80) == 0) {
+                    uCompressBufferSize--;
+                    uOrigSize--;
+                } else {
+                    int nSize = (pCompressBuffer[--uCompressBufferSize] >> 4 & 0x0F) + 3;
+                    uCompressBufferSize--;
+                    uOrigSize -= nSize;
+
+                    if (uOrigSize < uCompressBufferSize) {
+                        uOrigSafe = uOrigSize;
+                        uCompressSafe = uCompressBufferSize;
+                        bOver = true;
+                        break;
+                    }
+                }
+
+                if (uOrigSize <= 0) {
+                    break;
+                }
+            }
+
+            if (bOver) {
+                break;
+            }
+        }
+
+        u32 uCompressedSize = *a_uCompressedSize - uCompressSafe;
+        u32 uPadOffset = uOrigSafe + uCompressedSize;
+        u32 uCompFooterOffset = (u32)(alignBytes(uPadOffset, 4));
+        *a_uCompressedSize = uCompFooterOffset + sizeof(CodeLzssFooter);
+        u32 uTop = *a_uCompressedSize - uOrigSafe;
+        u32 uBottom = *a_uCompressedSize - uPadOffset;
+
+        if (*a_uCompressedSize >= a_uUncompressedSize || uTop > 0xFFFFFF) {
+            bResult = false;
+        } else {
+            memcpy(a_pCompressed, a_pUncompressed, uOrigSafe);
+            memmove(a_pCompressed + uOrigSafe, pCompressBuffer + uCompressSafe, uCompressedSize);
+            memset(a_pCompressed + uPadOffset, 0xFF, uCompFooterOffset - uPadOffset);
+            CodeLzssFooter* pCompFooter = (void*)(a_pCompressed + uCompFooterOffset);
+            pCompFooter->off_size_comp = uTop | (uBottom << 24);
+            pCompFooter->addsize_dec = a_uUncompressedSize - *a_uCompressedSize;
+        }
+    }
+
+    return bResult;
+}
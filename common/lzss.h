@@ -0,0 +1,22 @@
+#pragma once
+
+#include <types.h>
+
+// .code compression matchers (selectable per call)
+#define CODE_LZSS_BYTETABLE (0)    // 3dstool compatible per byte linked lists (slow, best ratio)
+#define CODE_LZSS_HASHCHAIN (1<<0) // 3 byte hash heads with bounded chain depth (fast)
+#define CODE_LZSS_LAZY      (1<<1) // lazy matching, only used with CODE_LZSS_HASHCHAIN
+
+typedef struct {
+    u32 off_size_comp; // 0xOOSSSSSS, where O == reverse offset and S == size
+    u32 addsize_dec; // decompressed size - compressed size
+} PACKED_ALIGN(4) CodeLzssFooter;
+
+// called once per output flag byte, return false to cancel
+typedef bool (*CodeLzssProgress)(u32 done, u32 total, void* data);
+
+// shared by both CPUs, the ARM11 runs this as an offloaded job (see pxijob.h)
+// work needs CodeLzssWorkSize(flags) bytes, the compressor itself allocates nothing
+u32 CodeLzssWorkSize(u32 flags);
+bool CodeLzssCompress(const u8* src, u32 size, u8* dst, u32* dst_size, u32 flags,
+    void* work, CodeLzssProgress progress, void* data);
@@ -38,6 +38,8 @@ enum {
 	PXICMD_SET_NOTIFY_LED,
 	PXICMD_SET_BRIGHTNESS,
 
+	PXICMD_JOB_KICK,
+
 	PXICMD_NONE,
 };
 
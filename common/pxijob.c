@@ -0,0 +1,180 @@
+#include <common.h>
+#include <pxijob.h>
+#include <lzss.h>
+#include <arm.h>
+
+#ifdef ARM9
+// shared memory is cached on the ARM9, job buffers are handled by the caller
+#define PXIJOB_WB(p, len)	ARM_WbDC_Range((void*) (p), (len))
+#define PXIJOB_INV(p, len)	ARM_InvDC_Range((void*) (p), (len))
+#define PXIJOB_WBINV(p, len)	ARM_WbInvDC_Range((void*) (p), (len))
+#define PXIJOB_BUF_IN(p, len)
+#define PXIJOB_BUF_OUT(p, len)
+#define PXIJOB_BARRIER()	ARM_DSB()
+#else
+// shared memory is strongly ordered on the ARM11, job buffers (FCRAM) are not
+#define PXIJOB_WB(p, len)
+#define PXIJOB_INV(p, len)
+#define PXIJOB_WBINV(p, len)
+#define PXIJOB_BUF_IN(p, len)	ARM_InvDC_Range((void*) (p), (len))
+#define PXIJOB_BUF_OUT(p, len)	ARM_WbInvDC_Range((void*) (p), (len))
+#define PXIJOB_BARRIER()	ARM_DSB()
+#endif
+
+#define PXIJOB_SLOT(queue, ticket)	(&(queue)->jobs[(ticket) % PXIJOB_QUEUE_LEN])
+#define PXIJOB_DATA(queue, ticket)	((queue)->data[(ticket) % PXIJOB_QUEUE_LEN])
+
+u32 PxiJobFree(PxiJobQueue *queue)
+{
+	PXIJOB_INV(&queue->tail, 32);
+	return PXIJOB_QUEUE_LEN - (queue->head - *(vu32*)&queue->tail);
+}
+
+// sets up the job at head + index, it is not handed over before publishing
+PxiJob *PxiJobPrepare(PxiJobQueue *queue, u32 index, u32 func, const u32 *args, u32 argc)
+{
+	if ((func >= PXIJOB_COUNT) || (argc > PXIJOB_MAX_ARGS) || (index >= PxiJobFree(queue)))
+		return NULL;
+
+	PxiJob *job = PXIJOB_SLOT(queue, queue->head + index);
+	PxiJobRequest *req = &job->req;
+	req->func = func;
+	req->cancel = 0;
+	for (u32 i = 0; i < PXIJOB_MAX_ARGS; i++)
+		req->args[i] = (i < argc) ? args[i] : 0;
+	PXIJOB_WB(req, sizeof(PxiJobRequest));
+	return job;
+}
+
+u32 PxiJobPublish(PxiJobQueue *queue, u32 count)
+{
+	u32 head = queue->head;
+
+	// slot data may have been filled after preparing, and nothing
+	// cached may be left behind to shadow what the ARM11 writes
+	for (u32 i = 0; i < count; i++)
+		PXIJOB_WBINV(PXIJOB_DATA(queue, head + i), PXIJOB_DATA_SIZE);
+	PXIJOB_BARRIER();
+
+	// publishing the new head hands the jobs over to the ARM11
+	*(vu32*)&queue->head = head + count;
+	PXIJOB_WB(&queue->head, 32);
+	PXIJOB_BARRIER();
+	return head;
+}
+
+bool PxiJobSubmit(PxiJobQueue *queue, u32 func, const u32 *args, u32 argc, u32 *ticket)
+{
+	if (!PxiJobPrepare(queue, 0, func, args, argc))
+		return false;
+
+	u32 head = PxiJobPublish(queue, 1);
+	if (ticket) *ticket = head;
+	return true;
+}
+
+bool PxiJobDone(PxiJobQueue *queue, u32 ticket)
+{
+	PXIJOB_INV(&queue->tail, 32);
+	return (s32)(*(vu32*)&queue->tail - ticket) > 0;
+}
+
+// returns NULL once the slot was reused for a newer job
+PxiJob *PxiJobGet(PxiJobQueue *queue, u32 ticket)
+{
+	PxiJob *job = PXIJOB_SLOT(queue, ticket);
+	PXIJOB_INV(&job->status, sizeof(PxiJobStatus));
+	if ((queue->head - ticket) > PXIJOB_QUEUE_LEN)
+		return NULL;
+	if (PxiJobDone(queue, ticket) && (*(vu32*)&job->status.ticket != ticket))
+		return NULL;
+	return job;
+}
+
+// 0 as long as the job has not started yet
+u32 PxiJobProgress(PxiJobQueue *queue, u32 ticket)
+{
+	PxiJob *job = PxiJobGet(queue, ticket);
+	if (!job || (*(vu32*)&job->status.ticket != ticket))
+		return 0;
+	return *(vu32*)&job->status.progress;
+}
+
+// slot data of a finished job, NULL once the slot was reused
+u8 *PxiJobData(PxiJobQueue *queue, u32 ticket)
+{
+	if (!PxiJobGet(queue, ticket) || !PxiJobDone(queue, ticket))
+		return NULL;
+	PXIJOB_INV(PXIJOB_DATA(queue, ticket), PXIJOB_DATA_SIZE);
+	return PXIJOB_DATA(queue, ticket);
+}
+
+// called by jobs in between steps, keeps things like HID updates going
+static void (*pxiJobYield)(void);
+
+static bool PxiJobLzssProgress(u32 done, u32 total, void *data)
+{
+	PxiJob *job = (PxiJob*) data;
+	(void) total;
+	if (pxiJobYield) pxiJobYield();
+	*(vu32*)&job->status.progress = done;
+	return !*(vu32*)&job->req.cancel;
+}
+
+static u32 PxiJobLzssCompress(PxiJob *job, u8 *data)
+{
+	const u32 *args = job->req.args;
+	const u8 *src = (const u8*) args[0];
+	u8 *dst = (u8*) args[2];
+	u32 dst_size = args[3];
+	void *work = (void*) args[5];
+	(void) data;
+
+	PXIJOB_BUF_IN(src, args[1]);
+	PXIJOB_BUF_IN(dst, dst_size);
+	PXIJOB_BUF_IN(work, CodeLzssWorkSize(args[4]));
+
+	bool res = CodeLzssCompress(src, args[1], dst, &dst_size, args[4], work, PxiJobLzssProgress, job);
+	job->status.out[0] = res ? dst_size : 0;
+
+	PXIJOB_BUF_OUT(dst, args[3]);
+	PXIJOB_BUF_OUT(work, CodeLzssWorkSize(args[4]));
+	return res;
+}
+
+static PxiJobHandler pxiJobFuncs[PXIJOB_COUNT] = {
+	[PXIJOB_LZSS_COMPRESS] = PxiJobLzssCompress,
+};
+
+void PxiJobSetHandler(u32 func, PxiJobHandler handler)
+{
+	if (func < PXIJOB_COUNT)
+		pxiJobFuncs[func] = handler;
+}
+
+bool PxiJobRunNext(PxiJobQueue *queue, void (*yield)(void))
+{
+	u32 tail = queue->tail;
+
+	if (tail == *(vu32*)&queue->head)
+		return false;
+	PXIJOB_BARRIER();
+
+	PxiJob *job = PXIJOB_SLOT(queue, tail);
+	PxiJobStatus *status = &job->status;
+	u32 func = job->req.func;
+	PxiJobHandler handler = (func < PXIJOB_COUNT) ? pxiJobFuncs[func] : NULL;
+
+	status->progress = 0;
+	PXIJOB_BARRIER();
+	status->ticket = tail;
+	pxiJobYield = yield;
+	status->result = handler ? handler(job, PXIJOB_DATA(queue, tail)) : 0xFFFFFFFF;
+	pxiJobYield = NULL;
+	PXIJOB_BARRIER();
+
+	// job is visible as done only after its status is complete
+	*(vu32*)&queue->tail = tail + 1;
+	PXIJOB_BARRIER();
+	return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <types.h>
+
+/*
+ * Job queue for handing CPU bound work to the ARM11, which otherwise
+ * only serves PXI commands. The queue lives in shared memory, the ARM9
+ * is the only producer and the ARM11 the only consumer. Jobs are run
+ * in order, one at a time, in between PXI commands. Commands sent while
+ * a job runs are answered once it is done.
+ *
+ * head and the requests are written by the ARM9 only, tail and the
+ * status by the ARM11 only, and the ARM9 and ARM11 owned parts sit in
+ * separate cache lines, so write backs never clobber anything the other
+ * side wrote. Slot data changes hands instead: the ARM9 fills it (and
+ * writes it back) before publishing, the ARM11 may write results into
+ * it while the job runs, and the ARM9 reads it (invalidated) only once
+ * the job is done.
+ */
+
+#define PXIJOB_QUEUE_LEN	(8) // must be a power of two
+#define PXIJOB_MAX_ARGS	(6)
+#define PXIJOB_MAX_OUT	(5)
+#define PXIJOB_DATA_SIZE	(256) // multiple of the cache line size
+
+enum {
+	PXIJOB_LZSS_COMPRESS = 0,
+	PXIJOB_I2C_READ,
+	PXIJOB_I2C_WRITE,
+	PXIJOB_NVRAM_READ,
+
+	PXIJOB_COUNT,
+};
+
+// written by the ARM9 before submitting
+typedef struct {
+	u32 func;
+	u32 cancel; // nonzero asks a running job to stop early
+	u32 args[PXIJOB_MAX_ARGS];
+} __attribute__((aligned(32))) PxiJobRequest;
+
+// written by the ARM11 while / after running the job
+typedef struct {
+	u32 ticket; // ticket of the job this status belongs to
+	u32 result;
+	u32 progress;
+	u32 out[PXIJOB_MAX_OUT];
+} __attribute__((aligned(32))) PxiJobStatus;
+
+typedef struct {
+	PxiJobRequest req;
+	PxiJobStatus status;
+} PxiJob;
+
+typedef struct {
+	u32 head; // jobs submitted, ARM9 owned
+	u32 pad0[7];
+	u32 tail; // jobs finished, ARM11 owned
+	u32 pad1[7];
+	PxiJob jobs[PXIJOB_QUEUE_LEN];
+	u8 data[PXIJOB_QUEUE_LEN][PXIJOB_DATA_SIZE];
+} __attribute__((aligned(32))) PxiJobQueue;
+
+typedef u32 (*PxiJobHandler)(PxiJob *job, u8 *data);
+
+/*
+ * PXIJOB_LZSS_COMPRESS
+ * args: src, src size, dst, dst size, flags (CODE_LZSS_*), work buffer
+ * out[0]: compressed size, progress: bytes consumed so far
+ * all buffers must be in FCRAM
+ *
+ * PXIJOB_I2C_READ, PXIJOB_I2C_WRITE
+ * args: device, register, size (up to PXIJOB_DATA_SIZE)
+ * data: bytes read / to write, result: true on success
+ *
+ * PXIJOB_NVRAM_READ
+ * args: offset, size, dst
+ * dst 0 reads up to PXIJOB_DATA_SIZE bytes into the slot data, anything
+ * else is a cache line aligned FCRAM buffer of any size
+ */
+
+// ARM9 side, a ticket stays valid until PXIJOB_QUEUE_LEN newer jobs are submitted
+bool PxiJobSubmit(PxiJobQueue *queue, u32 func, const u32 *args, u32 argc, u32 *ticket);
+// batches: fill up to PxiJobFree() slots, then hand them over all at once
+u32 PxiJobFree(PxiJobQueue *queue);
+PxiJob *PxiJobPrepare(PxiJobQueue *queue, u32 index, u32 func, const u32 *args, u32 argc);
+u32 PxiJobPublish(PxiJobQueue *queue, u32 count); // returns the first ticket
+bool PxiJobDone(PxiJobQueue *queue, u32 ticket);
+PxiJob *PxiJobGet(PxiJobQueue *queue, u32 ticket);
+u32 PxiJobProgress(PxiJobQueue *queue, u32 ticket);
+u8 *PxiJobData(PxiJobQueue *queue, u32 ticket);
+
+// ARM11 side, runs the oldest pending job, false if there was none
+// yield (may be NULL) gets called regularly while the job runs
+bool PxiJobRunNext(PxiJobQueue *queue, void (*yield)(void));
+// hardware jobs are registered by the ARM11 code that owns the drivers
+void PxiJobSetHandler(u32 func, PxiJobHandler handler);
@@ -19,10 +19,14 @@
 #pragma once
 
 #include <arm.h>
+#include <pxijob.h>
 
 #define SHMEM_BUFFER_SIZE 2048
 
 typedef struct {
+	// kept first so it starts on a cache line
+	PxiJobQueue jobQueue;
+
 	union {
 		struct { u32 keys, touch; };
 		u64 full;
@@ -34,7 +38,7 @@ typedef struct {
 		uint32_t w[SHMEM_BUFFER_SIZE / 4];
 		uint64_t q[SHMEM_BUFFER_SIZE / 8];
 	} dataBuffer;
-} __attribute__((packed, aligned(8))) SystemSHMEM;
+} __attribute__((packed, aligned(32))) SystemSHMEM;
 
 #ifdef ARM9
 #include <pxi.h>
@@ -0,0 +1,113 @@
+#include "common.h"
+#include "card_spi.h"
+#include "card_spi_emu.h"
+
+/*
+ * Save chip handling (card_spi.c) against the save chip emulator, for
+ * every known chip type: type detection, full restore, unchanged rewrite
+ * and read back, then small unaligned writes that must leave everything
+ * around them alone. Any protocol violation the emulator counts fails.
+ */
+
+#define TEST_PARTIAL_WRITES	64
+
+extern u32 host_spi_xfers;
+
+static u32 failures = 0;
+static u32 seed = 0x5A7E;
+
+#define CHECK(x, ...) do { \
+	if (!(x)) { \
+		fprintf(stderr, __VA_ARGS__); \
+		fputc('\n', stderr); \
+		failures++; \
+	} \
+} while (0)
+
+static u32 Random(void)
+{
+	seed = (seed * 1103515245) + 12345;
+	return seed >> 8;
+}
+
+static void ChipName(char *name, u32 len, const CardSPITypeData *type, bool infrared)
+{
+	if (type->jedecId != 0xFFFF) snprintf(name, len, "flash %04X%s", type->jedecId, infrared ? " IR" : "");
+	else snprintf(name, len, "EEPROM %u bytes", type->capacity);
+}
+
+static void TestPartialWrites(const CardSPITypeData *type, bool infrared, u8 *mem, u8 *expect, const char *name)
+{
+	CardSPIEmuChip chip;
+	CardSPIType spi = { type, infrared };
+	u8 data[600];
+
+	CardSPIEmuChipFor(type, infrared, &chip);
+	CardSPIEmuInit(&chip, mem);
+	for (u32 i = 0; i < TEST_PARTIAL_WRITES; i++) {
+		u32 size = 1 + (Random() % min(sizeof(data), chip.capacity / 2));
+		u32 offset = Random() % (chip.capacity - size);
+		if (i & 1) offset -= offset % chip.pageSize; // page aligned start, partial end
+		for (u32 b = 0; b < size; b++)
+			data[b] = (u8) Random();
+		memcpy(expect + offset, data, size);
+		CHECK(CardSPIWriteSaveData(spi, offset, data, size) == 0, "%s: write of %u bytes at %06X failed", name, size, offset);
+	}
+
+	u32 bad = 0;
+	for (u32 i = 0; i < chip.capacity; i++)
+		if (mem[i] != expect[i]) bad++;
+	CHECK(!bad, "%s: %u bytes wrong after partial writes", name, bad);
+	CHECK(!CardSPIEmuGetStats()->violations, "%s: %u violations in partial writes", name, CardSPIEmuGetStats()->violations);
+	CardSPIEmuDeinit();
+}
+
+static void TestChip(const CardSPITypeData *type, bool infrared, u8 *mem, u8 *img, u8 *rd)
+{
+	CardSPIEmuResult res;
+	char name[32];
+
+	ChipName(name, sizeof(name), type, infrared);
+	for (u32 i = 0; i < CARDSPI_EMU_MAX_SIZE; i++)
+		img[i] = (u8) Random();
+	if (!CardSPIEmuRun(type, infrared, mem, img, rd, &res)) {
+		printf("%-20s skipped\n", name);
+		return;
+	}
+
+	CHECK(res.idOk, "%s: detected as another type", name);
+	CHECK(res.dataOk, "%s: bad capacity, write or read back", name);
+	CHECK(!res.violations, "%s: %u violations", name, res.violations);
+	printf("%-20s %s, %u transactions\n", name, (res.idOk && res.dataOk && !res.violations) ? "ok" : "FAIL",
+		res.transactions);
+
+	TestPartialWrites(type, infrared, mem, img, name);
+}
+
+int main(void)
+{
+	u8 *mem = malloc(CARDSPI_EMU_MAX_SIZE);
+	u8 *img = malloc(CARDSPI_EMU_MAX_SIZE);
+	u8 *rd = malloc(CARDSPI_EMU_MAX_SIZE);
+	u32 txt_len = 0x4000;
+	char *txt = malloc(txt_len);
+
+	if (!mem || !img || !rd || !txt) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (u32 i = 0; CardSPIGetKnownType(i); i++) {
+		const CardSPITypeData *type = CardSPIGetKnownType(i);
+		TestChip(type, false, mem, img, rd);
+		if (type->jedecId != 0xFFFF) TestChip(type, true, mem, img, rd);
+	}
+
+	// the console side benchmark has to agree
+	CardSPIEmuBench(txt, txt_len);
+	CHECK(strstr(txt, "Result: PASS"), "benchmark failed:\n%s", txt);
+	CHECK(!host_spi_xfers, "%u transfers went to the SPI bus", host_spi_xfers);
+
+	if (failures) fprintf(stderr, "%u check(s) failed\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <types.h>
+#include <spi.h>
+#include "timer.h"
+
+// host stand-ins for what the ARM9 code under test links against
+
+#undef malloc
+#undef realloc
+
+static u64 host_ticks = 0;
+u32 host_spi_xfers = 0;
+
+u64 timer_start( void ) {
+	return host_ticks += TIMER_HOST_STEP;
+}
+
+u64 timer_ticks( u64 start_time ) {
+	return timer_start() - start_time;
+}
+
+u64 timer_msec( u64 start_time ) {
+	return timer_ticks(start_time) / (TICKS_PER_SEC / 1000);
+}
+
+u64 timer_sec( u64 start_time ) {
+	return timer_ticks(start_time) / TICKS_PER_SEC;
+}
+
+void wait_msec( u64 msec ) {
+	host_ticks += msec * (TICKS_PER_SEC / 1000);
+}
+
+void* mem_malloc(size_t size) {
+	return malloc(size);
+}
+
+void* mem_realloc(void* ptr, size_t new_size) {
+	return realloc(ptr, new_size);
+}
+
+u32 crc32_update(u32 crc32, const void* data, u32 length) {
+	const u8* p = (const u8*) data;
+	while (length--) {
+		crc32 ^= *(p++);
+		for (u32 i = 0; i < 8; i++)
+			crc32 = (crc32 >> 1) ^ (0xEDB88320 & -(crc32 & 1));
+	}
+	return crc32;
+}
+
+// there is no bus here, everything has to go through the emulator
+int SPI_DoXfer(u32 dev, const SPI_XferInfo *xfer, u32 xfer_cnt, bool done) {
+	(void) dev;
+	(void) xfer;
+	(void) xfer_cnt;
+	(void) done;
+	host_spi_xfers++;
+	return -1;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <types.h>
+
+// host stand-ins for the ARM helpers the shared code uses,
+// host caches are coherent, only the ordering has to be kept
+
+static inline void ARM_DSB(void)
+{
+	__sync_synchronize();
+}
+
+static inline void ARM_InvDC_Range(void *base, u32 len)
+{
+	(void) base;
+	(void) len;
+}
+
+static inline void ARM_WbDC_Range(void *base, u32 len)
+{
+	(void) base;
+	(void) len;
+}
+
+static inline void ARM_WbInvDC_Range(void *base, u32 len)
+{
+	(void) base;
+	(void) len;
+}
+
+static inline void ARM_WaitCycles(u32 cycles)
+{
+	(void) cycles;
+}
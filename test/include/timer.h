@@ -0,0 +1,14 @@
+#pragma once
+
+#include "common.h"
+
+// host stand-in for the ARM9 timers, a virtual clock that moves on by
+// TIMER_HOST_STEP ticks on every read, so busy waits end without sleeping
+#define TICKS_PER_SEC   67027964ULL
+#define TIMER_HOST_STEP 67 // about 1us
+
+u64 timer_start( void );
+u64 timer_ticks( u64 start_time );
+u64 timer_msec( u64 start_time );
+u64 timer_sec( u64 start_time );
+void wait_msec( u64 msec );
@@ -0,0 +1,214 @@
+#include <common.h>
+#include <pxijob.h>
+#include <lzss.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#ifndef MAP_32BIT // x86-64 only, anything else has to get lucky
+#define MAP_32BIT 0
+#endif
+
+/*
+ * The ARM9 (producer) and ARM11 (consumer) sides of the job queue run
+ * as two threads on one shared queue. Jobs are submitted in batches of
+ * random size, every job is checked once it is done, before its slot
+ * may be reused.
+ */
+
+#define TEST_JOBS	200000
+#define TEST_LZSS_SIZE	0x40000
+
+static PxiJobQueue queue;
+static volatile bool consumer_stop = false;
+static u32 failures = 0;
+
+#define CHECK(x, ...) do { \
+	if (!(x)) { \
+		fprintf(stderr, __VA_ARGS__); \
+		fputc('\n', stderr); \
+		failures++; \
+	} \
+} while (0)
+
+static u32 EchoResult(u32 ticket)
+{
+	return (ticket * 2654435761u) | 1;
+}
+
+// checks the slot data the producer filled in and answers in the status
+// and the slot data (like the I2C and NVRAM reads do)
+static u32 EchoJob(PxiJob *job, u8 *data)
+{
+	u32 ticket = job->req.args[0];
+
+	for (u32 i = 0; i < PXIJOB_DATA_SIZE; i++)
+		if (data[i] != (u8) (ticket + i)) return 0;
+	for (u32 i = 0; i < PXIJOB_DATA_SIZE; i++)
+		data[i] = (u8) ~(ticket + i);
+	for (u32 i = 0; i < PXIJOB_MAX_OUT; i++)
+		job->status.out[i] = job->req.args[i + 1];
+	job->status.progress = ticket;
+
+	return EchoResult(ticket);
+}
+
+static void *Consumer(void *arg)
+{
+	(void) arg;
+	while (!consumer_stop)
+		if (!PxiJobRunNext(&queue, NULL)) sched_yield();
+	return NULL;
+}
+
+static void CheckEchoJob(u32 ticket)
+{
+	PxiJob *job = PxiJobGet(&queue, ticket);
+	u8 *data = PxiJobData(&queue, ticket);
+
+	CHECK(job && data, "job %u: not available", ticket);
+	if (!job || !data) return;
+	CHECK(job->status.ticket == ticket, "job %u: status of job %u", ticket, job->status.ticket);
+	CHECK(job->status.result == EchoResult(ticket), "job %u: bad result %08X", ticket, job->status.result);
+	CHECK(PxiJobProgress(&queue, ticket) == ticket, "job %u: bad progress", ticket);
+	for (u32 i = 0; i < PXIJOB_MAX_OUT; i++)
+		CHECK(job->status.out[i] == ticket + i, "job %u: bad out[%u]", ticket, i);
+	for (u32 i = 0; i < PXIJOB_DATA_SIZE; i++) {
+		if (data[i] == (u8) ~(ticket + i)) continue;
+		CHECK(false, "job %u: bad data at %u", ticket, i);
+		break;
+	}
+}
+
+static void TestArgs(void)
+{
+	u32 args[PXIJOB_MAX_ARGS + 1] = { 0 };
+
+	CHECK(PxiJobFree(&queue) == PXIJOB_QUEUE_LEN, "queue not empty");
+	CHECK(!PxiJobPrepare(&queue, 0, PXIJOB_COUNT, args, 1), "bad function accepted");
+	CHECK(!PxiJobPrepare(&queue, 0, PXIJOB_I2C_READ, args, PXIJOB_MAX_ARGS + 1), "too many args accepted");
+	CHECK(!PxiJobPrepare(&queue, PXIJOB_QUEUE_LEN, PXIJOB_I2C_READ, args, 1), "index past the free slots accepted");
+	CHECK(PxiJobPrepare(&queue, PXIJOB_QUEUE_LEN - 1, PXIJOB_I2C_READ, args, 1), "last free slot rejected");
+}
+
+static void TestEcho(void)
+{
+	u32 checked = queue.head;
+	u32 end = queue.head + TEST_JOBS;
+
+	srand(1);
+	while (checked != end) {
+		// everything done gets checked before its slot can be prepared again
+		while ((checked != queue.head) && PxiJobDone(&queue, checked))
+			CheckEchoJob(checked++);
+
+		u32 room = min(checked + PXIJOB_QUEUE_LEN - queue.head, end - queue.head);
+		u32 batch = 1 + (rand() % PXIJOB_QUEUE_LEN);
+		u32 count = min(room, batch);
+		if (!count) {
+			sched_yield();
+			continue;
+		}
+
+		u32 head = queue.head;
+		for (u32 i = 0; i < count; i++) {
+			u32 ticket = head + i;
+			u32 args[PXIJOB_MAX_ARGS];
+			args[0] = ticket;
+			for (u32 a = 1; a < PXIJOB_MAX_ARGS; a++)
+				args[a] = ticket + a - 1;
+			CHECK(PxiJobPrepare(&queue, i, PXIJOB_I2C_READ, args, PXIJOB_MAX_ARGS),
+				"job %u: prepare failed", ticket);
+			for (u32 b = 0; b < PXIJOB_DATA_SIZE; b++)
+				queue.data[ticket % PXIJOB_QUEUE_LEN][b] = (u8) (ticket + b);
+		}
+
+		CHECK(PxiJobPublish(&queue, count) == head, "publish returned the wrong ticket");
+		CHECK(queue.head == head + count, "publish didn't move head");
+	}
+
+	CHECK(!PxiJobGet(&queue, end - PXIJOB_QUEUE_LEN - 1), "reused slot still returned");
+	CHECK(!PxiJobData(&queue, end - PXIJOB_QUEUE_LEN - 1), "reused slot data still returned");
+}
+
+// the job buffers are passed as u32, so they have to sit below 4GB
+static u8 *LowAlloc(u32 size)
+{
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if (ptr == MAP_FAILED) return NULL;
+	return ((uintptr_t) ptr + size <= 0x100000000ull) ? (u8*) ptr : NULL;
+}
+
+static bool RunLzssJob(const u8 *src, u32 size, u8 *dst, u8 *work, u32 flags, bool cancel, u32 *result, u32 *dst_size)
+{
+	const u32 args[6] = { (u32) (uintptr_t) src, size, (u32) (uintptr_t) dst, *dst_size, flags, (u32) (uintptr_t) work };
+	PxiJob *job = PxiJobPrepare(&queue, 0, PXIJOB_LZSS_COMPRESS, args, 6);
+	if (!job) return false;
+	if (cancel) job->req.cancel = 1;
+
+	u32 ticket = PxiJobPublish(&queue, 1);
+	while (!PxiJobDone(&queue, ticket))
+		sched_yield();
+
+	job = PxiJobGet(&queue, ticket);
+	if (!job) return false;
+	*result = job->status.result;
+	*dst_size = job->status.out[0];
+	return true;
+}
+
+static void TestLzss(void)
+{
+	const u32 flags = CODE_LZSS_HASHCHAIN | CODE_LZSS_LAZY;
+	u32 work_size = CodeLzssWorkSize(flags);
+	u8 *src = LowAlloc(TEST_LZSS_SIZE);
+	u8 *dst = LowAlloc(TEST_LZSS_SIZE);
+	u8 *ref = LowAlloc(TEST_LZSS_SIZE);
+	u8 *work = LowAlloc(work_size);
+
+	CHECK(src && dst && ref && work, "no memory below 4GB");
+	if (!src || !dst || !ref || !work) return;
+
+	// code-like data, random words with plenty of repeats
+	srand(2);
+	for (u32 i = 0; i < TEST_LZSS_SIZE; i += 4) {
+		u32 word = (rand() & 3) ? (u32) rand() & 0xFF00FFFF : 0xE12FFF1E;
+		if ((i >= 64) && !(rand() & 1)) memcpy(&word, src + i - (4 * (1 + (rand() & 15))), 4);
+		memcpy(src + i, &word, 4);
+	}
+
+	u32 ref_size = TEST_LZSS_SIZE;
+	bool ref_res = CodeLzssCompress(src, TEST_LZSS_SIZE, ref, &ref_size, flags, work, NULL, NULL);
+	CHECK(ref_res, "lzss: reference compression failed");
+
+	u32 result = 0;
+	u32 dst_size = TEST_LZSS_SIZE;
+	CHECK(RunLzssJob(src, TEST_LZSS_SIZE, dst, work, flags, false, &result, &dst_size), "lzss: job failed");
+	CHECK(result && (dst_size == ref_size) && (memcmp(dst, ref, ref_size) == 0),
+		"lzss: job output differs (%u vs %u bytes)", dst_size, ref_size);
+
+	dst_size = TEST_LZSS_SIZE;
+	CHECK(RunLzssJob(src, TEST_LZSS_SIZE, dst, work, flags, true, &result, &dst_size), "lzss: job failed");
+	CHECK(!result && !dst_size, "lzss: cancelled job returned a result");
+}
+
+int main(void)
+{
+	pthread_t consumer;
+
+	PxiJobSetHandler(PXIJOB_I2C_READ, EchoJob);
+	TestArgs();
+	if (pthread_create(&consumer, NULL, Consumer, NULL) != 0) {
+		fprintf(stderr, "can't start the consumer thread\n");
+		return 1;
+	}
+
+	TestEcho();
+	TestLzss();
+
+	consumer_stop = true;
+	pthread_join(consumer, NULL);
+
+	if (failures) fprintf(stderr, "%u check(s) failed\n", failures);
+	return failures ? 1 : 0;
+}